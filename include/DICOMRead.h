@@ -286,6 +286,8 @@ char *ElementValueString(DCM_ELEMENT *e, int DoBackslash);
 int FreeElementData(DCM_ELEMENT *e);
 DCM_ELEMENT *GetElementFromFile(const char *dicomfile, long grpid, long elid);
 DCM_OBJECT *GetObjectFromFile(const char *fname, unsigned long options);
+int dcmHeaderCacheClear(void);
+int dcmPrefetchFiles(char **FileNames, int nfiles);
 int IsSiemensDICOM(const char *dcmfile);
 char *SiemensAsciiTag(const char *dcmfile,const  char *TagString, int flag);
 char *SiemensAsciiTagEx(const char *dcmfile,const  char *TagString, int cleanup);
@@ -63,6 +63,12 @@ int   fwrite2(int v, FILE *fp) ;
 int   fwrite3(int v, FILE *fp) ;
 int   fwrite4(int v, FILE *fp) ;
 
+/* bulk big-endian 4-byte blocks, return # of values read/written */
+size_t freadFloatArray(float *v, size_t n, FILE *fp) ;
+size_t freadIntArray(int *v, size_t n, FILE *fp) ;
+size_t fwriteFloatArray(const float *v, size_t n, FILE *fp) ;
+size_t fwriteIntArray(const int *v, size_t n, FILE *fp) ;
+
 /* znzlib support routines */
 int   znzread1(int *v, znzFile fp) ;
 int   znzread2(int *v, znzFile fp) ;
@@ -102,6 +102,24 @@ typedef struct {
 }
 GLMMAT;
 
+/* Many y's fit at once against the same X, one column per y. Filled by
+   GLMfitAndTestBatch() from a GLMMAT whose X matrices have already been
+   computed; the per-column results match GLMfit() and GLMtest(). */
+typedef struct {
+  int nvox;        // number of y's (columns)
+  MATRIX *y;       // input: nframes-by-nvox
+  MATRIX *Xty, *beta, *yhat, *eres;
+  double *rvar;
+  MATRIX *iCiXtXCt[GLMMAT_NCONTRASTS_MAX]; // inv(C*inv(X'*X)*C'), NULL if singular
+  MATRIX *gamma[GLMMAT_NCONTRASTS_MAX];
+  double *gammaVar[GLMMAT_NCONTRASTS_MAX]; // for single-row contrasts
+  double *F[GLMMAT_NCONTRASTS_MAX];
+  double *p[GLMMAT_NCONTRASTS_MAX];
+  double *z[GLMMAT_NCONTRASTS_MAX];
+  MATRIX *ypmf[GLMMAT_NCONTRASTS_MAX];
+}
+GLMBATCH;
+
 GLMMAT *GLMalloc(void);
 int GLMfree(GLMMAT **pgm);
 int GLMallocX(GLMMAT *glm, int nrows, int ncols);
@@ -123,6 +141,10 @@ int GLMresynthTest(int niters, double *prvar);
 MATRIX *GLMpmfMatrix(MATRIX *C, double *cond, MATRIX *P);
 int GLMdof(GLMMAT *glm);
 
+GLMBATCH *GLMbatchAlloc(GLMMAT *glm, int nvox);
+int GLMbatchFree(GLMBATCH **pgb);
+int GLMfitAndTestBatch(GLMMAT *glm, GLMBATCH *gb);
+
 
 
 #endif
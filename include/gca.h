@@ -234,6 +234,7 @@ typedef struct
   int          total_training ;
   int          max_label ;
   COLOR_TABLE  *ct ;
+  void         *flat ;        // mapping of a flat GCA file, see GCAwriteFlat()
 }
 GAUSSIAN_CLASSIFIER_ARRAY, GCA ;
 
@@ -289,6 +290,8 @@ int  GCAtrain(GCA *gca, MRI *mri_inputs, MRI *mri_labels, TRANSFORM *transform,
 int  GCAtrainCovariances(GCA *gca, MRI *mri_inputs, MRI *mri_labels, TRANSFORM *transform) ;
 int  GCAwrite(GCA *gca,const char *fname) ;
 GCA  *GCAread(const char *fname) ;
+int  GCAwriteFlat(GCA *gca, const char *fname) ;
+int  GCAisFlat(const char *fname) ;
 int  GCAcompleteMeanTraining(GCA *gca) ;
 int  GCAcompleteCovarianceTraining(GCA *gca) ;
 MRI  *GCAlabel(MRI *mri_src, GCA *gca, MRI *mri_dst, TRANSFORM *transform) ;
@@ -567,6 +570,9 @@ int free_gcs(GC1D *gcs, int nlabels, int ninputs) ;
 int GCAmapRenormalizeByClass(GCA *gca, MRI *mri, TRANSFORM *transform) ;
 extern int Ggca_x, Ggca_y, Ggca_z, Ggca_label, Ggca_nbr_label, Gxp, Gyp, Gzp ;
 extern char *G_write_probs ;
+// if set, GCAreclassifyUsingGibbsPriors() updates voxels in a parallel
+// red/black (checkerboard) order instead of the sequential one
+extern int gca_gibbs_redblack ;
 MRI *GCAmarkImpossible(GCA *gca, MRI *mri_labeled, MRI *mri_dst, TRANSFORM *transform) ;
 int GCAclassMode(GCA *gca, int the_class, float *modes) ;
 int GCAcomputeLabelMeansAndCovariances(GCA *gca, int target_label, MATRIX **p_mcov, VECTOR **p_vmeans) ;
@@ -62,6 +62,7 @@ typedef struct
   char   space[100];          /* space description of the coords */
   double avg_stat ;
   int    *vertex_label_ind ; // mris->nvertices long - < 0 means it isn't in the label
+  int    nvertices_ind ;     // length of vertex_label_ind (see LabelIndexVertices)
   MRI    *mri_template ;
   void   *mht ;
   void   *mris; 
@@ -114,6 +115,7 @@ LABEL  *LabelRemoveAlmostDuplicates(LABEL *area, double dist, LABEL *ldst);
 LABEL   *LabelCompact(LABEL *lsrc, LABEL *ldst) ;
 int     LabelRemoveDuplicates(LABEL *area) ;
 int     LabelHasVertex(int vtxno, LABEL *lb);
+int     LabelIndexVertices(LABEL *area, int nvertices) ;
 LABEL   *LabelAlloc(int max_points, char *subject_name, char *label_name) ;
 LABEL   *LabelRealloc(LABEL *lb, int max_points);
 int     LabelCurvFill(LABEL *area, int *vertex_list, int nvertices,
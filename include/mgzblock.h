@@ -0,0 +1,57 @@
+/**
+ * @file  mgzblock.h
+ * @brief seekable block-compressed gzip members for .mgz volumes
+ *
+ * A block-compressed mgz is an ordinary multi-member gzip file, so gunzip
+ * and gzread() see the same byte stream as for a conventional .mgz. Each
+ * member except the last carries a gzip extra subfield ('F','S') holding its
+ * compressed length and uncompressed length. Walking those headers gives an
+ * index of the file without decompressing anything, so a reader can inflate
+ * only the members it needs. mghWrite() puts the MGH header in member 0, one
+ * frame per member after that, and the tags in a trailing plain member.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#ifndef MGZBLOCK_H
+#define MGZBLOCK_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdio.h>
+
+typedef struct
+{
+  FILE *fp;
+  int nmembers;              /* # of indexed ('F','S' tagged) members */
+  long long *offset;         /* file offset of each indexed member */
+  long long *csize;          /* compressed size of each member, gzip header and trailer included */
+  long long *usize;          /* uncompressed size of each member */
+  long long tail_offset;     /* offset of the untagged trailing member, -1 if none */
+} MGZ_BLOCKS, MGZB;
+
+MGZB *MGZBopen(const char *fname);
+int MGZBclose(MGZB **pmgzb);
+int MGZBisBlocked(const char *fname);
+int MGZBreadMember(MGZB *mgzb, int member, void *buf, size_t nbytes);
+int MGZBwriteMember(FILE *fp, const void *buf, size_t nbytes, int level);
+
+#if defined(__cplusplus)
+};
+#endif
+
+#endif
@@ -260,6 +260,8 @@ typedef struct
   /* volume is allocated one big buffer. */   \
   ELTT( int, ischunked ) SEP          /* 1 means alloc is one big chunk */    \
   ELTP( void, chunk ) SEP              /* pointer to the one big chunk of buffer */    \
+  ELTP( void, chunk_map ) SEP          /* if not NULL, chunk lives in this mmap'd region */    \
+  ELTX( size_t, chunk_map_size ) SEP   /* # bytes mapped at chunk_map */    \
   ELTT( size_t, bytes_per_vox ) SEP      /* # bytes per voxels */    \
   ELTT( size_t, bytes_per_row ) SEP      /* # bytes per row */    \
   ELTT( size_t, bytes_per_slice ) SEP    /* # bytes per slice */    \
@@ -425,6 +427,8 @@ int   MRIallocIndices(MRI *mri) ;
 int   MRIsetResolution(MRI *mri, float xres, float yres, float zres) ;
 int   MRIsetTransform(MRI *mri,   General_transform *transform) ;
 MRI * MRIallocChunk(int width, int height, int depth, int type, int nframes);
+MRI * MRIallocChunkMapped(int width, int height, int depth, int type, int nframes,
+                          void *map, size_t map_size, size_t offset);
 int   MRIchunk(MRI **pmri);
 
 
@@ -464,6 +468,10 @@ MRI   *MRIaffine(MRI *mri_src, MRI *mri_dst, MATRIX *mA, MATRIX *mB) ;
 MRI   *MRIinverseLinearTransform(MRI *mri_src, MRI *mri_dst, MATRIX *mA) ;
 MRI   *MRIlinearTransformInterp(MRI *mri_src, MRI *mri_dst, MATRIX *mA,
                                 int InterpMethod);
+/* typed resampling kernels, see mriview.cpp */
+int   MRIlinearTransformInterpTyped(MRI *mri_src, MRI *mri_dst, MATRIX *mAinv,
+                                    int InterpMethod);
+int   MRIvol2VolNearestTyped(MRI *src, MRI *targ, MATRIX *Vt2s);
 MRI   *MRIlinearTransform(MRI *mri_src, MRI *mri_dst, MATRIX *mA) ;
 MRI   *MRIapplyRASlinearTransform(MRI *mri_src, MRI *mri_dst, MATRIX *mA) ;
 MRI   *MRIapplyRASinverseLinearTransform(MRI *mri_src, MRI *mri_dst,
@@ -858,6 +866,10 @@ int   MRIsampleVolumeFrame( const MRI *mri,
 			    double x, double y, double z,
 			    const int frame,
 			    double *pval);
+int   MRIsampleVolumeFrames(const MRI *mri,
+                            double x, double y, double z,
+                            int firstframe, int lastframe,
+                            int type, float *valvect);
 #ifdef FASTER_MRI_EM_REGISTER
 int   MRIsampleVolumeFrame_xyzInt_nRange_floats(const MRI *mri,
                             int x, int y, int z, 
@@ -122,6 +122,10 @@ int MRIsegStats(MRI *seg, int segid, MRI *mri,int frame,
 int MRIsegStatsRobust(MRI *seg, int segid, MRI *mri,int frame,
 		      float *min, float *max, float *range,
 		      float *mean, float *std, float Pct);
+int MRIsegStatsAll(MRI *seg, int nsegs, int *segids, MRI *mri, int frame,
+                   int robust, float Pct, int *nvoxels,
+                   float *min, float *max, float *range,
+                   float *mean, float *std, double **favg);
 
 MRI *MRImask_with_T2_and_aparc_aseg(MRI *mri_src, MRI *mri_dst, MRI *mri_T2, MRI *mri_aparc_aseg, float T2_thresh, int mm_from_exterior) ;
 int *MRIsegmentationList(MRI *seg, int *pListLength);
@@ -136,6 +140,8 @@ MRI *MRIpartialVolumeFractionAS(LTA *aseg2vol, MRI *aseg, MRIS *lhw, MRIS *lhp,
 int MRIcountMatches(const MRI *seg, const int MatchVal, const int frame, const MRI *mask);
 MRI *MRIaddExtraCerebralCSF(MRI *seg, int nDil, MRI *out);
 COLOR_TABLE *CTABpruneCTab(const COLOR_TABLE *ct0, MRI *seg);
+int MRISclosestVertexField(MRI *vol, MRI *mask, MATRIX *vox2surf, MRIS **surfs, int nsurfs,
+                           MRI **pindex, int **pvtxno, float **pdist);
 MRI *MRIannot2CorticalSeg(MRI *seg, MRIS *lhw, MRIS *lhp, MRIS *rhw, MRIS *rhp, LTA *anat2seg, MRI *ctxseg);
 MRI *MRIannot2CerebralWMSeg(MRI *seg, MRIS *lhw, MRIS *rhw, double DistThresh, LTA *anat2seg, MRI *wmseg);
 MRI *MRIunsegmentCortex(MRI *seg, int lhmin, int lhmax, int rhmin, int rhmax, MRI *out);
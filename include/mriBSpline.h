@@ -74,6 +74,10 @@ int MRIsampleSeqBSpline(const MRI_BSPLINE *bspline, double x, double y, double z
 /** Based on pre-computed B-spline coefficients interpolate image using voxel map MATRIX*/
 MRI *MRIlinearTransformBSpline(const MRI_BSPLINE *bspline, MRI *mri_dst, MATRIX *mA);
 
+/** Typed, multithreaded sampling loop of MRIlinearTransformInterp(), see mriview.cpp.
+    mAinv maps mri_dst voxels to bspline voxels. */
+int MRIlinearTransformBSplineTyped(const MRI_BSPLINE *bspline, MRI *mri_dst, MATRIX *mAinv);
+
 /** Based on pre-computed B-spline coefficients interpolate image using RAS map MATRIX*/
 MRI *MRIapplyRASlinearTransformBSpline(const MRI_BSPLINE *bspline, MRI *mri_dst, MATRIX *mA) ;
 
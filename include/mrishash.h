@@ -58,6 +58,17 @@ MRIS_HASH_TABLE *MHTcreateFaceTable_Resolution(
     int   which, 
     float res) ;
 
+// Same tables backed by a bounding volume hierarchy instead of buckets.
+// The queries below work on them unchanged, except MHTacqBucket.
+// After vertices move, MHTrefit updates the tree in place.
+MRIS_HASH_TABLE *MHTcreateFaceTree(
+    MRI_SURFACE const *mris, 
+    int   which) ;
+MRIS_HASH_TABLE *MHTcreateVertexTree(
+    MRI_SURFACE const *mris, 
+    int   which) ;
+int MHTrefit(MRIS_HASH_TABLE *mht, MRI_SURFACE const *mris) ;
+
 // Add/remove the faces of which vertex V is a part
 int  MHTaddAllFaces(   MRIS_HASH_TABLE *mht, MRI_SURFACE const *mris, VERTEX const *v) ;
 int  MHTremoveAllFaces(MRIS_HASH_TABLE *mht, MRI_SURFACE const *mris, VERTEX const *v) ;
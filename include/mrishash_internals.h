@@ -94,6 +94,29 @@ typedef struct mht_face_t {
 } MHT_FACE;
 
 
+//--------------------------
+// Tree-backed tables (MHTcreateFaceTree, MHTcreateVertexTree) keep the faces
+// or vertices in a flattened bounding volume hierarchy instead of buckets.
+// The tree is split at the median centroid along the widest axis, k-d tree
+// fashion, so it stays balanced however uneven the triangle sizes are, and
+// its boxes are refit in place when vertices move.
+typedef struct mht_tree_node_t {
+  float lo[3], hi[3];   // bounding box of everything below
+  int   first;          // leaf: first slot in items; inner: left child, the right child follows it
+  int   count;          // leaf: # of items; inner: 0
+  int   parent;         // -1 for the root
+} MHT_TREE_NODE;
+
+typedef struct mht_tree_t {
+  int            nnodes;
+  MHT_TREE_NODE *nodes;     // root first, children after their parents
+  int            nitems;
+  int           *items;     // face or vertex numbers, grouped by leaf
+  int           *leaf;      // face or vertex number -> its leaf node, -1 if not in the tree
+  char          *absent;    // set by MHTremoveAllFaces until MHTaddAllFaces restores the face
+} MHT_TREE;
+
+
 struct _mht 
 {
   MRI_SURFACE const *mris ;                                             //
@@ -109,6 +132,8 @@ struct _mht
 
   int                nfaces;
   MHT_FACE*          f;
+
+  MHT_TREE*          tree;                                              // not NULL for tree-backed tables, which have no buckets
 } ;
 
 
@@ -0,0 +1,49 @@
+/**
+ * @file  mrissmoothop.h
+ * @brief nearest-neighbor surface smoothing as a precomputed sparse operator
+ *
+ * The averaging step of MRISsmoothMRIFast() stored in compressed sparse
+ * row form, built once per surface and mask and applied to blocks of
+ * frames at a time.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#ifndef MRISSMOOTHOP_H
+#define MRISSMOOTHOP_H
+
+#include "mri.h"
+#include "mrisurf.h"
+
+// number of frames smoothed together by MRISsmoothOpApply()
+#define MRIS_SMOOTH_OP_FRAME_BLOCK 32
+
+typedef struct MRIS_SMOOTH_OP
+{
+  int nvertices;
+  int nnz;
+  int nrows;       // number of vertices in the mask
+  // Row vno lists colidx[rowptr[vno]] to colidx[rowptr[vno+1]-1]: the
+  // vertex itself followed by its unripped neighbors in the mask, which
+  // are averaged. Vertices outside the mask have empty rows.
+  int *rowptr;
+  int *colidx;
+} MRIS_SMOOTH_OP;
+
+MRIS_SMOOTH_OP *MRISsmoothOpAlloc(MRIS *surf, MRI *IncMask);
+int MRISsmoothOpFree(MRIS_SMOOTH_OP **pop);
+MRI *MRISsmoothOpApply(MRIS_SMOOTH_OP *op, MRI *Src, int nSmoothSteps, MRI *Targ);
+
+#endif
@@ -398,6 +398,28 @@ typedef char   *MRIS_cmdlines_t[MAX_CMDS] ;
 typedef char    MRIS_subject_name_t[STRLEN] ;
 typedef char    MRIS_fname_t[STRLEN] ;
 
+/*
+  Optional structure-of-arrays mirror of the vertex fields that the
+  neighborhood sweeps in the integration loops read. Vertex vno lives at
+  index vno of each array. The vertices remain the authoritative copy:
+  MRISsoaGather() refreshes the arrays from them and MRISsoaScatter()
+  writes the positions, normals and values back.
+*/
+typedef struct
+{
+  int   nvertices ;
+  float *x, *y, *z ;         /* current position */
+  float *nx, *ny, *nz ;      /* current normal */
+  float *val ;
+  char  *ripflag ;
+}
+MRIS_SOA ;
+
+#define MRIS_SOA_POSITIONS   0x01
+#define MRIS_SOA_NORMALS     0x02
+#define MRIS_SOA_VALS        0x04
+#define MRIS_SOA_ALL         (MRIS_SOA_POSITIONS | MRIS_SOA_NORMALS | MRIS_SOA_VALS)
+
 typedef struct MRIS
 {
 // The LIST_OF_MRIS_ELTS macro used here enables the the mris_hash
@@ -507,7 +529,8 @@ typedef struct MRIS
   ELTP(void,user_parms) SEP             /* for whatever the user wants to hang here  */    \
   ELTP(MATRIX,m_sras2vox) SEP             /* for converting surface ras to voxel       */    \
   ELTP(MRI,mri_sras2vox) SEP           /* volume that the above matrix is for       */    \
-  ELTP(void,mht)     \
+  ELTP(void,mht) SEP    \
+  ELTP(MRIS_SOA,soa)     /* NULL unless MRISsoaAlloc() was called */    \
   // end of macro
   
 #define LIST_OF_MRIS_ELTS       \
@@ -1076,6 +1099,10 @@ MRI_SURFACE  *MRISoverAlloc(int max_vertices, int max_faces,
 MRI_SURFACE  *MRISalloc(int nvertices, int nfaces) ;
 int          MRISfreeDists(MRI_SURFACE *mris) ;
 int          MRISfree(MRI_SURFACE **pmris) ;
+int          MRISsoaAlloc(MRI_SURFACE *mris) ;
+int          MRISsoaFree(MRI_SURFACE *mris) ;
+int          MRISsoaGather(MRI_SURFACE *mris, int which) ;
+int          MRISsoaScatter(MRI_SURFACE *mris, int which) ;
 int   MRISintegrate(MRI_SURFACE *mris, INTEGRATION_PARMS *parms, int n_avgs);
 int   mrisLogIntegrationParms(FILE *fp, MRI_SURFACE *mris,
 			      INTEGRATION_PARMS *parms) ;
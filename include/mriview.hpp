@@ -0,0 +1,357 @@
+/**
+ * @file  mriview.hpp
+ * @brief typed voxel access to MRI volumes, resolved once per loop
+ *
+ * MRIgetVoxVal() and MRIsetVoxVal() switch on mri->type for every voxel.
+ * MRIView<T> binds an MRI whose type is known to be T and gives direct
+ * access to its rows, so an inner loop compiles to plain loads and stores.
+ * MRIdispatchType() and MRIdispatchTypes() pick T from mri->type once and
+ * call a kernel with the matching view(s), e.g.
+ *
+ *   struct Scale
+ *   {
+ *     float s ;
+ *     template <typename T> void operator()(MRIView<T> v) const
+ *     {
+ *       for (int f = 0 ; f < v.nframes() ; f++)
+ *         for (int z = 0 ; z < v.depth() ; z++)
+ *           for (int y = 0 ; y < v.height() ; y++)
+ *           {
+ *             T *row = v.row(y, z, f) ;
+ *             for (int x = 0 ; x < v.width() ; x++)
+ *               row[x] = MRIvoxelCast<T>(s * row[x]) ;
+ *           }
+ *     }
+ *   } ;
+ *   Scale k = { 2.0f } ;
+ *   MRIdispatchType(mri, k) ;
+ *
+ * Conversions follow MRIgetVoxVal()/MRIsetVoxVal(): values are clipped to
+ * the range of T and rounded with nint().
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#ifndef MRIVIEW_HPP
+#define MRIVIEW_HPP
+
+#include "error.h"
+#include "macros.h"
+#include "mri.h"
+
+//! Maps a voxel type to its MRI_* type code and clipping range
+template <typename T>
+struct MRIvoxelTraits;
+
+template <>
+struct MRIvoxelTraits<unsigned char>
+{
+  enum { type = MRI_UCHAR };
+  static float lo() { return 0.0f; }
+  static float hi() { return 255.0f; }
+};
+
+template <>
+struct MRIvoxelTraits<short>
+{
+  enum { type = MRI_SHORT };
+  static float lo() { return -32768.0f; }
+  static float hi() { return 32767.0f; }
+};
+
+template <>
+struct MRIvoxelTraits<int>
+{
+  enum { type = MRI_INT };
+  static float lo() { return -2147483648.0f; }
+  static float hi() { return 2147483647.0f; }
+};
+
+template <>
+struct MRIvoxelTraits<float>
+{
+  enum { type = MRI_FLOAT };
+};
+
+//! Same rounding as nint() in utils.c, inlined
+inline int MRIvoxelRound(double f) { return (f < 0 ? ((int)(f - 0.5)) : ((int)(f + 0.5))); }
+
+//! Converts a value the way MRIsetVoxVal() stores it in a voxel of type T
+template <typename T>
+inline T MRIvoxelCast(float val)
+{
+  if (val < MRIvoxelTraits<T>::lo()) {
+    val = MRIvoxelTraits<T>::lo();
+  }
+  if (val > MRIvoxelTraits<T>::hi()) {
+    val = MRIvoxelTraits<T>::hi();
+  }
+  return (T)MRIvoxelRound(val);
+}
+
+template <>
+inline float MRIvoxelCast<float>(float val)
+{
+  return val;
+}
+
+//! Typed view of an MRI whose mri->type matches T
+/*!
+  The view holds no data, only the MRI pointer, so it is cheap to copy and
+  pass by value. Rows are contiguous in x for every frame, whether or not
+  the volume is chunked.
+*/
+template <typename T>
+class MRIView
+{
+ public:
+  explicit MRIView(MRI *mri) : mri_(mri)
+  {
+    if (mri->type != MRIvoxelTraits<T>::type) {
+      ErrorExit(ERROR_BADPARM, "MRIView: volume type %d does not match view type %d", mri->type,
+                (int)MRIvoxelTraits<T>::type);
+    }
+  }
+
+  int width(void) const { return mri_->width; }
+  int height(void) const { return mri_->height; }
+  int depth(void) const { return mri_->depth; }
+  int nframes(void) const { return mri_->nframes; }
+  MRI *mri(void) const { return mri_; }
+
+  //! Pointer to voxel (0,y,z) of frame f
+  T *row(int y, int z, int f = 0) const { return (T *)mri_->slices[z + f * mri_->depth][y]; }
+
+  //! Reference to voxel (x,y,z) of frame f, no bounds checks
+  T &at(int x, int y, int z, int f = 0) const { return row(y, z, f)[x]; }
+
+  //! MRIgetVoxVal() without the type switch
+  float get(int x, int y, int z, int f = 0) const
+  {
+    if (x < 0 || y < 0 || z < 0) {
+      return mri_->outside_val;
+    }
+    return (float)at(x, y, z, f);
+  }
+
+  //! MRIsetVoxVal() without the type switch
+  void set(int x, int y, int z, int f, float val) const { at(x, y, z, f) = MRIvoxelCast<T>(val); }
+
+  //! MRIsampleVolumeFrameType() for SAMPLE_NEAREST and SAMPLE_TRILINEAR
+  double sample(double x, double y, double z, int f, int type) const
+  {
+    if (FEQUAL((int)x, x) && FEQUAL((int)y, y) && FEQUAL((int)z, z)) {
+      type = SAMPLE_NEAREST;
+    }
+    if (type == SAMPLE_TRILINEAR) {
+      return sampleTrilinear(x, y, z, f);
+    }
+    return sampleNearest(x, y, z, f);
+  }
+
+  //! MRIsampleVolumeFrameType() with SAMPLE_NEAREST
+  double sampleNearest(double x, double y, double z, int f) const
+  {
+    int xv, yv, zv;
+
+    if (MRIindexNotInVolume(mri_, x, y, z) == 1) {
+      return mri_->outside_val;
+    }
+    xv = MRIvoxelRound(x);
+    yv = MRIvoxelRound(y);
+    zv = MRIvoxelRound(z);
+    if (xv < 0) xv = 0;
+    if (xv >= mri_->width) xv = mri_->width - 1;
+    if (yv < 0) yv = 0;
+    if (yv >= mri_->height) yv = mri_->height - 1;
+    if (zv < 0) zv = 0;
+    if (zv >= mri_->depth) zv = mri_->depth - 1;
+    return (float)at(xv, yv, zv, f);
+  }
+
+  //! MRIsampleVolumeFrame(), same arithmetic and operation order
+  double sampleTrilinear(double x, double y, double z, int f) const
+  {
+    int xm, xp, ym, yp, zm, zp, width, height, depth;
+    double xmd, ymd, zmd, xpd, ypd, zpd;
+
+    if (f >= mri_->nframes) {
+      return mri_->outside_val;
+    }
+    if (MRIindexNotInVolume(mri_, x, y, z) == 1) {
+      return mri_->outside_val;
+    }
+
+    width = mri_->width;
+    height = mri_->height;
+    depth = mri_->depth;
+    if (x >= width) x = width - 1.0;
+    if (y >= height) y = height - 1.0;
+    if (z >= depth) z = depth - 1.0;
+    if (x < 0.0) x = 0.0;
+    if (y < 0.0) y = 0.0;
+    if (z < 0.0) z = 0.0;
+
+    xm = MAX((int)x, 0);
+    xp = MIN(width - 1, xm + 1);
+    ym = MAX((int)y, 0);
+    yp = MIN(height - 1, ym + 1);
+    zm = MAX((int)z, 0);
+    zp = MIN(depth - 1, zm + 1);
+
+    xmd = x - (float)xm;
+    ymd = y - (float)ym;
+    zmd = z - (float)zm;
+    xpd = (1.0f - xmd);
+    ypd = (1.0f - ymd);
+    zpd = (1.0f - zmd);
+
+    const T *const rmm = row(ym, zm, f), *const rmp = row(ym, zp, f);
+    const T *const rpm = row(yp, zm, f), *const rpp = row(yp, zp, f);
+    return xpd * ypd * zpd * (double)rmm[xm] + xpd * ypd * zmd * (double)rmp[xm] + xpd * ymd * zpd * (double)rpm[xm] +
+           xpd * ymd * zmd * (double)rpp[xm] + xmd * ypd * zpd * (double)rmm[xp] + xmd * ypd * zmd * (double)rmp[xp] +
+           xmd * ymd * zpd * (double)rpm[xp] + xmd * ymd * zmd * (double)rpp[xp];
+  }
+
+  //! Walks the rows of one frame, z-major, for loops that do not need (y,z)
+  class RowIterator
+  {
+   public:
+    RowIterator(const MRIView<T> &view, int f) : view_(view), y_(0), z_(0), f_(f) {}
+    bool done(void) const { return z_ >= view_.depth(); }
+    T *begin(void) const { return view_.row(y_, z_, f_); }
+    T *end(void) const { return begin() + view_.width(); }
+    int y(void) const { return y_; }
+    int z(void) const { return z_; }
+    RowIterator &operator++(void)
+    {
+      if (++y_ >= view_.height()) {
+        y_ = 0;
+        z_++;
+      }
+      return *this;
+    }
+
+   private:
+    MRIView<T> view_;
+    int y_, z_, f_;
+  };
+
+  RowIterator rows(int f = 0) const { return RowIterator(*this, f); }
+
+  //! Frame-major access: all frames of one voxel, for per-voxel time series
+  /*!
+    Frame f of the voxel is at(x,y,z,f). For chunked volumes the frames
+    are a constant stride apart, so gather() reads them with one pointer.
+  */
+  void gather(int x, int y, int z, float *vals) const
+  {
+    int f, nframes = mri_->nframes;
+
+    if (mri_->ischunked) {
+      const T *p = &at(x, y, z, 0);
+      size_t stride = mri_->bytes_per_vol / sizeof(T);
+      for (f = 0; f < nframes; f++, p += stride) {
+        vals[f] = (float)*p;
+      }
+    }
+    else
+      for (f = 0; f < nframes; f++) {
+        vals[f] = (float)at(x, y, z, f);
+      }
+  }
+
+  //! Inverse of gather(), converting like MRIsetVoxVal()
+  void scatter(int x, int y, int z, const float *vals) const
+  {
+    int f, nframes = mri_->nframes;
+
+    for (f = 0; f < nframes; f++) {
+      at(x, y, z, f) = MRIvoxelCast<T>(vals[f]);
+    }
+  }
+
+ private:
+  MRI *mri_;
+};
+
+//! Calls kernel(MRIView<T>(mri)) with T matching mri->type
+/*!
+  Returns NO_ERROR, or ERROR_UNSUPPORTED for types without a view (MRI_LONG,
+  MRI_BITMAP, ...) so the caller can fall back to MRIgetVoxVal().
+*/
+template <class Kernel>
+int MRIdispatchType(MRI *mri, Kernel &kernel)
+{
+  switch (mri->type) {
+    case MRI_UCHAR:
+      kernel(MRIView<unsigned char>(mri));
+      break;
+    case MRI_SHORT:
+      kernel(MRIView<short>(mri));
+      break;
+    case MRI_INT:
+      kernel(MRIView<int>(mri));
+      break;
+    case MRI_FLOAT:
+      kernel(MRIView<float>(mri));
+      break;
+    default:
+      return (ERROR_UNSUPPORTED);
+  }
+  return (NO_ERROR);
+}
+
+//! Binds the first view of MRIdispatchTypes() while the second is resolved
+template <class Kernel, typename S>
+struct MRIdispatchSecond
+{
+  Kernel &kernel;
+  MRIView<S> src;
+  MRIdispatchSecond(Kernel &k, MRIView<S> s) : kernel(k), src(s) {}
+  template <typename D>
+  void operator()(MRIView<D> dst)
+  {
+    kernel(src, dst);
+  }
+};
+
+//! Calls kernel(MRIView<S>(src), MRIView<D>(dst)) for the types of src and dst
+template <class Kernel>
+int MRIdispatchTypes(MRI *src, MRI *dst, Kernel &kernel)
+{
+  switch (src->type) {
+    case MRI_UCHAR: {
+      MRIdispatchSecond<Kernel, unsigned char> second(kernel, MRIView<unsigned char>(src));
+      return MRIdispatchType(dst, second);
+    }
+    case MRI_SHORT: {
+      MRIdispatchSecond<Kernel, short> second(kernel, MRIView<short>(src));
+      return MRIdispatchType(dst, second);
+    }
+    case MRI_INT: {
+      MRIdispatchSecond<Kernel, int> second(kernel, MRIView<int>(src));
+      return MRIdispatchType(dst, second);
+    }
+    case MRI_FLOAT: {
+      MRIdispatchSecond<Kernel, float> second(kernel, MRIView<float>(src));
+      return MRIdispatchType(dst, second);
+    }
+    default:
+      return (ERROR_UNSUPPORTED);
+  }
+}
+
+#endif
@@ -60,6 +60,7 @@ int RFname2Code(RFS *rfs);
 const char *RFcode2Name(RFS *rfs);
 int RFprint(FILE *fp, RFS *rfs);
 int RFspecSetSeed(RFS *rfs,unsigned long int seed);
+unsigned long int RFstreamSeed(unsigned long int seed, int stream);
 int RFnparams(RFS *rfs);
 int RFexpectedMeanStddev(RFS *rfs);
 int RFsynth(MRI *rf, RFS *rfs, MRI *binmask);
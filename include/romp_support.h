@@ -35,6 +35,16 @@
 
 
 void ROMP_show_stats(FILE*);
+void ROMP_write_profile_json(FILE*);       // also written at exit to $FS_ROMP_PROFILE
+void ROMP_write_profile_folded(FILE*);     // when ROMP_SUPPORT_ENABLED, see romp_support.c
+
+// Environment
+//
+//      FS_ROMP_PROFILE=<file>  at exit of a program that uses ROMP_main, write the scope tree
+//                              to <file>, as folded stacks if the name ends in .folded,
+//                              otherwise as JSON. The tree is only collected when the
+//                              library is built with ROMP_SUPPORT_ENABLED; other builds
+//                              print a warning at exit and write nothing.
 
 // An annotated omp for loop looks like this...
 //
@@ -118,6 +118,10 @@ static float hashres = 16;
 static int normal_smoothing_iterations = 10 ;
 int crsTest = 0, ctest=0, rtest=0, stest=0;
 int UseHash = 1;
+int UseVertexField = 0; // closest vertices of all voxels in one pass
+MRI *VtxIndex = NULL; // row of each voxel in VtxNo and VtxDist
+int *VtxNo = NULL;
+float *VtxDist = NULL;
 int DoLH=1, DoRH=1, LHOnly=0, RHOnly=0;
 
 char *CtxSegFile = NULL;
@@ -133,6 +137,7 @@ int main(int argc, char **argv)
   int annotid, IsCortex=0, IsWM=0, IsHypo=0, hemi=0, segval=0;
   int IsCblumCtx = 0;
   int RibbonVal=0,nbrute=0;
+  size_t vtxrow;
   float dmin=0.0, lhRibbonVal=0, rhRibbonVal=0, dist, dthresh;
   double dot ;
   MRI    *mri_fixed = NULL, *mri_lh_dist, *mri_rh_dist, *mri_dist=NULL;
@@ -227,12 +232,14 @@ int main(int argc, char **argv)
       }
       printf("Ripped %d vertices from left hemi\n",nripped);
     }
-    printf("\n");
-    printf("Building hash of lh white\n");
-    lhwhite_hash = MHTcreateVertexTable_Resolution(lhwhite, CURRENT_VERTICES,hashres);
-    printf("\n");
-    printf("Building hash of lh pial\n");
-    lhpial_hash = MHTcreateVertexTable_Resolution(lhpial, CURRENT_VERTICES,hashres);
+    if(!UseVertexField || crsTest){
+      printf("\n");
+      printf("Building hash of lh white\n");
+      lhwhite_hash = MHTcreateVertexTable_Resolution(lhwhite, CURRENT_VERTICES,hashres);
+      printf("\n");
+      printf("Building hash of lh pial\n");
+      lhpial_hash = MHTcreateVertexTable_Resolution(lhpial, CURRENT_VERTICES,hashres);
+    }
   }
 
   if(DoRH){
@@ -291,12 +298,14 @@ int main(int argc, char **argv)
       }
       printf("Ripped %d vertices from right hemi\n",nripped);
     }
-    printf("\n");
-    printf("Building hash of rh white\n");
-    rhwhite_hash = MHTcreateVertexTable_Resolution(rhwhite, CURRENT_VERTICES,hashres);
-    printf("\n");
-    printf("Building hash of rh pial\n");
-    rhpial_hash = MHTcreateVertexTable_Resolution(rhpial, CURRENT_VERTICES,hashres);
+    if(!UseVertexField || crsTest){
+      printf("\n");
+      printf("Building hash of rh white\n");
+      rhwhite_hash = MHTcreateVertexTable_Resolution(rhwhite, CURRENT_VERTICES,hashres);
+      printf("\n");
+      printf("Building hash of rh pial\n");
+      rhpial_hash = MHTcreateVertexTable_Resolution(rhpial, CURRENT_VERTICES,hashres);
+    }
   }
 
   if(UseNewRibbon){
@@ -545,6 +554,40 @@ int main(int argc, char **argv)
     Ggca_x = Gx ; Ggca_y = Gy ; Ggca_z = Gz ; // diagnostics
   }
 
+  if(UseVertexField){
+    // Closest lh/rh white/pial vertex of every voxel that can get to
+    // the search below, all at once. Same as --no-hash, which is also
+    // what any voxel outside the mask falls back to. No hash is built.
+    MRI *VtxMask;
+    MRIS *surfs[4];
+    surfs[0] = DoLH ? lhwhite : NULL;
+    surfs[1] = DoLH ? lhpial  : NULL;
+    surfs[2] = DoRH ? rhwhite : NULL;
+    surfs[3] = DoRH ? rhpial  : NULL;
+    VtxMask = MRIalloc(ASeg->width, ASeg->height, ASeg->depth, MRI_UCHAR);
+    MRIcopyHeader(ASeg, VtxMask);
+    for (c=0; c < ASeg->width; c++){
+      for (r=0; r < ASeg->height; r++){
+        for (s=0; s < ASeg->depth; s++){
+          asegid = MRIgetVoxVal(ASeg,c,r,s,0);
+          if(asegid == 2 || asegid == 3 || asegid == 41 || asegid == 42)
+            MRIsetVoxVal(VtxMask,c,r,s,0,1);
+          else if(asegid >= 77 && asegid <= 82 && LabelHypoAsWM && MRIgetVoxVal(filled,c,r,s,0))
+            MRIsetVoxVal(VtxMask,c,r,s,0,1);
+          else if(UseNewRibbon){
+            RibbonVal = MRIgetVoxVal(RibbonSeg,c,r,s,0);
+            if(RibbonVal == 2 || RibbonVal == 3 || RibbonVal == 41 || RibbonVal == 42)
+              MRIsetVoxVal(VtxMask,c,r,s,0,1);
+          }
+        }
+      }
+    }
+    printf("Computing closest vertex field\n");fflush(stdout);
+    err = MRISclosestVertexField(ASeg, VtxMask, Vox2RAS, surfs, 4, &VtxIndex, &VtxNo, &VtxDist);
+    if(err) exit(1);
+    MRIfree(&VtxMask);
+  }
+
   // Go through each voxel in the aseg
   for (c=0; c < ASeg->width; c++){
     printf("%3d ",c);
@@ -647,7 +690,18 @@ int main(int argc, char **argv)
 
         // Get the index of the closest vertex in the
         // lh.white, lh.pial, rh.white, rh.pial
-        if(UseHash) {
+        if(VtxIndex && MRIIvox(VtxIndex,c,r,s) >= 0) {
+	  vtxrow = 4*(size_t)MRIIvox(VtxIndex,c,r,s);
+	  lhwvtx = VtxNo[vtxrow];
+	  lhpvtx = VtxNo[vtxrow+1];
+	  rhwvtx = VtxNo[vtxrow+2];
+	  rhpvtx = VtxNo[vtxrow+3];
+	  dlhw = VtxDist[vtxrow];
+	  dlhp = VtxDist[vtxrow+1];
+	  drhw = VtxDist[vtxrow+2];
+	  drhp = VtxDist[vtxrow+3];
+        }
+        else if(UseHash && !VtxIndex) {
 	  if(DoLH){
 	    lhwvtx = MHTfindClosestVertexNo(lhwhite_hash,lhwhite,&vtx,&dlhw);
 	    lhpvtx = MHTfindClosestVertexNo(lhpial_hash, lhpial, &vtx,&dlhp);
@@ -853,6 +907,11 @@ int main(int argc, char **argv)
   }
   printf("nctx = %d\n",nctx);
   printf("Used brute-force search on %d voxels\n",nbrute);
+  if(VtxIndex){
+    MRIfree(&VtxIndex);
+    free(VtxNo);
+    free(VtxDist);
+  }
 
   if (relabel_gca_name != NULL)    // reclassify voxels interior to white that are likely to be something else
   {
@@ -1246,6 +1305,10 @@ static int parse_commandline(int argc, char **argv)
     {
       UseHash = 0;
     }
+    else if (!strcasecmp(option, "--vertex-field"))
+    {
+      UseVertexField = 1;
+    }
     else if (!strcmp(option, "--sd"))
     {
       if (nargc < 1)
@@ -1488,6 +1551,7 @@ static void dump_options(FILE *fp)
     printf("dmaxctx %f\n",dmaxctx);
   }
   fprintf(fp,"RipUnknown %d\n",RipUnknown);
+  fprintf(fp,"UseVertexField %d\n",UseVertexField);
   if (CtxSegFile)
   {
     fprintf(fp,"CtxSeg %s\n",CtxSegFile);
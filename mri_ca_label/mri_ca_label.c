@@ -1606,6 +1606,11 @@ get_option(int argc, char *argv[])
     handle_expanded_ventricles = 0 ;
     printf("not handling expanded ventricles...\n") ;
   }
+  else if (!stricmp(option, "redblack"))
+  {
+    gca_gibbs_redblack = 1 ;
+    printf("relabeling with a parallel red/black Gibbs schedule\n") ;
+  }
   else if (!stricmp(option, "write_probs"))
   {
     G_write_probs = argv[2] ;
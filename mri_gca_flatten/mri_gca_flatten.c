@@ -0,0 +1,235 @@
+/**
+ * @file  mri_gca_flatten.c
+ * @brief convert a GCA atlas to the flat, mmap-able GCA format
+ *
+ * The output can be passed anywhere a .gca is expected; GCAread() detects
+ * the format. It is written in host byte order, so generate it on the
+ * architecture that will read it.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "macros.h"
+#include "error.h"
+#include "diag.h"
+#include "proto.h"
+#include "timer.h"
+#include "utils.h"
+#include "gca.h"
+#include "version.h"
+
+char *Progname ;
+
+static void usage_exit(int code) ;
+static int get_option(int argc, char *argv[]) ;
+static int compare_gcas(GCA *gca1, GCA *gca2) ;
+
+static int verify = 0 ;
+
+int
+main(int argc, char *argv[])
+{
+  char   *in_fname, *out_fname ;
+  GCA    *gca, *gca_flat ;
+  int    nargs, msec, ndiffs ;
+  struct timeb start ;
+
+  nargs = handle_version_option
+          (argc, argv,
+           "$Id$",
+           "$Name:  $");
+  if (nargs && argc - nargs == 1)
+    exit (0);
+  argc -= nargs;
+
+  Progname = argv[0] ;
+  DiagInit(NULL, NULL, NULL) ;
+  ErrorInit(NULL, NULL, NULL) ;
+
+  for ( ; argc > 1 && ISOPTION(*argv[1]) ; argc--, argv++)
+  {
+    nargs = get_option(argc, argv) ;
+    argc -= nargs ;
+    argv += nargs ;
+  }
+  if (argc < 3)
+    usage_exit(1) ;
+
+  in_fname = argv[1] ;
+  out_fname = argv[2] ;
+
+  TimerStart(&start) ;
+  printf("reading atlas from %s...\n", in_fname) ;
+  gca = GCAread(in_fname) ;
+  if (!gca)
+    ErrorExit(ERROR_NOFILE, "%s: could not read atlas %s", Progname, in_fname) ;
+  printf("atlas read in %2.1f sec\n", TimerStop(&start)/1000.0) ;
+
+  printf("writing flat atlas to %s...\n", out_fname) ;
+  if (GCAwriteFlat(gca, out_fname) != NO_ERROR)
+    ErrorExit(Gerror, "%s: could not write flat atlas %s", Progname, out_fname) ;
+
+  if (verify)
+  {
+    TimerStart(&start) ;
+    gca_flat = GCAread(out_fname) ;
+    msec = TimerStop(&start) ;
+    if (!gca_flat)
+      ErrorExit(ERROR_BADFILE, "%s: could not read back %s", Progname, out_fname) ;
+    printf("flat atlas read in %2.3f sec\n", msec/1000.0) ;
+    ndiffs = compare_gcas(gca, gca_flat) ;
+    GCAfree(&gca_flat) ;
+    if (ndiffs)
+      ErrorExit(ERROR_BADFILE, "%s: %d differences between %s and %s",
+                Progname, ndiffs, in_fname, out_fname) ;
+    printf("%s verified\n", out_fname) ;
+  }
+
+  GCAfree(&gca) ;
+  exit(0) ;
+  return(0) ;
+}
+
+static int
+compare_gcas(GCA *gca1, GCA *gca2)
+{
+  int       x, y, z, n, i, j, ndiffs = 0, ncovars ;
+  GCA_NODE  *gcan1, *gcan2 ;
+  GCA_PRIOR *gcap1, *gcap2 ;
+  GC1D      *gc1, *gc2 ;
+
+  if (gca1->node_width != gca2->node_width ||
+      gca1->node_height != gca2->node_height ||
+      gca1->node_depth != gca2->node_depth ||
+      gca1->prior_width != gca2->prior_width ||
+      gca1->prior_height != gca2->prior_height ||
+      gca1->prior_depth != gca2->prior_depth ||
+      gca1->ninputs != gca2->ninputs ||
+      gca1->flags != gca2->flags ||
+      gca1->type != gca2->type)
+  {
+    printf("atlas geometry differs\n") ;
+    return(1) ;
+  }
+  ncovars = (gca1->ninputs * (gca1->ninputs+1)) / 2 ;
+  for (x = 0 ; x < gca1->node_width ; x++)
+    for (y = 0 ; y < gca1->node_height ; y++)
+      for (z = 0 ; z < gca1->node_depth ; z++)
+      {
+        gcan1 = &gca1->nodes[x][y][z] ;
+        gcan2 = &gca2->nodes[x][y][z] ;
+        if (gcan1->nlabels != gcan2->nlabels ||
+            gcan1->total_training != gcan2->total_training)
+        {
+          ndiffs++ ;
+          continue ;
+        }
+        for (n = 0 ; n < gcan1->nlabels ; n++)
+        {
+          gc1 = &gcan1->gcs[n] ;
+          gc2 = &gcan2->gcs[n] ;
+          if (gcan1->labels[n] != gcan2->labels[n] ||
+              gc1->ntraining != gc2->ntraining ||
+              memcmp(gc1->means, gc2->means, gca1->ninputs*sizeof(float)) ||
+              memcmp(gc1->covars, gc2->covars, ncovars*sizeof(float)))
+          {
+            ndiffs++ ;
+            continue ;
+          }
+          if (gca1->flags & GCA_NO_MRF)
+            continue ;
+          for (i = 0 ; i < GIBBS_NEIGHBORS ; i++)
+          {
+            if (gc1->nlabels[i] != gc2->nlabels[i])
+            {
+              ndiffs++ ;
+              continue ;
+            }
+            for (j = 0 ; j < gc1->nlabels[i] ; j++)
+              if (gc1->labels[i][j] != gc2->labels[i][j] ||
+                  gc1->label_priors[i][j] != gc2->label_priors[i][j])
+                ndiffs++ ;
+          }
+        }
+      }
+
+  for (x = 0 ; x < gca1->prior_width ; x++)
+    for (y = 0 ; y < gca1->prior_height ; y++)
+      for (z = 0 ; z < gca1->prior_depth ; z++)
+      {
+        gcap1 = &gca1->priors[x][y][z] ;
+        gcap2 = &gca2->priors[x][y][z] ;
+        if (gcap1->nlabels != gcap2->nlabels ||
+            gcap1->total_training != gcap2->total_training)
+        {
+          ndiffs++ ;
+          continue ;
+        }
+        for (n = 0 ; n < gcap1->nlabels ; n++)
+          if (gcap1->labels[n] != gcap2->labels[n] ||
+              gcap1->priors[n] != gcap2->priors[n])
+            ndiffs++ ;
+      }
+  return(ndiffs) ;
+}
+
+static void
+usage_exit(int code)
+{
+  printf("usage: %s [options] <input gca> <output gca>\n", Progname) ;
+  printf("\n") ;
+  printf("writes the atlas in the flat GCA format, which GCAread() maps\n") ;
+  printf("into memory instead of parsing\n") ;
+  printf("\n") ;
+  printf("Options:\n\n") ;
+  printf("  -verify       : read the output back and compare it to the input\n") ;
+  printf("  -?, -u, -help : print usage\n") ;
+  exit(code) ;
+}
+
+static int
+get_option(int argc, char *argv[])
+{
+  int  nargs = 0 ;
+  char *option ;
+
+  option = argv[1] + 1 ;            /* past '-' */
+  if (!stricmp(option, "verify"))
+  {
+    verify = 1 ;
+  }
+  else if (!stricmp(option, "help"))
+  {
+    usage_exit(0) ;
+  }
+  else switch (toupper(*option))
+  {
+    case '?':
+    case 'U':
+      usage_exit(0) ;
+      break ;
+    default:
+      printf("unknown option %s\n", argv[1]) ;
+      usage_exit(1) ;
+      break ;
+  }
+  return(nargs) ;
+}
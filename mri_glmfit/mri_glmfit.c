@@ -88,6 +88,7 @@ USAGE: ./mri_glmfit
 
    --sim nulltype nsim thresh csdbasename : simulation perm, mc-full, mc-z
    --sim-sign signstring : abs, pos, or neg. Default is abs.
+   --sim-shard k n : run the kth of n equal parts of the nsim iterations (needs --seed)
    --uniform min max : use uniform distribution instead of gaussian
 
    --pca : perform pca/svd analysis on residual
@@ -460,6 +461,7 @@ is invoked by calling mri_glmfit with the following arguments:
 
 --sim nulltype nsim thresh csdbasename
 --sim-sign sign
+--sim-shard k n
 
 It is not necessary to specify --glmdir (it will be ignored). If
 you are analyzing surface data, then include --surf.
@@ -481,6 +483,13 @@ and mri_volcluster. The Full CSD file is written on each iteration,
 which means that the CSD file will be valid if the simulation
 is aborted or crashes.
 
+Each iteration draws its noise or permutation from its own random
+stream derived from --seed, so iteration i is the same whichever job
+runs it. To split one simulation over n jobs, give each job the same
+--seed, nsim and thresh, its own csdbasename, and --sim-shard k n for
+k = 1 to n. Merging the shards in order with mri_surfcluster or
+mri_volcluster --csd ... --csd-out gives the same CSD as a single job.
+
 In the cases where the design matrix is a single columns of ones
 (ie, one-sample group mean), it makes no sense to permute the
 rows of the design matrix. mri_glmfit automatically checks
@@ -653,6 +662,8 @@ int nClusters;
 char *subject=NULL, *hemi=NULL, *simbase=NULL;
 MRI_SURFACE *surf=NULL;
 int nsim,nthsim;
+int nSimShards = 1, nthSimShard = 1, SimRepStart = 0, nSimShardReps;
+MATRIX *Xg0 = NULL;
 double csize;
 
 VOLCLUSTER **VolClustList;
@@ -1622,7 +1633,13 @@ int main(int argc, char **argv) {
   //--------------------------------------------------------------------------
   //--------------------------------------------------------------------------
   if (DoSim) {
-    csd->seed = SynthSeed;
+    // This shard runs iterations SimRepStart to SimRepStart+nSimShardReps-1
+    // of nsim. Shards record the seed of their first iteration, which
+    // differs between shards, so that CSDmerge() accepts them
+    SimRepStart   = (int)(((long)(nthSimShard-1)*nsim)/nSimShards);
+    nSimShardReps = (int)(((long)nthSimShard*nsim)/nSimShards) - SimRepStart;
+    if(nSimShards == 1) csd->seed = SynthSeed;
+    else                csd->seed = RFstreamSeed(SynthSeed,SimRepStart);
     if (surf != NULL) {
       strcpy(csd->anattype,"surface");
       strcpy(csd->subject,subject);
@@ -1630,7 +1647,7 @@ int main(int argc, char **argv) {
     } 
     else  strcpy(csd->anattype,"volume");
     csd->searchspace = searchspace;
-    csd->nreps = nsim;
+    csd->nreps = nSimShardReps;
     CSDallocData(csd);
     if (!strcmp(csd->simtype,"mc-z")) {
       rfs = RFspecInit(SynthSeed,NULL);
@@ -1671,12 +1688,21 @@ int main(int argc, char **argv) {
       }
     }
 
-    printf("\n\nStarting simulation sim over %d trials\n",nsim);
+    // Permutations are drawn from the original design each iteration
+    if (!strcmp(csd->simtype,"perm")) Xg0 = MatrixCopy(mriglm->Xg,NULL);
+
+    printf("\n\nStarting simulation sim over %d trials (%d to %d of %d)\n",
+           nSimShardReps,SimRepStart,SimRepStart+nSimShardReps-1,nsim);
     TimerStart(&mytimer) ;
-    for (nthsim=0; nthsim < nsim; nthsim++) {
+    for (nthsim=0; nthsim < nSimShardReps; nthsim++) {
       msecFitTime = TimerStop(&mytimer) ;
       if(debug) printf("%d/%d t=%g ---------------------------------\n",
-             nthsim+1,nsim,msecFitTime/(1000*60.0));
+             nthsim+1,nSimShardReps,msecFitTime/(1000*60.0));
+
+      // Each iteration draws from its own stream, so the results do
+      // not depend on how the iterations are split into shards
+      srand48(RFstreamSeed(SynthSeed,SimRepStart+nthsim));
+      if(rfs) RFspecSetSeed(rfs,RFstreamSeed(SynthSeed,SimRepStart+nthsim));
 
       if (!strcmp(csd->simtype,"mc-full")) {
 	if(! UseUniform)
@@ -1690,7 +1716,10 @@ int main(int argc, char **argv) {
           SmoothSurfOrVol(surf, mriglm->y, mriglm->mask, SmoothLevel);
       }
       if (!strcmp(csd->simtype,"perm")) {
-        if (!OneSamplePerm) MatrixRandPermRows(mriglm->Xg);
+        if (!OneSamplePerm) {
+          MatrixCopy(Xg0,mriglm->Xg);
+          MatrixRandPermRows(mriglm->Xg);
+        }
         else {
           for (n=0; n < mriglm->y->nframes; n++) {
             if (drand48() > 0.5) m = +1;
@@ -1847,6 +1876,8 @@ int main(int argc, char **argv) {
 	    fprintf(fp,"# num_dof %d\n",mriglm->glm->C[n]->rows);
 	    fprintf(fp,"# den_dof %g\n",mriglm->glm->dof);
 	    fprintf(fp,"# SmoothLevel %g\n",SmoothLevel);
+	    if(nSimShards > 1) fprintf(fp,"# shard %d %d reps %d to %d of %d\n",nthSimShard,nSimShards,
+				       SimRepStart,SimRepStart+nSimShardReps-1,nsim);
 	    csd->nreps = nthsim+1;
 	    csd->nClusters[nthsim] = nClusters;
 	    csd->MaxClusterSize[nthsim] = csize;
@@ -2447,6 +2478,12 @@ static int parse_commandline(int argc, char **argv) {
       DoPCC = 0;
       nargsused = 4;
     } 
+    else if (!strcasecmp(option, "--sim-shard")) {
+      if (nargc < 2) CMDargNErr(option,2);
+      sscanf(pargv[0],"%d",&nthSimShard);
+      sscanf(pargv[1],"%d",&nSimShards);
+      nargsused = 2;
+    } 
     else if(!strcasecmp(option, "--sim-thresh-loop")) DoSimThreshLoop = 1;
     else if(!strcasecmp(option, "--sim-thresh-loop-pos")){
       DoSimThreshLoop = 1;
@@ -2940,6 +2977,7 @@ printf("   --kurtosis : compute kurtosis and p-value for kurtosis\n");
 printf("\n");
 printf("   --sim nulltype nsim thresh csdbasename : simulation perm, mc-full, mc-z\n");
 printf("   --sim-sign signstring : abs, pos, or neg. Default is abs.\n");
+printf("   --sim-shard k n : run the kth of n equal parts of the nsim iterations (needs --seed)\n");
 printf("   --uniform min max : use uniform distribution instead of gaussian\n");
 printf("\n");
 printf("   --pca : perform pca/svd analysis on residual\n");
@@ -3316,6 +3354,7 @@ printf("is invoked by calling mri_glmfit with the following arguments:\n");
 printf("\n");
 printf("--sim nulltype nsim thresh csdbasename\n");
 printf("--sim-sign sign\n");
+printf("--sim-shard k n\n");
 printf("\n");
 printf("It is not necessary to specify --glmdir (it will be ignored). If\n");
 printf("you are analyzing surface data, then include --surf.\n");
@@ -3337,6 +3376,13 @@ printf("and mri_volcluster. The Full CSD file is written on each iteration,\n");
 printf("which means that the CSD file will be valid if the simulation\n");
 printf("is aborted or crashes.\n");
 printf("\n");
+printf("Each iteration draws its noise or permutation from its own random\n");
+printf("stream derived from --seed, so iteration i is the same whichever job\n");
+printf("runs it. To split one simulation over n jobs, give each job the same\n");
+printf("--seed, nsim and thresh, its own csdbasename, and --sim-shard k n for\n");
+printf("k = 1 to n. Merging the shards in order with mri_surfcluster or\n");
+printf("mri_volcluster --csd ... --csd-out gives the same CSD as a single job.\n");
+printf("\n");
 printf("In the cases where the design matrix is a single columns of ones\n");
 printf("(ie, one-sample group mean), it makes no sense to permute the\n");
 printf("rows of the design matrix. mri_glmfit automatically checks\n");
@@ -3495,6 +3541,20 @@ static void check_options(void) {
     printf("ERROR: you must supply --fwhm with --sim, even if it is 0\n");
     exit(1);
   }
+  if(nSimShards > 1 || nthSimShard > 1){
+    if(!DoSim){
+      printf("ERROR: need --sim with --sim-shard\n");
+      exit(1);
+    }
+    if(nSimShards < 1 || nthSimShard < 1 || nthSimShard > nSimShards || nSimShards > nsim) {
+      printf("ERROR: --sim-shard k n needs 1 <= k <= n <= nsim\n");
+      exit(1);
+    }
+    if(SynthSeed < 0) {
+      printf("ERROR: must specify the same --seed for all shards\n");
+      exit(1);
+    }
+  }
   // Not sure why this was here, but it does not seem to apply anymore
   //if(DoSimThreshLoop && strcmp(csd->simtype,"mc-z")){
   //printf("ERROR: you can only use --sim-thresh-loop with mc-z\n");
@@ -597,6 +597,10 @@ int main(int argc, char **argv) {
 
     if (reversemap) {
       printf("Performing mapping from target back to the source label %d\n",TrgSurf->nvertices);
+      /* Index both labels so that LabelHasVertex() below is a lookup
+         instead of a search of the label */
+      LabelIndexVertices(srclabel, SrcSurfReg->nvertices);
+      LabelIndexVertices(trglabel, TrgSurfReg->nvertices);
       nrevhits = 0;
       for (trgvtxno = 0; trgvtxno < TrgSurf->nvertices; trgvtxno++) {
 	trgvtx = &TrgSurf->vertices[trgvtxno] ;
@@ -658,6 +662,7 @@ int main(int argc, char **argv) {
         trglabel->lv[nTrgLabel].y = trgvtx->y + dy;
         trglabel->lv[nTrgLabel].z = trgvtx->z + dz;
         trglabel->lv[nTrgLabel].stat = srclabel->lv[nSrcLabel].stat;
+        trglabel->vertex_label_ind[trgvtxno] = nTrgLabel;
         trglabel->n_points ++;
 
         if (trgvtxno == 53018 && 0) {
@@ -57,17 +57,23 @@ mri_mcsim --o /path/to/mult-comp-cor/fsaverage/lh/superiortemporal --base mc-z
 When running mri_glmfit, make sure to use   --label labeldir/lh.superiortemporal.label
 When running mri_glmfit-sim, add --cache-dir /path/to/mult-comp-cor --cache-label superiortemporal
 
-Example 3: running simulations in parallel (two jobs, 5000 iterations
-each for a total of 10000)
+Example 3: running simulations in parallel. Within a job, repetitions
+are run in parallel with --threads. To split the work over jobs, give
+each job the same --seed and --nreps and its own --shard (two jobs,
+5000 iterations each for a total of 10000)
 
 mri_mcsim --o /path/to/mult-comp-cor/fsaverage/lh/superiortemporal --base mc-z.j001 
-  --save-iter  --surf fsaverage lh --nreps 5000
+  --save-iter  --surf fsaverage lh --nreps 10000 --seed 1234 --shard 1 2
   --label labeldir/lh.superiortemporal.label
 
 mri_mcsim --o /path/to/mult-comp-cor/fsaverage/lh/superiortemporal --base mc-z.j002 
-  --save-iter  --surf fsaverage lh --nreps 500
+  --save-iter  --surf fsaverage lh --nreps 10000 --seed 1234 --shard 2 2
   --label labeldir/lh.superiortemporal.label
 
+Each repetition draws its noise from its own stream of the seed, so
+the results do not depend on the number of threads, and the shards
+merged in order are the same as a single job with --nreps 10000.
+
 When those jobs are done, merge the results into a single table with
 
 mri_surfcluster 
@@ -112,6 +118,8 @@ double round(double x);
 #include "volcluster.h"
 #include "surfcluster.h"
 #include "randomfields.h"
+#include "mrissmoothop.h"
+#include "romp_support.h"
 
 static int  parse_commandline(int argc, char **argv);
 static void check_options(void);
@@ -162,25 +170,37 @@ int *nSmoothsList;
 double fwhmmax=30;
 int SaveWeight=0;
 int FixFSALH = 1;
+int *maskoutvtxno;
+double avgvtxarea;
+int nthreads = 1, ThreadsSet = 0;
+int nShards = 1, nthShard = 1, RepStart = 0, nShardReps;
+
+// Smoothing operator, shared by all threads
+MRIS_SMOOTH_OP *SmoothOp;
+
+// Per-thread state of the simulation loop
+typedef struct {
+  RFS *rfs;
+  MRIS *surf;   // private copy, clustering writes into val and undefval
+  MRI *z, *zabs, *p, *sig;
+} MCSIM_THREAD;
+
+static MCSIM_THREAD *MCSthreadAlloc(MRIS *surf);
+static int MCSrunRep(MCSIM_THREAD *mcst, int nthRepShard);
 
 /*---------------------------------------------------------------*/
 int main(int argc, char *argv[]) {
-  int nargs, n, err,k, *maskoutvtxno;
+  int nargs, n, err,k;
   char tmpstr[2000], *signstr=NULL,*SUBJECTS_DIR, fname[2000];
   //char *OutDir = NULL;
-  RFS *rfs;
-  int nSmoothsPrev, nSmoothsDelta;
-  MRI *z, *zabs=NULL, *sig=NULL, *p=NULL;
   int FreeMask = 0;
   int nthSign, nthFWHM, nthThresh;
-  double sigmax, zmax, threshadj, csize, csizeavg, cweightvtx, searchspace,avgvtxarea;
-  int csizen;
-  int nClusters, cmax,rmax,smax;
-  SURFCLUSTERSUM *SurfClustList;
+  double searchspace;
+  int nChunk;
+  MCSIM_THREAD **mcst;
   struct timeb  mytimer;
   LABEL *clabel;
   FILE *fp, *fpLog=NULL;
-  float **ppVal, **ppSig, **ppVal0, **ppSig0, **ppZ, **ppZ0;
 
   nargs = handle_version_option (argc, argv, vcid, "$Name:  $");
   if (nargs && argc - nargs == 1) exit (0);
@@ -212,6 +232,11 @@ int main(int argc, char *argv[]) {
   if(SynthSeed < 0) SynthSeed = PDFtodSeed();
   srand48(SynthSeed);
 
+  // This shard runs repetitions RepStart to RepStart+nShardReps-1 of
+  // nRepetitions
+  RepStart   = (int)(((long)(nthShard-1)*nRepetitions)/nShards);
+  nShardReps = (int)(((long)nthShard*nRepetitions)/nShards) - RepStart;
+
   SUBJECTS_DIR = getenv("SUBJECTS_DIR");
 
   // Create output directory
@@ -344,8 +369,11 @@ int main(int argc, char *argv[]) {
 	sprintf(csd->subject,"%s",subject);
 	sprintf(csd->hemi,"%s",hemi);
 	sprintf(csd->contrast,"%s","NA");
-	csd->seed = SynthSeed;
-	csd->nreps = nRepetitions;
+	// Shards record the seed of their first repetition, which
+	// differs between shards, so that CSDmerge() accepts them
+	if(nShards == 1) csd->seed = SynthSeed;
+	else             csd->seed = RFstreamSeed(SynthSeed,RepStart);
+	csd->nreps = nShardReps;
 	csd->thresh = ThreshList[nthThresh];
 	csd->threshsign = SignList[nthSign];
 	csd->nullfwhm = FWHMList[nthFWHM];
@@ -363,15 +391,17 @@ int main(int argc, char *argv[]) {
     fprintf(fp,"%5.1f %4d\n",FWHMList[nthFWHM],nSmoothsList[nthFWHM]);
   fclose(fp);
 
-  // Alloc the z and sig maps
-  z   = MRIallocSequence(surf->nvertices, 1,1, MRI_FLOAT, 1);
-  sig = MRIallocSequence(surf->nvertices, 1,1, MRI_FLOAT, 1);
-
-  // Set up the random field specification
-  rfs = RFspecInit(SynthSeed,NULL);
-  rfs->name = strcpyalloc("gaussian");
-  rfs->params[0] = 0;
-  rfs->params[1] = 1;
+  // One set of scratch volumes, a random field spec and a copy of the
+  // surface (clustering writes into val and undefval) per thread
+  // One repetition at a time unless --threads or OMP_NUM_THREADS asks
+  // for more, since each thread holds its own volumes and surface
+#ifdef HAVE_OPENMP
+  if(!ThreadsSet && getenv("OMP_NUM_THREADS") != NULL) nthreads = omp_get_max_threads();
+#endif
+  printf("Running %d threads\n",nthreads);
+  SmoothOp = MRISsmoothOpAlloc(surf, mask);
+  mcst = (MCSIM_THREAD **) calloc(nthreads,sizeof(MCSIM_THREAD *));
+  for(n=0; n < nthreads; n++) mcst[n] = MCSthreadAlloc(surf);
 
   printf("Thresholds (%d): ",nThreshList);
   for(n=0; n < nThreshList; n++) printf("%5.2f ",ThreshList[n]);
@@ -383,126 +413,49 @@ int main(int argc, char *argv[]) {
   for(n=0; n < nFWHMList; n++) printf("%5.2f ",FWHMList[n]);
   printf("\n");
 
-  // Set up pointer to the val field
-  ppVal = (float **) calloc(surf->nvertices,sizeof(float *));
-  ppVal0 = ppVal;
-  ppSig = (float **) calloc(surf->nvertices,sizeof(float *));
-  ppSig0 = ppSig;
-  ppZ = (float **) calloc(surf->nvertices,sizeof(float *));
-  ppZ0 = ppZ;
-  for(k=0; k < surf->nvertices; k++){
-    ppVal[k] = &(surf->vertices[k].val);
-    ppSig[k] = &(MRIFseq_vox(sig,k,0,0,0));
-    ppZ[k] = &(MRIFseq_vox(z,k,0,0,0));
-  }
-
-  // Start the simulation loop
-  printf("\n\nStarting Simulation over %d Repetitions\n",nRepetitions);
-  if(fpLog) fprintf(fpLog,"\n\nStarting Simulation over %d Repetitions\n",nRepetitions);
+  // Start the simulation loop. Repetitions are run nthreads at a time
+  // so that the save and stop files are still checked regularly. Each
+  // repetition draws from its own stream, so the results do not depend
+  // on the number of threads or shards.
+  printf("\n\nStarting Simulation over %d Repetitions (%d to %d)\n",
+         nShardReps,RepStart,RepStart+nShardReps-1);
+  if(fpLog) fprintf(fpLog,"\n\nStarting Simulation over %d Repetitions (%d to %d)\n",
+                    nShardReps,RepStart,RepStart+nShardReps-1);
   TimerStart(&mytimer) ;
-  for(nthRep = 0; nthRep < nRepetitions; nthRep++){
+  nthRep = 0;
+  while(nthRep < nShardReps){
+    nChunk = MIN(nthreads, nShardReps-nthRep);
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible) schedule(static,1)
+#endif
+    for(k=0; k < nChunk; k++){
+      ROMP_PFLB_begin
+#ifdef HAVE_OPENMP
+      int tid = omp_get_thread_num();
+#else
+      int tid = 0;
+#endif
+      MCSrunRep(mcst[tid], nthRep+k);
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+    nthRep += nChunk;
+
     msecTime = TimerStop(&mytimer) ;
-    printf("%5d %7.2f ",nthRep,(msecTime/1000.0)/60);
+    printf("%5d %7.2f\n",RepStart+nthRep-1,(msecTime/1000.0)/60);
     fflush(stdout);
     if(fpLog) {
-      fprintf(fpLog,"%5d %7.1f ",nthRep,(msecTime/1000.0)/60);
+      fprintf(fpLog,"%5d %7.1f\n",RepStart+nthRep-1,(msecTime/1000.0)/60);
       fflush(fpLog);
     }
-    // Synthesize an unsmoothed z map
-    RFsynth(z,rfs,mask); 
-    nSmoothsPrev = 0;
-    
-    // Loop through FWHMs
-    for(nthFWHM=0; nthFWHM < nFWHMList; nthFWHM++){
-      printf("%d ",nthFWHM);
-      fflush(stdout);
-      if(fpLog) {
-	fprintf(fpLog,"%d ",nthFWHM);
-	fflush(fpLog);
-      }
-      nSmoothsDelta = nSmoothsList[nthFWHM] - nSmoothsPrev;
-      nSmoothsPrev = nSmoothsList[nthFWHM];
-      // Incrementally smooth z
-      MRISsmoothMRIFastFrame(surf, z, 0, nSmoothsDelta, mask);
-      // Rescale
-      RFrescale(z,rfs,mask,z);
-      // Slightly tortured way to get the right p-values because
-      //   RFstat2P() computes one-sided, but I handle sidedness
-      //   during thresholding.
-      // First, use zabs to get a two-sided pval bet 0 and 0.5
-      zabs = MRIabs(z,zabs);
-      p = RFstat2P(zabs,rfs,mask,0,p);
-      // Next, mult pvals by 2 to get two-sided bet 0 and 1
-      MRIscalarMul(p,p,2.0);
-      sig = MRIlog10(p,NULL,sig,1); // sig = -log10(p)
-
-      for(nthSign = 0; nthSign < nSignList; nthSign++){
-	csd = csdList[nthFWHM][0][nthSign]; // just need csd->threshsign
-
-	// If test is not ABS then apply the sign
-	if(csd->threshsign != 0) MRIsetSign(sig,z,0);
-
-	// Get the max stats
-	sigmax = MRIframeMax(sig,0,mask,csd->threshsign,
-			     &cmax,&rmax,&smax);
-	zmax = MRIgetVoxVal(z,cmax,rmax,smax,0);
-	if(csd->threshsign == 0){
-	  zmax = fabs(zmax);
-	  sigmax = fabs(sigmax);
-	}
-	// Mask
-	if(mask) {
-	  //MRImask(sig,mask,sig,0.0,0.0); // a little slow
-	  for(k=0; k < nmaskout; k++) MRIsetVoxVal(sig, maskoutvtxno[k],0,0,0, 0.0);
-	}
-
-	// Copy sig to vertexval
-	//MRIScopyMRI(surf, sig, 0, "val"); // MRIScopyMRI() is a little slow
-	ppVal = ppVal0;
-	ppSig = ppSig0;
-	for(k=0; k < surf->nvertices; k++) *(*ppVal++) = *(*ppSig++);
-
-	for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
-	  csd = csdList[nthFWHM][nthThresh][nthSign];
-
-	  // Surface clustering
-	  // Set the threshold
-	  if(csd->threshsign == 0) threshadj = csd->thresh;
-	  else threshadj = csd->thresh - log10(2.0); // one-sided test
-	  // Compute clusters
-	  SurfClustList = sclustMapSurfClusters(surf,threshadj,-1,csd->threshsign,
-						0,&nClusters,NULL);
-	  // Actual area of cluster with max area
-	  csize  = sclustMaxClusterArea(SurfClustList, nClusters);
-	  // Number of vertices of cluster with max number of vertices. 
-	  // Note: this may be a different cluster from above!
-	  csizen = sclustMaxClusterCount(SurfClustList, nClusters);
-	  cweightvtx = sclustMaxClusterWeightVtx(SurfClustList, nClusters, csd->threshsign);
-	  // Area of this cluster based on average vertex area. This just scales
-	  // the number of vertices.
-	  csizeavg = csizen * avgvtxarea;
-	  if(UseAvgVtxArea) csize = csizeavg;
-	  // Store results
-	  csd->nClusters[nthRep] = nClusters;
-	  csd->MaxClusterSize[nthRep] = csize;
-	  csd->MaxClusterSizeVtx[nthRep] = csizen;
-	  csd->MaxClusterWeightVtx[nthRep] = cweightvtx;
-	  csd->MaxSig[nthRep] = sigmax;
-	  csd->MaxStat[nthRep] = zmax;
-	} // Sign
-      } // Thresh
-    } // FWHM
-    printf("\n");
-    if(fpLog) fprintf(fpLog,"\n");
     if(SaveEachIter || fio_FileExistsReadable(SaveFile)) SaveOutput();
     if(fio_FileExistsReadable(StopFile)) {
       printf("Found stop file %s\n",StopFile);
-      goto finish;
+      break;
     }
   } // Simulation Repetition
 
- finish:
-
   SaveOutput();
 
   msecTime = TimerStop(&mytimer) ;
@@ -643,6 +596,21 @@ static int parse_commandline(int argc, char **argv) {
       nargsused = 1;
     } 
     else if (!strcasecmp(option, "--no-save-mask")) SaveMask = 0;
+    else if (!strcasecmp(option, "--shard")) {
+      if (nargc < 2) CMDargNErr(option,2);
+      sscanf(pargv[0],"%d",&nthShard);
+      sscanf(pargv[1],"%d",&nShards);
+      nargsused = 2;
+    } 
+    else if(!strcasecmp(option, "--threads") || !strcasecmp(option, "--nthreads") ){
+      if(nargc < 1) CMDargNErr(option,1);
+      sscanf(pargv[0],"%d",&nthreads);
+      ThreadsSet = 1;
+      #ifdef _OPENMP
+      omp_set_num_threads(nthreads);
+      #endif
+      nargsused = 1;
+    } 
     else if (!strcasecmp(option, "--nreps")) {
       if (nargc < 1) CMDargNErr(option,1);
       sscanf(pargv[0],"%d",&nRepetitions);
@@ -699,7 +667,9 @@ static void print_usage(void) {
   printf("   --o top-output-dir\n");
   printf("   --base csdbase\n");
   printf("   --surface subjectname hemi\n");
-  printf("   --nreps nrepetitions\n");
+  printf("   --nreps nrepetitions : total over all shards\n");
+  printf("   --shard k n : run the kth of n equal parts of the repetitions (needs --seed)\n");
+  printf("   --threads nthreads : run repetitions in parallel (default 1, or OMP_NUM_THREADS)\n");
   printf("   --fwhm FWHM <FWHM2 FWHM3 ...>\n");
   printf("   --fwhm-max FWHMMax : sim with fwhm=1:FWHMMax (default %g)\n",fwhmmax);
   printf("   \n");
@@ -760,17 +730,23 @@ printf("\n");
 printf("When running mri_glmfit, make sure to use   --label labeldir/lh.superiortemporal.label\n");
 printf("When running mri_glmfit-sim, add --cache-dir /path/to/mult-comp-cor --cache-label superiortemporal\n");
 printf("\n");
-printf("Example 3: running simulations in parallel (two jobs, 5000 iterations\n");
-printf("each for a total of 10000)\n");
+printf("Example 3: running simulations in parallel. Within a job, repetitions\n");
+printf("are run in parallel with --threads. To split the work over jobs, give\n");
+printf("each job the same --seed and --nreps and its own --shard (two jobs,\n");
+printf("5000 iterations each for a total of 10000)\n");
 printf("\n");
 printf("mri_mcsim --o /path/to/mult-comp-cor/fsaverage/lh/superiortemporal --base mc-z.j001 \n");
-printf("  --save-iter  --surf fsaverage lh --nreps 5000\n");
+printf("  --save-iter  --surf fsaverage lh --nreps 10000 --seed 1234 --shard 1 2\n");
 printf("  --label labeldir/lh.superiortemporal.label\n");
 printf("\n");
 printf("mri_mcsim --o /path/to/mult-comp-cor/fsaverage/lh/superiortemporal --base mc-z.j002 \n");
-printf("  --save-iter  --surf fsaverage lh --nreps 500\n");
+printf("  --save-iter  --surf fsaverage lh --nreps 10000 --seed 1234 --shard 2 2\n");
 printf("  --label labeldir/lh.superiortemporal.label\n");
 printf("\n");
+printf("Each repetition draws its noise from its own stream of the seed, so\n");
+printf("the results do not depend on the number of threads, and the shards\n");
+printf("merged in order are the same as a single job with --nreps 10000.\n");
+printf("\n");
 printf("When those jobs are done, merge the results into a single table with\n");
 printf("\n");
 printf("mri_surfcluster \n");
@@ -811,6 +787,18 @@ static void check_options(void) {
     printf("ERROR: need to specify number of simulation repitions\n");
     exit(1);
   }
+  if(nShards < 1 || nthShard < 1 || nthShard > nShards || nShards > nRepetitions) {
+    printf("ERROR: --shard k n needs 1 <= k <= n <= nreps\n");
+    exit(1);
+  }
+  if(nShards > 1 && SynthSeed < 0) {
+    printf("ERROR: must specify the same --seed for all shards\n");
+    exit(1);
+  }
+  if(nthreads < 1) {
+    printf("ERROR: --threads needs at least 1 thread\n");
+    exit(1);
+  }
   if(nFWHMList == 0){
     double fwhm;
     nFWHMList = 0;
@@ -853,6 +841,8 @@ static void dump_options(FILE *fp) {
   fprintf(fp,"OutTop  %s\n",OutTop);
   fprintf(fp,"CSDBase  %s\n",csdbase);
   fprintf(fp,"nreps    %d\n",nRepetitions);
+  fprintf(fp,"shard    %d %d\n",nthShard,nShards);
+  fprintf(fp,"nthreads %d\n",nthreads);
   fprintf(fp,"fwhmmax  %g\n",fwhmmax);
   fprintf(fp,"subject  %s\n",subject);
   fprintf(fp,"hemi     %s\n",hemi);
@@ -896,6 +886,8 @@ int SaveOutput(void)
 	fprintf(fp,"# runtime_min %g\n",msecTime/(1000*60.0));
 	fprintf(fp,"# nvertices-total %d\n",surf->nvertices);
 	fprintf(fp,"# nvertices-search %d\n",nmask);
+	if(nShards > 1) fprintf(fp,"# shard %d %d reps %d to %d of %d\n",nthShard,nShards,
+				RepStart,RepStart+nShardReps-1,nRepetitions);
 	if(mask) fprintf(fp,"# masking 1\n");
 	else     fprintf(fp,"# masking 0\n");
 	//fprintf(fp,"# FWHM %g\n",FWHMList[nthFWHM]);
@@ -910,3 +902,129 @@ int SaveOutput(void)
   return(0);
 }
 
+
+/*!
+  \fn static MCSIM_THREAD *MCSthreadAlloc(MRIS *surf)
+  \brief Allocates the state one thread needs to run repetitions,
+  including a copy of surf with the group-average areas that
+  sclustMapSurfClusters() uses.
+*/
+static MCSIM_THREAD *MCSthreadAlloc(MRIS *surf)
+{
+  MCSIM_THREAD *mcst;
+  int vno;
+
+  mcst = (MCSIM_THREAD *) calloc(1,sizeof(MCSIM_THREAD));
+  mcst->rfs = RFspecInit(SynthSeed,NULL);
+  mcst->rfs->name = strcpyalloc("gaussian");
+  mcst->rfs->params[0] = 0;
+  mcst->rfs->params[1] = 1;
+
+  mcst->surf = MRISclone(surf);
+  mcst->surf->group_avg_surface_area = surf->group_avg_surface_area;
+  mcst->surf->group_avg_vtxarea_loaded = surf->group_avg_vtxarea_loaded;
+  for(vno=0; vno < surf->nvertices; vno++)
+    mcst->surf->vertices[vno].group_avg_area = surf->vertices[vno].group_avg_area;
+
+  mcst->z    = MRIallocSequence(surf->nvertices, 1,1, MRI_FLOAT, 1);
+  mcst->zabs = MRIallocSequence(surf->nvertices, 1,1, MRI_FLOAT, 1);
+  mcst->p    = MRIallocSequence(surf->nvertices, 1,1, MRI_FLOAT, 1);
+  mcst->sig  = MRIallocSequence(surf->nvertices, 1,1, MRI_FLOAT, 1);
+  return(mcst);
+}
+
+/*!
+  \fn static int MCSrunRep(MCSIM_THREAD *mcst, int nthRepShard)
+  \brief Runs the nthRepShard'th repetition of this shard for all
+  FWHMs, signs and thresholds and stores the results in csdList. The
+  noise is drawn from stream RepStart+nthRepShard of SynthSeed.
+*/
+static int MCSrunRep(MCSIM_THREAD *mcst, int nthRepShard)
+{
+  int nthSign, nthFWHM, nthThresh, nSmoothsPrev, nSmoothsDelta, k;
+  int csizen, nClusters, cmax, rmax, smax;
+  double sigmax, zmax, threshadj, csize, csizeavg, cweightvtx;
+  MRIS *surf = mcst->surf;
+  MRI *z = mcst->z, *sig = mcst->sig;
+  RFS *rfs = mcst->rfs;
+  SURFCLUSTERSUM *SurfClustList;
+  CSD *csd;
+
+  // Synthesize an unsmoothed z map
+  RFspecSetSeed(rfs, RFstreamSeed(SynthSeed, RepStart+nthRepShard));
+  RFsynth(z,rfs,mask);
+  nSmoothsPrev = 0;
+
+  // Loop through FWHMs
+  for(nthFWHM=0; nthFWHM < nFWHMList; nthFWHM++){
+    nSmoothsDelta = nSmoothsList[nthFWHM] - nSmoothsPrev;
+    nSmoothsPrev = nSmoothsList[nthFWHM];
+    // Incrementally smooth z
+    MRISsmoothOpApply(SmoothOp, z, nSmoothsDelta, z);
+    // Rescale
+    RFrescale(z,rfs,mask,z);
+    // Slightly tortured way to get the right p-values because
+    //   RFstat2P() computes one-sided, but I handle sidedness
+    //   during thresholding.
+    // First, use zabs to get a two-sided pval bet 0 and 0.5
+    MRIabs(z,mcst->zabs);
+    RFstat2P(mcst->zabs,rfs,mask,0,mcst->p);
+    // Next, mult pvals by 2 to get two-sided bet 0 and 1
+    MRIscalarMul(mcst->p,mcst->p,2.0);
+    MRIlog10(mcst->p,NULL,sig,1); // sig = -log10(p)
+
+    for(nthSign = 0; nthSign < nSignList; nthSign++){
+      csd = csdList[nthFWHM][0][nthSign]; // just need csd->threshsign
+
+      // If test is not ABS then apply the sign
+      if(csd->threshsign != 0) MRIsetSign(sig,z,0);
+
+      // Get the max stats
+      sigmax = MRIframeMax(sig,0,mask,csd->threshsign,
+			   &cmax,&rmax,&smax);
+      zmax = MRIgetVoxVal(z,cmax,rmax,smax,0);
+      if(csd->threshsign == 0){
+	zmax = fabs(zmax);
+	sigmax = fabs(sigmax);
+      }
+      // Mask
+      if(mask) {
+	for(k=0; k < nmaskout; k++) MRIFseq_vox(sig,maskoutvtxno[k],0,0,0) = 0.0;
+      }
+
+      // Copy sig to vertexval
+      for(k=0; k < surf->nvertices; k++) surf->vertices[k].val = MRIFseq_vox(sig,k,0,0,0);
+
+      for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
+	csd = csdList[nthFWHM][nthThresh][nthSign];
+
+	// Surface clustering
+	// Set the threshold
+	if(csd->threshsign == 0) threshadj = csd->thresh;
+	else threshadj = csd->thresh - log10(2.0); // one-sided test
+	// Compute clusters
+	SurfClustList = sclustMapSurfClusters(surf,threshadj,-1,csd->threshsign,
+					      0,&nClusters,NULL);
+	// Actual area of cluster with max area
+	csize  = sclustMaxClusterArea(SurfClustList, nClusters);
+	// Number of vertices of cluster with max number of vertices.
+	// Note: this may be a different cluster from above!
+	csizen = sclustMaxClusterCount(SurfClustList, nClusters);
+	cweightvtx = sclustMaxClusterWeightVtx(SurfClustList, nClusters, csd->threshsign);
+	// Area of this cluster based on average vertex area. This just scales
+	// the number of vertices.
+	csizeavg = csizen * avgvtxarea;
+	if(UseAvgVtxArea) csize = csizeavg;
+	// Store results
+	csd->nClusters[nthRepShard] = nClusters;
+	csd->MaxClusterSize[nthRepShard] = csize;
+	csd->MaxClusterSizeVtx[nthRepShard] = csizen;
+	csd->MaxClusterWeightVtx[nthRepShard] = cweightvtx;
+	csd->MaxSig[nthRepShard] = sigmax;
+	csd->MaxStat[nthRepShard] = zmax;
+	free(SurfClustList);
+      } // Thresh
+    } // Sign
+  } // FWHM
+  return(0);
+}
@@ -0,0 +1,244 @@
+/**
+ * @file GaussianPyramidCache.cpp
+ * @brief A cache for Gaussian pyramids shared between registrations
+ *
+ */
+
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include "GaussianPyramidCache.h"
+#include "Registration.h"
+
+#include <cassert>
+#include <iostream>
+#include <sstream>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+#include "error.h"
+#include "fio.h"
+#ifdef __cplusplus
+}
+#endif
+
+using namespace std;
+
+bool GaussianPyramidCache::Key::operator<(const Key & k) const
+{
+  if (hash != k.hash)
+    return hash < k.hash;
+  if (width != k.width)
+    return width < k.width;
+  if (height != k.height)
+    return height < k.height;
+  if (depth != k.depth)
+    return depth < k.depth;
+  if (nframes != k.nframes)
+    return nframes < k.nframes;
+  if (minlevel != k.minlevel)
+    return minlevel < k.minlevel;
+  return maxlevel < k.maxlevel;
+}
+
+GaussianPyramidCache::GaussianPyramidCache()
+{
+#ifdef HAVE_OPENMP
+  omp_init_lock(&lock);
+#endif
+}
+
+GaussianPyramidCache::~GaussianPyramidCache()
+{
+  clear();
+#ifdef HAVE_OPENMP
+  omp_destroy_lock(&lock);
+#endif
+}
+
+/** Looks up the pyramid of mri_in with the given limits (see Registration::buildGPLimits).
+ If it is neither in memory nor in the directory, it is built by R (only once, other
+ threads asking for the same pyramid wait) and written to the directory (if set).
+ The returned pyramid is owned by the cache.
+ */
+const std::vector<MRI*> & GaussianPyramidCache::get(MRI * mri_in,
+    std::pair<int, int> limits, Registration & R)
+{
+  MRI_HASH h;
+  mri_hash_init(&h, mri_in);
+  Key key;
+  key.hash = h.hash;
+  key.width = mri_in->width;
+  key.height = mri_in->height;
+  key.depth = mri_in->depth;
+  key.nframes = mri_in->nframes;
+  key.minlevel = limits.first;
+  key.maxlevel = limits.second;
+
+  Entry * e = NULL;
+  bool isnew = false;
+#ifdef HAVE_OPENMP
+  omp_set_lock(&lock);
+#endif
+  std::map<Key, Entry*>::iterator it = entries.find(key);
+  if (it == entries.end())
+  {
+    e = new Entry;
+#ifdef HAVE_OPENMP
+    omp_init_lock(&e->lock);
+    omp_set_lock(&e->lock);
+#endif
+    entries[key] = e;
+    isnew = true;
+  }
+  else
+    e = it->second;
+  e->used = true;
+#ifdef HAVE_OPENMP
+  omp_unset_lock(&lock);
+#endif
+
+  if (isnew)
+  {
+    if (!read(key, mri_in, e->pyramid))
+    {
+      e->pyramid = R.buildGPLimits(mri_in, limits);
+      write(key, e->pyramid);
+    }
+    else if (R.verbose > 0)
+      cout << "   - Read Gaussian Pyramid from " << directory << endl;
+#ifdef HAVE_OPENMP
+    omp_unset_lock(&e->lock);
+#endif
+  }
+  else
+  {
+#ifdef HAVE_OPENMP
+    // wait until the pyramid is built
+    omp_set_lock(&e->lock);
+    omp_unset_lock(&e->lock);
+#endif
+    if (R.verbose > 1)
+      cout << "   - Reuse Gaussian Pyramid" << endl;
+  }
+
+  return e->pyramid;
+}
+
+bool GaussianPyramidCache::owns(const std::vector<MRI*> & p)
+{
+  if (p.size() == 0)
+    return false;
+  bool found = false;
+#ifdef HAVE_OPENMP
+  omp_set_lock(&lock);
+#endif
+  std::map<Key, Entry*>::iterator it;
+  for (it = entries.begin(); it != entries.end(); it++)
+    if (it->second->pyramid.size() > 0 && it->second->pyramid[0] == p[0])
+    {
+      found = true;
+      break;
+    }
+#ifdef HAVE_OPENMP
+  omp_unset_lock(&lock);
+#endif
+  return found;
+}
+
+void GaussianPyramidCache::purge()
+{
+  std::map<Key, Entry*>::iterator it = entries.begin();
+  while (it != entries.end())
+  {
+    if (!it->second->used)
+    {
+      freeEntry(it->second);
+      entries.erase(it++);
+    }
+    else
+    {
+      it->second->used = false;
+      it++;
+    }
+  }
+}
+
+void GaussianPyramidCache::clear()
+{
+  std::map<Key, Entry*>::iterator it;
+  for (it = entries.begin(); it != entries.end(); it++)
+    freeEntry(it->second);
+  entries.clear();
+}
+
+void GaussianPyramidCache::freeEntry(Entry * e)
+{
+  for (unsigned int i = 0; i < e->pyramid.size(); i++)
+    MRIfree(&e->pyramid[i]);
+#ifdef HAVE_OPENMP
+  omp_destroy_lock(&e->lock);
+#endif
+  delete e;
+}
+
+std::string GaussianPyramidCache::getFilename(const Key & key, int level)
+{
+  ostringstream oss;
+  oss << directory << "/gp-v" << fileVersion << "-" << hex << key.hash << dec
+      << "-" << key.width << "x" << key.height << "x" << key.depth << "x"
+      << key.nframes << "-" << key.minlevel << "-" << key.maxlevel << "-" << level << ".mgz";
+  return oss.str();
+}
+
+bool GaussianPyramidCache::read(const Key & key, MRI * mri_in,
+    std::vector<MRI*> & p)
+{
+  if (directory == "")
+    return false;
+
+  int n = key.maxlevel - key.minlevel + 1;
+  for (int i = 0; i < n; i++)
+    if (!fio_FileExistsReadable(getFilename(key, i).c_str()))
+      return false;
+
+  p.resize(n, NULL);
+  for (int i = 0; i < n; i++)
+  {
+    p[i] = MRIread(getFilename(key, i).c_str());
+    if (!p[i])
+    {
+      for (int j = 0; j < i; j++)
+        MRIfree(&p[j]);
+      p.clear();
+      return false;
+    }
+    p[i]->outside_val = mri_in->outside_val;
+  }
+  return true;
+}
+
+void GaussianPyramidCache::write(const Key & key, const std::vector<MRI*> & p)
+{
+  if (directory == "")
+    return;
+
+  for (unsigned int i = 0; i < p.size(); i++)
+    if (MRIwrite(p[i], getFilename(key, i).c_str()) != NO_ERROR)
+      cerr << "GaussianPyramidCache: could not write " << getFilename(key, i)
+          << endl;
+}
@@ -0,0 +1,120 @@
+/**
+ * @file GaussianPyramidCache.h
+ * @brief A cache for Gaussian pyramids shared between registrations
+ *
+ * GaussianPyramidCache keeps the pyramids built by Registration
+ *  (keyed by the hash of the input volume and the pyramid limits),
+ *  so that they are built only once, e.g. for the movables across
+ *  the iterations of mri_robust_template. Optionally the pyramids
+ *  are also written to and read from a directory.
+ *
+ */
+
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#ifndef GaussianPyramidCache_H
+#define GaussianPyramidCache_H
+
+#include <utility>
+#include <string>
+#include <vector>
+#include <map>
+
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+#include "mri.h"
+#ifdef __cplusplus
+}
+#endif
+
+class Registration;
+
+/** \class GaussianPyramidCache
+ * \brief Shares Gaussian pyramids between Registration instances (thread safe)
+ *
+ * Pyramids in the cache are owned by the cache: Registration does not free them.
+ * purge() and clear() must only be called when no Registration is using the cache.
+ */
+class GaussianPyramidCache
+{
+public:
+  GaussianPyramidCache();
+  ~GaussianPyramidCache();
+
+  //! Return pyramid of mri_in (build with R if not in memory or in the directory)
+  const std::vector<MRI*> & get(MRI * mri_in, std::pair<int, int> limits,
+      Registration & R);
+
+  //! Check if a pyramid (by its first level) is owned by the cache
+  bool owns(const std::vector<MRI*> & p);
+
+  //! Free pyramids that were not used since the last purge
+  void purge();
+
+  //! Free all pyramids
+  void clear();
+
+  //! Also write pyramids to / read them from this directory ("" to switch off)
+  void setDirectory(const std::string & dir)
+  {
+    directory = dir;
+  }
+
+private:
+  // not copyable (owns pyramids and locks)
+  GaussianPyramidCache(const GaussianPyramidCache &);
+  GaussianPyramidCache & operator=(const GaussianPyramidCache &);
+
+  struct Key
+  {
+    unsigned long hash;   // mri_hash of the header and the voxels of all frames
+    int width, height, depth, nframes;
+    int minlevel, maxlevel;
+    bool operator<(const Key & k) const;
+  };
+
+  struct Entry
+  {
+    std::vector<MRI*> pyramid;
+    bool used;
+#ifdef HAVE_OPENMP
+    omp_lock_t lock; // held while the pyramid is built
+#endif
+  };
+
+  std::string getFilename(const Key & key, int level);
+  bool read(const Key & key, MRI * mri_in, std::vector<MRI*> & p);
+  void write(const Key & key, const std::vector<MRI*> & p);
+  void freeEntry(Entry * e);
+
+  //! Version of the pyramid files (part of their names), increase it whenever
+  //! Registration::buildGPLimits changes, so that old files are not read
+  static const int fileVersion = 1;
+
+  std::map<Key, Entry*> entries;
+  std::string directory;
+#ifdef HAVE_OPENMP
+  omp_lock_t lock; // protects entries
+#endif
+};
+
+#endif
@@ -42,6 +42,11 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
 #include <vnl/vnl_inverse.h>
 #include <vnl/vnl_matrix.h>
 #include <vnl/vnl_matrix_fixed.h>
@@ -65,6 +70,7 @@ using namespace std;
 
 void MultiRegistration::clear()
 {
+  gpcache.clear();
   if (mri_mean)
     MRIfree(&mri_mean);
 
@@ -376,6 +382,9 @@ void MultiRegistration::initRegistration(RegRobust & R)
   R.setCost(Registration::ROB);
   R.setSaturation(sat);
   R.setDoublePrec(doubleprec);
+  R.setMatrixFree(matrixfree);
+  if (usegpcache)
+    R.setPyramidCache(&gpcache);
   //R.setDebug(debug);
 
   if (subsamplesize > 0)
@@ -394,6 +403,87 @@ void MultiRegistration::initRegistration(RegRobust & R)
 //   R.setTarget(P.mri_mean,P.fixvoxel,P.keeptype);
 }
 
+/*!
+ \fn double estimateRegistrationMem(MRI * mriS, MRI * mriT)
+ \brief Rough estimate (in MB) of the peak memory of a single registration of mriS to mriT
+ (images and Gaussian pyramids, partials and the regression on the highest resolution)
+ */
+double MultiRegistration::estimateRegistrationMem(MRI * mriS, MRI * mriT)
+{
+  double nvox = (double) mriS->width * mriS->height * mriS->depth * mriS->nframes;
+  double nvoxt = (double) mriT->width * mriT->height * mriT->depth * mriT->nframes;
+  if (nvoxt > nvox)
+    nvox = nvoxt;
+
+  // source and target (float) with their pyramids (1 + 1/8 + 1/64 ...)
+  double mu = 2.0 * nvox * sizeof(float) * 8.0 / 7.0;
+
+  // rows of the regression on the highest resolution
+  double rows = nvox;
+  if (subsamplesize > 0)
+    rows /= 8.0;
+  mu += 6.0 * rows * sizeof(float) + rows * sizeof(long int); // partials, indexing
+
+  int pnum = rigid ? 6 : 12;
+  if (iscale)
+    pnum++;
+  double tsize = doubleprec ? sizeof(double) : sizeof(float);
+  if (matrixfree)
+    mu += rows * (3 * sizeof(unsigned int) + 4 * sizeof(float) + 4 * tsize);
+  else
+  {
+    // see RegistrationStep::constructAb (float SVD)
+    double amu = rows * (pnum + 1) * tsize;
+    double bmu = rows * tsize;
+    mu += amu + 3 * bmu + 2 * (amu + bmu);
+  }
+
+  return mu / (1024.0 * 1024.0);
+}
+
+/*!
+ \fn int getRegistrationThreads(int nreg, MRI * mriT)
+ \brief Number of registrations (of all movables to mriT) to run concurrently
+ Limited by the OpenMP threads, setRegThreads (default 1) and setMemLimit
+ (at least 1).
+ \param nreg  number of registrations
+ \param mriT  common target
+ */
+int MultiRegistration::getRegistrationThreads(int nreg, MRI * mriT)
+{
+  int n = 1;
+#ifdef HAVE_OPENMP
+  n = omp_get_max_threads();
+#endif
+  if (regthreads > 0 && regthreads < n)
+    n = regthreads;
+  if (nreg < n)
+    n = nreg;
+
+  if (memlimit > 0.0 && n > 1)
+  {
+    double mu = 0.0;
+    for (unsigned int i = 0; i < mri_mov.size(); i++)
+    {
+      double mui = estimateRegistrationMem(mri_mov[i], mriT);
+      if (mui > mu)
+        mu = mui;
+    }
+    int nmem = mu > 0.0 ? (int) (memlimit / mu) : n;
+    if (nmem < n)
+    {
+      cout << " - memory limit " << memlimit << " MB (about " << mu
+          << " MB per registration): running " << (nmem > 1 ? nmem : 1)
+          << " instead of " << n << " registrations at a time" << endl;
+      n = nmem;
+    }
+  }
+
+  if (n < 1)
+    n = 1;
+  return n;
+}
+
 /*!
  \fn void mapAndAverageMov(int itdebug)
  \brief  maps movables to template using lta's, adjusts intensities (if iscale) and creates average (mean,median)
@@ -599,9 +689,14 @@ bool MultiRegistration::computeTemplate(int itmax, double eps, int iterate,
       cout << "  noxformits = " << noxformits[itcount - 1] << endl;
 
     // register all inputs to mean
+    // (each TP is independent, results do not depend on the number of concurrent registrations)
     vector<double> dists(nin, 1000); // should be larger than maxchange!
+    vector<int> havedists(nin, 0); // not vector<bool>, written concurrently
+    int nthreads = getRegistrationThreads(nin, mri_mean);
+    if (nthreads > 1)
+      cout << " - running " << nthreads << " registrations concurrently" << endl;
 #ifdef HAVE_OPENMP
-#pragma omp parallel for schedule(static,1)
+#pragma omp parallel for schedule(dynamic,1) num_threads(nthreads) if(nthreads > 1)
 #endif
     for (int i = 0; i < nin; i++)
     {
@@ -656,16 +751,19 @@ bool MultiRegistration::computeTemplate(int itmax, double eps, int iterate,
       if (satit)
         R.findSaturation();
 
+      if (nomulti || iscaleonly)
+      {
 #ifdef HAVE_OPENMP
 #pragma omp critical
 #endif 
-      if (nomulti || iscaleonly)
-      {
         cout << " - running high-res registration on TP " << i + 1 << "..." << endl;
         R.computeIterativeRegistration(iterate, epsit); 
       }
       else
       {
+#ifdef HAVE_OPENMP
+#pragma omp critical
+#endif 
         cout << " - running multi-resolutional registration on TP " << i + 1 << "..." << endl;
         R.computeMultiresRegistration(maxres, iterate, epsit);
       }
@@ -708,8 +806,7 @@ bool MultiRegistration::computeTemplate(int itmax, double eps, int iterate,
             MyMatrix::AffineTransDistSq(lastlta->xforms[0].m_L,
                 ltas[i]->xforms[0].m_L));
         LTAfree(&lastlta);
-        if (dists[i] > maxchange)
-          maxchange = dists[i];
+        havedists[i] = 1;
 #ifdef HAVE_OPENMP
 #pragma omp critical
 #endif  
@@ -842,6 +939,15 @@ bool MultiRegistration::computeTemplate(int itmax, double eps, int iterate,
 
     } // for loop end (all timepoints)
 
+    // maxchange (after the loop, not shared between threads)
+    for (int i = 0; i < nin; i++)
+      if (havedists[i] && dists[i] > maxchange)
+        maxchange = dists[i];
+
+    // keep pyramids of the movables, drop the one of the previous template
+    if (usegpcache)
+      gpcache.purge();
+
     // if we did not have initial transforms
     // allow for more iterations on different resolutions
     // based on noxformits vector defined above
@@ -1341,7 +1447,7 @@ bool MultiRegistration::initialXforms(int tpi, bool fixtp, int maxres,
     index[i] = i;
   index[0] = tpi;
   index[tpi] = 0;
-  vector<bool> converged(nin, true);
+  vector<int> converged(nin, 1); // not vector<bool>, written concurrently
 
   // Register everything to tpi TP
 //  vector < Registration > Rv(nin);
@@ -1352,8 +1458,13 @@ bool MultiRegistration::initialXforms(int tpi, bool fixtp, int maxres,
   //Md[0].first = MatrixIdentity(4,NULL);
   Md[0].first.set_identity();
   Md[0].second = 1.0;
+  // centroids are summed after the loop in TP order (independent of threads)
+  vector<vnl_vector_fixed<double, 4> > centroids(nin, vnl_vector_fixed<double, 4>(0.0));
+  int nthreads = getRegistrationThreads(nin - 1, mri_mov[tpi]);
+  if (nthreads > 1)
+    cout << " - running " << nthreads << " registrations concurrently" << endl;
 #ifdef HAVE_OPENMP
-#pragma omp parallel for schedule(static,1)
+#pragma omp parallel for schedule(dynamic,1) num_threads(nthreads) if(nthreads > 1)
 #endif
   for (int i = 1; i < nin; i++)
   {
@@ -1414,14 +1525,16 @@ bool MultiRegistration::initialXforms(int tpi, bool fixtp, int maxres,
       vnl_matlab_print(vcl_cout,R.getCentroidSinT(),"CentroidSinT",vnl_matlab_print_format_long);
       std::cout << std::endl;
     }
-#ifdef HAVE_OPENMP
-#pragma omp critical
-#endif  
-    {
-      centroid += centroid_temp;
-    }
+    centroids[i] = centroid_temp;
   } // end for loop (initial registration to inittp)
 
+  for (int i = 1; i < nin; i++)
+    centroid += centroids[i];
+
+  // pyramids in the space of TP tpi are not needed anymore
+  if (usegpcache)
+    gpcache.clear();
+
   centroid = (1.0 / nin) * centroid;
   if (debug)
   {
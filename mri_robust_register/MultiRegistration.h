@@ -38,6 +38,7 @@
 //#include <iostream>
 
 #include "RegRobust.h"
+#include "GaussianPyramidCache.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -61,8 +62,9 @@ public:
       outdir("./"), transonly(false), rigid(true), robust(true), sat(4.685),
           satit(false), debug(0), iscale(false), iscaleonly(false),
           nomulti(false), subsamplesize(-1), highit(-1), fixvoxel(false),
-          keeptype(false), average(1), doubleprec(false), backupweights(false),
-          sampletype(SAMPLE_CUBIC_BSPLINE), crascenter(false), mri_mean(NULL)
+          keeptype(false), average(1), doubleprec(false), matrixfree(false),
+          backupweights(false), sampletype(SAMPLE_CUBIC_BSPLINE), crascenter(false),
+          regthreads(1), memlimit(0.0), usegpcache(false), mri_mean(NULL)
   {
   }
 
@@ -70,8 +72,9 @@ public:
       outdir("./"), transonly(false), rigid(true), robust(true), sat(4.685),
           satit(false), debug(0), iscale(false), iscaleonly(false),
           nomulti(false), subsamplesize(-1), highit(-1), fixvoxel(false),
-          keeptype(false), average(1), doubleprec(false), backupweights(false),
-          sampletype(SAMPLE_CUBIC_BSPLINE), crascenter(false), mri_mean(NULL)
+          keeptype(false), average(1), doubleprec(false), matrixfree(false),
+          backupweights(false), sampletype(SAMPLE_CUBIC_BSPLINE), crascenter(false),
+          regthreads(1), memlimit(0.0), usegpcache(false), mri_mean(NULL)
   {
     loadMovables(mov);
   }
@@ -103,9 +106,13 @@ public:
     std::cout << " KeepType:      " << keeptype << std::endl;
     std::cout << " Average:       " << average << std::endl;
     std::cout << " DoublePrec:    " << doubleprec << std::endl;
+    std::cout << " MatrixFree:    " << matrixfree << std::endl;
     std::cout << " BackupWeights: " << backupweights << std::endl;
     std::cout << " SampleType:    " << sampletype<< std::endl;
     std::cout << " CRASCenter:    " << crascenter<< std::endl;
+    std::cout << " RegThreads:    " << regthreads << std::endl;
+    std::cout << " MemLimit:      " << memlimit << std::endl;
+    std::cout << " GPCache:       " << usegpcache << std::endl;
     std::cout << " Debug:         " << debug << std::endl;
     std::cout <<  std::noboolalpha << std::endl;
   
@@ -243,6 +250,37 @@ public:
     doubleprec = b;
   }
 
+  //! Specify if normal equations are accumulated without storing A
+  void setMatrixFree(bool b)
+  {
+    matrixfree = b;
+  }
+
+  //! Specify max number of concurrent registrations (default 1: sequential, 0: one per OpenMP thread)
+  void setRegThreads(int n)
+  {
+    regthreads = n;
+  }
+
+  //! Specify memory limit in MB for concurrent registrations (0: no limit)
+  void setMemLimit(double mb)
+  {
+    memlimit = mb;
+  }
+
+  //! Specify if Gaussian pyramids are shared between registrations and iterations
+  void setPyramidCache(bool b)
+  {
+    usegpcache = b;
+  }
+
+  //! Share Gaussian pyramids and also store them in dir
+  void setPyramidCacheDir(const std::string & dir)
+  {
+    usegpcache = true;
+    gpcache.setDirectory(dir);
+  }
+
   //! Specify if weights are keept
   void setBackupWeights(bool b)
   {
@@ -297,6 +335,9 @@ private:
 
   void initRegistration(RegRobust & R);
 
+  double estimateRegistrationMem(MRI * mriS, MRI * mriT);
+  int getRegistrationThreads(int nreg, MRI * mriT);
+
   vnl_matrix_fixed<double, 3, 3> getAverageCosines();
   MRI * createTemplateGeo();
 
@@ -323,9 +364,14 @@ private:
   bool keeptype;
   int average;
   bool doubleprec;
+  bool matrixfree;
   bool backupweights;
   int sampletype;
   bool crascenter;
+  int regthreads;
+  double memlimit;
+  bool usegpcache;
+  GaussianPyramidCache gpcache;
 
   // DATA
   std::vector<MRI*> mri_mov;
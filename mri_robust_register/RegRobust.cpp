@@ -237,9 +237,9 @@ double RegRobust::findSaturation()
     MINS = minsize; // use minsize, but at least 16
   pair<int, int> limits = getGPLimits(mriS, mriT, MINS, maxsize);
   if (gpS.size() == 0)
-    gpS = buildGPLimits(mriS, limits);
+    gpS = getGaussianPyramid(mriS, limits);
   if (gpT.size() == 0)
-    gpT = buildGPLimits(mriT, limits);
+    gpT = getGaussianPyramid(mriT, limits);
   assert(gpS.size() == gpT.size());
   if (gpS[0]->width < MINS || gpS[0]->height < MINS
       || (gpS[0]->depth < MINS && gpS[0]->depth != 1))
@@ -31,6 +31,7 @@
 #include "Regression.h"
 #include "CostFunctions.h"
 #include "mriBSpline.h"
+#include "GaussianPyramidCache.h"
 
 #include <limits>
 #include <cassert>
@@ -746,9 +747,9 @@ void Registration::computeMultiresRegistration(int stopres, int n, double epsit)
   //if (gpT.size() ==0) gpT = buildGaussianPyramid(mriT,MINS,maxsize);
   pair<int, int> limits = getGPLimits(mriS, mriT, MINS, maxsize);
   if (gpS.size() == 0)
-    gpS = buildGPLimits(mriS, limits);
+    gpS = getGaussianPyramid(mriS, limits);
   if (gpT.size() == 0)
-    gpT = buildGPLimits(mriT, limits);
+    gpT = getGaussianPyramid(mriT, limits);
   assert(gpS.size() == gpT.size());
   if (gpT[0]->width < MINS || gpT[0]->height < MINS
       || (gpT[0]->depth < MINS && gpT[0]->depth != 1))
@@ -3147,8 +3148,24 @@ vector<MRI*> Registration::buildGaussianPyramid(MRI * mri_in, int min, int max)
   return p;
 }
 
+/** Returns the pyramid from the cache (if set, see setPyramidCache),
+ else builds it with buildGPLimits.
+ */
+vector<MRI*> Registration::getGaussianPyramid(MRI * mri_in,
+    std::pair<int, int> limits)
+{
+  if (gpcache)
+    return gpcache->get(mri_in, limits, *this);
+  return buildGPLimits(mri_in, limits);
+}
+
 void Registration::freeGaussianPyramid(std::vector<MRI*>& p)
 {
+  if (gpcache && gpcache->owns(p)) // shared, freed by the cache
+  {
+    p.clear();
+    return;
+  }
   for (uint i = 0; i < p.size(); i++)
     MRIfree(&p[i]);
   p.clear();
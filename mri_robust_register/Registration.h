@@ -59,12 +59,15 @@ extern "C"
 #include "MyMRI.h"
 #include "Transformation.h"
 
+class GaussianPyramidCache;
+
 /** \class Registration
  * \brief Base class for registration 
  * Implements multi resolution and iterative registration, as well as initializations
  */
 class Registration
 {
+  friend class GaussianPyramidCache;
 public:
 
 //! The different cost functions
@@ -80,7 +83,8 @@ public:
           debug(0), verbose(1),initorient(false), inittransform(true), initscaling(false),
           highit(-1), mri_source(NULL), mri_target(NULL), iscaleinit(1.0),
           iscalefinal(1.0), doubleprec(false), symmetry(true),
-          sampletype(SAMPLE_TRILINEAR), resample(false), costfun(ROB), converged(false)
+          sampletype(SAMPLE_TRILINEAR), resample(false), costfun(ROB), converged(false),
+          gpcache(NULL)
   {
   }
 
@@ -257,6 +261,12 @@ public:
     symmetry = b;
   }
 
+  //! Share Gaussian pyramids with other registrations (cache is not owned)
+  void setPyramidCache(GaussianPyramidCache * c)
+  {
+    gpcache = c;
+  }
+
   //! Will be changed by Interpolator later, do not use
   void setSampleType(int st)
   {
@@ -400,6 +410,8 @@ protected:
       -1);
   //! Build Gaussian pyramid based on limits
   std::vector<MRI*> buildGPLimits(MRI *mri_in, std::pair<int, int> limits);
+  //! Build Gaussian pyramid based on limits (or get it from the cache)
+  std::vector<MRI*> getGaussianPyramid(MRI *mri_in, std::pair<int, int> limits);
   //! Free a Gaussian pyramid
   void freeGaussianPyramid(std::vector<MRI*>& p);
   //! Save a Gaussian pyramid
@@ -453,6 +465,8 @@ protected:
 
   bool converged;
 
+  GaussianPyramidCache * gpcache;
+
 private:
 
   // construct Ab and R:
@@ -53,6 +53,83 @@ extern "C"
 #include "Transformation.h"
 #include "RegRobust.h"
 
+/** \class RegistrationRows
+ * \brief Compact storage of the rows of A (voxel position and partials)
+ *
+ * Rows are regenerated from the transformation model when needed,
+ * instead of keeping the dense matrix A (see RegRobust::setMatrixFree).
+ */
+class RegistrationRows: public RegressionRows
+{
+public:
+  RegistrationRows() :
+      trans(NULL), iscale(false), ncols(0)
+  {
+  }
+
+  //! Remove all rows and set model (transform and intensity scaling)
+  void init(const Transformation * t, bool is, unsigned int n)
+  {
+    trans = t;
+    iscale = is;
+    ncols = trans->getDOF() + (iscale ? 1 : 0);
+    pos.clear();
+    partials.clear();
+    pos.reserve(3 * n);
+    partials.reserve(4 * n);
+  }
+
+  //! Append a row (voxel x,y,z and partials fx,fy,fz and ft)
+  void push_back(unsigned int x, unsigned int y, unsigned int z, float fx,
+      float fy, float fz, float ft)
+  {
+    pos.push_back(x);
+    pos.push_back(y);
+    pos.push_back(z);
+    partials.push_back(fx);
+    partials.push_back(fy);
+    partials.push_back(fz);
+    partials.push_back(ft);
+  }
+
+  //! Free the memory
+  void clear()
+  {
+    std::vector<unsigned int>().swap(pos);
+    std::vector<float>().swap(partials);
+  }
+
+  virtual unsigned int rows() const
+  {
+    return pos.size() / 3;
+  }
+
+  virtual unsigned int cols() const
+  {
+    return ncols;
+  }
+
+  virtual void getRow(unsigned int i, double * row) const
+  {
+    const unsigned int * xyz = &pos[3 * i];
+    const float * f = &partials[4 * i];
+    vnl_vector<double> grad = trans->getGradient(xyz[0], f[0], xyz[1], f[1],
+        xyz[2], f[2]);
+    unsigned int dof = grad.size();
+    for (unsigned int pno = 0; pno < dof; pno++)
+      row[pno] = grad[pno];
+    if (iscale)
+      row[dof] = f[3];
+  }
+
+private:
+  const Transformation * trans;
+  bool iscale;
+  unsigned int ncols;
+  std::vector<unsigned int> pos;
+  std::vector<float> partials;
+};
+
 template<class T>
 class RegistrationStep
 {
@@ -62,8 +139,8 @@ public:
   RegistrationStep(const RegRobust & R) :
       sat(R.sat), iscale(R.iscale), transonly(R.transonly), rigid(R.rigid), isoscale(
           R.isoscale), trans(R.trans), costfun(R.costfun), rtype(1), subsamplesize(
-          R.subsamplesize), debug(R.debug), verbose(R.verbose), floatsvd(false), iscalefinal(
-          R.iscalefinal), mri_weights(NULL), mri_indexing(NULL)
+          R.subsamplesize), debug(R.debug), verbose(R.verbose), floatsvd(false), matrixfree(
+          R.matrixfree), iscalefinal(R.iscalefinal), mri_weights(NULL), mri_indexing(NULL)
   {
   }
 
@@ -142,6 +219,7 @@ private:
   int debug;
   int verbose;
   bool floatsvd; // should be removed
+  bool matrixfree; // keep only rows (Arows) instead of A, see RegistrationRows
   double iscalefinal; // from the last step, used in constructAB
 
 // out:
@@ -155,6 +233,7 @@ private:
 
 //internal
   MRI * mri_indexing;
+  RegistrationRows Arows;
   vnl_vector<T> pvec;
 
 };
@@ -183,6 +262,7 @@ std::pair<vnl_matrix_fixed<double, 4, 4>, double> RegistrationStep<T>::computeRe
     if (verbose > 1)
       std::cout << "rigid and rtype 2 !" << std::endl;
     assert(rtype !=2);
+    assert(!matrixfree);
 
     // compute non rigid A
     rigid = false;
@@ -223,7 +303,8 @@ std::pair<vnl_matrix_fixed<double, 4, 4>, double> RegistrationStep<T>::computeRe
   if (verbose > 1)
     std::cout << "  DONE" << std::endl;
 
-  Regression<T> R(A, b);
+  // matrix-free: constructAb only stored the rows (Arows), A is empty
+  Regression<T> R = matrixfree ? Regression<T>(Arows, b) : Regression<T>(A, b);
   R.setVerbose(verbose);
   R.setFloatSvd(floatsvd);
   if (costfun == Registration::ROB)
@@ -239,6 +320,7 @@ std::pair<vnl_matrix_fixed<double, 4, 4>, double> RegistrationStep<T>::computeRe
 
     A.clear();
     b.clear();
+    Arows.clear();
 
     if (verbose > 1)
       std::cout << "  DONE" << std::endl;
@@ -344,6 +426,7 @@ std::pair<vnl_matrix_fixed<double, 4, 4>, double> RegistrationStep<T>::computeRe
 
     A.clear();
     b.clear();
+    Arows.clear();
     if (verbose > 1)
       std::cout << "  DONE" << std::endl;
     // no weights in this case
@@ -643,38 +726,60 @@ void RegistrationStep<T>::constructAb(MRI *mriS, MRI *mriT, vnl_matrix<T>& A,
   if (iscale)
     pnum++;
   //cout << " pnum: " << pnum << "  counti: " << counti<<  endl;
-  double amu = ((double) counti * (pnum + 1)) * sizeof(T) / (1024.0 * 1024.0); // +1 =  rowpointer vector
-  double bmu = (double) counti * sizeof(T) / (1024.0 * 1024.0);
-  if (verbose > 1)
-    std::cout << "     -- allocating " << amu + bmu << "Mb mem for A and b ... "
-        << std::flush;
-  bool OK = A.set_size(counti, pnum);
-  OK = OK && b.set_size(counti);
-  if (!OK)
+  if (matrixfree)
   {
-    std::cout << std::endl;
-    ErrorExit(ERROR_NO_MEMORY,
-        "Registration::constructAB could not allocate memory for A and b");
-  }
-  if (verbose > 1)
-    std::cout << " done! " << std::endl;
-  double maxmu = 5 * amu + 7 * bmu;
-  string fstr = "";
-  if (floatsvd)
-  {
-    maxmu = amu + 3 * bmu + 2 * (amu + bmu);
-    fstr = "-float";
+    // only store voxel position and partials, rows of A are generated when needed
+    double rmu = (double) counti * (3 * sizeof(unsigned int) + 4 * sizeof(float)
+        + 4 * sizeof(T)) / (1024.0 * 1024.0); // + b, r, w and last w
+    if (verbose > 1)
+      std::cout << "     -- matrix-free, allocating " << rmu
+          << "Mb mem for rows and vectors ... " << std::flush;
+    A.clear();
+    Arows.init(trans, iscale, counti);
+    if (!b.set_size(counti))
+    {
+      std::cout << std::endl;
+      ErrorExit(ERROR_NO_MEMORY,
+          "Registration::constructAB could not allocate memory for b");
+    }
+    if (verbose > 1)
+      std::cout << " done! " << std::endl;
   }
-  if (verbose > 1)
-    std::cout << "         (MAX usage in SVD" << fstr << " will be > " << maxmu
-        << "Mb mem + 6 MRI) " << std::endl;
-  if (maxmu > 3800)
+  else
   {
-    std::cout << "     -- WARNING: mem usage large: " << maxmu
-        << "Mb mem + 6 MRI" << std::endl;
-    //string fsvd;
-    //if (doubleprec) fsvd = "remove --doubleprec and/or ";
-    std::cout << "          Maybe use --subsample <int> " << std::endl;
+    double amu = ((double) counti * (pnum + 1)) * sizeof(T) / (1024.0 * 1024.0); // +1 =  rowpointer vector
+    double bmu = (double) counti * sizeof(T) / (1024.0 * 1024.0);
+    if (verbose > 1)
+      std::cout << "     -- allocating " << amu + bmu << "Mb mem for A and b ... "
+          << std::flush;
+    bool OK = A.set_size(counti, pnum);
+    OK = OK && b.set_size(counti);
+    if (!OK)
+    {
+      std::cout << std::endl;
+      ErrorExit(ERROR_NO_MEMORY,
+          "Registration::constructAB could not allocate memory for A and b");
+    }
+    if (verbose > 1)
+      std::cout << " done! " << std::endl;
+    double maxmu = 5 * amu + 7 * bmu;
+    string fstr = "";
+    if (floatsvd)
+    {
+      maxmu = amu + 3 * bmu + 2 * (amu + bmu);
+      fstr = "-float";
+    }
+    if (verbose > 1)
+      std::cout << "         (MAX usage in SVD" << fstr << " will be > " << maxmu
+          << "Mb mem + 6 MRI) " << std::endl;
+    if (maxmu > 3800)
+    {
+      std::cout << "     -- WARNING: mem usage large: " << maxmu
+          << "Mb mem + 6 MRI" << std::endl;
+      //string fsvd;
+      //if (doubleprec) fsvd = "remove --doubleprec and/or ";
+      std::cout << "          Maybe use --subsample <int> or --matrixfree" << std::endl;
+    }
   }
 
 //        char ch;
@@ -764,6 +869,15 @@ void RegistrationStep<T>::constructAb(MRI *mriS, MRI *mriT, vnl_matrix<T>& A,
           //cout << "x: " << x << " y: " << y << " z: " << z << " count: "<< count << std::endl;
           //cout << " " << count << " mrifx: " << MRIFvox(mri_fx, x, y, z) << " mrifx int: " << (int)MRIvox(mri_fx,x,y,z) <<endl;
 
+          // matrix-free: keep what is needed to recompute the row
+          if (matrixfree)
+          {
+            Arows.push_back(x, y, z, fxval, fyval, fzval, ftval);
+            b[count] = MRIFseq_vox(SmT, x, y, z, f);
+            count++;
+            continue;
+          }
+
           // new: now use transformation model to get the gradient vector
           vnl_vector < double > grad = trans->getGradient(x,fxval,y,fyval,z,fzval);
           int dof = grad.size();
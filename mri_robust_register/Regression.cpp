@@ -91,7 +91,7 @@ template<class T>
 vnl_vector<T> Regression<T>::getRobustEstW(vnl_vector<T>& w, double sat,
     double sig)
 {
-  if (A)
+  if (A || Arows)
     return getRobustEstWAB(w, sat, sig);
   else
     return vnl_vector<T>(1, getRobustEstWB(w, sat, sig));
@@ -209,7 +209,8 @@ vnl_vector<T> Regression<T>::getRobustEstWAB(vnl_vector<T>& wfinal, double sat,
   if (verbose > 1)
   {
     cout << "  Regression<T>::getRobustEstWAB( "<<sat<<" , "<<sig<<" ) " ;
-    if (floatsvd) cout << "  FLOAT version " ;
+    if (Arows) cout << "  MATRIX-FREE version " ;
+    else if (floatsvd) cout << "  FLOAT version " ;
     else cout << "  DOUBLE version " ;
     cout << endl;
   }
@@ -225,8 +226,8 @@ vnl_vector<T> Regression<T>::getRobustEstWAB(vnl_vector<T>& wfinal, double sat,
   err[1] = 1e20;
   double sigma;
 
-  int arows = A->rows(); // large (voxels)
-  int acols = A->cols(); // small (parameters)
+  int arows = Arows ? Arows->rows() : A->rows(); // large (voxels)
+  int acols = Arows ? Arows->cols() : A->cols(); // small (parameters)
 
   //pre-alocate vectors
   // init residuals (based on zero p, so r := b )
@@ -283,13 +284,18 @@ vnl_vector<T> Regression<T>::getRobustEstWAB(vnl_vector<T>& wfinal, double sat,
     r->clear();
 
     // compute weighted least squares
-    if (floatsvd)
+    if (Arows)
+      *p = getWeightedLSEstRows(*w);
+    else if (floatsvd)
       *p = getWeightedLSEstFloat(*w);
     else
       *p = getWeightedLSEst(*w);
 
     // compute new residuals
-    *r = *b - (*A * *p);
+    if (Arows)
+      getResidualsRows(*p, *r);
+    else
+      *r = *b - (*A * *p);
 
     // and total errors (using new r)
     // err = sum (w r^2) / sum (w)
@@ -445,6 +451,127 @@ vnl_vector<T> Regression<T>::getWeightedLSEstFloat(const vnl_vector<T> & w)
   return pd;
 }
 
+/** Matrix-free version for rows of A generated on the fly (Arows).
+ Accumulates \f$ A^T W A \f$ and \f$ A^T W b \f$ (with \f$ W = diag(w_i^2) \f$ )
+ directly from the rows, so memory is only O(cols^2) on top of b and w.
+ Rows are summed in a fixed number of chunks (in parallel) and the chunks
+ are added in order, so the result does not depend on the number of threads.
+ The small system is solved with SVD.
+ \param w vector representing a diagnoal matrix with the sqrt of the weights as elements
+ */
+template<class T>
+vnl_vector<T> Regression<T>::getWeightedLSEstRows(const vnl_vector<T> & w)
+{
+  assert(Arows != NULL);
+  const int n = Arows->rows();
+  const int m = Arows->cols();
+  assert((int)w.size() == n);
+  assert((int)b->size() == n);
+
+  int nchunks = 64;
+  if (nchunks > n)
+    nchunks = n;
+  const int psize = m * m + m;
+  std::vector<double> partials(nchunks * psize, 0.0);
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel
+#endif
+  {
+    std::vector<double> row(m);
+    int c, rr, i, j;
+#ifdef HAVE_OPENMP
+#pragma omp for schedule(dynamic,1)
+#endif
+    for (c = 0; c < nchunks; c++)
+    {
+      double * AtWA = &partials[c * psize];
+      double * AtWb = AtWA + m * m;
+      int rbegin = (int) (((long int) n * c) / nchunks);
+      int rend = (int) (((long int) n * (c + 1)) / nchunks);
+      for (rr = rbegin; rr < rend; rr++)
+      {
+        double wi = (double) w[rr] * (double) w[rr];
+        if (wi == 0.0)
+          continue;
+        Arows->getRow(rr, &row[0]);
+        double wb = wi * (double) b->operator[](rr);
+        for (i = 0; i < m; i++)
+        {
+          double wa = wi * row[i];
+          AtWb[i] += row[i] * wb;
+          for (j = i; j < m; j++)
+            AtWA[i * m + j] += wa * row[j];
+        }
+      }
+    }
+  }
+
+  // add chunks in order and fill lower triangle
+  vnl_matrix<double> AtWA(m, m, 0.0);
+  vnl_vector<double> AtWb(m, 0.0);
+  int c, i, j;
+  for (c = 0; c < nchunks; c++)
+  {
+    const double * pAtWA = &partials[c * psize];
+    const double * pAtWb = pAtWA + m * m;
+    for (i = 0; i < m; i++)
+    {
+      AtWb[i] += pAtWb[i];
+      for (j = i; j < m; j++)
+        AtWA(i, j) += pAtWA[i * m + j];
+    }
+  }
+  for (i = 0; i < m; i++)
+    for (j = 0; j < i; j++)
+      AtWA(i, j) = AtWA(j, i);
+
+  vnl_svd<double> svd(AtWA);
+  if (!svd.valid())
+  {
+    cerr << "    Regression<T>::getWeightedLSEstRows   could not solve normal equations!"
+        << endl;
+    exit(1);
+  }
+  vnl_vector<double> p = svd.solve(AtWb);
+
+  vnl_vector<T> pt(m);
+  for (i = 0; i < m; i++)
+    pt[i] = (T) p[i];
+  return pt;
+}
+
+/** Computes residuals r = b - A p for rows of A generated on the fly (Arows).
+ */
+template<class T>
+void Regression<T>::getResidualsRows(const vnl_vector<T>& p, vnl_vector<T>& r)
+{
+  assert(Arows != NULL);
+  const int n = Arows->rows();
+  const int m = Arows->cols();
+  assert((int)p.size() == m);
+  r.set_size(n);
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel
+#endif
+  {
+    std::vector<double> row(m);
+    int rr, i;
+#ifdef HAVE_OPENMP
+#pragma omp for schedule(static)
+#endif
+    for (rr = 0; rr < n; rr++)
+    {
+      Arows->getRow(rr, &row[0]);
+      double d = 0.0;
+      for (i = 0; i < m; i++)
+        d += row[i] * (double) p[i];
+      r[rr] = (T) ((double) b->operator[](rr) - d);
+    }
+  }
+}
+
 // template <class T>
 // vnl_vector< T >  Regression<T>::getWeightedLSEst(const vnl_vector< T > & w)
 // // w is a vector representing a diagnoal matrix with the sqrt of the weights as elements
@@ -543,6 +670,19 @@ vnl_vector<T> Regression<T>::getLSEst()
   //cout << " Regression<T>::getLSEst " << endl;
   lastweight = -1;
   lastzero = -1;
+  if (Arows) // matrix-free: normal equations with unit weights
+  {
+    vnl_vector<T> w(b->size(), 1.0);
+    vnl_vector<T> p = getWeightedLSEstRows(w);
+    vnl_vector<T> R;
+    getResidualsRows(p, R);
+    double serror = 0;
+    for (unsigned int rr = 0; rr < R.size(); rr++)
+      serror += R[rr] * R[rr];
+    lasterror = serror;
+    return p;
+  }
+
   if (A == NULL) // LS solution is just the mean of B
   {
     assert(b!=NULL);
@@ -50,6 +50,26 @@ extern "C"
 #include <vnl/vnl_vector.h>
 #include <vnl/vnl_matrix.h>
 
+/** \class RegressionRows
+ * \brief Interface to generate the rows of the design matrix A on the fly
+ *
+ * Used instead of a dense A when the rows are cheap to recompute
+ * (matrix-free normal equations, see Regression::getWeightedLSEstRows).
+ */
+class RegressionRows
+{
+public:
+  virtual ~RegressionRows()
+  {}
+
+  //! Number of rows of A (large, e.g. voxels)
+  virtual unsigned int rows() const =0;
+  //! Number of columns of A (small, parameters)
+  virtual unsigned int cols() const =0;
+  //! Write row i of A into row (length cols()), must be thread safe
+  virtual void getRow(unsigned int i, double * row) const =0;
+};
+
 /** \class Transform3dTranslate
  * \brief Templated class for iteratively reweighted least squares
  */
@@ -60,12 +80,17 @@ public:
 
   //! Constructor initializing A and b
   Regression(vnl_matrix<T> & Ap, vnl_vector<T> & bp) :
-      A(&Ap), b(&bp), lasterror(-1), lastweight(-1), lastzero(-1), verbose(1), floatsvd(false)
+      A(&Ap), Arows(NULL), b(&bp), lasterror(-1), lastweight(-1), lastzero(-1), verbose(1), floatsvd(false)
+  {}
+
+  //! Constructor initializing rows of A (generated on the fly) and b
+  Regression(RegressionRows & Ar, vnl_vector<T> & bp) :
+      A(NULL), Arows(&Ar), b(&bp), lasterror(-1), lastweight(-1), lastzero(-1), verbose(1), floatsvd(false)
   {}
 
   //! Constructor initializing b (for simple case where x is single variable and A is (...1...)^T
   Regression(vnl_vector<T> & bp) :
-      A(NULL), b(&bp), lasterror(-1), lastweight(-1), lastzero(-1), verbose(1), floatsvd(false)
+      A(NULL), Arows(NULL), b(&bp), lasterror(-1), lastweight(-1), lastzero(-1), verbose(1), floatsvd(false)
   {}
 
   //! Robust solver
@@ -79,6 +104,8 @@ public:
   vnl_vector<T> getWeightedLSEst(const vnl_vector<T> & sqrtweights);
   //! Weighted least squares in float (only for the T=double version)
   vnl_vector<T> getWeightedLSEstFloat(const vnl_vector<T> & sqrtweights);
+  //! Weighted least squares via normal equations accumulated from the rows of A
+  vnl_vector<T> getWeightedLSEstRows(const vnl_vector<T> & sqrtweights);
 
   double getLastError()
   {
@@ -125,8 +152,11 @@ protected:
   void getTukeyBiweight(const vnl_vector<T>& r, vnl_vector<T> &w, double sat = SATr);
   double getTukeyPartialSat(const vnl_vector<T>& r, double sat = SATr);
 
+  void getResidualsRows(const vnl_vector<T>& p, vnl_vector<T>& r);
+
 private:
   vnl_matrix<T> * A;
+  RegressionRows * Arows;
   vnl_vector<T> * b;
   double lasterror, lastweight, lastzero;
   int verbose;
@@ -51,6 +51,7 @@
 #include "MyMRI.h"
 #include "MyMatrix.h"
 #include "JointHisto.h"
+#include "GaussianPyramidCache.h"
 
 // all other software are all in "C"
 #ifdef __cplusplus
@@ -138,6 +139,8 @@ struct Parameters
   bool entball;
   bool entcorrection;
   double powelltol;
+  bool matrixfree;
+  string gpcachedir;
 };
 static struct Parameters P =
 { "", "", "", "", "", "", "", "", "", "", "", false, false, false, false, false, false,
@@ -145,12 +148,15 @@ static struct Parameters P =
     NULL, NULL, false, false, true, false, 1, -1, false, 0.16, true, true, "",
     "", -1, -1, Registration::ROB,
 //  256,
-    SAMPLE_CUBIC_BSPLINE, false, ERADIUS, "", "", false, false, 1e-5 };
+    SAMPLE_CUBIC_BSPLINE, false, ERADIUS, "", "", false, false, 1e-5, false, "" };
 
 static void printUsage(void);
 static bool parseCommandLine(int argc, char *argv[], Parameters & P);
 static void initRegistration(Registration & R, Parameters & P);
 
+// Gaussian pyramids read from / written to --gpcachedir
+static GaussianPyramidCache gpcache;
+
 static char vcid[] =
     "$Id: mri_robust_register.cpp,v 1.77 2016/01/20 23:36:17 greve Exp $";
 char *Progname = NULL;
@@ -1466,11 +1472,17 @@ static void initRegistration(Registration & R, Parameters & P)
   {
     dynamic_cast<RegRobust*>(&R)->setSaturation(P.sat);
     dynamic_cast<RegRobust*>(&R)->setWLimit(P.wlimit);
+    dynamic_cast<RegRobust*>(&R)->setMatrixFree(P.matrixfree);
   }
   if (R.getClassName() == "RegPowell")
   {
     dynamic_cast<RegPowell*>(&R)->setTolerance(P.powelltol);
   }
+  if (P.gpcachedir != "")
+  {
+    gpcache.setDirectory(P.gpcachedir);
+    R.setPyramidCache(&gpcache);
+  }
 
   int pos = P.lta.rfind(".");
   if (pos > 0)
@@ -2070,6 +2082,21 @@ static int parseNextCommand(int argc, char *argv[], Parameters & P)
         << "--doubleprec: Will perform algorithm with double precision (higher mem usage)!"
         << endl;
   }
+  else if (!strcmp(option, "GPCACHEDIR"))
+  {
+    P.gpcachedir = string(argv[1]);
+    nargs = 1;
+    cout << "--gpcachedir: Will read/write Gaussian pyramids in " << P.gpcachedir
+        << " !" << endl;
+  }
+  else if (!strcmp(option, "MATRIXFREE"))
+  {
+    P.matrixfree = true;
+    nargs = 0;
+    cout
+        << "--matrixfree: Will accumulate normal equations without storing A (lower mem usage)!"
+        << endl;
+  }
   else if (!strcmp(option, "DEBUG"))
   {
     P.debug = 1;
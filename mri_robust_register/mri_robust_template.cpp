@@ -131,6 +131,11 @@ struct Parameters
   bool crascenter;
   int pairiterate;
   double pairepsit;
+  bool matrixfree;
+  int regthreads;
+  double memlimit;
+  bool gpcache;
+  string gpcachedir;
 };
 
 // Initializations:
@@ -138,7 +143,7 @@ static struct Parameters P =
 { vector<string>(0), vector<string>(0), "", vector<string>(0), vector<string>(0), vector<string>(
     0), false, false, false, false, false, false, false, false, false, 5, -1.0, SAT, vector<
     string>(0), 0, 1, -1, false, false, SSAMPLE, false, false, "", false, true,
-    vector<string>(0), vector<string>(0), SAMPLE_CUBIC_BSPLINE, -1, 0 , false, 5, 0.01};
+    vector<string>(0), vector<string>(0), SAMPLE_CUBIC_BSPLINE, -1, 0 , false, 5, 0.01, false, 1, 0.0, false, ""};
 
 static void printUsage(void);
 static bool parseCommandLine(int argc, char *argv[], Parameters & P);
@@ -229,6 +234,12 @@ int main(int argc, char *argv[])
     MR.setKeepType(!P.floattype);
     MR.setAverage(P.average);
     MR.setDoublePrec(P.doubleprec);
+    MR.setMatrixFree(P.matrixfree);
+    MR.setRegThreads(P.regthreads);
+    MR.setMemLimit(P.memlimit);
+    MR.setPyramidCache(P.gpcache);
+    if (P.gpcachedir != "")
+      MR.setPyramidCacheDir(P.gpcachedir);
     MR.setSubsamplesize(P.subsamplesize);
     MR.setHighit(P.highit);
     if (P.nweights.size() > 0)
@@ -671,6 +682,41 @@ static int parseNextCommand(int argc, char *argv[], Parameters & P)
         << "--doubleprec: Will perform algorithm with double precision (higher mem usage)!"
         << endl;
   }
+  else if (!strcmp(option, "REGTHREADS"))
+  {
+    P.regthreads = atoi(argv[1]);
+    nargs = 1;
+    cout << "--regthreads: Will run at most " << P.regthreads
+        << " registrations concurrently!" << endl;
+  }
+  else if (!strcmp(option, "MEMLIMIT"))
+  {
+    P.memlimit = atof(argv[1]);
+    nargs = 1;
+    cout << "--memlimit: Will limit concurrent registrations to about "
+        << P.memlimit << " MB!" << endl;
+  }
+  else if (!strcmp(option, "GPCACHE"))
+  {
+    P.gpcache = true;
+    nargs = 0;
+    cout << "--gpcache: Will share Gaussian pyramids across registrations!" << endl;
+  }
+  else if (!strcmp(option, "GPCACHEDIR"))
+  {
+    P.gpcachedir = string(argv[1]);
+    nargs = 1;
+    cout << "--gpcachedir: Will read/write Gaussian pyramids in " << P.gpcachedir
+        << " !" << endl;
+  }
+  else if (!strcmp(option, "MATRIXFREE"))
+  {
+    P.matrixfree = true;
+    nargs = 0;
+    cout
+        << "--matrixfree: Will accumulate normal equations without storing A (lower mem usage)!"
+        << endl;
+  }
   else if (!strcmp(option, "WEIGHTS"))
   {
     nargs = 0;
@@ -198,6 +198,7 @@ int DoEuler = 0;
 int lheno, rheno;
 int DoAbs = 0;
 int UsePrintSegStat = 1; // use new way to print
+int DoSegStatsAll = 1; // stats of all segs in one pass (MRIsegStatsAll)
 
 int nReplace , SrcReplace[1000], TrgReplace[1000]; // for replacing segs
 
@@ -219,6 +220,8 @@ int main(int argc, char **argv)
   MRI *tmp;
   MATRIX *vox2vox = NULL;
   double *BrainVolStats=NULL;
+  int *segidsall=NULL, *nhitsall=NULL;
+  float *minall=NULL, *maxall=NULL, *rangeall=NULL, *meanall=NULL, *stdall=NULL;
   nhits = 0;
   vol = 0;
 
@@ -779,6 +782,24 @@ int main(int argc, char **argv)
   printf("Computing statistics for each segmentation\n");
   fflush(stdout);
 
+  // Counts (and stats of the input) of all the segmentations in one
+  // pass through the volume instead of one pass per segmentation
+  if (DoSegStatsAll && !dontrun && !mris)
+  {
+    segidsall = (int *) calloc(sizeof(int),nsegid);
+    for (n=0; n < nsegid; n++) segidsall[n] = StatSumTable[n].id;
+    nhitsall = (int *) calloc(sizeof(int),nsegid);
+    minall   = (float *) calloc(sizeof(float),nsegid);
+    maxall   = (float *) calloc(sizeof(float),nsegid);
+    rangeall = (float *) calloc(sizeof(float),nsegid);
+    meanall  = (float *) calloc(sizeof(float),nsegid);
+    stdall   = (float *) calloc(sizeof(float),nsegid);
+    err = MRIsegStatsAll(seg, nsegid, segidsall, (InVolFile != NULL) ? invol : NULL,
+                         frame, UseRobust, RobustPct, nhitsall,
+                         minall, maxall, rangeall, meanall, stdall, NULL);
+    if (err) exit(1);
+  }
+
   DoContinue=0;nx=0;skip=0;n0=0;vol=0;nhits=0;c=0;min=0.0;max=0.0;range=0.0;mean=0.0;std=0.0;snr=0.0;
 
   ROMP_PF_begin
@@ -823,13 +844,15 @@ int main(int argc, char **argv)
       {
         if (pvvol == NULL)
         {
-          nhits = MRIsegCount(seg, StatSumTable[n].id, 0);
+          if (nhitsall) nhits = nhitsall[n];
+          else          nhits = MRIsegCount(seg, StatSumTable[n].id, 0);
           vol = nhits*voxelvolume;
         }
         else
         {
           vol = MRIvoxelsInLabelWithPartialVolumeEffects(seg, pvvol, StatSumTable[n].id, NULL, NULL);
-          nhits = MRIsegCount(seg, StatSumTable[n].id, 0);
+          if (nhitsall) nhits = nhitsall[n];
+          else          nhits = MRIsegCount(seg, StatSumTable[n].id, 0);
 //          nhits = nint(vol/voxelvolume);
         }
       }
@@ -866,7 +889,15 @@ int main(int argc, char **argv)
     {
       if (nhits > 0)
       {
-        if(UseRobust == 0)
+        if(nhitsall)
+        {
+          min   = minall[n];
+          max   = maxall[n];
+          range = rangeall[n];
+          mean  = meanall[n];
+          std   = stdall[n];
+        }
+        else if(UseRobust == 0)
           MRIsegStats(seg, StatSumTable[n].id, invol, frame,
             &min, &max, &range, &mean, &std);
         else
@@ -895,6 +926,16 @@ int main(int argc, char **argv)
     ROMP_PFLB_end
   }
   ROMP_PF_end
+  if (nhitsall)
+  {
+    free(segidsall);
+    free(nhitsall);
+    free(minall);
+    free(maxall);
+    free(rangeall);
+    free(meanall);
+    free(stdall);
+  }
   
   /* print results ordered */
   for (n=0; n < nsegid; n++)
@@ -1371,11 +1412,22 @@ int main(int argc, char **argv)
     for (n=0; n < nsegid; n++)
       favg[n] = (double *) calloc(sizeof(double),invol->nframes);
     favgmn = (double *) calloc(sizeof(double *),nsegid);
+    if (DoSegStatsAll)
+    {
+      // all the waveforms in one pass
+      segidsall = (int *) calloc(sizeof(int),nsegid);
+      for (n=0; n < nsegid; n++) segidsall[n] = StatSumTable[n].id;
+      nhitsall = (int *) calloc(sizeof(int),nsegid);
+      err = MRIsegStatsAll(seg, nsegid, segidsall, invol, 0, 0, 0, nhitsall,
+                           NULL, NULL, NULL, NULL, NULL, favg);
+      if (err) exit(1);
+    }
     for (n=0; n < nsegid; n++) {
       printf("%3d",n);
       if (n%20 == 19) printf("\n");
       fflush(stdout);
-      nvox = MRIsegFrameAvg(seg, StatSumTable[n].id, invol, favg[n]);
+      if (DoSegStatsAll) nvox = nhitsall[n];
+      else nvox = MRIsegFrameAvg(seg, StatSumTable[n].id, invol, favg[n]);
       favgmn[n] = 0.0;
       for(f=0; f < invol->nframes; f++) {
 	if(DoFrameSum) favg[n][f] *= nvox; // Undo spatial average
@@ -1385,6 +1437,11 @@ int main(int argc, char **argv)
       if(RmFrameAvgMn) for(f=0; f < invol->nframes; f++) favg[n][f] -= favgmn[n];
     }
     printf("\n");
+    if (DoSegStatsAll)
+    {
+      free(segidsall);
+      free(nhitsall);
+    }
 
     // Save mean over space and frames in simple text file
     // Each seg on a separate line
@@ -1486,6 +1543,7 @@ static int parse_commandline(int argc, char **argv)
     }
     else if (!strcasecmp(option, "--newprint")) UsePrintSegStat = 1;
     else if (!strcasecmp(option, "--no-newprint")) UsePrintSegStat = 0;
+    else if (!strcasecmp(option, "--seg-by-seg")) DoSegStatsAll = 0;
     else if (!strcasecmp(option, "--dontrun"))
     {
       dontrun = 1;
@@ -2130,6 +2188,7 @@ static void dump_options(FILE *fp)
   fprintf(fp,"user     %s\n",VERuser());
   fprintf(fp,"whitesurfname  %s\n",whitesurfname);
   fprintf(fp,"UseRobust  %d\n",UseRobust);
+  fprintf(fp,"SegStatsAll  %d\n",DoSegStatsAll);
   return;
 }
 /*---------------------------------------------------------------*/
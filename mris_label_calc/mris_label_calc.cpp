@@ -161,6 +161,7 @@ int main(int argc, char *argv[])
 	  string of   = argv[5];
 	  LABEL *l1   = LabelRead(NULL,if1.c_str());
 		MRIS *surf  = MRISread(if2.c_str());
+		LabelIndexVertices(l1,surf->nvertices);
 		if (LabelErode(l1,surf,it) == NO_ERROR)
 		{
 		  l1->subject_name[0]='\0';
@@ -181,6 +182,7 @@ int main(int argc, char *argv[])
 	  string of   = argv[5];
 	  LABEL *l1   = LabelRead(NULL,if1.c_str());
 		MRIS *surf  = MRISread(if2.c_str());
+		LabelIndexVertices(l1,surf->nvertices);
 		if (LabelDilate(l1,surf,it, CURRENT_VERTICES) == NO_ERROR)
 		{
 		  l1->subject_name[0]='\0';
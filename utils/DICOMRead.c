@@ -23,11 +23,13 @@
 
 #include <ctype.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/file.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/timeb.h>
 #include <sys/types.h>
@@ -51,6 +53,7 @@ void *malloc(size_t size);
 #include "macros.h"  // DEGREES
 #include "mosaic.h"
 #include "mri_identify.h"
+#include "romp_support.h"
 
 // #include "affine.h"
 
@@ -60,6 +63,29 @@ void *malloc(size_t size);
 
 static int DCMPrintCond(CONDITION cond);
 void *ReadDICOMImage2(int nfiles, DICOMInfo **aDicomInfo, int startIndex);
+static DCM_OBJECT *dcmGetCachedObject(const char *fname);
+
+/* Parsed headers of the most recently used files, so that the
+   accessors that take a file name (dcmGetNRows(), dcmImagePosition(),
+   IsSiemensDICOM(), ...) do not reparse the file on every call.
+   See dcmGetCachedObject() and dcmHeaderCacheClear(). The load
+   functions (sdcmLoadVolume(), sdcmLoadVolumeAutoScale(),
+   DICOMRead2(), DICOMRead()) clear it before they return. */
+#define DCM_HEADER_CACHE_SIZE 16
+typedef struct
+{
+  char *fname;
+  time_t mtime;
+  off_t size;
+  unsigned long lastuse;
+  DCM_OBJECT *object;
+} DCM_HEADER_CACHE_ENTRY;
+static DCM_HEADER_CACHE_ENTRY dcmHeaderCache[DCM_HEADER_CACHE_SIZE];
+static unsigned long dcmHeaderCacheClock = 0;
+
+/* Bytes of each file read by dcmPrefetchFiles(): enough for the
+   header of a typical (Siemens) DICOM file */
+#define DCM_PREFETCH_BYTES 65536
 
 static BOOL IsTagPresent[NUMBEROFTAGS];
 static int sliceDirCosPresent;
@@ -134,11 +160,13 @@ MRI *sdcmLoadVolume(const char *dcmfile, int LoadVolume, int nthonly)
 
   if (SeriesList == NULL) {
     fprintf(stderr, "ERROR: could not find any files (SeriesList==NULL)\n");
+    dcmHeaderCacheClear();
     return (NULL);
   }
 
   if (nlist == 0) {
     fprintf(stderr, "ERROR: could not find any files (nlist==0)\n");
+    dcmHeaderCacheClear();
     return (NULL);
   }
 
@@ -214,6 +242,7 @@ MRI *sdcmLoadVolume(const char *dcmfile, int LoadVolume, int nthonly)
     if (nthonly > nframes - 1) {
       printf("ERROR: only has %d frames (%d - %d) but called for %d\n", nframes, 0, nframes - 1, nthonly);
       fflush(stdout);
+      dcmHeaderCacheClear();
       return (NULL);
     }
   }
@@ -243,6 +272,7 @@ MRI *sdcmLoadVolume(const char *dcmfile, int LoadVolume, int nthonly)
     if (vol == NULL) {
       fprintf(stderr, "ERROR: could not alloc MRI volume\n");
       fflush(stderr);
+      dcmHeaderCacheClear();
       return (NULL);
     }
   }
@@ -251,6 +281,7 @@ MRI *sdcmLoadVolume(const char *dcmfile, int LoadVolume, int nthonly)
     if (vol == NULL) {
       fprintf(stderr, "ERROR: could not alloc MRI header \n");
       fflush(stderr);
+      dcmHeaderCacheClear();
       return (NULL);
     }
   }
@@ -318,6 +349,7 @@ MRI *sdcmLoadVolume(const char *dcmfile, int LoadVolume, int nthonly)
     /* restore progress range */
     global_progress_range[0] = nstart;
     global_progress_range[1] = nend;
+    dcmHeaderCacheClear();
     return (vol);
   }
 
@@ -564,6 +596,7 @@ MRI *sdcmLoadVolume(const char *dcmfile, int LoadVolume, int nthonly)
 
   FSENVfree(&env);
 
+  dcmHeaderCacheClear();
   return (vol);
 }
 
@@ -619,11 +652,13 @@ MRI *sdcmLoadVolumeAutoScale(const char *dcmfile, int LoadVolume, int nthonly)
 
   if (SeriesList == NULL) {
     fprintf(stderr, "ERROR: could not find any files (SeriesList==NULL)\n");
+    dcmHeaderCacheClear();
     return (NULL);
   }
 
   if (nlist == 0) {
     fprintf(stderr, "ERROR: could not find any files (nlist==0)\n");
+    dcmHeaderCacheClear();
     return (NULL);
   }
 
@@ -705,6 +740,7 @@ MRI *sdcmLoadVolumeAutoScale(const char *dcmfile, int LoadVolume, int nthonly)
     if (nthonly > nframes - 1) {
       printf("ERROR: only has %d frames (%d - %d) but called for %d\n", nframes, 0, nframes - 1, nthonly);
       fflush(stdout);
+      dcmHeaderCacheClear();
       return (NULL);
     }
   }
@@ -723,6 +759,7 @@ MRI *sdcmLoadVolumeAutoScale(const char *dcmfile, int LoadVolume, int nthonly)
     if (vol == NULL) {
       fprintf(stderr, "ERROR: could not alloc MRI volume\n");
       fflush(stderr);
+      dcmHeaderCacheClear();
       return (NULL);
     }
   }
@@ -731,6 +768,7 @@ MRI *sdcmLoadVolumeAutoScale(const char *dcmfile, int LoadVolume, int nthonly)
     if (vol == NULL) {
       fprintf(stderr, "ERROR: could not alloc MRI header \n");
       fflush(stderr);
+      dcmHeaderCacheClear();
       return (NULL);
     }
   }
@@ -865,6 +903,7 @@ MRI *sdcmLoadVolumeAutoScale(const char *dcmfile, int LoadVolume, int nthonly)
     /* restore progress range */
     global_progress_range[0] = nstart;
     global_progress_range[1] = nend;
+    dcmHeaderCacheClear();
     return (vol);
   }
 
@@ -1062,6 +1101,7 @@ MRI *sdcmLoadVolumeAutoScale(const char *dcmfile, int LoadVolume, int nthonly)
   global_progress_range[0] = nstart;
   global_progress_range[1] = nend;
 
+  dcmHeaderCacheClear();
   return (vol);
 }
 
@@ -1120,7 +1160,9 @@ MATRIX *sdcmAutoAlignMatrix(const char *dcmfile)
 
 /*---------------------------------------------------------------
   GetElementFromFile() - gets an element from a DICOM file. Returns
-  a pointer to the object (or NULL upon failure).
+  a pointer to the object (or NULL upon failure). The parsed header
+  is kept in a cache, so getting several elements from the same
+  file only parses it once.
   Author: Douglas Greve 9/6/2001
   ---------------------------------------------------------------*/
 DCM_ELEMENT *GetElementFromFile(const char *dicomfile, long grpid, long elid)
@@ -1134,7 +1176,8 @@ DCM_ELEMENT *GetElementFromFile(const char *dicomfile, long grpid, long elid)
 
   element = (DCM_ELEMENT *)calloc(1, sizeof(DCM_ELEMENT));
 
-  object = GetObjectFromFile(dicomfile, 0);
+  // the object is owned by the header cache, do not close it
+  object = dcmGetCachedObject(dicomfile);
   if (object == NULL) {
     exit(1);
   }
@@ -1142,7 +1185,6 @@ DCM_ELEMENT *GetElementFromFile(const char *dicomfile, long grpid, long elid)
   tag = DCM_MAKETAG(grpid, elid);
   cond = DCM_GetElement(&object, tag, element);
   if (cond != DCM_NORMAL) {
-    DCM_CloseObject(&object);
     free(element);
     return (NULL);
   }
@@ -1150,12 +1192,10 @@ DCM_ELEMENT *GetElementFromFile(const char *dicomfile, long grpid, long elid)
   cond = DCM_GetElementValue(&object, element, &rtnLength, &Ctx);
   /* Does Ctx have to be freed? */
   if (cond != DCM_NORMAL) {
-    DCM_CloseObject(&object);
     FreeElementData(element);
     free(element);
     return (NULL);
   }
-  DCM_CloseObject(&object);
 
   COND_PopCondition(1); /********************************/
 
@@ -1205,6 +1245,129 @@ DCM_OBJECT *GetObjectFromFile(const char *fname, unsigned long options)
 
   return (object);
 }
+/*---------------------------------------------------------------
+  dcmGetCachedObject() - returns the parsed header of a DICOM file
+  from the header cache, parsing the file (GetObjectFromFile()) if it
+  is not in the cache or has been modified since it was parsed. The
+  least recently used entry is replaced. The object is owned by the
+  cache: do not close it. Returns NULL upon failure, including when
+  the file cannot be stat'ed (an object that is not in the cache would
+  never be closed). Like the rest of the DICOM code, this is not thread
+  safe.
+  ---------------------------------------------------------------*/
+static DCM_OBJECT *dcmGetCachedObject(const char *fname)
+{
+  struct stat st;
+  int n, nuse;
+
+  if (stat(fname, &st) != 0) {
+    fprintf(stderr, "ERROR: cannot stat %s\n", fname);
+    return (NULL);
+  }
+
+  nuse = 0;
+  for (n = 0; n < DCM_HEADER_CACHE_SIZE; n++) {
+    if (dcmHeaderCache[n].object == NULL) {
+      nuse = n;
+      continue;
+    }
+    if (strcmp(dcmHeaderCache[n].fname, fname) == 0) {
+      if (dcmHeaderCache[n].mtime == st.st_mtime && dcmHeaderCache[n].size == st.st_size) {
+        dcmHeaderCache[n].lastuse = ++dcmHeaderCacheClock;
+        return (dcmHeaderCache[n].object);
+      }
+      nuse = n;  // file changed, reparse into this entry
+      break;
+    }
+    if (dcmHeaderCache[nuse].object != NULL && dcmHeaderCache[n].lastuse < dcmHeaderCache[nuse].lastuse) {
+      nuse = n;
+    }
+  }
+
+  if (dcmHeaderCache[nuse].object != NULL) {
+    DCM_CloseObject(&dcmHeaderCache[nuse].object);
+    free(dcmHeaderCache[nuse].fname);
+    dcmHeaderCache[nuse].object = NULL;
+    dcmHeaderCache[nuse].fname = NULL;
+  }
+
+  dcmHeaderCache[nuse].object = GetObjectFromFile(fname, 0);
+  if (dcmHeaderCache[nuse].object == NULL) {
+    return (NULL);
+  }
+  dcmHeaderCache[nuse].fname = strcpyalloc(fname);
+  dcmHeaderCache[nuse].mtime = st.st_mtime;
+  dcmHeaderCache[nuse].size = st.st_size;
+  dcmHeaderCache[nuse].lastuse = ++dcmHeaderCacheClock;
+
+  return (dcmHeaderCache[nuse].object);
+}
+/*---------------------------------------------------------------
+  dcmHeaderCacheClear() - closes all the objects in the header cache
+  (see GetElementFromFile()), which also closes the files that they
+  keep open for reading the pixel data.
+  ---------------------------------------------------------------*/
+int dcmHeaderCacheClear(void)
+{
+  int n;
+
+  for (n = 0; n < DCM_HEADER_CACHE_SIZE; n++) {
+    if (dcmHeaderCache[n].object == NULL) {
+      continue;
+    }
+    DCM_CloseObject(&dcmHeaderCache[n].object);
+    free(dcmHeaderCache[n].fname);
+    dcmHeaderCache[n].object = NULL;
+    dcmHeaderCache[n].fname = NULL;
+  }
+  COND_PopCondition(1);
+
+  return (0);
+}
+/*---------------------------------------------------------------
+  dcmPrefetchFiles() - reads the first DCM_PREFETCH_BYTES of the given
+  files concurrently so that their headers are in the file system
+  cache when they are parsed. The parsing itself stays serial (the
+  DICOM library is not thread safe), but the latency of network file
+  systems is hidden when scanning a series of thousands of files.
+  Only the header block is read, because the scanned directory
+  often holds other series whose pixel data is never used. Files
+  that cannot be read are ignored. Setenv
+  FS_DCM_PREFETCH 0 to turn it off. Returns the number of files read.
+  ---------------------------------------------------------------*/
+int dcmPrefetchFiles(char **FileNames, int nfiles)
+{
+  int n, nread = 0;
+  char *pc;
+
+  pc = getenv("FS_DCM_PREFETCH");
+  if (pc != NULL && strcmp(pc, "0") == 0) {
+    return (0);
+  }
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 8) reduction(+ : nread)
+#endif
+  for (n = 0; n < nfiles; n++) {
+    ROMP_PFLB_begin
+    char buf[DCM_PREFETCH_BYTES];
+    int fd;
+
+    fd = open(FileNames[n], O_RDONLY);
+    if (fd < 0) {
+      ROMP_PFLB_continue;
+    }
+    if (read(fd, buf, sizeof(buf)) > 0) {
+      nread++;
+    }
+    close(fd);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  return (nread);
+}
 /*-------------------------------------------------------------------
   AllocElementData() - allocates memory for the data portion of
   the element structure. Returns 1 if there's an error (otherwise 0).
@@ -2280,7 +2443,8 @@ SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
 
   fflush(stdout);
   fflush(stderr);
-  object = GetObjectFromFile(dcmfile, 0);
+  // owned by the header cache (already parsed by IsSiemensDICOM())
+  object = dcmGetCachedObject(dcmfile);
   fflush(stdout);
   fflush(stderr);
   if (object == NULL) {
@@ -2572,8 +2736,6 @@ SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
   // cleanup Ascii storage
   SiemensAsciiTagEx(dcmfile, (char *)0, 1);
 
-  cond = DCM_CloseObject(&object);
-
   /* Clear the condition stack to prevent overflow */
   COND_PopCondition(1);
 
@@ -2759,6 +2921,7 @@ SDCMFILEINFO **ScanSiemensDCMDir(const char *PathName, int *NSDCMFiles)
   int i, pathlength;
   int NFiles;
   char tmpstr[1000];
+  char **FileNames;
   SDCMFILEINFO **sdcmfi_list;
   int pct, sumpct;
   FILE *fp;
@@ -2788,24 +2951,17 @@ SDCMFILEINFO **ScanSiemensDCMDir(const char *PathName, int *NSDCMFiles)
   }
   fprintf(stderr, "INFO: Found %d files in %s\n", NFiles, pname);
 
-  /* Count the number of Siemens DICOM Files */
-  fprintf(stderr, "INFO: counting Siemens Files\n");
-  (*NSDCMFiles) = 0;
+  /* Read the files concurrently into the file system cache */
+  FileNames = (char **)calloc(NFiles, sizeof(char *));
   for (i = 0; i < NFiles; i++) {
     sprintf(tmpstr, "%s/%s", pname, NameList[i]->d_name);
-    if (IsSiemensDICOM(tmpstr)) {
-      (*NSDCMFiles)++;
-    }
-  }
-
-  fprintf(stderr, "INFO: found %d Siemens Files\n", *NSDCMFiles);
-
-  if (*NSDCMFiles == 0) {
-    free(pname);
-    return (NULL);
+    FileNames[i] = strcpyalloc(tmpstr);
   }
+  dcmPrefetchFiles(FileNames, NFiles);
 
-  sdcmfi_list = (SDCMFILEINFO **)calloc(*NSDCMFiles, sizeof(SDCMFILEINFO *));
+  /* Siemens DICOM Files are counted while scanning (each file
+     is only parsed once), the list is shrunk afterwards */
+  sdcmfi_list = (SDCMFILEINFO **)calloc(NFiles, sizeof(SDCMFILEINFO *));
 
   fprintf(stderr, "INFO: scanning info from Siemens Files\n");
 
@@ -2832,25 +2988,42 @@ SDCMFILEINFO **ScanSiemensDCMDir(const char *PathName, int *NSDCMFiles)
       }
     }
 
-    sprintf(tmpstr, "%s/%s", pname, NameList[i]->d_name);
-    if (IsSiemensDICOM(tmpstr)) {
-      sdcmfi_list[*NSDCMFiles] = GetSDCMFileInfo(tmpstr);
+    if (IsSiemensDICOM(FileNames[i])) {
+      sdcmfi_list[*NSDCMFiles] = GetSDCMFileInfo(FileNames[i]);
       if (sdcmfi_list[*NSDCMFiles] == NULL) {
-        return (NULL);
+        // free the entries read so far, the list is freed below
+        while (*NSDCMFiles > 0) {
+          (*NSDCMFiles)--;
+          FreeSDCMFileInfo(&sdcmfi_list[*NSDCMFiles]);
+        }
+        break;
       }
       (*NSDCMFiles)++;
     }
   }
   fprintf(stderr, "\n");
+  dcmHeaderCacheClear();
+
+  if (i == NFiles) {
+    fprintf(stderr, "INFO: found %d Siemens Files\n", *NSDCMFiles);
+  }
 
   // free memory
   while (NFiles--) {
     free(NameList[NFiles]);
+    free(FileNames[NFiles]);
   }
   free(NameList);
+  free(FileNames);
 
   free(pname);
 
+  if (*NSDCMFiles == 0) {
+    free(sdcmfi_list);
+    return (NULL);
+  }
+  sdcmfi_list = (SDCMFILEINFO **)realloc(sdcmfi_list, (*NSDCMFiles) * sizeof(SDCMFILEINFO *));
+
   return (sdcmfi_list);
 }
 /*--------------------------------------------------------------------
@@ -2869,6 +3042,8 @@ SDCMFILEINFO **LoadSiemensSeriesInfo(char **SeriesList, int nList)
 
   sdfi_list = (SDCMFILEINFO **)calloc(nList, sizeof(SDCMFILEINFO *));
 
+  dcmPrefetchFiles(SeriesList, nList);
+
   for (n = 0; n < nList; n++) {
     fflush(stdout);
     fflush(stderr);
@@ -2878,6 +3053,7 @@ SDCMFILEINFO **LoadSiemensSeriesInfo(char **SeriesList, int nList)
       fprintf(stderr, "ERROR: %s is not a Siemens DICOM File\n", SeriesList[n]);
       fflush(stderr);
       free(sdfi_list);
+      dcmHeaderCacheClear();
       return (NULL);
     }
 
@@ -2889,10 +3065,12 @@ SDCMFILEINFO **LoadSiemensSeriesInfo(char **SeriesList, int nList)
       fprintf(stderr, "ERROR: reading %s \n", SeriesList[n]);
       fflush(stderr);
       free(sdfi_list);
+      dcmHeaderCacheClear();
       return (NULL);
     }
     exec_progress_callback(n, nList, 0, 1);
   }
+  dcmHeaderCacheClear();
   fprintf(stderr, "\n");
   fflush(stdout);
   fflush(stderr);
@@ -5432,6 +5610,7 @@ MRI *DICOMRead2(const char *dcmfile, int LoadVolume)
   if (RefDCMInfo.BitsAllocated != 16 && RefDCMInfo.BitsAllocated != 8) {
     printf("ERROR: bits = %d not supported.\n", RefDCMInfo.BitsAllocated);
     printf("Send email to freesurfer@nmr.mgh.harvard.edu\n");
+    dcmHeaderCacheClear();
     return (NULL);
   }
 
@@ -5529,6 +5708,7 @@ MRI *DICOMRead2(const char *dcmfile, int LoadVolume)
       printf(
           "ERROR: the number of frames * number of slices does\n"
           "not equal the number of dicom files.\n");
+      dcmHeaderCacheClear();
       return (NULL);
     }
   }
@@ -5550,6 +5730,7 @@ MRI *DICOMRead2(const char *dcmfile, int LoadVolume)
   }
   if (mri == NULL) {
     printf("ERROR: mri alloc failed\n");
+    dcmHeaderCacheClear();
     return (NULL);
   }
 
@@ -5656,6 +5837,7 @@ MRI *DICOMRead2(const char *dcmfile, int LoadVolume)
       free(dcminfo[nthfile]);
     }
     free(dcminfo);
+    dcmHeaderCacheClear();
     return (mri);
   }
 
@@ -5754,6 +5936,7 @@ MRI *DICOMRead2(const char *dcmfile, int LoadVolume)
 
   FSENVfree(&env);
 
+  dcmHeaderCacheClear();
   return (mri);
 }
 
@@ -6577,6 +6760,7 @@ int DICOMRead(const char *FileName, MRI **mri, int ReadImage)
 
   *mri = pmri;
 
+  dcmHeaderCacheClear();
   return 0;
 }
 
@@ -330,6 +330,82 @@ int fwriteDouble(double d, FILE *fp)
   return (fwrite(&d, sizeof(double), 1, fp));
 }
 
+/*------ bulk routines -------------*/
+/* Read/write blocks of 4-byte big-endian values with a single
+  fread/fwrite instead of one call per value. The swap loop below is
+  plain enough for the compiler to vectorize it.
+*/
+#define FIO_BULK_CHUNK 4096
+
+static void fioSwap4(void *buf, size_t n)
+{
+  unsigned char *p = (unsigned char *)buf;
+  size_t i;
+  unsigned char c0, c1;
+
+  for (i = 0; i < n; i++, p += 4) {
+    c0 = p[0];
+    c1 = p[1];
+    p[0] = p[3];
+    p[1] = p[2];
+    p[2] = c1;
+    p[3] = c0;
+  }
+}
+
+static size_t fioRead4Array(void *v, size_t n, FILE *fp)
+{
+  size_t nread;
+
+  nread = fread(v, 4, n, fp);
+  if (nread != n) ErrorPrintf(ERROR_BADFILE, "fioRead4Array: read %ld of %ld values", (long)nread, (long)n);
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+  fioSwap4(v, nread);
+#endif
+  return (nread);
+}
+
+static size_t fioWrite4Array(const void *v, size_t n, FILE *fp)
+{
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+  // swap through a small buffer so the caller's data is left untouched
+  unsigned char buf[4 * FIO_BULK_CHUNK];
+  const unsigned char *p = (const unsigned char *)v;
+  size_t nwritten = 0, nchunk, ret;
+
+  while (nwritten < n) {
+    nchunk = n - nwritten;
+    if (nchunk > FIO_BULK_CHUNK) nchunk = FIO_BULK_CHUNK;
+    memcpy(buf, p + 4 * nwritten, 4 * nchunk);
+    fioSwap4(buf, nchunk);
+    ret = fwrite(buf, 4, nchunk, fp);
+    nwritten += ret;
+    if (ret != nchunk) break;
+  }
+  return (nwritten);
+#else
+  return (fwrite(v, 4, n, fp));
+#endif
+}
+
+/* return the number of values read/written */
+size_t freadFloatArray(float *v, size_t n, FILE *fp)
+{
+  return (fioRead4Array(v, n, fp));
+}
+size_t freadIntArray(int *v, size_t n, FILE *fp)
+{
+  return (fioRead4Array(v, n, fp));
+}
+size_t fwriteFloatArray(const float *v, size_t n, FILE *fp)
+{
+  return (fioWrite4Array(v, n, fp));
+}
+size_t fwriteIntArray(const int *v, size_t n, FILE *fp)
+{
+  return (fioWrite4Array(v, n, fp));
+}
+
 /*------ znzlib support ------------*/
 /* Note: an mgz file has a variable number of fields that get written at the
   end of the file. The reader keeps reading until it gets an EOF at which
@@ -49,6 +49,7 @@ double round(double x);
 #include "numerics.h"
 #include "pdf.h"
 #include "randomfields.h"
+#include "romp_support.h"
 #include "sig.h"
 #include "utils.h"
 #include "volcluster.h"
@@ -905,6 +906,10 @@ MRI *MRInormWeights(MRI *w, int sqrtFlag, int invFlag, MRI *mask, MRI *wn)
   return (wn);
 }
 
+#define MRIGLM_BATCH_SIZE 256
+
+static int MRIglmFitAndTestBatch(MRIGLM *mriglm);
+
 /*---------------------------------------------------------------------
   MRIglmFitAndTest() - fits and tests glm on a voxel-by-voxel basis.
   There are also two other related functions, MRIglmFit() and
@@ -986,6 +991,11 @@ int MRIglmFitAndTest(MRIGLM *mriglm)
     }
   }
 
+  // With the same X at every voxel, fit many voxels at a time
+  if (!mriglm->pervoxflag && mriglm->wg == NULL && mriglm->yffxvar == NULL && !mriglm->glm->DoPCC &&
+      !mriglm->glm->ill_cond_flag && getenv("FS_GLM_NOBATCH") == NULL)
+    return (MRIglmFitAndTestBatch(mriglm));
+
   //--------------------------------------------
   pctdone = 0;
   nthvox = 0;
@@ -1060,6 +1070,115 @@ int MRIglmFitAndTest(MRIGLM *mriglm)
   return (0);
 }
 
+/*---------------------------------------------------------------------
+  MRIglmFitAndTestBatch() - the voxel loop of MRIglmFitAndTest() for
+  when X is the same at every voxel (no weights, per-voxel regressors,
+  frame mask or ffx variance) and pcc is not wanted. The masked voxels
+  are packed MRIGLM_BATCH_SIZE at a time into the columns of one y
+  matrix and fit and tested together with GLMfitAndTestBatch(), with
+  the batches spread over threads. Only the position of the first voxel
+  of each batch is kept; each batch finds the rest by scanning the mask
+  from there. The outputs are the same as those of the voxel-by-voxel
+  loop. Set FS_GLM_NOBATCH to use that loop.
+  --------------------------------------------------------------------*/
+static int MRIglmFitAndTestBatch(MRIGLM *mriglm)
+{
+  GLMMAT *glm = mriglm->glm;
+  int c, r, s, nc, nr, ns, nvox, nbatches, batch;
+  long *batchstart;
+  float Xcond = 0;
+
+  nc = mriglm->y->width;
+  nr = mriglm->y->height;
+  ns = mriglm->y->depth;
+
+  // Index (c*nr+r)*ns+s of the first voxel of each batch, visiting the
+  // masked voxels in the order the voxel-by-voxel loop does
+  nbatches = ((long)nc * nr * ns + MRIGLM_BATCH_SIZE - 1) / MRIGLM_BATCH_SIZE;
+  batchstart = (long *)calloc(MAX(nbatches, 1), sizeof(long));
+  if (batchstart == NULL) {
+    printf("ERROR: MRIglmFitAndTestBatch(): could not alloc %d batches\n", nbatches);
+    return (1);
+  }
+  nvox = 0;
+  for (c = 0; c < nc; c++) {
+    for (r = 0; r < nr; r++) {
+      for (s = 0; s < ns; s++) {
+        if (mriglm->mask != NULL && MRIgetVoxVal(mriglm->mask, c, r, s, 0) < 0.5) continue;
+        if (nvox % MRIGLM_BATCH_SIZE == 0) batchstart[nvox / MRIGLM_BATCH_SIZE] = ((long)c * nr + r) * ns + s;
+        nvox++;
+      }
+    }
+  }
+
+  // X is the same everywhere, so is its condition
+  if (mriglm->condsave) Xcond = MatrixConditionNumber(glm->XtX);
+
+  nbatches = (nvox + MRIGLM_BATCH_SIZE - 1) / MRIGLM_BATCH_SIZE;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 1)
+#endif
+  for (batch = 0; batch < nbatches; batch++) {
+    ROMP_PFLB_begin
+    int first, n, j, f, k, cc, rr, ss;
+    int vox[3 * MRIGLM_BATCH_SIZE];
+    long index;
+    GLMBATCH *gb;
+
+    first = batch * MRIGLM_BATCH_SIZE;
+    n = MIN(MRIGLM_BATCH_SIZE, nvox - first);
+    gb = GLMbatchAlloc(glm, n);
+
+    for (j = 0, index = batchstart[batch]; j < n; index++) {
+      cc = index / ((long)nr * ns);
+      rr = (index / ns) % nr;
+      ss = index % ns;
+      if (mriglm->mask != NULL && MRIgetVoxVal(mriglm->mask, cc, rr, ss, 0) < 0.5) continue;
+      vox[3 * j] = cc;
+      vox[3 * j + 1] = rr;
+      vox[3 * j + 2] = ss;
+      for (f = 0; f < mriglm->y->nframes; f++) gb->y->rptr[f + 1][j + 1] = MRIgetVoxVal(mriglm->y, cc, rr, ss, f);
+      j++;
+    }
+
+    GLMfitAndTestBatch(glm, gb);
+
+    // Pack data back into MRI
+    for (j = 0; j < n; j++) {
+      cc = vox[3 * j];
+      rr = vox[3 * j + 1];
+      ss = vox[3 * j + 2];
+      if (mriglm->condsave) MRIsetVoxVal(mriglm->cond, cc, rr, ss, 0, Xcond);
+      MRIsetVoxVal(mriglm->rvar, cc, rr, ss, 0, gb->rvar[j]);
+      for (f = 0; f < gb->beta->rows; f++) MRIsetVoxVal(mriglm->beta, cc, rr, ss, f, gb->beta->rptr[f + 1][j + 1]);
+      for (f = 0; f < gb->eres->rows; f++) MRIsetVoxVal(mriglm->eres, cc, rr, ss, f, gb->eres->rptr[f + 1][j + 1]);
+      if (mriglm->yhatsave)
+        for (f = 0; f < gb->yhat->rows; f++) MRIsetVoxVal(mriglm->yhat, cc, rr, ss, f, gb->yhat->rptr[f + 1][j + 1]);
+      for (k = 0; k < glm->ncontrasts; k++) {
+        for (f = 0; f < gb->gamma[k]->rows; f++)
+          MRIsetVoxVal(mriglm->gamma[k], cc, rr, ss, f, gb->gamma[k]->rptr[f + 1][j + 1]);
+        if (glm->C[k]->rows == 1) MRIsetVoxVal(mriglm->gammaVar[k], cc, rr, ss, 0, gb->gammaVar[k][j]);
+        MRIsetVoxVal(mriglm->F[k], cc, rr, ss, 0, gb->F[k][j]);
+        MRIsetVoxVal(mriglm->p[k], cc, rr, ss, 0, gb->p[k][j]);
+        MRIsetVoxVal(mriglm->z[k], cc, rr, ss, 0, gb->z[k][j]);
+        // as in MRIfromMatrix(), which skips a pmf that does not fit
+        if (glm->ypmfflag[k] && gb->ypmf[k]->rows == mriglm->ypmf[k]->nframes)
+          for (f = 0; f < gb->ypmf[k]->rows; f++)
+            MRIsetVoxVal(mriglm->ypmf[k], cc, rr, ss, f, gb->ypmf[k]->rptr[f + 1][j + 1]);
+      }
+    }
+
+    GLMbatchFree(&gb);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  free(batchstart);
+  mriglm->n_ill_cond = 0;
+  return (0);
+}
+
 /*---------------------------------------------------------------------
   MRIglmFit() - fits glm (beta and rvar) on a voxel-by-voxel basis.
   Made to be followed by MRIglmTest(). See notes on MRIglmFitandTest()
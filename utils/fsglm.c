@@ -890,3 +890,185 @@ MATRIX *GLMpmfMatrix(MATRIX *C, double *cond, MATRIX *P)
 
   return (P);
 }
+
+/*--------------------------------------------------------------------
+  GLMbatchAlloc() - allocates a batch of nvox y's for the given GLM,
+  which must have X, its contrasts, GLMcMatrices() and GLMxMatrices()
+  already done. inv(C*inv(X'*X)*C') is computed here since it is the
+  same for every y.
+  ------------------------------------------------------------------*/
+GLMBATCH *GLMbatchAlloc(GLMMAT *glm, int nvox)
+{
+  GLMBATCH *gb;
+  int n, nrows, ncols, J;
+
+  nrows = glm->X->rows;
+  ncols = glm->X->cols;
+
+  gb = (GLMBATCH *)calloc(sizeof(GLMBATCH), 1);
+  gb->nvox = nvox;
+  gb->y = MatrixAlloc(nrows, nvox, MATRIX_REAL);
+  gb->Xty = MatrixAlloc(ncols, nvox, MATRIX_REAL);
+  gb->beta = MatrixAlloc(ncols, nvox, MATRIX_REAL);
+  gb->yhat = MatrixAlloc(nrows, nvox, MATRIX_REAL);
+  gb->eres = MatrixAlloc(nrows, nvox, MATRIX_REAL);
+  gb->rvar = (double *)calloc(sizeof(double), nvox);
+  for (n = 0; n < glm->ncontrasts; n++) {
+    J = glm->C[n]->rows;
+    gb->iCiXtXCt[n] = MatrixInverse(glm->CiXtXCt[n], NULL);
+    gb->gamma[n] = MatrixAlloc(J, nvox, MATRIX_REAL);
+    if (J == 1) gb->gammaVar[n] = (double *)calloc(sizeof(double), nvox);
+    gb->F[n] = (double *)calloc(sizeof(double), nvox);
+    gb->p[n] = (double *)calloc(sizeof(double), nvox);
+    gb->z[n] = (double *)calloc(sizeof(double), nvox);
+    if (glm->ypmfflag[n]) gb->ypmf[n] = MatrixAlloc(glm->Mpmf[n]->rows, nvox, MATRIX_REAL);
+  }
+  return (gb);
+}
+
+/*--------------------------------------------------------------------
+  GLMbatchFree() - frees a batch allocated with GLMbatchAlloc()
+  ------------------------------------------------------------------*/
+int GLMbatchFree(GLMBATCH **pgb)
+{
+  GLMBATCH *gb = *pgb;
+  int n;
+
+  if (gb == NULL) return (0);
+  MatrixFree(&gb->y);
+  MatrixFree(&gb->Xty);
+  MatrixFree(&gb->beta);
+  MatrixFree(&gb->yhat);
+  MatrixFree(&gb->eres);
+  free(gb->rvar);
+  for (n = 0; n < GLMMAT_NCONTRASTS_MAX; n++) {
+    if (gb->iCiXtXCt[n]) MatrixFree(&gb->iCiXtXCt[n]);
+    if (gb->gamma[n]) MatrixFree(&gb->gamma[n]);
+    if (gb->ypmf[n]) MatrixFree(&gb->ypmf[n]);
+    free(gb->gammaVar[n]);
+    free(gb->F[n]);
+    free(gb->p[n]);
+    free(gb->z[n]);
+  }
+  free(gb);
+  *pgb = NULL;
+  return (0);
+}
+
+/*--------------------------------------------------------------------
+  GLMmultiplyBatch() - m3 = m1*m2 for a wide m2. Each element is summed
+  in double in the same order as MatrixMultiplyD(), so the result is
+  identical, but the inner loop runs along the rows of m2 and m3.
+  acc must have room for m2->cols doubles.
+  ------------------------------------------------------------------*/
+static MATRIX *GLMmultiplyBatch(const MATRIX *m1, const MATRIX *m2, MATRIX *m3, double *acc)
+{
+  int row, col, i, cols = m2->cols;
+  const float *r2;
+  float *r3;
+  double a;
+
+  for (row = 1; row <= m1->rows; row++) {
+    for (col = 0; col < cols; col++) acc[col] = 0.0;
+    for (i = 1; i <= m1->cols; i++) {
+      a = m1->rptr[row][i];
+      r2 = &m2->rptr[i][1];
+      for (col = 0; col < cols; col++) acc[col] += a * r2[col];
+    }
+    r3 = &m3->rptr[row][1];
+    for (col = 0; col < cols; col++) r3[col] = acc[col];
+  }
+  return (m3);
+}
+
+/*------------------------------------------------------------------------
+  GLMfitAndTestBatch() - GLMfit() and GLMtest() for every column of gb->y
+  at once, using the X matrices already in glm, which must not be
+  ill-conditioned. The large products are done once for the whole batch
+  instead of once per y; each column gets the same values GLMfit() and
+  GLMtest() would give it. Partial correlation and fixed-effects tests
+  are not done here. Does not change glm, so several threads can each
+  run their own batch against the same glm.
+  ------------------------------------------------------------------------*/
+int GLMfitAndTestBatch(GLMMAT *glm, GLMBATCH *gb)
+{
+  int n, f, v, r, c, J, nvox = gb->nvox;
+  double *acc, dtmp, dsum, Fdsum;
+  float e, rvarscale, igCVM, *gtig, *gammaval;
+
+  if (glm->ill_cond_flag) return (1);
+
+  J = 1;
+  for (n = 0; n < glm->ncontrasts; n++)
+    if (glm->C[n]->rows > J) J = glm->C[n]->rows;
+  acc = (double *)calloc(sizeof(double), nvox);
+  gtig = (float *)calloc(sizeof(float), J);
+  gammaval = (float *)calloc(sizeof(float), J);
+
+  // beta = inv(X'*X)*X'*y, yhat = X*beta, eres = y - yhat
+  GLMmultiplyBatch(glm->Xt, gb->y, gb->Xty, acc);
+  GLMmultiplyBatch(glm->iXtX, gb->Xty, gb->beta, acc);
+  GLMmultiplyBatch(glm->X, gb->beta, gb->yhat, acc);
+  MatrixSubtract(gb->y, gb->yhat, gb->eres);
+
+  for (v = 0; v < nvox; v++) gb->rvar[v] = 0;
+  for (f = 1; f <= gb->eres->rows; f++) {
+    for (v = 0; v < nvox; v++) {
+      e = gb->eres->rptr[f][v + 1];
+      gb->rvar[v] += (e * e);
+    }
+  }
+  for (v = 0; v < nvox; v++) {
+    gb->rvar[v] /= glm->dof;
+    if (gb->rvar[v] < FLT_MIN) gb->rvar[v] = FLT_MIN;
+  }
+
+  for (n = 0; n < glm->ncontrasts; n++) {
+    J = glm->C[n]->rows;
+    GLMmultiplyBatch(glm->C[n], gb->beta, gb->gamma[n], acc);
+    if (glm->UseGamma0[n])
+      for (r = 1; r <= J; r++)
+        for (v = 1; v <= nvox; v++) gb->gamma[n]->rptr[r][v] -= glm->gamma0[n]->rptr[r][1];
+    if (glm->ypmfflag[n]) GLMmultiplyBatch(glm->Mpmf[n], gb->beta, gb->ypmf[n], acc);
+
+    for (v = 0; v < nvox; v++) {
+      // Error trap for when rvar==0, as in GLMtest()
+      if (gb->rvar[v] < 2 * FLT_MIN)
+        dtmp = 1e10 * J;
+      else
+        dtmp = gb->rvar[v] * J;
+      if (J == 1) gb->gammaVar[n][v] = glm->CiXtXCt[n]->rptr[1][1] * (float)dtmp;
+
+      if (gb->iCiXtXCt[n] == NULL || gb->rvar[v] <= FLT_MIN) {
+        gb->F[n][v] = 0;
+        gb->p[n][v] = 1;
+        gb->z[n][v] = 0;
+        continue;
+      }
+
+      // F = gamma' * inv(gCVM) * gamma, with the roundings of GLMtest()
+      for (r = 0; r < J; r++) gammaval[r] = gb->gamma[n]->rptr[r + 1][v + 1];
+      rvarscale = 1.0 / dtmp;
+      for (c = 0; c < J; c++) {
+        dsum = 0.0;
+        for (r = 0; r < J; r++) {
+          igCVM = gb->iCiXtXCt[n]->rptr[r + 1][c + 1] * rvarscale;
+          dsum += (double)gammaval[r] * igCVM;
+        }
+        gtig[c] = dsum;
+      }
+      Fdsum = 0.0;
+      for (c = 0; c < J; c++) Fdsum += (double)gtig[c] * gammaval[c];
+      gb->F[n][v] = (float)Fdsum;
+      gb->p[n][v] = sc_cdf_fdist_Q(gb->F[n][v], J, glm->dof);
+      // same as RFp2StatVal() for a "z" field
+      gb->z[n][v] = sc_cdf_gaussian_Qinv(gb->p[n][v] / 2.0, 1);
+      if (J == 1 && gammaval[0] < 0) gb->z[n][v] *= -1;
+    }
+  }
+
+  free(acc);
+  free(gtig);
+  free(gammaval);
+  return (0);
+}
@@ -29,9 +29,13 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "faster_variants.h"
 #include "romp_support.h"
@@ -224,6 +228,12 @@ float getPrior(GCA_PRIOR *gcap, int label);
 GCA_PRIOR *getGCAP(GCA *gca, MRI *mri, TRANSFORM *transform, int xv, int yv, int zv);
 GCA_PRIOR *getGCAPfloat(GCA *gca, MRI *mri, TRANSFORM *transform, float xv, float yv, float zv);
 static int gcaNodeToPrior(const GCA *gca, int xn, int yn, int zn, int *pxp, int *pyp, int *pzp);
+static void gcaSetNodeTraining(GCA *gca);
+static int gcaReadTags(GCA *gca, znzFile file, const char *fname);
+static int gcaWriteTags(GCA *gca, znzFile file);
+static GCA *gcaReadFlat(const char *fname);
+static void gcaFlatRelease(GCA *gca);
+static void gcaFreeStorage(void *p);
 static HISTOGRAM *gcaHistogramSamples(
     GCA *gca, GCA_SAMPLE *gcas, MRI *mri, TRANSFORM *transform, int nsamples, HISTOGRAM *histo, int frame);
 int GCApriorToNode(const GCA *gca, int xp, int yp, int zp, int *pxn, int *pyn, int *pzn);
@@ -1883,7 +1893,7 @@ int GCAfree(GCA **pgca)
       for (z = 0; z < gca->node_depth; z++) {
         GCANfree(&gca->nodes[x][y][z], gca->ninputs);
       }
-      free(gca->nodes[x][y]);
+      gcaFreeStorage(gca->nodes[x][y]);
     }
     free(gca->nodes[x]);
   }
@@ -1892,16 +1902,17 @@ int GCAfree(GCA **pgca)
   for (x = 0; x < gca->prior_width; x++) {
     for (y = 0; y < gca->prior_height; y++) {
       for (z = 0; z < gca->prior_depth; z++) {
-        free(gca->priors[x][y][z].labels);
-        free(gca->priors[x][y][z].priors);
+        gcaFreeStorage(gca->priors[x][y][z].labels);
+        gcaFreeStorage(gca->priors[x][y][z].priors);
       }
-      free(gca->priors[x][y]);
+      gcaFreeStorage(gca->priors[x][y]);
     }
     free(gca->priors[x]);
   }
 
   free(gca->priors);
   GCAcleanup(gca);
+  gcaFlatRelease(gca);
 
   free(gca);
 
@@ -1911,7 +1922,7 @@ int GCAfree(GCA **pgca)
 int GCANfree(GCA_NODE *gcan, int ninputs)
 {
   if (gcan->nlabels) {
-    free(gcan->labels);
+    gcaFreeStorage(gcan->labels);
     free_gcs(gcan->gcs, gcan->nlabels, ninputs);
   }
   return (NO_ERROR);
@@ -1920,8 +1931,8 @@ int GCANfree(GCA_NODE *gcan, int ninputs)
 int GCAPfree(GCA_PRIOR *gcap)
 {
   if (gcap->nlabels) {
-    free(gcap->labels);
-    free(gcap->priors);
+    gcaFreeStorage(gcap->labels);
+    gcaFreeStorage(gcap->priors);
   }
   return (NO_ERROR);
 }
@@ -2462,57 +2473,7 @@ int GCAwrite(GCA *gca, const char *fname)
     }
   }
 
-  // if (gca->type == GCA_FLASH || gca->type == GCA_PARAM)
-  // always write gca->type
-  {
-    int n;
-
-    znzwriteInt(FILE_TAG, file); /* beginning of tagged section */
-
-    /* all tags are format: <int: tag> <int: num> <parm> <parm> .... */
-    znzwriteInt(TAG_GCA_TYPE, file);
-    znzwriteInt(1, file);
-    znzwriteInt(gca->type, file);
-
-    if (gca->type == GCA_FLASH) {
-      znzwriteInt(TAG_PARAMETERS, file);
-      znzwriteInt(3, file); /* currently only storing 3 parameters */
-      for (n = 0; n < gca->ninputs; n++) {
-        znzwriteFloat(gca->TRs[n], file);
-        znzwriteFloat(gca->FAs[n], file);
-        znzwriteFloat(gca->TEs[n], file);
-      }
-    }
-  }
-
-  if (gca->ct) {
-    if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON) {
-      printf("writing colortable into GCA file...\n");
-    }
-    znzwriteInt(TAG_GCA_COLORTABLE, file);
-    znzCTABwriteIntoBinary(gca->ct, file);
-  }
-
-  // write direction cosine information
-  znzwriteInt(TAG_GCA_DIRCOS, file);
-  znzwriteFloat(gca->x_r, file);
-  znzwriteFloat(gca->x_a, file);
-  znzwriteFloat(gca->x_s, file);
-  znzwriteFloat(gca->y_r, file);
-  znzwriteFloat(gca->y_a, file);
-  znzwriteFloat(gca->y_s, file);
-  znzwriteFloat(gca->z_r, file);
-  znzwriteFloat(gca->z_a, file);
-  znzwriteFloat(gca->z_s, file);
-  znzwriteFloat(gca->c_r, file);
-  znzwriteFloat(gca->c_a, file);
-  znzwriteFloat(gca->c_s, file);
-  znzwriteInt(gca->width, file);
-  znzwriteInt(gca->height, file);
-  znzwriteInt(gca->depth, file);
-  znzwriteFloat(gca->xsize, file);
-  znzwriteFloat(gca->ysize, file);
-  znzwriteFloat(gca->zsize, file);
+  gcaWriteTags(gca, file);
 
   znzclose(file);
 
@@ -2530,10 +2491,13 @@ GCA *GCAread(const char *fname)
   float version, node_spacing, prior_spacing;
   int node_width, node_height, node_depth, ninputs, flags;
   // int prior_width, prior_height, prior_depth;
-  int tag;
   int gzipped = 0;
   int tempZNZ;
 
+  if (GCAisFlat(fname)) {
+    return (gcaReadFlat(fname));
+  }
+
   if (strstr(fname, ".gcz")) {
     gzipped = 1;
   }
@@ -2841,6 +2805,27 @@ GCA *GCAread(const char *fname)
     }
   }
 
+  gcaSetNodeTraining(gca);
+  gcaReadTags(gca, file, fname);
+
+  GCAsetup(gca);
+
+  znzclose(file);
+
+  return (gca);
+}
+
+/*
+  gc->ntraining is not stored in the file, it is derived from the node
+  and prior training counts.
+*/
+static void gcaSetNodeTraining(GCA *gca)
+{
+  int x, y, z, n;
+  GCA_NODE *gcan;
+  GCA_PRIOR *gcap;
+  GC1D *gc;
+
   for (x = 0; x < gca->node_width; x++) {
     for (y = 0; y < gca->node_height; y++) {
       for (z = 0; z < gca->node_depth; z++) {
@@ -2863,6 +2848,11 @@ GCA *GCAread(const char *fname)
       }
     }
   }
+}
+
+static int gcaReadTags(GCA *gca, znzFile file, const char *fname)
+{
+  int tag;
 
   while (znzreadIntEx(&tag, file)) {
     int n, nparms;
@@ -2937,26 +2927,716 @@ GCA *GCAread(const char *fname)
             gca->ysize = znzreadFloat(file);
             gca->zsize = znzreadFloat(file);
 
-            if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON) {
-              printf("Direction cosines read:\n");
-              printf(" x_r = % .4f, y_r = % .4f, z_r = % .4f\n", gca->x_r, gca->y_r, gca->z_r);
-              printf(" x_a = % .4f, y_a = % .4f, z_a = % .4f\n", gca->x_a, gca->y_a, gca->z_a);
-              printf(" x_s = % .4f, y_s = % .4f, z_s = % .4f\n", gca->x_s, gca->y_s, gca->z_s);
-              printf(" c_r = % .4f, c_a = % .4f, c_s = % .4f\n", gca->c_r, gca->c_a, gca->c_s);
-            }
-            break;
-          default:
-            ErrorPrintf(ERROR_BADFILE, "GCAread(%s): unknown tag %x\n", fname, tag);
-            break;
-        }
+            if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON) {
+              printf("Direction cosines read:\n");
+              printf(" x_r = % .4f, y_r = % .4f, z_r = % .4f\n", gca->x_r, gca->y_r, gca->z_r);
+              printf(" x_a = % .4f, y_a = % .4f, z_a = % .4f\n", gca->x_a, gca->y_a, gca->z_a);
+              printf(" x_s = % .4f, y_s = % .4f, z_s = % .4f\n", gca->x_s, gca->y_s, gca->z_s);
+              printf(" c_r = % .4f, c_a = % .4f, c_s = % .4f\n", gca->c_r, gca->c_a, gca->c_s);
+            }
+            break;
+          default:
+            ErrorPrintf(ERROR_BADFILE, "GCAread(%s): unknown tag %x\n", fname, tag);
+            break;
+        }
+      }
+    }
+  }
+  return (NO_ERROR);
+}
+
+static int gcaWriteTags(GCA *gca, znzFile file)
+{
+  // if (gca->type == GCA_FLASH || gca->type == GCA_PARAM)
+  // always write gca->type
+  {
+    int n;
+
+    znzwriteInt(FILE_TAG, file); /* beginning of tagged section */
+
+    /* all tags are format: <int: tag> <int: num> <parm> <parm> .... */
+    znzwriteInt(TAG_GCA_TYPE, file);
+    znzwriteInt(1, file);
+    znzwriteInt(gca->type, file);
+
+    if (gca->type == GCA_FLASH) {
+      znzwriteInt(TAG_PARAMETERS, file);
+      znzwriteInt(3, file); /* currently only storing 3 parameters */
+      for (n = 0; n < gca->ninputs; n++) {
+        znzwriteFloat(gca->TRs[n], file);
+        znzwriteFloat(gca->FAs[n], file);
+        znzwriteFloat(gca->TEs[n], file);
+      }
+    }
+  }
+
+  if (gca->ct) {
+    if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON) {
+      printf("writing colortable into GCA file...\n");
+    }
+    znzwriteInt(TAG_GCA_COLORTABLE, file);
+    znzCTABwriteIntoBinary(gca->ct, file);
+  }
+
+  // write direction cosine information
+  znzwriteInt(TAG_GCA_DIRCOS, file);
+  znzwriteFloat(gca->x_r, file);
+  znzwriteFloat(gca->x_a, file);
+  znzwriteFloat(gca->x_s, file);
+  znzwriteFloat(gca->y_r, file);
+  znzwriteFloat(gca->y_a, file);
+  znzwriteFloat(gca->y_s, file);
+  znzwriteFloat(gca->z_r, file);
+  znzwriteFloat(gca->z_a, file);
+  znzwriteFloat(gca->z_s, file);
+  znzwriteFloat(gca->c_r, file);
+  znzwriteFloat(gca->c_a, file);
+  znzwriteFloat(gca->c_s, file);
+  znzwriteInt(gca->width, file);
+  znzwriteInt(gca->height, file);
+  znzwriteInt(gca->depth, file);
+  znzwriteFloat(gca->xsize, file);
+  znzwriteFloat(gca->ysize, file);
+  znzwriteFloat(gca->zsize, file);
+  return (NO_ERROR);
+}
+
+/*
+  Flat GCA files.
+
+  GCAwrite() stores the atlas as a stream of per-node records that have to
+  be parsed (and usually gunzipped) one field at a time. A flat GCA file is
+  laid out so that it can be mmap'd instead: a fixed header, then one packed
+  array per field over all nodes/classifiers/priors, each 8-byte aligned and
+  in host byte order, then the usual tagged section. Per-node offset tables
+  (GCAF_NODE_FIRST etc.) give the index of each node's first classifier, and
+  each classifier's first gibbs entry, so any node can be located without
+  scanning its predecessors.
+
+  GCAread() recognizes the magic number and maps the file MAP_PRIVATE. The
+  labels, means, covariances and priors point straight into the mapping, so
+  concurrent processes reading the same atlas share its page cache copy, and
+  pages are only faulted in when touched. Code that modifies the atlas gets
+  copy-on-write pages. The GCA_NODE, GCA_PRIOR and GC1D structs are built in
+  a handful of bulk allocations. Storage inside any of these regions is
+  released as a whole by GCAfree(); gcaFreeStorage() skips it.
+*/
+#define GCA_FLAT_MAGIC "GCAFLAT"
+#define GCA_FLAT_VERSION 1
+#define GCA_FLAT_BYTE_ORDER 0x01020304
+
+enum {
+  GCAF_NODE_NLABELS = 0,  // int[nnodes]
+  GCAF_NODE_TRAINING,     // int[nnodes]
+  GCAF_NODE_FIRST,        // long long[nnodes+1], index of first classifier
+  GCAF_GC_LABELS,         // unsigned short[ngcs]
+  GCAF_GC_MEANS,          // float[ngcs*ninputs]
+  GCAF_GC_COVARS,         // float[ngcs*ninputs*(ninputs+1)/2]
+  GCAF_GC_NGIBBS,         // short[ngcs*GIBBS_NEIGHBORHOOD], empty if GCA_NO_MRF
+  GCAF_GC_FIRST_GIBBS,    // long long[ngcs+1], empty if GCA_NO_MRF
+  GCAF_GIBBS_LABELS,      // unsigned short[ngibbs]
+  GCAF_GIBBS_PRIORS,      // float[ngibbs]
+  GCAF_PRIOR_NLABELS,     // int[npriors]
+  GCAF_PRIOR_TRAINING,    // int[npriors]
+  GCAF_PRIOR_FIRST,       // long long[npriors+1]
+  GCAF_PRIOR_LABELS,      // unsigned short[nprior_labels]
+  GCAF_PRIOR_PRIORS,      // float[nprior_labels]
+  GCAF_TAGS,              // FILE_TAG section as written by GCAwrite()
+  GCAF_NSECTIONS
+};
+
+typedef struct
+{
+  char magic[8];
+  int byte_order;
+  int version;
+  float prior_spacing;
+  float node_spacing;
+  int prior_width, prior_height, prior_depth;
+  int node_width, node_height, node_depth;
+  int ninputs;
+  int flags;
+  int max_label;
+  int spare;
+  long long ngcs;
+  long long ngibbs;
+  long long nprior_labels;
+  long long offset[GCAF_NSECTIONS];
+} GCA_FLAT_HEADER;
+
+typedef struct gca_flat
+{
+  char *map;
+  size_t map_size;
+  GCA_NODE *nodes;
+  size_t nnodes;
+  GCA_PRIOR *priors;
+  size_t npriors;
+  GC1D *gcs;
+  size_t ngcs;
+  void **ptrs;  // gibbs labels[] and label_priors[] tables of each gc
+  size_t nptrs;
+  struct gca_flat *next;
+} GCA_FLAT;
+
+static GCA_FLAT *gca_flat_list = NULL;
+
+#define IN_BLOCK(p, base, n) ((const char *)(p) >= (const char *)(base) && (const char *)(p) < (const char *)((base) + (n)))
+
+static int gcaFlatOwns(const void *p)
+{
+  GCA_FLAT *flat;
+
+  for (flat = gca_flat_list; flat; flat = flat->next) {
+    if (IN_BLOCK(p, flat->map, flat->map_size) || IN_BLOCK(p, flat->nodes, flat->nnodes) ||
+        IN_BLOCK(p, flat->priors, flat->npriors) || IN_BLOCK(p, flat->gcs, flat->ngcs) ||
+        IN_BLOCK(p, flat->ptrs, flat->nptrs)) {
+      return (1);
+    }
+  }
+  return (0);
+}
+
+/* free() for node, prior and classifier storage, which may belong to a flat GCA */
+static void gcaFreeStorage(void *p)
+{
+  if (p && gca_flat_list && gcaFlatOwns(p)) {
+    return;
+  }
+  free(p);
+}
+
+static void gcaFlatRelease(GCA *gca)
+{
+  GCA_FLAT *flat = (GCA_FLAT *)gca->flat, **pflat;
+
+  if (!flat) {
+    return;
+  }
+  for (pflat = &gca_flat_list; *pflat; pflat = &(*pflat)->next) {
+    if (*pflat == flat) {
+      *pflat = flat->next;
+      break;
+    }
+  }
+  munmap(flat->map, flat->map_size);
+  free(flat->nodes);
+  free(flat->priors);
+  free(flat->gcs);
+  free(flat->ptrs);
+  free(flat);
+  gca->flat = NULL;
+}
+
+static long long gcaFlatSectionSize(const GCA_FLAT_HEADER *hdr, int section)
+{
+  long long nnodes, npriors, ncovars, mrf;
+
+  nnodes = (long long)hdr->node_width * hdr->node_height * hdr->node_depth;
+  npriors = (long long)hdr->prior_width * hdr->prior_height * hdr->prior_depth;
+  ncovars = (hdr->ninputs * (hdr->ninputs + 1)) / 2;
+  mrf = (hdr->flags & GCA_NO_MRF) == 0;
+  switch (section) {
+    case GCAF_NODE_NLABELS:
+    case GCAF_NODE_TRAINING:
+      return (nnodes * sizeof(int));
+    case GCAF_NODE_FIRST:
+      return ((nnodes + 1) * sizeof(long long));
+    case GCAF_GC_LABELS:
+      return (hdr->ngcs * sizeof(unsigned short));
+    case GCAF_GC_MEANS:
+      return (hdr->ngcs * hdr->ninputs * sizeof(float));
+    case GCAF_GC_COVARS:
+      return (hdr->ngcs * ncovars * sizeof(float));
+    case GCAF_GC_NGIBBS:
+      return (mrf * hdr->ngcs * GIBBS_NEIGHBORHOOD * sizeof(short));
+    case GCAF_GC_FIRST_GIBBS:
+      return (mrf * (hdr->ngcs + 1) * sizeof(long long));
+    case GCAF_GIBBS_LABELS:
+      return (hdr->ngibbs * sizeof(unsigned short));
+    case GCAF_GIBBS_PRIORS:
+      return (hdr->ngibbs * sizeof(float));
+    case GCAF_PRIOR_NLABELS:
+    case GCAF_PRIOR_TRAINING:
+      return (npriors * sizeof(int));
+    case GCAF_PRIOR_FIRST:
+      return ((npriors + 1) * sizeof(long long));
+    case GCAF_PRIOR_LABELS:
+      return (hdr->nprior_labels * sizeof(unsigned short));
+    case GCAF_PRIOR_PRIORS:
+      return (hdr->nprior_labels * sizeof(float));
+    default:
+      return (0);
+  }
+}
+
+/*!
+  \fn int GCAisFlat(const char *fname)
+  \brief Returns 1 if fname is a flat GCA file (see GCAwriteFlat()).
+*/
+int GCAisFlat(const char *fname)
+{
+  FILE *fp;
+  char magic[8];
+  int flat = 0;
+
+  fp = fopen(fname, "rb");
+  if (!fp) {
+    return (0);
+  }
+  if (fread(magic, 1, sizeof(magic), fp) == sizeof(magic)) {
+    flat = memcmp(magic, GCA_FLAT_MAGIC, sizeof(GCA_FLAT_MAGIC)) == 0;
+  }
+  fclose(fp);
+  return (flat);
+}
+
+static int gcaFlatPad(znzFile file, long long offset)
+{
+  static char zeros[8];
+  long long pos = znztell(file);
+
+  if (offset < pos || offset - pos > (long long)sizeof(zeros)) {
+    return (0);
+  }
+  if (offset > pos && znzwrite(zeros, 1, offset - pos, file) != (size_t)(offset - pos)) {
+    return (0);
+  }
+  return (1);
+}
+
+/*!
+  \fn int GCAwriteFlat(GCA *gca, const char *fname)
+  \brief Writes gca as a flat, mmap-able GCA file. GCAread() detects these
+  by their magic number. The file is in host byte order, so it should be
+  generated (e.g. with mri_gca_flatten) on the architecture that reads it.
+*/
+int GCAwriteFlat(GCA *gca, const char *fname)
+{
+  GCA_FLAT_HEADER hdr;
+  znzFile file;
+  GCA_NODE *gcan;
+  GCA_PRIOR *gcap;
+  GC1D *gc;
+  long long offset, first;
+  int x, y, z, n, i, section, ncovars, mrf, ok;
+  short nbr_nlabels;
+
+  ncovars = (gca->ninputs * (gca->ninputs + 1)) / 2;
+  mrf = (gca->flags & GCA_NO_MRF) == 0;
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, GCA_FLAT_MAGIC, sizeof(GCA_FLAT_MAGIC));
+  hdr.byte_order = GCA_FLAT_BYTE_ORDER;
+  hdr.version = GCA_FLAT_VERSION;
+  hdr.prior_spacing = gca->prior_spacing;
+  hdr.node_spacing = gca->node_spacing;
+  hdr.prior_width = gca->prior_width;
+  hdr.prior_height = gca->prior_height;
+  hdr.prior_depth = gca->prior_depth;
+  hdr.node_width = gca->node_width;
+  hdr.node_height = gca->node_height;
+  hdr.node_depth = gca->node_depth;
+  hdr.ninputs = gca->ninputs;
+  hdr.flags = gca->flags;
+  hdr.max_label = gca->max_label;
+  for (x = 0; x < gca->node_width; x++)
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++) {
+        gcan = &gca->nodes[x][y][z];
+        hdr.ngcs += gcan->nlabels;
+        if (mrf)
+          for (n = 0; n < gcan->nlabels; n++)
+            for (i = 0; i < GIBBS_NEIGHBORHOOD; i++) {
+              hdr.ngibbs += gcan->gcs[n].nlabels[i];
+            }
+      }
+  for (x = 0; x < gca->prior_width; x++)
+    for (y = 0; y < gca->prior_height; y++)
+      for (z = 0; z < gca->prior_depth; z++) {
+        hdr.nprior_labels += gca->priors[x][y][z].nlabels;
+      }
+  for (offset = sizeof(hdr), section = 0; section < GCAF_NSECTIONS; section++) {
+    offset = (offset + 7) & ~7LL;
+    hdr.offset[section] = offset;
+    offset += gcaFlatSectionSize(&hdr, section);
+  }
+
+  file = znzopen(fname, "wb", 0);
+  if (znz_isnull(file)) {
+    errno = 0;
+    ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "GCAwriteFlat(%s): could not open file", fname));
+  }
+  ok = znzwrite(&hdr, sizeof(hdr), 1, file) == 1;
+
+  for (section = 0; ok && section < GCAF_TAGS; section++) {
+    ok = gcaFlatPad(file, hdr.offset[section]);
+    if (section <= GCAF_GIBBS_PRIORS) {
+      if (!mrf && section >= GCAF_GC_NGIBBS) {
+        continue;
+      }
+      first = 0;
+      for (x = 0; ok && x < gca->node_width; x++)
+        for (y = 0; ok && y < gca->node_height; y++)
+          for (z = 0; ok && z < gca->node_depth; z++) {
+            gcan = &gca->nodes[x][y][z];
+            switch (section) {
+              case GCAF_NODE_NLABELS:
+                ok = znzwrite(&gcan->nlabels, sizeof(int), 1, file) == 1;
+                break;
+              case GCAF_NODE_TRAINING:
+                ok = znzwrite(&gcan->total_training, sizeof(int), 1, file) == 1;
+                break;
+              case GCAF_NODE_FIRST:
+                ok = znzwrite(&first, sizeof(first), 1, file) == 1;
+                first += gcan->nlabels;
+                break;
+              case GCAF_GC_LABELS:
+                ok = znzwrite(gcan->labels, sizeof(unsigned short), gcan->nlabels, file) == (size_t)gcan->nlabels;
+                break;
+              default:
+                for (n = 0; ok && n < gcan->nlabels; n++) {
+                  gc = &gcan->gcs[n];
+                  switch (section) {
+                    case GCAF_GC_MEANS:
+                      ok = znzwrite(gc->means, sizeof(float), gca->ninputs, file) == (size_t)gca->ninputs;
+                      break;
+                    case GCAF_GC_COVARS:
+                      ok = znzwrite(gc->covars, sizeof(float), ncovars, file) == (size_t)ncovars;
+                      break;
+                    case GCAF_GC_NGIBBS:
+                      ok = znzwrite(gc->nlabels, sizeof(short), GIBBS_NEIGHBORHOOD, file) == GIBBS_NEIGHBORHOOD;
+                      break;
+                    case GCAF_GC_FIRST_GIBBS:
+                      ok = znzwrite(&first, sizeof(first), 1, file) == 1;
+                      for (i = 0; i < GIBBS_NEIGHBORHOOD; i++) {
+                        first += gc->nlabels[i];
+                      }
+                      break;
+                    case GCAF_GIBBS_LABELS:
+                    case GCAF_GIBBS_PRIORS:
+                      for (i = 0; ok && i < GIBBS_NEIGHBORHOOD; i++) {
+                        nbr_nlabels = gc->nlabels[i];
+                        if (section == GCAF_GIBBS_LABELS) {
+                          ok = znzwrite(gc->labels[i], sizeof(unsigned short), nbr_nlabels, file) ==
+                               (size_t)nbr_nlabels;
+                        }
+                        else {
+                          ok = znzwrite(gc->label_priors[i], sizeof(float), nbr_nlabels, file) == (size_t)nbr_nlabels;
+                        }
+                      }
+                      break;
+                  }
+                }
+                break;
+            }
+          }
+      if (ok && (section == GCAF_NODE_FIRST || section == GCAF_GC_FIRST_GIBBS)) {
+        ok = znzwrite(&first, sizeof(first), 1, file) == 1;
+      }
+    }
+    else {
+      first = 0;
+      for (x = 0; ok && x < gca->prior_width; x++)
+        for (y = 0; ok && y < gca->prior_height; y++)
+          for (z = 0; ok && z < gca->prior_depth; z++) {
+            gcap = &gca->priors[x][y][z];
+            n = gcap->nlabels;
+            switch (section) {
+              case GCAF_PRIOR_NLABELS:
+                ok = znzwrite(&n, sizeof(int), 1, file) == 1;
+                break;
+              case GCAF_PRIOR_TRAINING:
+                ok = znzwrite(&gcap->total_training, sizeof(int), 1, file) == 1;
+                break;
+              case GCAF_PRIOR_FIRST:
+                ok = znzwrite(&first, sizeof(first), 1, file) == 1;
+                first += n;
+                break;
+              case GCAF_PRIOR_LABELS:
+                ok = znzwrite(gcap->labels, sizeof(unsigned short), n, file) == (size_t)n;
+                break;
+              case GCAF_PRIOR_PRIORS:
+                ok = znzwrite(gcap->priors, sizeof(float), n, file) == (size_t)n;
+                break;
+            }
+          }
+      if (ok && section == GCAF_PRIOR_FIRST) {
+        ok = znzwrite(&first, sizeof(first), 1, file) == 1;
+      }
+    }
+  }
+  if (ok) {
+    ok = gcaFlatPad(file, hdr.offset[GCAF_TAGS]);
+  }
+  if (ok) {
+    gcaWriteTags(gca, file);
+  }
+  znzclose(file);
+  if (!ok) {
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "GCAwriteFlat(%s): write failed", fname));
+  }
+  return (NO_ERROR);
+}
+
+/*
+  gcaFlatFirstValid() - returns 1 if the n+1 offsets in first[] start at 0,
+  step by the n counts and end at total, ie, every run of classifiers or
+  prior labels they describe lies inside its section.
+*/
+static int gcaFlatFirstValid(const long long *first, const int *counts, size_t n, long long total)
+{
+  size_t i;
+
+  if (first[0] != 0) {
+    return (0);
+  }
+  for (i = 0; i < n; i++)
+    if (counts[i] < 0 || first[i + 1] != first[i] + counts[i]) {
+      return (0);
+    }
+  return (first[n] == total);
+}
+
+/* the same for the gibbs offsets, which step by the sum of the
+   GIBBS_NEIGHBORHOOD counts of each classifier */
+static int gcaFlatGibbsValid(const long long *first_gibbs, const short *ngibbs, long long ngcs, long long total)
+{
+  long long g, n;
+  int i;
+
+  if (first_gibbs[0] != 0) {
+    return (0);
+  }
+  for (g = 0; g < ngcs; g++) {
+    for (n = i = 0; i < GIBBS_NEIGHBORHOOD; i++) {
+      if (ngibbs[g * GIBBS_NEIGHBORHOOD + i] < 0) {
+        return (0);
+      }
+      n += ngibbs[g * GIBBS_NEIGHBORHOOD + i];
+    }
+    if (first_gibbs[g + 1] != first_gibbs[g] + n) {
+      return (0);
+    }
+  }
+  return (first_gibbs[ngcs] == total);
+}
+
+static GCA *gcaReadFlat(const char *fname)
+{
+  GCA_FLAT_HEADER *hdr;
+  GCA_FLAT *flat;
+  GCA *gca;
+  GCA_NODE *gcan;
+  GCA_PRIOR *gcap;
+  GC1D *gc;
+  struct stat st;
+  znzFile file;
+  char *map;
+  const int *nlabels, *training;
+  const long long *first, *first_gibbs = NULL;
+  unsigned short *gc_labels, *gibbs_labels, *prior_labels;
+  float *means, *covars, *gibbs_priors, *priors;
+  short *ngibbs = NULL;
+  long long g, gibbs, end;
+  size_t nnodes, npriors, node;
+  int fd, x, y, i, section, ncovars, mrf;
+
+  fd = open(fname, O_RDONLY);
+  if (fd < 0) {
+    ErrorReturn(NULL, (ERROR_BADPARM, "GCAread(%s): could not open file", fname));
+  }
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(GCA_FLAT_HEADER)) {
+    close(fd);
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCAread(%s): truncated flat GCA file", fname));
+  }
+  map = (char *)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCAread(%s): could not map file", fname));
+  }
+
+  hdr = (GCA_FLAT_HEADER *)map;
+  if (hdr->byte_order != GCA_FLAT_BYTE_ORDER || hdr->version != GCA_FLAT_VERSION) {
+    munmap(map, st.st_size);
+    ErrorReturn(NULL,
+                (ERROR_BADFILE,
+                 "GCAread(%s): flat GCA version %d written with a different byte order or version, "
+                 "regenerate it with mri_gca_flatten",
+                 fname,
+                 hdr->version));
+  }
+  // counts and dimensions that the section sizes below can be computed from
+  if (hdr->ninputs < 1 || hdr->ninputs > MAX_GCA_INPUTS || hdr->node_width < 1 || hdr->node_height < 1 ||
+      hdr->node_depth < 1 || hdr->prior_width < 1 || hdr->prior_height < 1 || hdr->prior_depth < 1 ||
+      (double)hdr->node_width * hdr->node_height * hdr->node_depth > st.st_size ||
+      (double)hdr->prior_width * hdr->prior_height * hdr->prior_depth > st.st_size || hdr->ngcs < 0 ||
+      hdr->ngcs > st.st_size || hdr->ngibbs < 0 || hdr->ngibbs > st.st_size || hdr->nprior_labels < 0 ||
+      hdr->nprior_labels > st.st_size || !(hdr->node_spacing > 0) || !(hdr->prior_spacing > 0)) {
+    munmap(map, st.st_size);
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCAread(%s): bad flat GCA header", fname));
+  }
+  for (section = 0; section < GCAF_NSECTIONS; section++) {
+    end = hdr->offset[section] + gcaFlatSectionSize(hdr, section);
+    if (hdr->offset[section] < (long long)sizeof(*hdr) || (hdr->offset[section] & 7) || end > st.st_size) {
+      munmap(map, st.st_size);
+      ErrorReturn(NULL, (ERROR_BADFILE, "GCAread(%s): flat GCA section %d out of bounds", fname, section));
+    }
+  }
+
+  gca = gcaAllocMax(hdr->ninputs,
+                    hdr->prior_spacing,
+                    hdr->node_spacing,
+                    hdr->node_spacing * hdr->node_width,
+                    hdr->node_spacing * hdr->node_height,
+                    hdr->node_spacing * hdr->node_depth,
+                    -1,
+                    hdr->flags);
+  if (!gca) {
+    munmap(map, st.st_size);
+    ErrorReturn(NULL, (Gerror, NULL));
+  }
+  if (gca->node_width != hdr->node_width || gca->node_height != hdr->node_height ||
+      gca->node_depth != hdr->node_depth || gca->prior_width != hdr->prior_width ||
+      gca->prior_height != hdr->prior_height || gca->prior_depth != hdr->prior_depth) {
+    gca->node_width = gca->prior_width = 0;  // no nodes or priors allocated yet
+    GCAfree(&gca);
+    munmap(map, st.st_size);
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCAread(%s): flat GCA dimensions do not match its sections", fname));
+  }
+  gca->max_label = hdr->max_label;
+  ncovars = (gca->ninputs * (gca->ninputs + 1)) / 2;
+  mrf = (gca->flags & GCA_NO_MRF) == 0;
+  nnodes = (size_t)gca->node_width * gca->node_height * gca->node_depth;
+  npriors = (size_t)gca->prior_width * gca->prior_height * gca->prior_depth;
+
+  flat = (GCA_FLAT *)calloc(1, sizeof(GCA_FLAT));
+  if (!flat) {
+    ErrorExit(ERROR_NOMEMORY, "GCAread(%s): could not allocate flat GCA", fname);
+  }
+  flat->map = map;
+  flat->map_size = st.st_size;
+  flat->nnodes = nnodes;
+  flat->npriors = npriors;
+  flat->ngcs = hdr->ngcs;
+  flat->nptrs = mrf ? 2 * GIBBS_NEIGHBORHOOD * hdr->ngcs : 0;
+  flat->nodes = (GCA_NODE *)calloc(nnodes, sizeof(GCA_NODE));
+  flat->priors = (GCA_PRIOR *)calloc(npriors, sizeof(GCA_PRIOR));
+  flat->gcs = (GC1D *)calloc(hdr->ngcs + 1, sizeof(GC1D));
+  flat->ptrs = (void **)calloc(flat->nptrs + 1, sizeof(void *));
+  if (!flat->nodes || !flat->priors || !flat->gcs || !flat->ptrs) {
+    ErrorExit(ERROR_NOMEMORY, "GCAread(%s): could not allocate %d nodes and %lld classifiers",
+              fname, (int)nnodes, hdr->ngcs);
+  }
+  flat->next = gca_flat_list;
+  gca_flat_list = flat;
+  gca->flat = flat;
+
+  gca->nodes = (GCA_NODE ***)calloc(gca->node_width, sizeof(GCA_NODE **));
+  if (!gca->nodes) {
+    ErrorExit(ERROR_NOMEMORY, "GCAread(%s): could not allocate nodes", fname);
+  }
+  for (x = 0; x < gca->node_width; x++) {
+    gca->nodes[x] = (GCA_NODE **)calloc(gca->node_height, sizeof(GCA_NODE *));
+    if (!gca->nodes[x]) {
+      ErrorExit(ERROR_NOMEMORY, "GCAread(%s): could not allocate %dth **", fname, x);
+    }
+    for (y = 0; y < gca->node_height; y++) {
+      gca->nodes[x][y] = flat->nodes + ((size_t)x * gca->node_height + y) * gca->node_depth;
+    }
+  }
+  gca->priors = (GCA_PRIOR ***)calloc(gca->prior_width, sizeof(GCA_PRIOR **));
+  if (!gca->priors) {
+    ErrorExit(ERROR_NOMEMORY, "GCAread(%s): could not allocate priors", fname);
+  }
+  for (x = 0; x < gca->prior_width; x++) {
+    gca->priors[x] = (GCA_PRIOR **)calloc(gca->prior_height, sizeof(GCA_PRIOR *));
+    if (!gca->priors[x]) {
+      ErrorExit(ERROR_NOMEMORY, "GCAread(%s): could not allocate %dth **", fname, x);
+    }
+    for (y = 0; y < gca->prior_height; y++) {
+      gca->priors[x][y] = flat->priors + ((size_t)x * gca->prior_height + y) * gca->prior_depth;
+    }
+  }
+
+  nlabels = (const int *)(map + hdr->offset[GCAF_NODE_NLABELS]);
+  training = (const int *)(map + hdr->offset[GCAF_NODE_TRAINING]);
+  first = (const long long *)(map + hdr->offset[GCAF_NODE_FIRST]);
+  gc_labels = (unsigned short *)(map + hdr->offset[GCAF_GC_LABELS]);
+  means = (float *)(map + hdr->offset[GCAF_GC_MEANS]);
+  covars = (float *)(map + hdr->offset[GCAF_GC_COVARS]);
+  gibbs_labels = (unsigned short *)(map + hdr->offset[GCAF_GIBBS_LABELS]);
+  gibbs_priors = (float *)(map + hdr->offset[GCAF_GIBBS_PRIORS]);
+  if (mrf) {
+    ngibbs = (short *)(map + hdr->offset[GCAF_GC_NGIBBS]);
+    first_gibbs = (const long long *)(map + hdr->offset[GCAF_GC_FIRST_GIBBS]);
+  }
+  if (!gcaFlatFirstValid(first, nlabels, nnodes, hdr->ngcs) ||
+      (mrf && !gcaFlatGibbsValid(first_gibbs, ngibbs, hdr->ngcs, hdr->ngibbs))) {
+    GCAfree(&gca);
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCAread(%s): inconsistent flat GCA offset tables", fname));
+  }
+
+  for (node = 0; node < nnodes; node++) {
+    gcan = &flat->nodes[node];
+    gcan->nlabels = gcan->max_labels = nlabels[node];
+    gcan->total_training = training[node];
+    if (gcan->nlabels == 0) {
+      continue;
+    }
+    gcan->labels = gc_labels + first[node];
+    gcan->gcs = flat->gcs + first[node];
+    for (g = first[node]; g < first[node + 1]; g++) {
+      gc = &flat->gcs[g];
+      gc->means = means + g * gca->ninputs;
+      gc->covars = covars + g * ncovars;
+      if (!mrf) {
+        continue;
+      }
+      gc->nlabels = ngibbs + g * GIBBS_NEIGHBORHOOD;
+      gc->labels = (unsigned short **)(flat->ptrs + 2 * GIBBS_NEIGHBORHOOD * g);
+      gc->label_priors = (float **)(flat->ptrs + 2 * GIBBS_NEIGHBORHOOD * g + GIBBS_NEIGHBORHOOD);
+      for (gibbs = first_gibbs[g], i = 0; i < GIBBS_NEIGHBORHOOD; gibbs += gc->nlabels[i], i++) {
+        gc->labels[i] = gibbs_labels + gibbs;
+        gc->label_priors[i] = gibbs_priors + gibbs;
       }
     }
   }
 
-  GCAsetup(gca);
+  nlabels = (const int *)(map + hdr->offset[GCAF_PRIOR_NLABELS]);
+  training = (const int *)(map + hdr->offset[GCAF_PRIOR_TRAINING]);
+  first = (const long long *)(map + hdr->offset[GCAF_PRIOR_FIRST]);
+  prior_labels = (unsigned short *)(map + hdr->offset[GCAF_PRIOR_LABELS]);
+  priors = (float *)(map + hdr->offset[GCAF_PRIOR_PRIORS]);
+  if (!gcaFlatFirstValid(first, nlabels, npriors, hdr->nprior_labels)) {
+    GCAfree(&gca);
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCAread(%s): inconsistent flat GCA offset tables", fname));
+  }
+  for (node = 0; node < npriors; node++) {
+    gcap = &flat->priors[node];
+    gcap->nlabels = gcap->max_labels = nlabels[node];
+    gcap->total_training = training[node];
+    if (gcap->nlabels) {
+      gcap->labels = prior_labels + first[node];
+      gcap->priors = priors + first[node];
+    }
+  }
 
+  gcaSetNodeTraining(gca);
+
+  file = znzopen(fname, "rb", 0);
+  if (znz_isnull(file) || znzseek(file, hdr->offset[GCAF_TAGS], SEEK_SET) < 0) {
+    if (!znz_isnull(file)) {
+      znzclose(file);
+    }
+    GCAfree(&gca);
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCAread(%s): could not read tags", fname));
+  }
+  gcaReadTags(gca, file, fname);
   znzclose(file);
 
+  GCAsetup(gca);
+
   return (gca);
 }
 
@@ -3008,8 +3688,8 @@ static int GCAupdatePrior(GCA *gca, MRI *mri, int xn, int yn, int zn, int label)
       memmove(gcap->labels, old_labels, old_max_labels * sizeof(unsigned short));
 
       /* free the old ones */
-      free(old_priors);
-      free(old_labels);
+      gcaFreeStorage(old_priors);
+      gcaFreeStorage(old_labels);
     }
     // add one
     gcap->nlabels++;
@@ -3174,8 +3854,8 @@ static int GCAupdateNode(GCA *gca, MRI *mri, int xn, int yn, int zn, float *vals
       memmove(gcan->labels, old_labels, old_max_labels * sizeof(unsigned short));
 
       /* free the old ones */
-      free(old_gcs);
-      free(old_labels);
+      gcaFreeStorage(old_gcs);
+      gcaFreeStorage(old_labels);
     }
     gcan->nlabels++;
   }
@@ -3525,12 +4205,194 @@ int GCAcompleteCovarianceTraining(GCA *gca)
   return (NO_ERROR);
 }
 
+/*
+  Per-node table of the Gaussian constants GCAlabel() and
+  GCAlabelProbabilities() need for every voxel. GCAmahDist() and
+  covariance_determinant() rebuild the covariance, its inverse and its
+  determinant on every call; here they are computed once per node and
+  label. The atlas means and covariances change between calls (e.g.
+  renormalization in mri_ca_label), so the table lives for one labeling
+  pass. Entry node_offset[node]+n belongs to gca->nodes[..].gcs[n].
+  setenv FS_GCA_NO_DENSITY_TABLE to compute every density untabulated.
+*/
+typedef struct
+{
+  int ninputs;
+  int nentries;
+  int *node_offset;   // first entry of each node, x slowest
+  double *log_norm;   // -log(sqrt(det)), as in GCAcomputeConditionalLogDensity()
+  double *norm;       // 1/((2 pi)^(ninputs/2) sqrt(det)), as in GCAcomputeConditionalDensity()
+  float *inv_covars;  // ninputs x ninputs inverse, row major (ninputs > 1 only)
+  char *valid;        // 0 if the covariance is singular
+} GCA_DENSITY_TABLE;
+
+static int gcaDensityTableFree(GCA_DENSITY_TABLE **ptable)
+{
+  GCA_DENSITY_TABLE *table = *ptable;
+
+  if (table == NULL) return (NO_ERROR);
+  free(table->node_offset);
+  free(table->log_norm);
+  free(table->norm);
+  free(table->inv_covars);
+  free(table->valid);
+  free(table);
+  *ptable = NULL;
+  return (NO_ERROR);
+}
+
+static GCA_DENSITY_TABLE *gcaDensityTableAlloc(GCA *gca)
+{
+  GCA_DENSITY_TABLE *table;
+  int nodeno, nnodes, ninputs, nsq;
+
+  if (getenv("FS_GCA_NO_DENSITY_TABLE") != NULL) return (NULL);
+  ninputs = gca->ninputs;
+  nsq = ninputs * ninputs;
+  nnodes = gca->node_width * gca->node_height * gca->node_depth;
+  table = (GCA_DENSITY_TABLE *)calloc(1, sizeof(GCA_DENSITY_TABLE));
+  table->ninputs = ninputs;
+  table->node_offset = (int *)calloc(nnodes + 1, sizeof(int));
+  for (nodeno = 0; nodeno < nnodes; nodeno++) {
+    int zn = nodeno % gca->node_depth;
+    int yn = (nodeno / gca->node_depth) % gca->node_height;
+    int xn = nodeno / (gca->node_depth * gca->node_height);
+    table->node_offset[nodeno + 1] = table->node_offset[nodeno] + gca->nodes[xn][yn][zn].nlabels;
+  }
+  table->nentries = table->node_offset[nnodes];
+  table->log_norm = (double *)calloc(table->nentries + 1, sizeof(double));
+  table->norm = (double *)calloc(table->nentries + 1, sizeof(double));
+  table->valid = (char *)calloc(table->nentries + 1, sizeof(char));
+  if (ninputs > 1) table->inv_covars = (float *)calloc((size_t)(table->nentries + 1) * nsq, sizeof(float));
+  if (!table->node_offset || !table->log_norm || !table->norm || !table->valid ||
+      (ninputs > 1 && !table->inv_covars))
+    ErrorExit(ERROR_NOMEMORY, "gcaDensityTableAlloc: could not allocate %d entries", table->nentries);
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(static)
+#endif
+  for (nodeno = 0; nodeno < nnodes; nodeno++) {
+    ROMP_PFLB_begin
+    int n, entry, r, c;
+    int zn = nodeno % gca->node_depth;
+    int yn = (nodeno / gca->node_depth) % gca->node_height;
+    int xn = nodeno / (gca->node_depth * gca->node_height);
+    GCA_NODE *gcan = &gca->nodes[xn][yn][zn];
+    MATRIX *m_cov = NULL, *m_cov_inv = NULL, *m_inv;
+    double det;
+
+    for (n = 0; n < gcan->nlabels; n++) {
+      GC1D *gc = &gcan->gcs[n];
+      entry = table->node_offset[nodeno] + n;
+      // same operations as covariance_determinant() and GCAmahDist()
+      if (ninputs == 1)
+        det = gc->covars[0];
+      else {
+        m_cov = load_covariance_matrix(gc, m_cov, ninputs);
+        det = MatrixDeterminant(m_cov);
+        // a singular m_cov gives NULL and leaves m_cov_inv allocated
+        m_inv = MatrixInverse(m_cov, m_cov_inv);
+        if (m_inv == NULL) continue;  // left invalid
+        m_cov_inv = m_inv;
+        MatrixSVDInverse(m_cov, m_cov_inv);
+        for (r = 0; r < ninputs; r++)
+          for (c = 0; c < ninputs; c++)
+            table->inv_covars[(size_t)entry * ninputs * ninputs + r * ninputs + c] = *MATRIX_RELT(m_cov_inv, r + 1, c + 1);
+      }
+      table->log_norm[entry] = -log(sqrt(det));
+      table->norm[entry] = 1.0 / (pow(2 * M_PI, ninputs / 2.0) * sqrt(det));
+      table->valid[entry] = 1;
+    }
+    if (m_cov) MatrixFree(&m_cov);
+    if (m_cov_inv) MatrixFree(&m_cov_inv);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  return (table);
+}
+
+/*
+  Returns the table entry of gc if it is one of the classifiers of node
+  (xn,yn,zn) and could be inverted, or -1 if the caller has to fall back
+  to the untabulated functions (e.g. for GCAfindClosestValidGC() results,
+  or if there is no table).
+*/
+static int gcaDensityTableEntry(
+    const GCA_DENSITY_TABLE *table, const GCA *gca, int xn, int yn, int zn, const GC1D *gc)
+{
+  const GCA_NODE *gcan = &gca->nodes[xn][yn][zn];
+  int n, entry;
+
+  if (table == NULL) return (-1);
+  if (gc < gcan->gcs || gc >= gcan->gcs + gcan->nlabels) return (-1);
+  n = gc - gcan->gcs;
+  entry = table->node_offset[(xn * gca->node_height + yn) * gca->node_depth + zn] + n;
+  return (table->valid[entry] ? entry : -1);
+}
+
+/*
+  Mahalanobis distance of vals from gc with the tabulated inverse. The
+  products and sums are done in float in the order of GCAmahDist(), so
+  the result is bit-identical to it.
+*/
+static double gcaDensityTableMahDist(const GCA_DENSITY_TABLE *table, int entry, const GC1D *gc, const float *vals)
+{
+  int r, i, ninputs = table->ninputs;
+  float d[MAX_GCA_INPUTS], val, dsq;
+  const float *inv;
+
+  if (ninputs == 1) {
+    float v;
+    v = vals[0] - gc->means[0];
+    return (v * v / gc->covars[0]);
+  }
+  for (i = 0; i < ninputs; i++) d[i] = gc->means[i] - vals[i];
+  inv = table->inv_covars + (size_t)entry * ninputs * ninputs;
+  for (dsq = 0.0f, r = 0; r < ninputs; r++, inv += ninputs) {
+    for (val = 0.0f, i = 0; i < ninputs; i++) val += inv[i] * d[i];
+    dsq += d[r] * val;
+  }
+  return (dsq);
+}
+
+/* gcaComputeLogDensity() with the tabulated constants */
+static double gcaDensityTableLogDensity(const GCA_DENSITY_TABLE *table,
+                                        const GCA *gca,
+                                        int xn,
+                                        int yn,
+                                        int zn,
+                                        GC1D *gc,
+                                        float *vals,
+                                        float prior,
+                                        int label)
+{
+  double log_p;
+  int entry;
+
+  entry = gcaDensityTableEntry(table, gca, xn, yn, zn, gc);
+  if (entry < 0) return (gcaComputeLogDensity(gc, vals, gca->ninputs, prior, label));
+  log_p = table->log_norm[entry] - .5 * gcaDensityTableMahDist(table, entry, gc, vals);
+  log_p += log(prior);
+  return (log_p);
+}
+
+/* GCAcomputeConditionalDensity() with the tabulated constants */
+static double gcaDensityTableConditionalDensity(
+    const GCA_DENSITY_TABLE *table, const GCA *gca, int xn, int yn, int zn, GC1D *gc, float *vals, int label)
+{
+  int entry;
+
+  entry = gcaDensityTableEntry(table, gca, xn, yn, zn, gc);
+  if (entry < 0) return (GCAcomputeConditionalDensity(gc, vals, gca->ninputs, label));
+  return (table->norm[entry] * exp(-0.5 * gcaDensityTableMahDist(table, entry, gc, vals)));
+}
+
 MRI *GCAlabel(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform)
 {
   int x, width, height, depth, num_pv, use_partial_volume_stuff;
-#if INTERP_PRIOR
-  float prior;
-#endif
+  GCA_DENSITY_TABLE *table;
 
   use_partial_volume_stuff = (getenv("USE_PARTIAL_VOLUME_STUFF") != NULL);
   if (use_partial_volume_stuff) {
@@ -3554,14 +4416,22 @@ MRI *GCAlabel(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform)
   height = mri_inputs->height;
   depth = mri_inputs->depth;
   num_pv = 0;
-  // if 0
-  // ifdef HAVE_OPENMP
-  // pragma omp parallel for if_ROMP(experimental) reduction(+: num_pv)
-  // endif
+  table = gcaDensityTableAlloc(gca);
+
+  // every voxel is labeled independently, so the result does not depend
+  // on the number of threads
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) reduction(+ : num_pv) schedule(dynamic, 1)
+#endif
   for (x = 0; x < width; x++) {
+    ROMP_PFLB_begin
     int y, z, n, label, xn, yn, zn;
     // int max_n;
     float vals[MAX_GCA_INPUTS], max_p, p;
+#if INTERP_PRIOR
+    float prior;
+#endif
     GCA_NODE *gcan;
     GCA_PRIOR *gcap;
     GC1D *gc;
@@ -3605,9 +4475,9 @@ MRI *GCAlabel(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform)
             }
 #if INTERP_PRIOR
             prior = gcaComputePrior(gca, mri_inputs, transform, x, y, z, gcap->labels[n]);
-            p = gcaComputeLogDensity(gc, vals, gca->ninputs, prior, gcap->labels[n]);
+            p = gcaDensityTableLogDensity(table, gca, xn, yn, zn, gc, vals, prior, gcap->labels[n]);
 #else
-            p = gcaComputeLogDensity(gc, vals, gca->ninputs, gcap->priors[n], gcap->labels[n]);
+            p = gcaDensityTableLogDensity(table, gca, xn, yn, zn, gc, vals, gcap->priors[n], gcap->labels[n]);
 #endif
 #endif
             // look for largest p
@@ -3701,14 +4571,18 @@ MRI *GCAlabel(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform)
         }
       }  // z loop
     }    // y loop
+    ROMP_PFLB_end
   }      // x loop
+  ROMP_PF_end
 
+  gcaDensityTableFree(&table);
   return (mri_dst);
 }
 
 MRI *GCAlabelProbabilities(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform)
 {
   int x, width, height, depth;
+  GCA_DENSITY_TABLE *table;
 
   width = mri_inputs->width;
   height = mri_inputs->height;
@@ -3725,10 +4599,13 @@ MRI *GCAlabelProbabilities(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *t
      voxel (and hence the classifier) to which it maps. Then update the
      classifiers statistics based on this voxel's intensity and label.
   */
-  //#ifdef HAVE_OPENMP
-  //#pragma omp parallel for if_ROMP(experimental)
-  //#endif
+  table = gcaDensityTableAlloc(gca);
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 1)
+#endif
   for (x = 0; x < width; x++) {
+    ROMP_PFLB_begin
     int y, z, xn, yn, zn, n;
     // int label;
     GCA_NODE *gcan;
@@ -3754,8 +4631,9 @@ MRI *GCAlabelProbabilities(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *t
           for (total_p = 0.0, n = 0; n < gcan->nlabels; n++) {
             // gc = &gcan->gcs[n];
 
-            /* compute 1-d Mahalanobis distance */
-            p = GCAcomputePosteriorDensity(gcap, gcan, n, -1, vals, gca->ninputs, xn, yn, zn, gca);
+            /* compute 1-d Mahalanobis distance; as GCAcomputePosteriorDensity() */
+            p = gcaDensityTableConditionalDensity(table, gca, xn, yn, zn, &gcan->gcs[n], vals, gcan->labels[n]);
+            p *= getPrior(gcap, gcan->labels[n]);
             if (p > max_p) {
               max_p = p;
               // label = gcan->labels[n];
@@ -3773,8 +4651,11 @@ MRI *GCAlabelProbabilities(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *t
         }
       }
     }
+    ROMP_PFLB_end
   }
+  ROMP_PF_end
 
+  gcaDensityTableFree(&table);
   return (mri_dst);
 }
 
@@ -7198,8 +8079,8 @@ static int GCAupdateNodeGibbsPriors(GCA *gca, MRI *mri, int xn, int yn, int zn,
         memmove(gc->labels[i], old_labels, gc->nlabels[i] * sizeof(unsigned short));
 
         /* free the old ones */
-        free(old_label_priors);
-        free(old_labels);
+        gcaFreeStorage(old_label_priors);
+        gcaFreeStorage(old_labels);
       }
       gc->labels[i][gc->nlabels[i]++] = nbr_label;
 #else
@@ -7670,6 +8551,130 @@ MRI *GCAanneal(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform, in
 
 char *gca_write_fname = NULL;
 int gca_write_iterations = 0;
+int gca_gibbs_redblack = 0;
+
+/*-------------------------------------------------------------------
+  gcaGibbsRelabelVoxel() - one ICM update of the voxel at (x,y,z):
+  assigns the label of its prior that maximizes the Gibbs posterior
+  given the current labels of its 6 neighbors and marks it in
+  mri_changed. Returns 1 if the label changed. The posterior only reads
+  the 6-neighborhood, so voxels of the same (x+y+z) parity can be
+  updated concurrently.
+  -------------------------------------------------------------------*/
+static int gcaGibbsRelabelVoxel(GCA *gca,
+                                MRI *mri_inputs,
+                                MRI *mri_dst,
+                                MRI *mri_fixed,
+                                MRI *mri_changed,
+                                MRI *mri_probs,
+                                TRANSFORM *transform,
+                                double prior_factor,
+                                int x,
+                                int y,
+                                int z)
+{
+  int n, label, old_label;
+  GCA_PRIOR *gcap;
+  double new_posterior, max_posterior;
+  // float val;
+
+  if (x == Ggca_x && y == Ggca_y && z == Ggca_z) DiagBreak();
+
+  // if the label is fixed, don't do anything
+  if (mri_fixed && MRIgetVoxVal(mri_fixed, x, y, z, 0)) return (0);
+
+  // if not marked, don't do anything
+  if (MRIgetVoxVal(mri_changed, x, y, z, 0) == 0) return (0);
+
+  // get the grey value
+  // val =
+  MRIgetVoxVal(mri_inputs, x, y, z, 0);
+
+  /* find the node associated with this coordinate and classify */
+  gcap = getGCAP(gca, mri_inputs, transform, x, y, z);
+  // it is not in the right place
+  if (gcap == NULL) return (0);
+
+  // only one label associated, don't do anything
+  if (gcap->nlabels == 1) return (0);
+
+  // save the current label
+  label = old_label = nint(MRIgetVoxVal(mri_dst, x, y, z, 0));
+  // calculate neighborhood likelihood
+  max_posterior = GCAnbhdGibbsLogPosterior(gca, mri_dst, mri_inputs, x, y, z, transform, prior_factor);
+
+  // go through all labels at this point
+  for (n = 0; n < gcap->nlabels; n++) {
+    // skip the current label
+    if (gcap->labels[n] == old_label) continue;
+
+    // assign the new label
+    MRIsetVoxVal(mri_dst, x, y, z, 0, gcap->labels[n]);
+    // calculate neighborhood likelihood
+    new_posterior = GCAnbhdGibbsLogPosterior(gca, mri_dst, mri_inputs, x, y, z, transform, prior_factor);
+    // if it is bigger than the old one, then replace the label
+    // and change max_posterior
+    if (new_posterior > max_posterior) {
+      if (x == Ggca_x && y == Ggca_y && z == Ggca_z &&
+          (label == Ggca_label || old_label == Ggca_label || Ggca_label < 0))
+        fprintf(stdout,
+                "NbhdGibbsLogLikelihood at (%d, %d, %d):"
+                " old = %d (ll=%.2f) new = %d (ll=%.2f)\n",
+                x,
+                y,
+                z,
+                old_label,
+                max_posterior,
+                gcap->labels[n],
+                new_posterior);
+
+      max_posterior = new_posterior;
+      label = gcap->labels[n];
+    }
+  }
+
+  /*#ifndef __OPTIMIZE__*/
+  if (x == Ggca_x && y == Ggca_y && z == Ggca_z &&
+      (label == Ggca_label || old_label == Ggca_label || Ggca_label < 0)) {
+    int xn, yn, zn;
+    GCA_NODE *gcan;
+
+    if (!GCAsourceVoxelToNode(gca, mri_inputs, transform, x, y, z, &xn, &yn, &zn)) {
+      gcan = &gca->nodes[xn][yn][zn];
+      printf(
+          "(%d, %d, %d): old label %s (%d), "
+          "new label %s (%d) (log(p)=%2.3f)\n",
+          x,
+          y,
+          z,
+          cma_label_to_name(old_label),
+          old_label,
+          cma_label_to_name(label),
+          label,
+          max_posterior);
+      dump_gcan(gca, gcan, stdout, 0, gcap);
+      if (label == Right_Caudate) {
+        DiagBreak();
+      }
+    }
+  }
+  /*#endif*/
+
+  // if label changed
+  if (label != old_label) {
+    // mark it as changed
+    MRIsetVoxVal(mri_changed, x, y, z, 0, 1);
+  }
+  else {
+    MRIsetVoxVal(mri_changed, x, y, z, 0, 0);
+  }
+  // assign new label
+  MRIsetVoxVal(mri_dst, x, y, z, 0, label);
+  if (mri_probs) {
+    MRIsetVoxVal(mri_probs, x, y, z, 0, -max_posterior);
+  }
+  return (label != old_label);
+}
 
 #if 0
 double MAX_PRIOR_FACTOR = 1.0 ;
@@ -7829,13 +8834,26 @@ MRI *GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
         printf("writing snapshot to %s\n", fname);
         MRIwrite(mri_dst, fname);
       }
-      // probs has 0 to 255 values
-      mri_probs = GCAlabelProbabilities(mri_inputs, gca, NULL, transform);
-      // sorted according to ascending order of probs
-      MRIorderIndices(mri_probs, x_indices, y_indices, z_indices);
-      MRIfree(&mri_probs);
+      if (gca_gibbs_redblack) {
+        // the order within a color does not matter, so visit in raster order
+        for (index = x = 0; x < width; x++)
+          for (y = 0; y < height; y++)
+            for (z = 0; z < depth; z++) {
+              x_indices[index] = x;
+              y_indices[index] = y;
+              z_indices[index] = z;
+              index++;
+            }
+      }
+      else {
+        // probs has 0 to 255 values
+        mri_probs = GCAlabelProbabilities(mri_inputs, gca, NULL, transform);
+        // sorted according to ascending order of probs
+        MRIorderIndices(mri_probs, x_indices, y_indices, z_indices);
+        MRIfree(&mri_probs);
+      }
     }
-    else
+    else if (!gca_gibbs_redblack)  // red/black keeps the raster order of the first pass
       // randomize the indices value ((0 -> width*height*depth)
       MRIcomputeVoxelPermutation(mri_inputs, x_indices, y_indices, z_indices);
 
@@ -7846,113 +8864,41 @@ MRI *GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
       MRIcopyHeader(mri_inputs, mri_probs);
     }
 
-    //#ifdef HAVE_OPENMP
-    // pragma omp parallel for if_ROMP(experimental) reduction(+: nchanged)
-    //#endif
-    for (index = 0; index < nindices; index++) {
-      int x, y, z, n, label, old_label;
-      GCA_PRIOR *gcap;
-      double new_posterior, max_posterior;
-      // float val;
-
-      x = x_indices[index];
-      y = y_indices[index];
-      z = z_indices[index];
-      if (x == Ggca_x && y == Ggca_y && z == Ggca_z) DiagBreak();
-
-      // if the label is fixed, don't do anything
-      if (mri_fixed && MRIgetVoxVal(mri_fixed, x, y, z, 0)) continue;
-
-      // if not marked, don't do anything
-      if (MRIgetVoxVal(mri_changed, x, y, z, 0) == 0) continue;
-
-      // get the grey value
-      // val =
-      MRIgetVoxVal(mri_inputs, x, y, z, 0);
-
-      /* find the node associated with this coordinate and classify */
-      gcap = getGCAP(gca, mri_inputs, transform, x, y, z);
-      // it is not in the right place
-      if (gcap == NULL) continue;
-
-      // only one label associated, don't do anything
-      if (gcap->nlabels == 1) continue;
-
-      // save the current label
-      label = old_label = nint(MRIgetVoxVal(mri_dst, x, y, z, 0));
-      // calculate neighborhood likelihood
-      max_posterior = GCAnbhdGibbsLogPosterior(gca, mri_dst, mri_inputs, x, y, z, transform, prior_factor);
-
-      // go through all labels at this point
-      for (n = 0; n < gcap->nlabels; n++) {
-        // skip the current label
-        if (gcap->labels[n] == old_label) continue;
-
-        // assign the new label
-        MRIsetVoxVal(mri_dst, x, y, z, 0, gcap->labels[n]);
-        // calculate neighborhood likelihood
-        new_posterior = GCAnbhdGibbsLogPosterior(gca, mri_dst, mri_inputs, x, y, z, transform, prior_factor);
-        // if it is bigger than the old one, then replace the label
-        // and change max_posterior
-        if (new_posterior > max_posterior) {
-          if (x == Ggca_x && y == Ggca_y && z == Ggca_z &&
-              (label == Ggca_label || old_label == Ggca_label || Ggca_label < 0))
-            fprintf(stdout,
-                    "NbhdGibbsLogLikelihood at (%d, %d, %d):"
-                    " old = %d (ll=%.2f) new = %d (ll=%.2f)\n",
-                    x,
-                    y,
-                    z,
-                    old_label,
-                    max_posterior,
-                    gcap->labels[n],
-                    new_posterior);
-
-          max_posterior = new_posterior;
-          label = gcap->labels[n];
-        }
-      }
-
-      /*#ifndef __OPTIMIZE__*/
-      if (x == Ggca_x && y == Ggca_y && z == Ggca_z &&
-          (label == Ggca_label || old_label == Ggca_label || Ggca_label < 0)) {
-        int xn, yn, zn;
-        GCA_NODE *gcan;
-
-        if (!GCAsourceVoxelToNode(gca, mri_inputs, transform, x, y, z, &xn, &yn, &zn)) {
-          gcan = &gca->nodes[xn][yn][zn];
-          printf(
-              "(%d, %d, %d): old label %s (%d), "
-              "new label %s (%d) (log(p)=%2.3f)\n",
-              x,
-              y,
-              z,
-              cma_label_to_name(old_label),
-              old_label,
-              cma_label_to_name(label),
-              label,
-              max_posterior);
-          dump_gcan(gca, gcan, stdout, 0, gcap);
-          if (label == Right_Caudate) {
-            DiagBreak();
-          }
+    if (gca_gibbs_redblack) {
+      int color;
+      // red/black sweep: a voxel's posterior only depends on its 6
+      // neighbors, which all have the other parity, so the voxels of one
+      // color can be relabeled in parallel with the same result as any
+      // sequential order
+      for (color = 0; color < 2; color++) {
+        ROMP_PF_begin
+#ifdef HAVE_OPENMP
+        #pragma omp parallel for if_ROMP(shown_reproducible) reduction(+ : nchanged)
+#endif
+        for (index = 0; index < nindices; index++) {
+          ROMP_PFLB_begin
+          int x = x_indices[index], y = y_indices[index], z = z_indices[index];
+          if (((x + y + z) & 1) != color) ROMP_PFLB_continue;
+          nchanged += gcaGibbsRelabelVoxel(
+              gca, mri_inputs, mri_dst, mri_fixed, mri_changed, mri_probs, transform, prior_factor, x, y, z);
+          ROMP_PFLB_end
         }
+        ROMP_PF_end
       }
-      /*#endif*/
-
-      // if label changed
-      if (label != old_label) {
-        nchanged++;
-        // mark it as changed
-        MRIsetVoxVal(mri_changed, x, y, z, 0, 1);
-      }
-      else {
-        MRIsetVoxVal(mri_changed, x, y, z, 0, 0);
-      }
-      // assign new label
-      MRIsetVoxVal(mri_dst, x, y, z, 0, label);
-      if (mri_probs) {
-        MRIsetVoxVal(mri_probs, x, y, z, 0, -max_posterior);
+    }
+    else {
+      for (index = 0; index < nindices; index++) {
+        nchanged += gcaGibbsRelabelVoxel(gca,
+                                         mri_inputs,
+                                         mri_dst,
+                                         mri_fixed,
+                                         mri_changed,
+                                         mri_probs,
+                                         transform,
+                                         prior_factor,
+                                         x_indices[index],
+                                         y_indices[index],
+                                         z_indices[index]);
       }
     }
     if (mri_probs) {
@@ -8230,7 +9176,7 @@ gcaGibbsSort(GCA *gca, MRI *mri_labels, MRI *mri_inputs,
 
 double GCAgibbsImageLogPosterior(GCA *gca, MRI *mri_labels, MRI *mri_inputs, TRANSFORM *transform, double prior_factor)
 {
-  int x, width, depth, height;
+  int width, depth, height;
   double total_log_posterior;
 
   width = mri_labels->width;
@@ -8238,10 +9184,24 @@ double GCAgibbsImageLogPosterior(GCA *gca, MRI *mri_labels, MRI *mri_inputs, TRA
   depth = mri_labels->depth;
 
   total_log_posterior = 0.0;
-  // ifdef HAVE_OPENMP
-  // pragma omp parallel for if_ROMP(experimental) reduction(+: total_log_posterior)
-  // endif
-  for (x = 0; x < width; x++) {
+
+  // read-only in the labels, so the slices can be summed in parallel; the
+  // distributor keeps the partial sums independent of the number of threads
+  #define ROMP_VARIABLE       x
+  #define ROMP_LO             0
+  #define ROMP_HI             width
+
+  #define ROMP_SUMREDUCTION0  total_log_posterior
+
+  #define ROMP_FOR_LEVEL      ROMP_level_assume_reproducible
+
+#ifdef ROMP_SUPPORT_ENABLED
+  const int romp_for_line = __LINE__;
+#endif
+  #include "romp_for_begin.h"
+
+    #define total_log_posterior  ROMP_PARTIALSUM(0)
+
     int y, z;
     double log_posterior;
     for (y = 0; y < height; y++) {
@@ -8256,7 +9216,10 @@ double GCAgibbsImageLogPosterior(GCA *gca, MRI *mri_labels, MRI *mri_inputs, TRA
         }
       }
     }
-  }
+
+    #undef total_log_posterior
+  #include "romp_for_end.h"
+
   return (total_log_posterior);
 }
 static double gcaGibbsImpossibleConfiguration(GCA *gca, MRI *mri_labels, int x, int y, int z, TRANSFORM *transform)
@@ -14226,7 +15189,13 @@ GC1D *GCAfindClosestValidGC(GCA *gca, int x0, int y0, int z0, int label, int che
   int x, y, z, n, wsize;
   double dist, min_dist, det;
   GCA_NODE *gcan;
-  static MATRIX *m_cov_inv = NULL;
+  static MATRIX *m_cov_inv_tid[_MAX_FS_THREADS];
+  MATRIX *m_cov_inv;
+#ifdef HAVE_OPENMP
+  int tid = omp_get_thread_num();
+#else
+  int tid = 0;
+#endif
 
   min_dist = gca->node_width + gca->node_height + gca->node_depth;
   wsize = 1;
@@ -14256,7 +15225,7 @@ GC1D *GCAfindClosestValidGC(GCA *gca, int x0, int y0, int z0, int label, int che
             }
             gc = &gcan->gcs[n];
             det = covariance_determinant(gc, gca->ninputs);
-            m_cov_inv = load_inverse_covariance_matrix(gc, m_cov_inv, gca->ninputs);
+            m_cov_inv = m_cov_inv_tid[tid] = load_inverse_covariance_matrix(gc, m_cov_inv_tid[tid], gca->ninputs);
             if (m_cov_inv == NULL) {
               det = -1;
             }
@@ -14814,28 +15783,28 @@ int free_gcs(GC1D *gcs, int nlabels, int ninputs)
 
   for (i = 0; i < nlabels; i++) {
     if (gcs[i].means) {
-      free(gcs[i].means);
+      gcaFreeStorage(gcs[i].means);
     }
     if (gcs[i].covars) {
-      free(gcs[i].covars);
+      gcaFreeStorage(gcs[i].covars);
     }
     if (gcs[i].nlabels) /* gibbs stuff allocated */
     {
       for (j = 0; j < GIBBS_NEIGHBORHOOD; j++) {
         if (gcs[i].labels[j]) {
-          free(gcs[i].labels[j]);
+          gcaFreeStorage(gcs[i].labels[j]);
         }
         if (gcs[i].label_priors[j]) {
-          free(gcs[i].label_priors[j]);
+          gcaFreeStorage(gcs[i].label_priors[j]);
         }
       }
-      free(gcs[i].nlabels);
-      free(gcs[i].labels);
-      free(gcs[i].label_priors);
+      gcaFreeStorage(gcs[i].nlabels);
+      gcaFreeStorage(gcs[i].labels);
+      gcaFreeStorage(gcs[i].label_priors);
     }
   }
 
-  free(gcs);
+  gcaFreeStorage(gcs);
   return (NO_ERROR);
 }
 
@@ -14889,14 +15858,14 @@ int GCAfreeGibbs(GCA *gca)
         for (n = 0; n < gcan->nlabels; n++) {
           gc = &gcan->gcs[n];
           for (i = 0; i < GIBBS_NEIGHBORS; i++) {
-            free(gc->label_priors[i]);
-            free(gc->labels[i]);
+            gcaFreeStorage(gc->label_priors[i]);
+            gcaFreeStorage(gc->labels[i]);
             gc->label_priors[i] = NULL;
             gc->labels[i] = NULL;
           }
-          free(gc->nlabels);
-          free(gc->labels);
-          free(gc->label_priors);
+          gcaFreeStorage(gc->nlabels);
+          gcaFreeStorage(gc->labels);
+          gcaFreeStorage(gc->label_priors);
           gc->nlabels = NULL;
           gc->labels = NULL;
           gc->label_priors = NULL;
@@ -15004,14 +15973,8 @@ int GCArenormalizeFromAtlas(GCA *gca, GCA *gca_template)
 
 void load_vals(const MRI *mri_inputs, float x, float y, float z, float *vals, int ninputs)
 {
-  // go through all inputs and get values from inputs
-  int n;
-  for (n = 0; n < ninputs; n++) {
-    // trilinear value at float x, y, z
-    double val;
-    MRIsampleVolumeFrame(mri_inputs, x, y, z, n, &val);
-    vals[n] = val;
-  }
+  // trilinear values of all inputs at float x, y, z
+  MRIsampleVolumeFrames(mri_inputs, x, y, z, 0, ninputs - 1, SAMPLE_TRILINEAR, vals);
 }
 
 #ifdef FASTER_MRI_EM_REGISTER
@@ -15023,9 +15986,11 @@ static void load_vals_xyzInt(const MRI *mri_inputs, int x, int y, int z, float *
 
 double GCAmahDist(const GC1D *gc, const float *vals, const int ninputs)
 {
-  static VECTOR *v_means = NULL, *v_vals = NULL;
-  static MATRIX *m_cov = NULL, *m_cov_inv;
-  int i;
+  static VECTOR *v_means_tid[_MAX_FS_THREADS], *v_vals_tid[_MAX_FS_THREADS];
+  static MATRIX *m_cov_tid[_MAX_FS_THREADS], *m_cov_inv_tid[_MAX_FS_THREADS];
+  VECTOR *v_means, *v_vals;
+  MATRIX *m_cov, *m_cov_inv;
+  int i, tid;
   double dsq;
 
   if (ninputs == 1) {
@@ -15034,6 +15999,15 @@ double GCAmahDist(const GC1D *gc, const float *vals, const int ninputs)
     dsq = v * v / gc->covars[0];
     return (dsq);
   }
+#ifdef HAVE_OPENMP
+  tid = omp_get_thread_num();
+#else
+  tid = 0;
+#endif
+  v_means = v_means_tid[tid];
+  v_vals = v_vals_tid[tid];
+  m_cov = m_cov_tid[tid];
+  m_cov_inv = m_cov_inv_tid[tid];
   // printf("In GCAMahDist...ninputs = %d\n", ninputs);
   if (v_vals && ninputs != v_vals->rows) {
     VectorFree(&v_vals);
@@ -15069,6 +16043,10 @@ double GCAmahDist(const GC1D *gc, const float *vals, const int ninputs)
   /* v_means is now inverse(cov) * v_vals */
   dsq = VectorDot(v_vals, v_means);
 
+  v_means_tid[tid] = v_means;
+  v_vals_tid[tid] = v_vals;
+  m_cov_tid[tid] = m_cov;
+  m_cov_inv_tid[tid] = m_cov_inv;
   return (dsq);
 }
 double GCAmahDistIdentityCovariance(GC1D *gc, float *vals, int ninputs)
@@ -26118,6 +27096,17 @@ int GCAinsertLabels(GCA *gca,
               gc->ntraining = gcan->total_training;  // arbitrary
               gcan->total_training *= 2;
               gcan->gcs = gcs;
+              if (gcan->nlabels >= gcan->max_labels) {
+                // labels are packed tightly in a GCA that was read from disk
+                unsigned short *labels = (unsigned short *)calloc(gcan->nlabels + 1, sizeof(unsigned short));
+                if (!labels) {
+                  ErrorExit(ERROR_NOMEMORY, "GCAinsertLabels: couldn't expand labels to %d", gcan->nlabels + 1);
+                }
+                memmove(labels, gcan->labels, gcan->nlabels * sizeof(unsigned short));
+                gcaFreeStorage(gcan->labels);
+                gcan->labels = labels;
+                gcan->max_labels = gcan->nlabels + 1;
+              }
               gcan->labels[gcan->nlabels++] = label;
             }
           }
@@ -51,6 +51,8 @@ static int labelGetSurfaceRasCoords(LABEL *area, LABEL_VERTEX *lv, float *px, fl
 static int update_vertex_indices(LABEL *area);
 ;
 static LABEL_VERTEX *labelFindVertexNumber(LABEL *area, int vno);
+static int labelLivePoint(LABEL *area, int vno);
+static int labelMarkDuplicates(LABEL *area, int use_dist, double dist);
 static Transform *labelLoadTransform(const char *subject_name, const char *sdir, General_transform *transform);
 #define MAX_VERTICES 500000
 /*-----------------------------------------------------
@@ -240,6 +242,7 @@ int LabelToCanonical(LABEL *area, MRI_SURFACE *mris)
     area->lv[n].z = v->cz;
   }
   strncpy(area->space, "TkReg coords=canonical", sizeof(area->space));
+  update_vertex_indices(area);
   return (NO_ERROR);
 }
 /*-----------------------------------------------------
@@ -263,6 +266,7 @@ int LabelToCurrent(LABEL *area, MRI_SURFACE *mris)
     area->lv[n].z = v->z;
   }
   strncpy(area->space, "TkReg coords=canonical", sizeof(area->space));
+  update_vertex_indices(area);
   return (NO_ERROR);
 }
 /*-----------------------------------------------------
@@ -327,6 +331,7 @@ int LabelFromCanonical(LABEL *area, MRI_SURFACE *mris)
     lv->y = v->cy;
     lv->z = v->cz;
   }
+  update_vertex_indices(area);
   MRISPfree(&mrisp);
   return (NO_ERROR);
 }
@@ -482,6 +487,7 @@ int LabelFromTalairach(LABEL *area, MRI_SURFACE *mris)
     area->lv[n].y = v->origy;
     area->lv[n].z = v->origz;
   }
+  update_vertex_indices(area);
   return (NO_ERROR);
 }
 #endif
@@ -525,6 +531,7 @@ int LabelToFlat(LABEL *area, MRI_SURFACE *mris)
     }
   }
   MHTfree(&mht);
+  update_vertex_indices(area);
   return (NO_ERROR);
 }
 int LabelWriteInto(LABEL *area, FILE *fp)
@@ -689,17 +696,38 @@ int LabelRipRestOfSurfaceWithThreshold(LABEL *area, MRI_SURFACE *mris, float thr
 ------------------------------------------------------*/
 int LabelRemoveOverlap(LABEL *area1, LABEL *area2)
 {
-  int n1, n2, vno;
+  int n, vno, vmin, vmax;
+  unsigned char *in_area2;
 
-  for (n1 = 0; n1 < area1->n_points; n1++) {
-    vno = area1->lv[n1].vno;
-    for (n2 = 0; n2 < area2->n_points; n2++) {
-      if (vno == area2->lv[n2].vno) {
-        area1->lv[n1].deleted = 1;
-        break;
-      }
+  if (area1->n_points == 0 || area2->n_points == 0) {
+    return (NO_ERROR);
+  }
+
+  // flag the vertex numbers of area2 in a table over their range
+  vmin = vmax = area2->lv[0].vno;
+  for (n = 1; n < area2->n_points; n++) {
+    vno = area2->lv[n].vno;
+    if (vno < vmin) {
+      vmin = vno;
     }
+    if (vno > vmax) {
+      vmax = vno;
+    }
+  }
+  in_area2 = (unsigned char *)calloc(vmax - vmin + 1, sizeof(unsigned char));
+  if (!in_area2) ErrorExit(ERROR_NOMEMORY, "%s: could not allocate LabelRemoveOverlap table.", Progname);
+  for (n = 0; n < area2->n_points; n++) {
+    in_area2[area2->lv[n].vno - vmin] = 1;
   }
+
+  for (n = 0; n < area1->n_points; n++) {
+    vno = area1->lv[n].vno;
+    if (vno >= vmin && vno <= vmax && in_area2[vno - vmin]) {
+      area1->lv[n].deleted = 1;
+    }
+  }
+  free(in_area2);
+  update_vertex_indices(area1);
   return (NO_ERROR);
 }
 /*-----------------------------------------------------
@@ -739,7 +767,7 @@ int LabelIntersect(LABEL *area1, LABEL *area2)
       vmax = vno;
     }
   }
-  vnum = vmax - vmin;
+  vnum = vmax - vmin + 1;
   isec = (int *)calloc(vnum, sizeof(int));
   if (!isec) ErrorExit(ERROR_NOMEMORY, "%s: could not allocate LabelIntersect struct.", Progname);
   for (n = 0; n < vnum; n++) {
@@ -757,6 +785,8 @@ int LabelIntersect(LABEL *area1, LABEL *area2)
       area1->lv[isec[vno]].deleted = 0;
     }
   }
+  free(isec);
+  update_vertex_indices(area1);
 
   return (NO_ERROR);
 }
@@ -1195,6 +1225,7 @@ LABEL *LabelCombine(LABEL *asrc, LABEL *adst)
     memmove(vdst, vsrc, sizeof(LV));
   }
   adst->n_points += asrc->n_points;
+  update_vertex_indices(adst);
   return (adst);
 }
 /*-----------------------------------------------------
@@ -1216,10 +1247,12 @@ LABEL *LabelCopy(LABEL *asrc, LABEL *adst)
   adst->coords = asrc->coords;
   strcpy(adst->space, asrc->space);
   if (asrc->vertex_label_ind) {
-    adst->vertex_label_ind = (int *)calloc(asrc->max_points, sizeof(int));
+    if (adst->vertex_label_ind) free(adst->vertex_label_ind);
+    adst->vertex_label_ind = (int *)calloc(asrc->nvertices_ind, sizeof(int));
     if (adst->vertex_label_ind == NULL)
-      ErrorExit(ERROR_NOMEMORY, "LabelCompact: could not allocate %d long label index array", asrc->max_points);
-    memmove(adst->vertex_label_ind, asrc->vertex_label_ind, asrc->max_points * sizeof(int));
+      ErrorExit(ERROR_NOMEMORY, "LabelCopy: could not allocate %d long label index array", asrc->nvertices_ind);
+    memmove(adst->vertex_label_ind, asrc->vertex_label_ind, asrc->nvertices_ind * sizeof(int));
+    adst->nvertices_ind = asrc->nvertices_ind;
   }
 
   adst->n_points = asrc->n_points;
@@ -1236,30 +1269,9 @@ LABEL *LabelCopy(LABEL *asrc, LABEL *adst)
   ------------------------------------------------------*/
 int LabelRemoveDuplicates(LABEL *area)
 {
-  int n1, n2, deleted = 0;
-  LV *lv1, *lv2;
+  int deleted;
 
-  // loop thru each label point
-  for (n1 = 0; n1 < area->n_points; n1++) {
-    lv1 = &area->lv[n1];
-    if (lv1->deleted) {
-      continue;
-    }
-    // loop thru the remaining looking for duplicates
-    for (n2 = n1 + 1; n2 < area->n_points; n2++) {
-      lv2 = &area->lv[n2];
-      if (lv1->vno >= 0 && lv2->vno >= 0 && lv1->vno == lv2->vno) {
-        deleted++;
-        lv2->deleted = 1;
-      }
-      else if (lv1->vno < 0 && lv2->vno < 0) {
-        if (FEQUAL(lv1->x, lv2->x) && FEQUAL(lv1->y, lv2->y) && FEQUAL(lv1->z, lv2->z)) {
-          deleted++;
-          lv2->deleted = 1;
-        }
-      }
-    }
-  }
+  deleted = labelMarkDuplicates(area, 0, 0.0);
 
   if (Gdiag & DIAG_SHOW) fprintf(stderr, "%d duplicate vertices removed from label %s.\n", deleted, area->name);
   return (NO_ERROR);
@@ -1272,33 +1284,117 @@ int LabelRemoveDuplicates(LABEL *area)
   ------------------------------------------------------*/
 LABEL *LabelRemoveAlmostDuplicates(LABEL *area, double dist, LABEL *ldst)
 {
-  int n1, n2, deleted = 0;
-  LV *lv1, *lv2;
+  int deleted;
 
-  // loop thru each label point
-  for (n1 = 0; n1 < area->n_points; n1++) {
-    lv1 = &area->lv[n1];
-    if (lv1->deleted) {
+  deleted = labelMarkDuplicates(area, 1, dist);
+  if (Gdiag & DIAG_SHOW) fprintf(stderr, "%d duplicate vertices removed from label %s.\n", deleted, area->name);
+  ldst = LabelCompact(area, ldst);
+  return (ldst);
+}
+
+typedef struct
+{
+  float x;
+  int n;
+} LABEL_SORT_ELT;
+
+static int compare_label_sort_elts(const void *v1, const void *v2)
+{
+  const LABEL_SORT_ELT *e1 = (const LABEL_SORT_ELT *)v1, *e2 = (const LABEL_SORT_ELT *)v2;
+
+  if (e1->x < e2->x) return (-1);
+  if (e1->x > e2->x) return (1);
+  return (e1->n - e2->n);
+}
+
+static int labelCoordsEqual(float f1, float f2, int use_dist, double dist)
+{
+  if (use_dist) return (fabs(f1 - f2) < dist);
+  return (FEQUAL(f1, f2));
+}
+
+/*-----------------------------------------------------
+  labelMarkDuplicates() - sets the deleted flag of every label
+  point that duplicates an earlier undeleted point: same vertex
+  number, or for unassigned points (vno < 0) the same coordinates
+  (FEQUAL, or closer than dist in each coordinate if use_dist).
+  Gives the same result as comparing all pairs of points but
+  vertex numbers are looked up in a table and unassigned points
+  are only compared to the ones with similar x (sorted by x).
+  Returns the number of duplicates found.
+  ------------------------------------------------------*/
+static int labelMarkDuplicates(LABEL *area, int use_dist, double dist)
+{
+  int n, n2, k, k2, vmax, nunassigned, deleted = 0, *pos;
+  unsigned char *seen;
+  LABEL_SORT_ELT *sorted;
+  LV *lv, *lv2;
+
+  if (area->n_points == 0) return (0);
+
+  vmax = -1;
+  nunassigned = 0;
+  for (n = 0; n < area->n_points; n++) {
+    if (area->lv[n].vno > vmax) vmax = area->lv[n].vno;
+    if (area->lv[n].vno < 0) nunassigned++;
+  }
+  seen = (unsigned char *)calloc(vmax + 1, sizeof(unsigned char));
+  pos = (int *)calloc(area->n_points, sizeof(int));
+  sorted = (LABEL_SORT_ELT *)calloc(nunassigned + 1, sizeof(LABEL_SORT_ELT));
+  if (!seen || !pos || !sorted)
+    ErrorExit(ERROR_NOMEMORY, "%s: could not allocate duplicate tables for %d points", Progname, area->n_points);
+
+  for (k = n = 0; n < area->n_points; n++)
+    if (area->lv[n].vno < 0) {
+      sorted[k].x = area->lv[n].x;
+      sorted[k].n = n;
+      k++;
+    }
+  qsort(sorted, nunassigned, sizeof(LABEL_SORT_ELT), compare_label_sort_elts);
+  for (k = 0; k < nunassigned; k++) pos[sorted[k].n] = k;
+
+  // loop thru each label point in order, so the first one of a set of duplicates is kept
+  for (n = 0; n < area->n_points; n++) {
+    lv = &area->lv[n];
+    if (lv->vno >= 0) {
+      if (seen[lv->vno]) {  // an earlier undeleted point has this vertex
+        deleted++;
+        lv->deleted = 1;
+      }
+      else if (!lv->deleted) {
+        seen[lv->vno] = 1;
+      }
+      continue;
+    }
+    if (lv->deleted) {
       continue;
     }
-    // loop thru the remaining looking for duplicates
-    for (n2 = n1 + 1; n2 < area->n_points; n2++) {
+    // look for later unassigned points with the same coords on both sides in x
+    for (k2 = pos[n] + 1; k2 < nunassigned; k2++) {
+      n2 = sorted[k2].n;
       lv2 = &area->lv[n2];
-      if (lv1->vno >= 0 && lv2->vno >= 0 && lv1->vno == lv2->vno) {
+      if (!labelCoordsEqual(lv->x, lv2->x, use_dist, dist)) break;
+      if (n2 > n && labelCoordsEqual(lv->y, lv2->y, use_dist, dist) && labelCoordsEqual(lv->z, lv2->z, use_dist, dist)) {
         deleted++;
         lv2->deleted = 1;
       }
-      else if (lv1->vno < 0 && lv2->vno < 0) {
-        if (fabs(lv1->x - lv2->x) < dist && fabs(lv1->y - lv2->y) < dist && fabs(lv1->z - lv2->z) < dist) {
-          deleted++;
-          lv2->deleted = 1;
-        }
+    }
+    for (k2 = pos[n] - 1; k2 >= 0; k2--) {
+      n2 = sorted[k2].n;
+      lv2 = &area->lv[n2];
+      if (!labelCoordsEqual(lv->x, lv2->x, use_dist, dist)) break;
+      if (n2 > n && labelCoordsEqual(lv->y, lv2->y, use_dist, dist) && labelCoordsEqual(lv->z, lv2->z, use_dist, dist)) {
+        deleted++;
+        lv2->deleted = 1;
       }
     }
   }
-  if (Gdiag & DIAG_SHOW) fprintf(stderr, "%d duplicate vertices removed from label %s.\n", deleted, area->name);
-  ldst = LabelCompact(area, ldst);
-  return (ldst);
+
+  free(seen);
+  free(pos);
+  free(sorted);
+  update_vertex_indices(area);
+  return (deleted);
 }
 LABEL *LabelCompact(LABEL *lsrc, LABEL *ldst)
 {
@@ -1308,12 +1404,14 @@ LABEL *LabelCompact(LABEL *lsrc, LABEL *ldst)
 
   ldst = LabelRealloc(ldst, n);
   if (ldst != lsrc && lsrc->vertex_label_ind) {
-    ldst->vertex_label_ind = (int *)calloc(lsrc->max_points, sizeof(int));
+    if (ldst->vertex_label_ind) free(ldst->vertex_label_ind);
+    ldst->vertex_label_ind = (int *)calloc(lsrc->nvertices_ind, sizeof(int));
     if (ldst->vertex_label_ind == NULL)
-      ErrorExit(ERROR_NOMEMORY, "LabelCompact: could not allocate %d long label index array", lsrc->max_points);
+      ErrorExit(ERROR_NOMEMORY, "LabelCompact: could not allocate %d long label index array", lsrc->nvertices_ind);
+    ldst->nvertices_ind = lsrc->nvertices_ind;
   }
   if (ldst->vertex_label_ind != NULL)
-    for (i = 0; i < ldst->max_points; i++) ldst->vertex_label_ind[i] = -1;
+    for (i = 0; i < ldst->nvertices_ind; i++) ldst->vertex_label_ind[i] = -1;
 
   for (i = n = 0; i < lsrc->n_points; i++)
     if (lsrc->lv[i].deleted == 0) {
@@ -1323,7 +1421,9 @@ LABEL *LabelCompact(LABEL *lsrc, LABEL *ldst)
       ldst->lv[n].z = lsrc->lv[i].z;
       ldst->lv[n].vno = lsrc->lv[i].vno;
       ldst->lv[n].stat = lsrc->lv[i].stat;
-      if (lsrc->lv[i].vno >= 0 && lsrc->lv[i].vno < ldst->max_points) ldst->vertex_label_ind[lsrc->lv[i].vno] = n;
+      if (ldst->vertex_label_ind && lsrc->lv[i].vno >= 0 && lsrc->lv[i].vno < ldst->nvertices_ind &&
+          ldst->vertex_label_ind[lsrc->lv[i].vno] < 0)
+        ldst->vertex_label_ind[lsrc->lv[i].vno] = n;
       n++;
     }
   ldst->n_points = n;
@@ -2190,8 +2290,8 @@ int LabelErode(LABEL *area, MRI_SURFACE *mris, int num_times)
 
 int LabelDilate(LABEL *area, MRI_SURFACE *mris, int num_times, int coords)
 {
-  int n, neighbor_index, neighbor_vno, found, vno;
-  VERTEX *vn, *v;
+  int n, i, neighbor_index, neighbor_vno, vno, first, last, ncandidates, *candidates;
+  VERTEX *v;
 
   //  printf("LabelDilate(%d, %d)\n", num_times, coords) ;
   if (NULL == area) {
@@ -2204,62 +2304,65 @@ int LabelDilate(LABEL *area, MRI_SURFACE *mris, int num_times, int coords)
     ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "LabelDilate: num_times < 1"));
   }
 
-  MRISclearMarks(mris);
-  for (n = 0; n < num_times; n++) {
-    LabelMark(area, mris);  // all vertices in label now have v->marked==1
+  candidates = (int *)calloc(mris->nvertices, sizeof(int));
+  if (!candidates) ErrorExit(ERROR_NOMEMORY, "LabelDilate: could not allocate %d candidates", mris->nvertices);
 
-    /* For each vertex in the label... */
-    for (vno = 0; vno < mris->nvertices; vno++) {
-      v = &mris->vertices[vno];
-      if (vno == Gdiag_no) DiagBreak();
+  MRISclearMarks(mris);
+  LabelMark(area, mris);  // all vertices in label now have v->marked==1
 
-      if (v->marked == 1)  // already in label
-        continue;
+  // only the neighbors of the points added in the previous iteration
+  // (all points in the first one) can be added in an iteration
+  first = 0;
+  for (n = 0; n < num_times; n++) {
+    last = area->n_points;
+    ncandidates = 0;
+    for (i = first; i < last; i++) {
+      if (area->lv[i].deleted || area->lv[i].vno < 0) continue;
 
-      // Check its neighbors. If any are in the label, add it
-      found = 0;
+      v = &mris->vertices[area->lv[i].vno];
       for (neighbor_index = 0; neighbor_index < v->vnum; neighbor_index++) {
-        /* Look for neighbor_vno in the label. */
-        neighbor_vno = mris->vertices[vno].v[neighbor_index];
-        vn = &mris->vertices[neighbor_vno];
-        if (vn->marked > 0) {
-          if (neighbor_vno == Gdiag_no) DiagBreak();
-
-          found = 1;
-          break;
-        }
+        neighbor_vno = v->v[neighbor_index];
+        if (mris->vertices[neighbor_vno].marked)  // already in label or a candidate
+          continue;
+        mris->vertices[neighbor_vno].marked = 2;
+        candidates[ncandidates++] = neighbor_vno;
       }
+    }
 
-      // add it if at least one nbr was found that was in label
-      if (found) {
-        LV *lv;
-        int n;
+    // add them in vertex order, as a sweep over the surface would
+    qsort(candidates, ncandidates, sizeof(int), compare_ints);
+    for (i = 0; i < ncandidates; i++) {
+      LV *lv;
+      int n;
 
-        if (area->n_points >= area->max_points) LabelRealloc(area, nint(area->max_points * 1.5));
+      vno = candidates[i];
+      v = &mris->vertices[vno];
+      if (area->n_points >= area->max_points) LabelRealloc(area, nint(area->max_points * 1.5));
 
-        if (vno == Gdiag_no) DiagBreak();
+      if (vno == Gdiag_no) DiagBreak();
 
-        n = area->n_points++;
-        lv = &area->lv[n];
-        lv->vno = vno;
-        MRISgetCoords(v, coords, &lv->x, &lv->y, &lv->z);
-        if (area->vertex_label_ind) area->vertex_label_ind[vno] = n;
-        if (area->mris && area->mri_template) {
-          double xv, yv, zv;
-          MRISsurfaceRASToVoxel(area->mris, area->mri_template, lv->x, lv->y, lv->z, &xv, &yv, &zv);
-          lv->xv = nint(xv);
-          lv->yv = nint(yv);
-          lv->zv = nint(zv);
-        }
-        //	printf("LabelDilate: added vertex %d (%d)\n", vno, n) ;
+      n = area->n_points++;
+      lv = &area->lv[n];
+      lv->vno = vno;
+      MRISgetCoords(v, coords, &lv->x, &lv->y, &lv->z);
+      if (area->vertex_label_ind && vno < area->nvertices_ind && area->vertex_label_ind[vno] < 0)
+        area->vertex_label_ind[vno] = n;
+      if (area->mris && area->mri_template) {
+        double xv, yv, zv;
+        MRISsurfaceRASToVoxel(area->mris, area->mri_template, lv->x, lv->y, lv->z, &xv, &yv, &zv);
+        lv->xv = nint(xv);
+        lv->yv = nint(yv);
+        lv->zv = nint(zv);
       }
+      v->marked = 1;
+      //	printf("LabelDilate: added vertex %d (%d)\n", vno, n) ;
     }
-
-    /* Point the label's lv to the new one and update the number of
-      points. */
-    LabelUnmark(area, mris);
+    first = last;
   }
 
+  LabelUnmark(area, mris);
+  free(candidates);
+
   update_vertex_indices(area);
 
   //  printf("area->max_points = %d\n",area->max_points) ;
@@ -2269,15 +2372,9 @@ int LabelDilate(LABEL *area, MRI_SURFACE *mris, int num_times, int coords)
 static LABEL_VERTEX *labelFindVertexNumber(LABEL *area, int vno)
 {
   int n;
-  LABEL_VERTEX *lv;
 
-  for (n = 0; n < area->n_points; n++) {
-    lv = &area->lv[n];
-    if (lv->vno == vno) {
-      return (lv);
-    }
-  }
-  return (NULL);
+  n = LabelHasVertex(vno, area);
+  return (n >= 0 ? &area->lv[n] : NULL);
 }
 
 int LabelSetStat(LABEL *area, float stat)
@@ -2470,11 +2567,17 @@ LABEL *LabelFillHolesWithOrig(LABEL *area_src, MRI_SURFACE *mris)
 /*---------------------------------------------------------------
   LabelHasVertex() - returns -1 if the vertex is not in the label,
   otherwise returns the number of the label point that corresponds
-  to the vertex number.
+  to the vertex number. If the label has a vertex index (see
+  LabelIndexVertices()) this is a lookup, otherwise the label
+  points are searched. Either way the first point with the vertex
+  number is returned, whether it is deleted or not.
   ---------------------------------------------------------------*/
 int LabelHasVertex(int vtxno, LABEL *lb)
 {
   int n;
+  if (lb->vertex_label_ind && vtxno >= 0 && vtxno < lb->nvertices_ind) {
+    return (lb->vertex_label_ind[vtxno]);
+  }
   for (n = 0; n < lb->n_points; n++)
     if (lb->lv[n].vno == vtxno) {
       return (n);
@@ -2577,18 +2680,12 @@ LABEL *LabelfromASeg(MRI *aseg, int segcode)
 
 /*---------------------------------------------------------------
   VertexIsInLabel() - returns a 1 if the given vertex number is
-  in the label. Label must be surface-based.
+  in the label, ie, if LabelHasVertex() finds a point for it.
+  Label must be surface-based.
   ---------------------------------------------------------------*/
 int VertexIsInLabel(int vtxno, LABEL *label)
 {
-  int n;
-
-  for (n = 0; n < label->n_points; n++)
-    if (label->lv[n].vno == vtxno) {
-      return (1);
-    }
-
-  return (0);
+  return (LabelHasVertex(vtxno, label) >= 0);
 }
 /*---------------------------------------------------------------
   LabelBoundary() - returns a label of all the points in the input
@@ -2772,6 +2869,7 @@ int LabelUnassign(LABEL *area)
   for (i = 0; i < area->n_points; i++) {
     area->lv[i].vno = -1;
   }
+  update_vertex_indices(area);
   return (NO_ERROR);
 }
 
@@ -2853,6 +2951,7 @@ int LabelThreshold(LABEL *area, float thresh)
       ndel++;
     }
   }
+  update_vertex_indices(area);
   return (ndel);
 }
 
@@ -2875,6 +2974,7 @@ int LabelCropAnterior(LABEL *area, float anterior_dist)
       area->lv[n].deleted = 1;
     }
   }
+  update_vertex_indices(area);
   return (NO_ERROR);
 }
 
@@ -2897,6 +2997,7 @@ int LabelCropPosterior(LABEL *area, float anterior_dist)
       area->lv[n].deleted = 1;
     }
   }
+  update_vertex_indices(area);
   return (NO_ERROR);
 }
 
@@ -3392,7 +3493,7 @@ LABEL *LabelSampleToSurface(MRI_SURFACE *mris, LABEL *area, MRI *mri_template, i
     }
     if (min_vno == Gdiag_no) DiagBreak();
     lv->vno = min_vno;
-    area_dst->vertex_label_ind[min_vno] = n;
+    if (min_vno >= 0 && area_dst->vertex_label_ind[min_vno] < 0) area_dst->vertex_label_ind[min_vno] = n;
   }
   //  LabelRemoveDuplicates(area) ;
   //  MHTfree(&mht) ;
@@ -3444,7 +3545,7 @@ LABEL *LabelSampleToSurface(MRI_SURFACE *mris, LABEL *area, MRI *mri_template, i
           lv->z = zw;
           lv->stat = vn->val;
           vn->marked = 1;
-          area_dst->vertex_label_ind[vno2] = area_dst->n_points;
+          if (area_dst->vertex_label_ind[vno2] < 0) area_dst->vertex_label_ind[vno2] = area_dst->n_points;
           nchanged++;
           area_dst->n_points++;
         }
@@ -3510,9 +3611,11 @@ int LabelInit(LABEL *area, MRI *mri_template, MRI_SURFACE *mris, int coords)
   area->mris = mris;
 
   // create a volume of indices into the label. Voxels < 0 are not mapped
+  if (area->vertex_label_ind) free(area->vertex_label_ind);
   area->vertex_label_ind = (int *)calloc(mris->nvertices, sizeof(int));
   if (area->vertex_label_ind == NULL)
     ErrorExit(ERROR_NOMEMORY, "LabelInit: could not allocate %d-long vertex index array", mris->nvertices);
+  area->nvertices_ind = mris->nvertices;
   for (n = 0; n < mris->nvertices; n++) area->vertex_label_ind[n] = -1;  // means that this vertex is not in th elabel
 
   MRIScomputeVertexSpacingStats(mris, NULL, NULL, &max_spacing, NULL, &max_vno, coords);
@@ -3522,12 +3625,12 @@ int LabelInit(LABEL *area, MRI *mri_template, MRI_SURFACE *mris, int coords)
   for (n = 0; n < area->n_points; n++) {
     lv = &area->lv[n];
 
-    if (lv->deleted) continue;
     if (lv->vno >= 0 && lv->vno <= mris->nvertices)  // vertex already assigned
     {
-      area->vertex_label_ind[lv->vno] = n;
+      if (area->vertex_label_ind[lv->vno] < 0) area->vertex_label_ind[lv->vno] = n;
       continue;
     }
+    if (lv->deleted) continue;
 
     // vertex not assigned to this label vertex - assign all surface vertices at this location to the label
     // note that this includes the closest vertex, even if it does not sit in the same voxel
@@ -3582,7 +3685,7 @@ int LabelInit(LABEL *area, MRI *mri_template, MRI_SURFACE *mris, int coords)
       if (min_vno == 0) DiagBreak();
       if (min_vno >= 0) {
         lv->vno = min_vno;
-        area->vertex_label_ind[lv->vno] = n;
+        if (area->vertex_label_ind[lv->vno] < 0) area->vertex_label_ind[lv->vno] = n;
       }
 
       // now assign other surface vertices that fall into the same voxel to the label
@@ -3591,7 +3694,7 @@ int LabelInit(LABEL *area, MRI *mri_template, MRI_SURFACE *mris, int coords)
         vno = bin->fno;
         v = &mris->vertices[vno];
         if (vno == Gdiag_no) DiagBreak();
-        if (area->vertex_label_ind[vno] >= 0) continue;  // already in the label
+        if (labelLivePoint(area, vno) >= 0) continue;  // already in the label
 
         // check to see if this vertex maps to the voxel in question and if so add it
         MRISgetCoords(v, coords, &x, &y, &z);
@@ -3601,12 +3704,14 @@ int LabelInit(LABEL *area, MRI *mri_template, MRI_SURFACE *mris, int coords)
     }
     MHTrelBucket(&bucket);
   }
+  // points added above can precede ones appended by LabelAddVertex()
+  update_vertex_indices(area);
   return (NO_ERROR);
 }
 
 int LabelAddVoxel(LABEL *area, int xv, int yv, int zv, int coords, int *vertices, int *pnvertices)
 {
-  int n, min_vno, i, vno;
+  int n, min_vno, i, vno, in_label;
   LV *lv;
   double min_dist, dist, x, y, z, vx, vy, vz, dx, dy, dz;
   VERTEX *v;
@@ -3679,10 +3784,11 @@ int LabelAddVoxel(LABEL *area, int xv, int yv, int zv, int coords, int *vertices
       min_vno = vno;
     }
   }
+  in_label = (min_vno >= 0 && labelLivePoint(area, min_vno) >= 0);
   lv->vno = min_vno;
-  if (min_vno >= 0 && area->vertex_label_ind[min_vno] < 0)  // found one that isn't in label
+  if (min_vno >= 0 && !in_label)  // found one that isn't in label
   {
-    area->vertex_label_ind[min_vno] = n;
+    if (area->vertex_label_ind[min_vno] < 0) area->vertex_label_ind[min_vno] = n;
     if (pnvertices) {
       int n = *pnvertices;
       vertices[n] = min_vno;
@@ -3697,7 +3803,7 @@ int LabelAddVoxel(LABEL *area, int xv, int yv, int zv, int coords, int *vertices
   for (bin = bucket->bins, i = 0; i < bucket->nused; i++, bin++)  // find min dist vertex
   {
     vno = bin->fno;
-    if (area->vertex_label_ind[vno] >= 0) continue;  // already in the label
+    if (labelLivePoint(area, vno) >= 0) continue;  // already in the label
     v = &((MRI_SURFACE *)(area->mris))->vertices[vno];
     if (vno == Gdiag_no) DiagBreak();
 
@@ -3747,7 +3853,6 @@ int LabelDeleteVoxel(LABEL *area, int xv, int yv, int zv, int *vertices, int *pn
       if (lv->vno >= 0) {
         if (vertices) vertices[ndeleted] = lv->vno;
         ndeleted++;
-        if (area->vertex_label_ind) area->vertex_label_ind[lv->vno] = -1;
       }
     }
   }
@@ -3769,8 +3874,8 @@ int LabelDeleteVoxel(LABEL *area, int xv, int yv, int zv, int *vertices, int *pn
   the entire LV structure using memcpy(), and increments
   n_points. This differs from LabelAddVertex(). LabelAddVertex()
   specifically adds a surface vertex to the label computing the xyz
-  from the surface coords and updates vertex_label_ind; this function
-  does neither of those.
+  from the surface coords; this function does not. Both update
+  vertex_label_ind (if the label has one).
 */
 LABEL *LabelAddPoint(LABEL *label, LV *lv)
 {
@@ -3780,6 +3885,9 @@ LABEL *LabelAddPoint(LABEL *label, LV *lv)
   if (label->n_points >= label->max_points) LabelRealloc(label, nint(label->max_points * 1.5));
   // copy structure
   memcpy(&(label->lv[label->n_points]), lv, sizeof(LV));
+  if (label->vertex_label_ind && lv->vno >= 0 && lv->vno < label->nvertices_ind &&
+      label->vertex_label_ind[lv->vno] < 0)
+    label->vertex_label_ind[lv->vno] = label->n_points;
   // increment the number of points
   label->n_points++;
   return (label);
@@ -3789,10 +3897,10 @@ LABEL *LabelAddPoint(LABEL *label, LV *lv)
   Adds a surface vertex to a label (note: a surface vertex is
   different from a label vertex). Reallocs label if needed.  Sets the
   coordinates based on the coordinates of the given vertex and the
-  coords argument. The voxel coordinates are computed. If the label
-  already exists as indicated by area->vertex_label_ind[vno], then
-  nothing is done and -1 is returned. See also LabelDeleteVertex() and
-  LabelAddPoint().
+  coords argument. The voxel coordinates are computed. If the vertex
+  already has an undeleted point in the label (found from
+  area->vertex_label_ind[vno]), then nothing is done and -1 is
+  returned. See also LabelDeleteVertex() and LabelAddPoint().
  */
 int LabelAddVertex(LABEL *area, int vno, int coords)
 {
@@ -3803,7 +3911,7 @@ int LabelAddVertex(LABEL *area, int vno, int coords)
 
   x = y = z = -1;
 
-  if (area->vertex_label_ind[vno] >= 0) return (-1);  // already in the label
+  if (labelLivePoint(area, vno) >= 0) return (-1);  // already in the label
   if (area->n_points >= area->max_points) LabelRealloc(area, nint(1.5 * area->n_points));
 
   n = area->n_points++;  // n is the number of points before incr
@@ -3820,7 +3928,7 @@ int LabelAddVertex(LABEL *area, int vno, int coords)
   lv->yv = nint(yv);
   lv->zv = nint(zv);
 
-  area->vertex_label_ind[vno] = n;
+  if (area->vertex_label_ind[vno] < 0) area->vertex_label_ind[vno] = n;
   return (NO_ERROR);
 }
 
@@ -3828,23 +3936,70 @@ int LabelDeleteVertex(LABEL *area, int vno, int coords)
 {
   int n;
 
-  if (area->vertex_label_ind[vno] < 0) return (-1);
-  n = area->vertex_label_ind[vno];
-  area->vertex_label_ind[vno] = -1;
+  n = labelLivePoint(area, vno);
+  if (n < 0) return (-1);
   area->lv[n].deleted = 1;
   return (NO_ERROR);
 }
+/*
+  labelLivePoint() - returns the first undeleted point of vertex vno,
+  or -1 if there is none. vertex_label_ind[vno] is the first point of
+  the vertex whether deleted or not, so the search starts there.
+*/
+static int labelLivePoint(LABEL *area, int vno)
+{
+  int n;
+
+  for (n = area->vertex_label_ind[vno]; n >= 0 && n < area->n_points; n++)
+    if (area->lv[n].vno == vno && !area->lv[n].deleted) return (n);
+  return (-1);
+}
+/*!
+  \fn int LabelIndexVertices(LABEL *area, int nvertices)
+  \brief Builds area->vertex_label_ind, the index of the label point of
+  each surface vertex (-1 if the vertex is not in the label), so that
+  LabelHasVertex(), VertexIsInLabel() and LabelAddVertex() are lookups
+  instead of searches. The entry of a vertex is its first point,
+  deleted or not, which is what the LabelHasVertex() search returns;
+  the editing functions (LabelAddVertex(), LabelDeleteVertex(), ...)
+  look for an undeleted point from there. nvertices is the length of the index; if <= 0
+  the number of vertices of area->mris (or the largest vertex number
+  in the label + 1) is used. The label functions keep the index up to
+  date; code that changes the vno or deleted fields of the label points
+  directly has to call this again.
+*/
+int LabelIndexVertices(LABEL *area, int nvertices)
+{
+  int n;
+
+  if (nvertices <= 0) {
+    if (area->mris)
+      nvertices = ((MRI_SURFACE *)(area->mris))->nvertices;
+    else
+      for (n = 0; n < area->n_points; n++)
+        if (area->lv[n].vno >= nvertices) nvertices = area->lv[n].vno + 1;
+  }
+  if (area->vertex_label_ind == NULL || area->nvertices_ind != nvertices) {
+    if (area->vertex_label_ind) free(area->vertex_label_ind);
+    area->vertex_label_ind = (int *)calloc(nvertices > 0 ? nvertices : 1, sizeof(int));
+    if (area->vertex_label_ind == NULL)
+      ErrorExit(ERROR_NOMEMORY, "LabelIndexVertices: could not allocate %d-long vertex index array", nvertices);
+    area->nvertices_ind = nvertices;
+  }
+  return (update_vertex_indices(area));
+}
 static int update_vertex_indices(LABEL *area)
 {
   int vno, n;
-  MRI_SURFACE *mris = (MRI_SURFACE *)(area->mris);
 
-  if (area->vertex_label_ind == NULL || mris == NULL) return (NO_ERROR);
+  if (area->vertex_label_ind == NULL) return (NO_ERROR);
 
-  for (vno = 0; vno < mris->nvertices; vno++) area->vertex_label_ind[vno] = -1;
+  for (vno = 0; vno < area->nvertices_ind; vno++) area->vertex_label_ind[vno] = -1;
 
-  for (n = 0; n < area->n_points; n++)
-    if (area->lv[n].deleted == 0) area->vertex_label_ind[area->lv[n].vno] = n;
+  for (n = 0; n < area->n_points; n++) {
+    vno = area->lv[n].vno;
+    if (vno >= 0 && vno < area->nvertices_ind && area->vertex_label_ind[vno] < 0) area->vertex_label_ind[vno] = n;
+  }
   return (NO_ERROR);
 }
 LABEL *LabelApplyMatrix(LABEL *lsrc, MATRIX *m, LABEL *ldst)
@@ -0,0 +1,309 @@
+/**
+ * @file  mgzblock.c
+ * @brief seekable block-compressed gzip members for .mgz volumes
+ *
+ * See mgzblock.h for the layout. Each indexed member is a standard gzip
+ * member (RFC 1952) with FLG.FEXTRA set and a single 16 byte 'F','S'
+ * subfield: the compressed size of the whole member followed by its
+ * uncompressed size, both little endian 64 bit.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "zlib.h"
+
+#include "error.h"
+#include "mgzblock.h"
+
+#define MGZB_HEADER_SIZE 32 /* 10 fixed + 2 XLEN + 4 subfield header + 16 data */
+#define MGZB_XLEN 20
+#define MGZB_SI1 'F'
+#define MGZB_SI2 'S'
+#define MGZB_FEXTRA 0x04
+#define MGZB_IOSIZE (256 * 1024)
+#define MGZB_MAXPASS (1U << 30) /* zlib counts are 32 bit */
+
+static void put_le(unsigned char *p, unsigned long long v, int nbytes)
+{
+  int i;
+  for (i = 0; i < nbytes; i++, v >>= 8) p[i] = (unsigned char)(v & 0xff);
+}
+
+static unsigned long long get_le(const unsigned char *p, int nbytes)
+{
+  unsigned long long v = 0;
+  int i;
+  for (i = nbytes - 1; i >= 0; i--) v = (v << 8) | p[i];
+  return (v);
+}
+
+/*!
+  \fn static int mgzbParseHeader(const unsigned char *hdr, long long *csize, long long *usize)
+  \brief Returns 1 if hdr is the header of an indexed member, 0 if it is
+  some other gzip member and -1 if it is not gzip at all.
+*/
+static int mgzbParseHeader(const unsigned char *hdr, long long *csize, long long *usize)
+{
+  if (hdr[0] != 0x1f || hdr[1] != 0x8b || hdr[2] != Z_DEFLATED) return (-1);
+  if (hdr[3] != MGZB_FEXTRA) return (0);
+  if (get_le(hdr + 10, 2) != MGZB_XLEN) return (0);
+  if (hdr[12] != MGZB_SI1 || hdr[13] != MGZB_SI2 || get_le(hdr + 14, 2) != 16) return (0);
+  *csize = (long long)get_le(hdr + 16, 8);
+  *usize = (long long)get_le(hdr + 24, 8);
+  return (1);
+}
+
+/*!
+  \fn MGZB *MGZBopen(const char *fname)
+  \brief Opens a block-compressed mgz and builds its member index by walking
+  the member headers. Returns NULL (without printing an error) if the file
+  is not block-compressed, eg, a conventional single-member .mgz.
+*/
+MGZB *MGZBopen(const char *fname)
+{
+  MGZB *mgzb;
+  FILE *fp;
+  unsigned char hdr[MGZB_HEADER_SIZE];
+  long long offset, csize, usize;
+  int nalloc, ret;
+
+  fp = fopen(fname, "rb");
+  if (fp == NULL) return (NULL);
+
+  if (fread(hdr, 1, MGZB_HEADER_SIZE, fp) != MGZB_HEADER_SIZE || mgzbParseHeader(hdr, &csize, &usize) != 1) {
+    fclose(fp);
+    return (NULL);
+  }
+
+  mgzb = (MGZB *)calloc(1, sizeof(MGZB));
+  nalloc = 16;
+  mgzb->offset = (long long *)calloc(nalloc, sizeof(long long));
+  mgzb->csize = (long long *)calloc(nalloc, sizeof(long long));
+  mgzb->usize = (long long *)calloc(nalloc, sizeof(long long));
+  mgzb->fp = fp;
+  mgzb->tail_offset = -1;
+
+  offset = 0;
+  while (1) {
+    if (mgzb->nmembers == nalloc) {
+      nalloc *= 2;
+      mgzb->offset = (long long *)realloc(mgzb->offset, nalloc * sizeof(long long));
+      mgzb->csize = (long long *)realloc(mgzb->csize, nalloc * sizeof(long long));
+      mgzb->usize = (long long *)realloc(mgzb->usize, nalloc * sizeof(long long));
+    }
+    mgzb->offset[mgzb->nmembers] = offset;
+    mgzb->csize[mgzb->nmembers] = csize;
+    mgzb->usize[mgzb->nmembers] = usize;
+    mgzb->nmembers++;
+
+    offset += csize;
+    if (fseeko(fp, (off_t)offset, SEEK_SET) != 0) break;
+    if (fread(hdr, 1, MGZB_HEADER_SIZE, fp) != MGZB_HEADER_SIZE) {
+      // a short (<32 byte) trailing member is still a member
+      if (!feof(fp) || ftello(fp) == (off_t)offset) break;
+      clearerr(fp);
+      mgzb->tail_offset = offset;
+      break;
+    }
+    ret = mgzbParseHeader(hdr, &csize, &usize);
+    if (ret == 0) {
+      mgzb->tail_offset = offset;
+      break;
+    }
+    if (ret < 0 || csize < MGZB_HEADER_SIZE) {
+      MGZBclose(&mgzb);
+      ErrorReturn(NULL, (ERROR_BADFILE, "MGZBopen(%s): corrupt member header at offset %lld", fname, offset));
+    }
+  }
+
+  return (mgzb);
+}
+
+int MGZBclose(MGZB **pmgzb)
+{
+  MGZB *mgzb = *pmgzb;
+
+  if (mgzb == NULL) return (NO_ERROR);
+  if (mgzb->fp) fclose(mgzb->fp);
+  free(mgzb->offset);
+  free(mgzb->csize);
+  free(mgzb->usize);
+  free(mgzb);
+  *pmgzb = NULL;
+  return (NO_ERROR);
+}
+
+int MGZBisBlocked(const char *fname)
+{
+  MGZB *mgzb;
+
+  mgzb = MGZBopen(fname);
+  if (mgzb == NULL) return (0);
+  MGZBclose(&mgzb);
+  return (1);
+}
+
+/*!
+  \fn int MGZBreadMember(MGZB *mgzb, int member, void *buf, size_t nbytes)
+  \brief Inflates indexed member into buf, which must hold exactly the
+  uncompressed size of the member (nbytes). The gzip crc is checked.
+*/
+int MGZBreadMember(MGZB *mgzb, int member, void *buf, size_t nbytes)
+{
+  z_stream strm;
+  unsigned char *in, trailer[8];
+  long long remaining;
+  unsigned long crc;
+  size_t nread, out_done, pass;
+  int ret;
+
+  if (member < 0 || member >= mgzb->nmembers)
+    ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "MGZBreadMember: member %d out of range (%d)", member, mgzb->nmembers));
+  if ((long long)nbytes != mgzb->usize[member])
+    ErrorReturn(ERROR_BADPARM,
+                (ERROR_BADPARM,
+                 "MGZBreadMember: member %d has %lld bytes, not %lu",
+                 member,
+                 mgzb->usize[member],
+                 (unsigned long)nbytes));
+
+  if (fseeko(mgzb->fp, (off_t)(mgzb->offset[member] + MGZB_HEADER_SIZE), SEEK_SET) != 0)
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "MGZBreadMember: could not seek to member %d", member));
+
+  memset(&strm, 0, sizeof(strm));
+  if (inflateInit2(&strm, -MAX_WBITS) != Z_OK)
+    ErrorReturn(ERROR_NOMEMORY, (ERROR_NOMEMORY, "MGZBreadMember: inflateInit2 failed"));
+  in = (unsigned char *)malloc(MGZB_IOSIZE);
+
+  remaining = mgzb->csize[member] - MGZB_HEADER_SIZE - 8;
+  out_done = 0;
+  ret = Z_OK;
+  while (ret != Z_STREAM_END) {
+    if (strm.avail_in == 0) {
+      if (remaining <= 0) break;
+      nread = fread(in, 1, remaining < MGZB_IOSIZE ? (size_t)remaining : MGZB_IOSIZE, mgzb->fp);
+      if (nread == 0) break;
+      remaining -= nread;
+      strm.next_in = in;
+      strm.avail_in = nread;
+    }
+    pass = nbytes - out_done;
+    if (pass > MGZB_MAXPASS) pass = MGZB_MAXPASS;
+    strm.next_out = (unsigned char *)buf + out_done;
+    strm.avail_out = pass;
+    ret = inflate(&strm, Z_NO_FLUSH);
+    out_done += pass - strm.avail_out;
+    if (ret != Z_OK) break;  // Z_STREAM_END, or an error incl. more data than the index says
+  }
+  inflateEnd(&strm);
+  free(in);
+
+  if (ret != Z_STREAM_END || out_done != nbytes)
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "MGZBreadMember: could not inflate member %d", member));
+
+  // the raw deflate stream ends exactly where the 8 byte gzip trailer begins
+  if (fseeko(mgzb->fp, (off_t)(mgzb->offset[member] + mgzb->csize[member] - 8), SEEK_SET) != 0 ||
+      fread(trailer, 1, 8, mgzb->fp) != 8)
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "MGZBreadMember: could not read trailer of member %d", member));
+
+  crc = crc32(0L, Z_NULL, 0);
+  for (out_done = 0; out_done < nbytes; out_done += pass) {
+    pass = nbytes - out_done;
+    if (pass > MGZB_MAXPASS) pass = MGZB_MAXPASS;
+    crc = crc32(crc, (const unsigned char *)buf + out_done, pass);
+  }
+  if (get_le(trailer, 4) != (crc & 0xffffffffUL) || get_le(trailer + 4, 4) != (nbytes & 0xffffffffUL))
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "MGZBreadMember: crc mismatch in member %d", member));
+
+  return (NO_ERROR);
+}
+
+/*!
+  \fn int MGZBwriteMember(FILE *fp, const void *buf, size_t nbytes, int level)
+  \brief Appends buf to fp as one indexed gzip member. fp must be seekable
+  since the compressed size is patched into the header once it is known.
+*/
+int MGZBwriteMember(FILE *fp, const void *buf, size_t nbytes, int level)
+{
+  z_stream strm;
+  unsigned char hdr[MGZB_HEADER_SIZE], trailer[8], *out;
+  off_t start, end;
+  size_t in_done, pass, nout;
+  unsigned long crc;
+  int ret, flush;
+
+  start = ftello(fp);
+
+  memset(hdr, 0, sizeof(hdr));
+  hdr[0] = 0x1f;
+  hdr[1] = 0x8b;
+  hdr[2] = Z_DEFLATED;
+  hdr[3] = MGZB_FEXTRA;
+  hdr[9] = 3;  // OS = unix
+  put_le(hdr + 10, MGZB_XLEN, 2);
+  hdr[12] = MGZB_SI1;
+  hdr[13] = MGZB_SI2;
+  put_le(hdr + 14, 16, 2);
+  put_le(hdr + 24, nbytes, 8);
+  if (fwrite(hdr, 1, MGZB_HEADER_SIZE, fp) != MGZB_HEADER_SIZE)
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "MGZBwriteMember: could not write member header"));
+
+  memset(&strm, 0, sizeof(strm));
+  if (deflateInit2(&strm, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    ErrorReturn(ERROR_NOMEMORY, (ERROR_NOMEMORY, "MGZBwriteMember: deflateInit2 failed"));
+  out = (unsigned char *)malloc(MGZB_IOSIZE);
+
+  crc = crc32(0L, Z_NULL, 0);
+  in_done = 0;
+  ret = Z_OK;
+  do {
+    pass = nbytes - in_done;
+    if (pass > MGZB_MAXPASS) pass = MGZB_MAXPASS;
+    crc = crc32(crc, (const unsigned char *)buf + in_done, pass);
+    strm.next_in = (unsigned char *)buf + in_done;
+    strm.avail_in = pass;
+    in_done += pass;
+    flush = (in_done == nbytes) ? Z_FINISH : Z_NO_FLUSH;
+    do {
+      strm.next_out = out;
+      strm.avail_out = MGZB_IOSIZE;
+      ret = deflate(&strm, flush);
+      nout = MGZB_IOSIZE - strm.avail_out;
+      if (nout > 0 && fwrite(out, 1, nout, fp) != nout) ret = Z_ERRNO;
+    } while (ret == Z_OK && strm.avail_out == 0);
+  } while (ret == Z_OK && flush != Z_FINISH);
+  deflateEnd(&strm);
+  free(out);
+
+  if (ret != Z_STREAM_END) ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "MGZBwriteMember: deflate failed"));
+
+  put_le(trailer, crc, 4);
+  put_le(trailer + 4, nbytes & 0xffffffffUL, 4);
+  if (fwrite(trailer, 1, 8, fp) != 8)
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "MGZBwriteMember: could not write member trailer"));
+
+  // now that we know how big the member is, fill in the index entry
+  end = ftello(fp);
+  put_le(hdr + 16, (unsigned long long)(end - start), 8);
+  if (fseeko(fp, start + 16, SEEK_SET) != 0 || fwrite(hdr + 16, 1, 8, fp) != 8 || fseeko(fp, end, SEEK_SET) != 0)
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "MGZBwriteMember: could not update member header"));
+
+  return (NO_ERROR);
+}
@@ -37,6 +37,7 @@ const char *MRI_C_VERSION = "$Revision: 1.575 $";
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #include "faster_variants.h"
 #include "romp_support.h"
@@ -5451,39 +5452,40 @@ int MRIallocIndices(MRI *mri)
 }
 /*-----------------------------------------------------*/
 /*!
-\fn MRI *MRIallocChunk(int width, int height, int depth, int type, int nframes)
-\brief Alloc pixel data in MRI struct as one big buffer.
+\fn static MRI *mriAllocChunkHeader(int width, int height, int depth, int type, int nframes)
+\brief Alloc a header for a chunked MRI and compute the chunk sizes, but
+not the chunk or the row pointers into it (see mriSetChunkRows()).
 */
-MRI *MRIallocChunk(int width, int height, int depth, int type, int nframes)
+static MRI *mriAllocChunkHeader(int width, int height, int depth, int type, int nframes)
 {
   MRI *mri;
-  int slice, row;
-  void *p;
 
   if (sizeof(mri->bytes_total) != sizeof(size_t)) {
     fprintf(stderr, "%s: WARNING\nbytes_total is not a size_t\n", __FUNCTION__);
   }
 
-  mris_alloced++;
-
   if ((width <= 0) || (height <= 0) || (depth <= 0))
     ErrorReturn(NULL, (ERROR_BADPARM, "MRIallocChunk(%d, %d, %d): bad parm", width, height, depth));
   mri = MRIallocHeader(width, height, depth, type, nframes);
   mri->nframes = nframes;
   MRIinitHeader(mri);
 
-  // Allocate a big chunk of memory
   mri->ischunked = 1;
   mri->bytes_per_row = mri->bytes_per_vox * mri->width;
   mri->bytes_per_slice = mri->bytes_per_row * mri->height;
   mri->bytes_per_vol = mri->bytes_per_slice * mri->depth;
   mri->bytes_total = mri->bytes_per_vol * mri->nframes;
-  mri->chunk = calloc(mri->bytes_total, 1);
-  if (mri->chunk == NULL) {
-    printf("ERROR: MRIallocChunk(): could not alloc %lu\n", (unsigned long)mri->bytes_total);
-    return (NULL);
-  }
-  // printf("Allocing MRI with Chunk\n");
+  return (mri);
+}
+/*-----------------------------------------------------*/
+/*!
+\fn static void mriSetChunkRows(MRI *mri)
+\brief Point the slices/rows of a chunked MRI into mri->chunk.
+*/
+static void mriSetChunkRows(MRI *mri)
+{
+  int slice, row, depth = mri->depth, nframes = mri->nframes;
+  void *p;
 
   MRIallocIndices(mri);  // not sure what this does
   mri->outside_val = 0;
@@ -5498,8 +5500,8 @@ MRI *MRIallocChunk(int width, int height, int depth, int type, int nframes)
       ErrorExit(ERROR_NO_MEMORY,
                 "MRIallocChunk(%d, %d, %d): could not allocate "
                 "%d bytes for %dth slice\n",
-                height,
-                width,
+                mri->height,
+                mri->width,
                 depth,
                 mri->height * sizeof(BUFTYPE *),
                 slice);
@@ -5510,6 +5512,64 @@ MRI *MRIallocChunk(int width, int height, int depth, int type, int nframes)
       p += mri->bytes_per_row;
     }
   }
+}
+/*-----------------------------------------------------*/
+/*!
+\fn MRI *MRIallocChunk(int width, int height, int depth, int type, int nframes)
+\brief Alloc pixel data in MRI struct as one big buffer.
+*/
+MRI *MRIallocChunk(int width, int height, int depth, int type, int nframes)
+{
+  MRI *mri;
+
+  mri = mriAllocChunkHeader(width, height, depth, type, nframes);
+  if (mri == NULL) return (NULL);
+  mris_alloced++;
+
+  // Allocate a big chunk of memory
+  mri->chunk = calloc(mri->bytes_total, 1);
+  if (mri->chunk == NULL) {
+    printf("ERROR: MRIallocChunk(): could not alloc %lu\n", (unsigned long)mri->bytes_total);
+    return (NULL);
+  }
+  // printf("Allocing MRI with Chunk\n");
+
+  mriSetChunkRows(mri);
+  return (mri);
+}
+/*-----------------------------------------------------*/
+/*!
+\fn MRI *MRIallocChunkMapped(int width, int height, int depth, int type, int nframes,
+                             void *map, size_t map_size, size_t offset)
+\brief Wrap a chunked MRI around pixel data that is already in memory at
+map+offset, eg, the voxel block of an mmap'd .mgh file. The MRI takes
+ownership of the mapping and munmap()s it in MRIfree(). The data must
+already be in host byte order.
+*/
+MRI *MRIallocChunkMapped(
+    int width, int height, int depth, int type, int nframes, void *map, size_t map_size, size_t offset)
+{
+  MRI *mri;
+  size_t bytes_total;
+
+  mri = mriAllocChunkHeader(width, height, depth, type, nframes);
+  if (mri == NULL) return (NULL);
+  mris_alloced++;
+  bytes_total = mri->bytes_total;
+  if (offset + bytes_total > map_size) {
+    MRIfree(&mri);
+    ErrorReturn(NULL,
+                (ERROR_BADPARM,
+                 "MRIallocChunkMapped: %lu bytes at offset %lu do not fit in %lu byte map",
+                 (unsigned long)bytes_total,
+                 (unsigned long)offset,
+                 (unsigned long)map_size));
+  }
+
+  mri->chunk_map = map;
+  mri->chunk_map_size = map_size;
+  mri->chunk = (char *)map + offset;
+  mriSetChunkRows(mri);
   return (mri);
 }
 /*-------------------------------------------------------------*/
@@ -5793,11 +5853,17 @@ int MRIfree(MRI **pmri)
   }
   else {
     // printf("Freeing MRI Chunk\n");
-    free(mri->chunk);
+    if (mri->chunk_map)
+      munmap(mri->chunk_map, mri->chunk_map_size);
+    else
+      free(mri->chunk);
     mri->chunk = NULL;
-    for (slice = 0; slice < mri->depth * mri->nframes; slice++)
-      if (mri->slices[slice]) free(mri->slices[slice]);
-    free(mri->slices);
+    mri->chunk_map = NULL;
+    if (mri->slices) {
+      for (slice = 0; slice < mri->depth * mri->nframes; slice++)
+        if (mri->slices[slice]) free(mri->slices[slice]);
+      free(mri->slices);
+    }
   }
 
   if (mri->free_transform) delete_general_transform(&mri->transform);
@@ -8934,6 +9000,184 @@ int MRIsampleVolumeFrame(const MRI *mri, double x, double y, double z, const int
   return (NO_ERROR);
 }
 
+/*-----------------------------------------------------
+  mriSampleFramesTrilinear() - trilinear interpolation of frames
+  firstframe..lastframe at (x,y,z) into valvect[firstframe..lastframe].
+  The corner offsets and weights are computed once; per frame only the
+  four corner rows are looked up (for chunked volumes they are a constant
+  stride apart, so the slice table is not consulted at all). The sums are
+  formed in the same order as MRIsampleVolumeFrame(). Frames past the end
+  of the volume get outside_val.
+  ------------------------------------------------------*/
+static int mriSampleFramesTrilinear(
+    const MRI *mri, double x, double y, double z, int firstframe, int lastframe, float *valvect)
+{
+  int f, xm, xp, ym, yp, zm, zp, width, height, depth, nframes;
+  double xmd, ymd, zmd, xpd, ypd, zpd; /* d's are distances */
+  double w[8];
+  const void *rows[4], *rows0[4] = {NULL, NULL, NULL, NULL};
+
+  nframes = MIN(lastframe, mri->nframes - 1);
+  for (f = MAX(firstframe, nframes + 1); f <= lastframe; f++) valvect[f] = mri->outside_val;
+
+  if (MRIindexNotInVolume(mri, x, y, z) == 1) {
+    /* unambiguously out of bounds */
+    for (f = firstframe; f <= nframes; f++) valvect[f] = mri->outside_val;
+    return (NO_ERROR);
+  }
+
+  width = mri->width;
+  height = mri->height;
+  depth = mri->depth;
+  if (x >= width) x = width - 1.0;
+  if (y >= height) y = height - 1.0;
+  if (z >= depth) z = depth - 1.0;
+  if (x < 0.0) x = 0.0;
+  if (y < 0.0) y = 0.0;
+  if (z < 0.0) z = 0.0;
+
+  xm = MAX((int)x, 0);
+  xp = MIN(width - 1, xm + 1);
+  ym = MAX((int)y, 0);
+  yp = MIN(height - 1, ym + 1);
+  zm = MAX((int)z, 0);
+  zp = MIN(depth - 1, zm + 1);
+
+  xmd = x - (float)xm;
+  ymd = y - (float)ym;
+  zmd = z - (float)zm;
+  xpd = (1.0f - xmd);
+  ypd = (1.0f - ymd);
+  zpd = (1.0f - zmd);
+
+  /* weights of the corners (xm|xp, ym|yp, zm|zp), z fastest */
+  w[0] = xpd * ypd * zpd;
+  w[1] = xpd * ypd * zmd;
+  w[2] = xpd * ymd * zpd;
+  w[3] = xpd * ymd * zmd;
+  w[4] = xmd * ypd * zpd;
+  w[5] = xmd * ypd * zmd;
+  w[6] = xmd * ymd * zpd;
+  w[7] = xmd * ymd * zmd;
+
+  if (mri->ischunked) {
+    rows0[0] = mri->slices[zm][ym];
+    rows0[1] = mri->slices[zp][ym];
+    rows0[2] = mri->slices[zm][yp];
+    rows0[3] = mri->slices[zp][yp];
+  }
+
+#define MRI_SAMPLE_FRAMES_TRILINEAR(TYPE)                                                                \
+  for (f = firstframe; f <= nframes; f++) {                                                             \
+    if (mri->ischunked) {                                                                               \
+      size_t offset = (size_t)f * mri->bytes_per_vol;                                                   \
+      rows[0] = (const char *)rows0[0] + offset;                                                        \
+      rows[1] = (const char *)rows0[1] + offset;                                                        \
+      rows[2] = (const char *)rows0[2] + offset;                                                        \
+      rows[3] = (const char *)rows0[3] + offset;                                                        \
+    }                                                                                                   \
+    else {                                                                                              \
+      rows[0] = mri->slices[zm + f * depth][ym];                                                        \
+      rows[1] = mri->slices[zp + f * depth][ym];                                                        \
+      rows[2] = mri->slices[zm + f * depth][yp];                                                        \
+      rows[3] = mri->slices[zp + f * depth][yp];                                                        \
+    }                                                                                                   \
+    valvect[f] = w[0] * (double)((const TYPE *)rows[0])[xm] + w[1] * (double)((const TYPE *)rows[1])[xm] + \
+                 w[2] * (double)((const TYPE *)rows[2])[xm] + w[3] * (double)((const TYPE *)rows[3])[xm] + \
+                 w[4] * (double)((const TYPE *)rows[0])[xp] + w[5] * (double)((const TYPE *)rows[1])[xp] + \
+                 w[6] * (double)((const TYPE *)rows[2])[xp] + w[7] * (double)((const TYPE *)rows[3])[xp];  \
+  }
+
+  switch (mri->type) {
+    case MRI_UCHAR:
+      MRI_SAMPLE_FRAMES_TRILINEAR(BUFTYPE);
+      break;
+    case MRI_FLOAT:
+      MRI_SAMPLE_FRAMES_TRILINEAR(float);
+      break;
+    case MRI_SHORT:
+      MRI_SAMPLE_FRAMES_TRILINEAR(short);
+      break;
+    case MRI_INT:
+      MRI_SAMPLE_FRAMES_TRILINEAR(int);
+      break;
+    case MRI_LONG:
+      MRI_SAMPLE_FRAMES_TRILINEAR(long32);
+      break;
+    default:
+      ErrorReturn(ERROR_UNSUPPORTED, (ERROR_UNSUPPORTED, "mriSampleFramesTrilinear: unsupported type %d", mri->type));
+      break;
+  }
+#undef MRI_SAMPLE_FRAMES_TRILINEAR
+
+  return (NO_ERROR);
+}
+
+/*-----------------------------------------------------
+  MRIsampleVolumeFrames() - samples frames firstframe..lastframe of mri
+  at the voxel coordinate (x,y,z) into valvect[firstframe..lastframe].
+  type is the interpolation method, SAMPLE_NEAREST or SAMPLE_TRILINEAR.
+  Each value is the one MRIsampleVolumeFrameType() returns for that
+  frame, but the corner offsets and weights are computed only once, so
+  use this instead of a per-frame loop when sampling many frames at
+  the same point.
+  ------------------------------------------------------*/
+int MRIsampleVolumeFrames(
+    const MRI *mri, double x, double y, double z, int firstframe, int lastframe, int type, float *valvect)
+{
+  int f, xv, yv, zv, nframes;
+
+  if (FEQUAL((int)x, x) && FEQUAL((int)y, y) && FEQUAL((int)z, z)) type = SAMPLE_NEAREST;
+
+  switch (type) {
+    case SAMPLE_TRILINEAR:
+      return (mriSampleFramesTrilinear(mri, x, y, z, firstframe, lastframe, valvect));
+    case SAMPLE_CUBIC_BSPLINE:
+    case SAMPLE_SINC:
+      ErrorReturn(ERROR_UNSUPPORTED,
+                  (ERROR_UNSUPPORTED, "MRIsampleVolumeFrames(%d): unsupported interpolation type", type));
+    default:
+      break;
+  }
+
+  if (MRIindexNotInVolume(mri, x, y, z) == 1) {
+    /* unambiguously out of bounds */
+    for (f = firstframe; f <= lastframe; f++) valvect[f] = mri->outside_val;
+    return (NO_ERROR);
+  }
+
+  xv = nint(x);
+  yv = nint(y);
+  zv = nint(z);
+  if (xv < 0) xv = 0;
+  if (xv >= mri->width) xv = mri->width - 1;
+  if (yv < 0) yv = 0;
+  if (yv >= mri->height) yv = mri->height - 1;
+  if (zv < 0) zv = 0;
+  if (zv >= mri->depth) zv = mri->depth - 1;
+
+  nframes = MIN(lastframe, mri->nframes - 1);
+  switch (mri->type) {
+    case MRI_UCHAR:
+      for (f = firstframe; f <= nframes; f++) valvect[f] = MRIseq_vox(mri, xv, yv, zv, f);
+      break;
+    case MRI_SHORT:
+      for (f = firstframe; f <= nframes; f++) valvect[f] = MRISseq_vox(mri, xv, yv, zv, f);
+      break;
+    case MRI_INT:
+      for (f = firstframe; f <= nframes; f++) valvect[f] = MRIIseq_vox(mri, xv, yv, zv, f);
+      break;
+    case MRI_FLOAT:
+      for (f = firstframe; f <= nframes; f++) valvect[f] = MRIFseq_vox(mri, xv, yv, zv, f);
+      break;
+    default:
+      ErrorReturn(ERROR_UNSUPPORTED,
+                  (ERROR_UNSUPPORTED, "MRIsampleVolumeFrames: unsupported volume type %d", mri->type));
+  }
+  for (f = MAX(firstframe, nframes + 1); f <= lastframe; f++) valvect[f] = mri->outside_val;
+  return (NO_ERROR);
+}
+
 #ifdef FASTER_MRI_EM_REGISTER
 int   MRIsampleVolumeFrame_xyzInt_nRange_floats(const MRI *mri,
                             int x, int y, int z, 
@@ -9550,101 +9794,7 @@ int MRIsampleVolume(const MRI *mri, double x, double y, double z, double *pval)
   -------------------------------------------------------------------*/
 int MRIsampleSeqVolume(const MRI *mri, double x, double y, double z, float *valvect, int firstframe, int lastframe)
 {
-  int OutOfBounds;
-  int f, xm, xp, ym, yp, zm, zp, width, height, depth;
-  double xmd, ymd, zmd, xpd, ypd, zpd; /* d's are distances */
-
-  OutOfBounds = MRIindexNotInVolume(mri, x, y, z);
-  if (OutOfBounds == 1) {
-    /* unambiguously out of bounds */
-    for (f = firstframe; f <= lastframe; f++) valvect[f] = mri->outside_val;
-    return (NO_ERROR);
-  }
-
-  width = mri->width;
-  height = mri->height;
-  depth = mri->depth;
-
-  if (x >= width) x = width - 1.0;
-  if (y >= height) y = height - 1.0;
-  if (z >= depth) z = depth - 1.0;
-  if (x < 0.0) x = 0.0;
-  if (y < 0.0) y = 0.0;
-  if (z < 0.0) z = 0.0;
-
-  xm = MAX((int)x, 0);
-  xp = MIN(width - 1, xm + 1);
-  ym = MAX((int)y, 0);
-  yp = MIN(height - 1, ym + 1);
-  zm = MAX((int)z, 0);
-  zp = MIN(depth - 1, zm + 1);
-
-  xmd = x - (float)xm;
-  ymd = y - (float)ym;
-  zmd = z - (float)zm;
-  xpd = (1.0f - xmd);
-  ypd = (1.0f - ymd);
-  zpd = (1.0f - zmd);
-
-  for (f = firstframe; f <= lastframe; f++) {
-    switch (mri->type) {
-      case MRI_UCHAR:
-        valvect[f] = xpd * ypd * zpd * (double)MRIseq_vox(mri, xm, ym, zm, f) +
-                     xpd * ypd * zmd * (double)MRIseq_vox(mri, xm, ym, zp, f) +
-                     xpd * ymd * zpd * (double)MRIseq_vox(mri, xm, yp, zm, f) +
-                     xpd * ymd * zmd * (double)MRIseq_vox(mri, xm, yp, zp, f) +
-                     xmd * ypd * zpd * (double)MRIseq_vox(mri, xp, ym, zm, f) +
-                     xmd * ypd * zmd * (double)MRIseq_vox(mri, xp, ym, zp, f) +
-                     xmd * ymd * zpd * (double)MRIseq_vox(mri, xp, yp, zm, f) +
-                     xmd * ymd * zmd * (double)MRIseq_vox(mri, xp, yp, zp, f);
-        break;
-      case MRI_FLOAT:
-        valvect[f] = xpd * ypd * zpd * (double)MRIFseq_vox(mri, xm, ym, zm, f) +
-                     xpd * ypd * zmd * (double)MRIFseq_vox(mri, xm, ym, zp, f) +
-                     xpd * ymd * zpd * (double)MRIFseq_vox(mri, xm, yp, zm, f) +
-                     xpd * ymd * zmd * (double)MRIFseq_vox(mri, xm, yp, zp, f) +
-                     xmd * ypd * zpd * (double)MRIFseq_vox(mri, xp, ym, zm, f) +
-                     xmd * ypd * zmd * (double)MRIFseq_vox(mri, xp, ym, zp, f) +
-                     xmd * ymd * zpd * (double)MRIFseq_vox(mri, xp, yp, zm, f) +
-                     xmd * ymd * zmd * (double)MRIFseq_vox(mri, xp, yp, zp, f);
-        break;
-      case MRI_SHORT:
-        valvect[f] = xpd * ypd * zpd * (double)MRISseq_vox(mri, xm, ym, zm, f) +
-                     xpd * ypd * zmd * (double)MRISseq_vox(mri, xm, ym, zp, f) +
-                     xpd * ymd * zpd * (double)MRISseq_vox(mri, xm, yp, zm, f) +
-                     xpd * ymd * zmd * (double)MRISseq_vox(mri, xm, yp, zp, f) +
-                     xmd * ypd * zpd * (double)MRISseq_vox(mri, xp, ym, zm, f) +
-                     xmd * ypd * zmd * (double)MRISseq_vox(mri, xp, ym, zp, f) +
-                     xmd * ymd * zpd * (double)MRISseq_vox(mri, xp, yp, zm, f) +
-                     xmd * ymd * zmd * (double)MRISseq_vox(mri, xp, yp, zp, f);
-        break;
-      case MRI_INT:
-        valvect[f] = xpd * ypd * zpd * (double)MRIIseq_vox(mri, xm, ym, zm, f) +
-                     xpd * ypd * zmd * (double)MRIIseq_vox(mri, xm, ym, zp, f) +
-                     xpd * ymd * zpd * (double)MRIIseq_vox(mri, xm, yp, zm, f) +
-                     xpd * ymd * zmd * (double)MRIIseq_vox(mri, xm, yp, zp, f) +
-                     xmd * ypd * zpd * (double)MRIIseq_vox(mri, xp, ym, zm, f) +
-                     xmd * ypd * zmd * (double)MRIIseq_vox(mri, xp, ym, zp, f) +
-                     xmd * ymd * zpd * (double)MRIIseq_vox(mri, xp, yp, zm, f) +
-                     xmd * ymd * zmd * (double)MRIIseq_vox(mri, xp, yp, zp, f);
-        break;
-      case MRI_LONG:
-        valvect[f] = xpd * ypd * zpd * (double)MRILseq_vox(mri, xm, ym, zm, f) +
-                     xpd * ypd * zmd * (double)MRILseq_vox(mri, xm, ym, zp, f) +
-                     xpd * ymd * zpd * (double)MRILseq_vox(mri, xm, yp, zm, f) +
-                     xpd * ymd * zmd * (double)MRILseq_vox(mri, xm, yp, zp, f) +
-                     xmd * ypd * zpd * (double)MRILseq_vox(mri, xp, ym, zm, f) +
-                     xmd * ypd * zmd * (double)MRILseq_vox(mri, xp, ym, zp, f) +
-                     xmd * ymd * zpd * (double)MRILseq_vox(mri, xp, yp, zm, f) +
-                     xmd * ymd * zmd * (double)MRILseq_vox(mri, xp, yp, zp, f);
-        break;
-      default:
-        ErrorReturn(ERROR_UNSUPPORTED, (ERROR_UNSUPPORTED, "MRIsampleSeqVolume: unsupported type %d", mri->type));
-        break;
-    }
-  } /* end loop over frames */
-
-  return (NO_ERROR);
+  return (mriSampleFramesTrilinear(mri, x, y, z, firstframe, lastframe, valvect));
 }
 
 // testing - LZ
@@ -11048,7 +11198,7 @@ MRI *MRIlinearTransform(MRI *mri_src, MRI *mri_dst, MATRIX *mA)
   ------------------------------------------------------------------*/
 MRI *MRIlinearTransformInterp(MRI *mri_src, MRI *mri_dst, MATRIX *mA, int InterpMethod)
 {
-  int y1, y2, y3, width, height, depth, frame;
+  int y1, y2, y3, width, height, depth, frame, typed;
   VECTOR *v_X, *v_Y; /* original and transformed coordinate systems */
   MATRIX *mAinv;     /* inverse of mA */
   double val, x1, x2, x3;
@@ -11082,8 +11232,15 @@ MRI *MRIlinearTransformInterp(MRI *mri_src, MRI *mri_dst, MATRIX *mA, int Interp
   v_X = VectorAlloc(4, MATRIX_REAL); /* input (src) coordinates */
   v_Y = VectorAlloc(4, MATRIX_REAL); /* transformed (dst) coordinates */
 
+  // the typed kernels do the same sampling without per-voxel type switches,
+  // stepping along rows and running slices in parallel
+  if (InterpMethod == SAMPLE_CUBIC_BSPLINE)
+    typed = (MRIlinearTransformBSplineTyped(bspline, mri_dst, mAinv) == NO_ERROR);
+  else
+    typed = (MRIlinearTransformInterpTyped(mri_src, mri_dst, mAinv, InterpMethod) == NO_ERROR);
+
   v_Y->rptr[4][1] = 1.0f;
-  for (y3 = 0; y3 < depth; y3++) {
+  for (y3 = 0; !typed && y3 < depth; y3++) {
     V3_Z(v_Y) = y3;
     for (y2 = 0; y2 < height; y2++) {
       V3_Y(v_Y) = y2;
@@ -17463,9 +17620,11 @@ void mri_hash_add(MRI_HASH* hash, MRI const * mri)
     // nyi ct
     // nyi frames
     // 
+    // The voxels of all frames: frame f uses slices[f*depth .. f*depth+depth-1]
+    //
     if (mri->slices) {
         int slice, row;
-        for (slice = 0; slice < mri->depth; slice++) {
+        for (slice = 0; slice < mri->depth * mri->nframes; slice++) {
             if (!mri->slices[slice]) continue;
             for (row = 0; row < mri->height; row++) {
                 const unsigned char* ptr = (const unsigned char*)(mri->slices[slice][row]);
@@ -2928,7 +2928,7 @@ int MRIvol2VolVSM(MRI *src, MRI *targ, MATRIX *Vt2s, int InterpCode, float param
   double rval, v;
   MATRIX *V2Rsrc = NULL, *invV2Rsrc = NULL, *V2Rtarg = NULL;
   MATRIX *crsT = NULL, *crsS = NULL;
-  int FreeMats = 0;
+  int FreeMats = 0, typed;
 
   if (DIAG_VERBOSE_ON) printf("Using MRIvol2VolVSM\n");
 
@@ -2962,7 +2962,9 @@ int MRIvol2VolVSM(MRI *src, MRI *targ, MATRIX *Vt2s, int InterpCode, float param
   crsT = MatrixAlloc(4, 1, MATRIX_REAL);
   crsT->rptr[4][1] = 1;
   crsS = MatrixAlloc(4, 1, MATRIX_REAL);
-  for (ct = 0; ct < targ->width; ct++) {
+  // the typed kernel does the same nearest-neighbor copy without per-voxel type switches
+  typed = (vsm == NULL && InterpCode == SAMPLE_NEAREST && MRIvol2VolNearestTyped(src, targ, Vt2s) == NO_ERROR);
+  for (ct = 0; !typed && ct < targ->width; ct++) {
     for (rt = 0; rt < targ->height; rt++) {
       for (st = 0; st < targ->depth; st++) {
         // Compute CRS in VSM space
@@ -3728,6 +3730,298 @@ int MRIsegFrameAvg(MRI *seg, int segid, MRI *mri, double *favg)
   return (nvoxels);
 }
 
+/* Number of slabs (of slices) used by MRIsegStatsAll(). Fixed, so that
+   the reductions do not depend on the number of threads. */
+#define SEGSTATS_NSLABS 16
+
+typedef struct
+{
+  int id;
+  int u;  // index into the unique ids
+} SEGSTATS_ID;
+
+static int compare_segstats_ids(const void *v1, const void *v2)
+{
+  const SEGSTATS_ID *a = (const SEGSTATS_ID *)v1, *b = (const SEGSTATS_ID *)v2;
+  if (a->id < b->id) return (-1);
+  if (a->id > b->id) return (1);
+  return (0);
+}
+
+/* Index of id in the sorted unique ids (or -1). lastid/lastu
+   cache the previous lookup since neighboring voxels usually have
+   the same id (lastu = -2 means nothing cached yet). */
+static int segStatsLookup(int id, const SEGSTATS_ID *uids, int nuniq, int *lastid, int *lastu)
+{
+  SEGSTATS_ID key, *found;
+
+  if (*lastu != -2 && id == *lastid) return (*lastu);
+  key.id = id;
+  found = (SEGSTATS_ID *)bsearch(&key, uids, nuniq, sizeof(SEGSTATS_ID), compare_segstats_ids);
+  *lastid = id;
+  *lastu = (found ? found->u : -1);
+  return (*lastu);
+}
+
+/*---------------------------------------------------------
+  MRIsegStatsAll() - computes the statistics of all nsegs
+  segmentations in segids in one pass through the volume
+  instead of one pass per segmentation. For each segids[n]:
+  nvoxels[n] is the number of voxels (as MRIsegCount()); if
+  mri is not NULL, min[n], max[n], range[n], mean[n] and
+  std[n] are computed from the given frame as MRIsegStats(),
+  or as MRIsegStatsRobust() with Pct if robust is set (then
+  nvoxels[n] is still the full count) unless min is NULL;
+  if favg is not NULL,
+  favg[n] (preallocated to mri->nframes) gets the frame
+  averages as MRIsegFrameAvg(). The volume is processed in
+  parallel over a fixed number of slabs of slices, which
+  are combined in order, so the results do not depend on the
+  number of threads. Returns 0, or 1 on error.
+  ---------------------------------------------------------*/
+int MRIsegStatsAll(MRI *seg,
+                   int nsegs,
+                   int *segids,
+                   MRI *mri,
+                   int frame,
+                   int robust,
+                   float Pct,
+                   int *nvoxels,
+                   float *min,
+                   float *max,
+                   float *range,
+                   float *mean,
+                   float *std,
+                   double **favg)
+{
+  int n, u, nuniq, nslabs, slab, nframes, f, *segu, *count, *slabcount, *offset, *fill;
+  double *smin, *smax, *ssum, *ssum2, *sfsum;
+  float *vlist = NULL;
+  SEGSTATS_ID *uids;
+
+  if (nsegs <= 0) return (0);
+  if (mri && (mri->width != seg->width || mri->height != seg->height || mri->depth != seg->depth)) {
+    printf("ERROR: MRIsegStatsAll(): dimension mismatch between seg and input\n");
+    return (1);
+  }
+  if (mri && (frame < 0 || frame >= mri->nframes)) {
+    printf("ERROR: MRIsegStatsAll(): frame %d out of range\n", frame);
+    return (1);
+  }
+
+  // sorted unique ids, and for each requested id its unique index
+  uids = (SEGSTATS_ID *)calloc(nsegs, sizeof(SEGSTATS_ID));
+  segu = (int *)calloc(nsegs, sizeof(int));
+  for (n = 0; n < nsegs; n++) {
+    uids[n].id = segids[n];
+    uids[n].u = n;
+  }
+  qsort(uids, nsegs, sizeof(SEGSTATS_ID), compare_segstats_ids);
+  nuniq = 0;
+  for (n = 0; n < nsegs; n++) {
+    if (nuniq == 0 || uids[n].id != uids[nuniq - 1].id) {
+      uids[nuniq].id = uids[n].id;
+      nuniq++;
+    }
+    segu[uids[n].u] = nuniq - 1;
+  }
+  for (u = 0; u < nuniq; u++) uids[u].u = u;
+
+  nslabs = MIN(SEGSTATS_NSLABS, seg->depth);
+  nframes = (mri && favg) ? mri->nframes : 0;
+  slabcount = (int *)calloc(nslabs * nuniq, sizeof(int));
+  smin = (double *)calloc(nslabs * nuniq, sizeof(double));
+  smax = (double *)calloc(nslabs * nuniq, sizeof(double));
+  ssum = (double *)calloc(nslabs * nuniq, sizeof(double));
+  ssum2 = (double *)calloc(nslabs * nuniq, sizeof(double));
+  sfsum = (double *)calloc((size_t)nslabs * nuniq * nframes + 1, sizeof(double));
+  if (!slabcount || !smin || !smax || !ssum || !ssum2 || !sfsum)
+    ErrorExit(ERROR_NOMEMORY, "MRIsegStatsAll(): could not allocate %d x %d accumulators", nslabs, nuniq);
+
+  // pass 1: accumulate count, min, max, sums and frame sums per slab
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 1)
+#endif
+  for (slab = 0; slab < nslabs; slab++) {
+    ROMP_PFLB_begin
+    int c, r, s, k, ff, s0, s1, lastid = 0, lastu = -2;
+    int *cnt = &slabcount[slab * nuniq];
+    double val, *mn = &smin[slab * nuniq], *mx = &smax[slab * nuniq];
+    double *sm = &ssum[slab * nuniq], *sm2 = &ssum2[slab * nuniq];
+    double *fs = &sfsum[(size_t)slab * nuniq * nframes];
+
+    s0 = (slab * seg->depth) / nslabs;
+    s1 = ((slab + 1) * seg->depth) / nslabs;
+    for (s = s0; s < s1; s++) {
+      for (r = 0; r < seg->height; r++) {
+        for (c = 0; c < seg->width; c++) {
+          k = segStatsLookup((int)MRIgetVoxVal(seg, c, r, s, 0), uids, nuniq, &lastid, &lastu);
+          if (k < 0) continue;
+          cnt[k]++;
+          if (mri == NULL) continue;
+          val = MRIgetVoxVal(mri, c, r, s, frame);
+          if (cnt[k] == 1) {
+            mn[k] = val;
+            mx[k] = val;
+          }
+          if (mn[k] > val) mn[k] = val;
+          if (mx[k] < val) mx[k] = val;
+          sm[k] += val;
+          sm2[k] += (val * val);
+          for (ff = 0; ff < nframes; ff++) fs[(size_t)k * nframes + ff] += MRIgetVoxVal(mri, c, r, s, ff);
+        }
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  // combine the slabs in order (into the ones of slab 0)
+  count = (int *)calloc(nuniq, sizeof(int));
+  for (u = 0; u < nuniq; u++) count[u] = slabcount[u];
+  for (slab = 1; slab < nslabs; slab++) {
+    for (u = 0; u < nuniq; u++) {
+      int k = slab * nuniq + u;
+      if (slabcount[k] == 0) continue;
+      if (count[u] == 0) {
+        smin[u] = smin[k];
+        smax[u] = smax[k];
+      }
+      if (smin[u] > smin[k]) smin[u] = smin[k];
+      if (smax[u] < smax[k]) smax[u] = smax[k];
+      ssum[u] += ssum[k];
+      ssum2[u] += ssum2[k];
+      for (f = 0; f < nframes; f++) sfsum[(size_t)u * nframes + f] += sfsum[(size_t)k * nframes + f];
+      count[u] += slabcount[k];
+    }
+  }
+
+  if (mri && min && robust) {
+    // pass 2: gather the values of each id (slab by slab, so the
+    // offsets follow from the counts of pass 1), then sort them
+    offset = (int *)calloc(nuniq + 1, sizeof(int));
+    for (u = 0; u < nuniq; u++) offset[u + 1] = offset[u] + count[u];
+    fill = (int *)calloc(nslabs * nuniq, sizeof(int));
+    for (u = 0; u < nuniq; u++) {
+      int o = offset[u];
+      for (slab = 0; slab < nslabs; slab++) {
+        fill[slab * nuniq + u] = o;
+        o += slabcount[slab * nuniq + u];
+      }
+    }
+    vlist = (float *)calloc(offset[nuniq] + 1, sizeof(float));
+    if (!vlist) ErrorExit(ERROR_NOMEMORY, "MRIsegStatsAll(): could not allocate %d values", offset[nuniq]);
+
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 1)
+#endif
+    for (slab = 0; slab < nslabs; slab++) {
+      ROMP_PFLB_begin
+      int c, r, s, k, s0, s1, lastid = 0, lastu = -2;
+      int *fl = &fill[slab * nuniq];
+
+      s0 = (slab * seg->depth) / nslabs;
+      s1 = ((slab + 1) * seg->depth) / nslabs;
+      for (s = s0; s < s1; s++) {
+        for (r = 0; r < seg->height; r++) {
+          for (c = 0; c < seg->width; c++) {
+            k = segStatsLookup((int)MRIgetVoxVal(seg, c, r, s, 0), uids, nuniq, &lastid, &lastu);
+            if (k < 0) continue;
+            vlist[fl[k]++] = MRIgetVoxVal(mri, c, r, s, frame);
+          }
+        }
+      }
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 1)
+#endif
+    for (u = 0; u < nuniq; u++) {
+      ROMP_PFLB_begin
+      qsort((void *)&vlist[offset[u]], count[u], sizeof(float), compare_floats);
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+    free(fill);
+  }
+  else {
+    offset = NULL;
+  }
+
+  // outputs, in the order of segids
+  for (n = 0; n < nsegs; n++) {
+    int nv;
+    double sum, sum2, val, umin = 0, umax = 0;
+
+    u = segu[n];
+    nvoxels[n] = count[u];
+    if (mri == NULL) continue;
+
+    if (favg) {
+      for (f = 0; f < mri->nframes; f++) favg[n][f] = (count[u] != 0) ? sfsum[(size_t)u * nframes + f] / count[u] : 0;
+    }
+    if (min == NULL) continue;
+
+    if (robust) {
+      // as MRIsegStatsRobust(): exclude Pct of the sorted values from each end
+      float *v = &vlist[offset[u]];
+      int k;
+      nv = 0;
+      sum = sum2 = 0;
+      for (k = 0; k < count[u]; k++) {
+        if (k < Pct * count[u] / 100.0) continue;
+        if (k > (100 - Pct) * count[u] / 100.0) continue;
+        val = v[k];
+        if (nv == 0) {
+          umin = val;
+          umax = val;
+        }
+        if (umin > val) umin = val;
+        if (umax < val) umax = val;
+        sum += val;
+        sum2 += (val * val);
+        nv++;
+      }
+    }
+    else {
+      nv = count[u];
+      sum = ssum[u];
+      sum2 = ssum2[u];
+      if (nv > 0) {
+        umin = smin[u];
+        umax = smax[u];
+      }
+    }
+
+    min[n] = umin;
+    max[n] = umax;
+    range[n] = max[n] - min[n];
+    mean[n] = (nv != 0) ? sum / nv : 0.0;
+    if (nv > 1)
+      std[n] = sqrt(((nv)*mean[n] * mean[n] - 2 * mean[n] * sum + sum2) / (nv - 1));
+    else
+      std[n] = 0.0;
+  }
+
+  free(uids);
+  free(segu);
+  free(count);
+  free(slabcount);
+  free(smin);
+  free(smax);
+  free(ssum);
+  free(ssum2);
+  free(sfsum);
+  if (offset) free(offset);
+  if (vlist) free(vlist);
+  return (0);
+}
+
 MRI *MRImask_with_T2_and_aparc_aseg(
     MRI *mri_src, MRI *mri_dst, MRI *mri_T2, MRI *mri_aparc_aseg, float T2_thresh, int mm_from_exterior)
 {
@@ -4372,6 +4666,279 @@ COLOR_TABLE *CTABpruneCTab(const COLOR_TABLE *ct0, MRI *seg)
   return (ct);
 }
 
+/*
+  Vertices of a surface bucketed into a uniform grid of cubic cells
+  (compressed: the vertices of cell n are vno[start[n]..start[n+1]-1],
+  in increasing order) for MRISclosestVertexField().
+*/
+typedef struct
+{
+  float x0, y0, z0, cellsize;
+  int nx, ny, nz;
+  int *start;
+  int *vno;
+  float *xyz;  // coords of vno[], 3 per vertex
+} CLOSEST_VERTEX_GRID;
+
+static int cvgCellIndex(float v, float v0, float cellsize, int n)
+{
+  int i = (int)floor((v - v0) / cellsize);
+  if (i < 0) i = 0;
+  if (i > n - 1) i = n - 1;
+  return (i);
+}
+
+static CLOSEST_VERTEX_GRID *cvgAlloc(MRIS *surf)
+{
+  CLOSEST_VERTEX_GRID *g;
+  float xlo = 1e10, ylo = 1e10, zlo = 1e10, xhi = -1e10, yhi = -1e10, zhi = -1e10;
+  double vol;
+  int vno, nv, n, ncells, *cell;
+  VERTEX *v;
+
+  g = (CLOSEST_VERTEX_GRID *)calloc(1, sizeof(CLOSEST_VERTEX_GRID));
+  for (nv = vno = 0; vno < surf->nvertices; vno++) {
+    v = &surf->vertices[vno];
+    if (v->ripflag) continue;
+    xlo = MIN(xlo, v->x);
+    ylo = MIN(ylo, v->y);
+    zlo = MIN(zlo, v->z);
+    xhi = MAX(xhi, v->x);
+    yhi = MAX(yhi, v->y);
+    zhi = MAX(zhi, v->z);
+    nv++;
+  }
+  if (nv == 0) xlo = ylo = zlo = xhi = yhi = zhi = 0;
+
+  // about 4 vertices per cell
+  vol = (xhi - xlo + 1.0) * (yhi - ylo + 1.0) * (zhi - zlo + 1.0);
+  g->cellsize = MAX(0.5, cbrt(4.0 * vol / MAX(nv, 1)));
+  g->x0 = xlo;
+  g->y0 = ylo;
+  g->z0 = zlo;
+  g->nx = (int)floor((xhi - xlo) / g->cellsize) + 1;
+  g->ny = (int)floor((yhi - ylo) / g->cellsize) + 1;
+  g->nz = (int)floor((zhi - zlo) / g->cellsize) + 1;
+  ncells = g->nx * g->ny * g->nz;
+
+  g->start = (int *)calloc(ncells + 1, sizeof(int));
+  g->vno = (int *)calloc(MAX(nv, 1), sizeof(int));
+  g->xyz = (float *)calloc(3 * MAX(nv, 1), sizeof(float));
+  cell = (int *)calloc(MAX(surf->nvertices, 1), sizeof(int));
+  if (!g->start || !g->vno || !g->xyz || !cell)
+    ErrorExit(ERROR_NOMEMORY, "MRISclosestVertexField: could not allocate %d cell grid", ncells);
+
+  // counting sort of the vertices by cell keeps them in vertex order within a cell
+  for (vno = 0; vno < surf->nvertices; vno++) {
+    v = &surf->vertices[vno];
+    if (v->ripflag) continue;
+    cell[vno] = cvgCellIndex(v->x, g->x0, g->cellsize, g->nx) +
+                g->nx * (cvgCellIndex(v->y, g->y0, g->cellsize, g->ny) +
+                         g->ny * cvgCellIndex(v->z, g->z0, g->cellsize, g->nz));
+    g->start[cell[vno] + 1]++;
+  }
+  for (n = 0; n < ncells; n++) g->start[n + 1] += g->start[n];
+  for (vno = 0; vno < surf->nvertices; vno++) {
+    v = &surf->vertices[vno];
+    if (v->ripflag) continue;
+    n = g->start[cell[vno]]++;
+    g->vno[n] = vno;
+    g->xyz[3 * n] = v->x;
+    g->xyz[3 * n + 1] = v->y;
+    g->xyz[3 * n + 2] = v->z;
+  }
+  for (n = ncells; n > 0; n--) g->start[n] = g->start[n - 1];
+  g->start[0] = 0;
+  free(cell);
+  return (g);
+}
+
+static void cvgFree(CLOSEST_VERTEX_GRID **pg)
+{
+  CLOSEST_VERTEX_GRID *g = *pg;
+
+  *pg = NULL;
+  free(g->start);
+  free(g->vno);
+  free(g->xyz);
+  free(g);
+}
+
+/*
+  Searches the cells in shells of increasing (chessboard) radius k
+  around the cell of x,y,z. A vertex in shell k is at least (k-1)
+  cells away, so the search stops once that exceeds the best distance.
+  The distance is computed exactly as in MRISfindClosestVertex() and
+  ties go to the lower vertex number, so the result is the same.
+*/
+static int cvgFindClosest(CLOSEST_VERTEX_GRID *g, float x, float y, float z, float *pdmin)
+{
+  int ix, iy, iz, k, kmax, cx, cy, cz, cx0, cx1, cy0, cy1, cz0, cz1, step, cell, n, vno, min_v = -1;
+  float d, min_d, dx, dy, dz;
+
+  ix = cvgCellIndex(x, g->x0, g->cellsize, g->nx);
+  iy = cvgCellIndex(y, g->y0, g->cellsize, g->ny);
+  iz = cvgCellIndex(z, g->z0, g->cellsize, g->nz);
+  kmax = MAX(g->nx, MAX(g->ny, g->nz));
+
+  min_d = 10000.0f;
+  for (k = 0; k <= kmax; k++) {
+    if (min_v >= 0 && (k - 1) * g->cellsize > min_d + 0.001 * g->cellsize) break;
+    cz0 = MAX(iz - k, 0);
+    cz1 = MIN(iz + k, g->nz - 1);
+    cy0 = MAX(iy - k, 0);
+    cy1 = MIN(iy + k, g->ny - 1);
+    for (cz = cz0; cz <= cz1; cz++) {
+      for (cy = cy0; cy <= cy1; cy++) {
+        if (abs(cz - iz) == k || abs(cy - iy) == k) {  // a face of the shell - the whole row
+          cx0 = MAX(ix - k, 0);
+          cx1 = MIN(ix + k, g->nx - 1);
+          step = 1;
+        }
+        else {  // only the two ends of the row are on the shell
+          cx0 = ix - k;
+          cx1 = ix + k;
+          step = MAX(2 * k, 1);
+        }
+        for (cx = cx0; cx <= cx1; cx += step) {
+          if (cx < 0 || cx >= g->nx) continue;
+          cell = cx + g->nx * (cy + g->ny * cz);
+          for (n = g->start[cell]; n < g->start[cell + 1]; n++) {
+            dx = g->xyz[3 * n] - x;
+            dy = g->xyz[3 * n + 1] - y;
+            dz = g->xyz[3 * n + 2] - z;
+            d = sqrt(dx * dx + dy * dy + dz * dz);
+            vno = g->vno[n];
+            if (d < min_d || (d == min_d && vno < min_v)) {
+              min_d = d;
+              min_v = vno;
+            }
+          }
+        }
+      }
+    }
+  }
+  if (pdmin != NULL) *pdmin = min_d;
+  return (min_v);
+}
+
+/*!
+  \fn int MRISclosestVertexField(MRI *vol, MRI *mask, MATRIX *vox2surf, MRIS **surfs, int nsurfs,
+                                 MRI **pindex, int **pvtxno, float **pdist)
+  \brief Finds the closest vertex of each surface to every voxel of vol
+  (in the mask, if given). The result is the same as calling
+  MRISfindClosestVertex() at each voxel (ripped vertices are skipped,
+  ties go to the lowest vertex number), but the vertices are bucketed
+  into a grid and the voxels are done in parallel, so it is fast enough
+  for a whole volume and does not have the range limit of the hash.
+  Only the voxels in the mask are stored: *pindex gives each its row
+  in the output arrays, so the closest vertex of surface n to voxel
+  c,r,s is (*pvtxno)[MRIIvox(*pindex,c,r,s)*nsurfs + n].
+  \param vox2surf - col,row,slice to surface xyz. NULL uses the
+  tkregister vox2ras of vol.
+  \param surfs - nsurfs surfaces; a NULL surface gives vertex -1
+  \param pindex - output MRI_INT with the row of each voxel, -1 outside
+  the mask; allocated if *pindex is NULL
+  \param pvtxno - output, allocated here: nsurfs vertex numbers per row
+  \param pdist - output, allocated here: nsurfs distances per row (0 for
+  a NULL surface). Pass NULL if not needed.
+*/
+int MRISclosestVertexField(
+    MRI *vol, MRI *mask, MATRIX *vox2surf, MRIS **surfs, int nsurfs, MRI **pindex, int **pvtxno, float **pdist)
+{
+  CLOSEST_VERTEX_GRID **grids;
+  MATRIX *M;
+  MRI *index;
+  int n, c, r, s, nvox, *vtxno;
+  float *dist = NULL;
+
+  if (*pindex == NULL) {
+    *pindex = MRIalloc(vol->width, vol->height, vol->depth, MRI_INT);
+    if (*pindex == NULL) return (1);
+    MRIcopyHeader(vol, *pindex);
+  }
+  index = *pindex;
+  if (index->type != MRI_INT) {
+    printf("ERROR: MRISclosestVertexField(): index must be MRI_INT\n");
+    return (1);
+  }
+
+  // number the voxels in the mask, the only ones with a row in the outputs
+  nvox = 0;
+  for (s = 0; s < vol->depth; s++)
+    for (r = 0; r < vol->height; r++)
+      for (c = 0; c < vol->width; c++) {
+        if (mask && MRIgetVoxVal(mask, c, r, s, 0) < 0.5)
+          MRIIvox(index, c, r, s) = -1;
+        else
+          MRIIvox(index, c, r, s) = nvox++;
+      }
+
+  vtxno = *pvtxno = (int *)calloc((size_t)MAX(nvox, 1) * nsurfs, sizeof(int));
+  if (pdist) dist = *pdist = (float *)calloc((size_t)MAX(nvox, 1) * nsurfs, sizeof(float));
+  if (vtxno == NULL || (pdist && dist == NULL)) {
+    printf("ERROR: MRISclosestVertexField(): could not allocate %d voxels x %d surfaces\n", nvox, nsurfs);
+    return (1);
+  }
+
+  if (vox2surf)
+    M = MatrixCopy(vox2surf, NULL);
+  else
+    M = MRIxfmCRS2XYZtkreg(vol);
+
+  grids = (CLOSEST_VERTEX_GRID **)calloc(nsurfs, sizeof(CLOSEST_VERTEX_GRID *));
+  for (n = 0; n < nsurfs; n++)
+    if (surfs[n]) grids[n] = cvgAlloc(surfs[n]);
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (s = 0; s < vol->depth; s++) {
+    ROMP_PFLB_begin
+    int c, r, f, vno, row;
+    float x, y, z, d;
+
+    for (c = 0; c < vol->width; c++) {
+      for (r = 0; r < vol->height; r++) {
+        row = MRIIvox(index, c, r, s);
+        if (row < 0) continue;
+        // accumulated in float in the same order as MatrixMultiply()
+        x = 0;
+        x += M->rptr[1][1] * c;
+        x += M->rptr[1][2] * r;
+        x += M->rptr[1][3] * s;
+        x += M->rptr[1][4];
+        y = 0;
+        y += M->rptr[2][1] * c;
+        y += M->rptr[2][2] * r;
+        y += M->rptr[2][3] * s;
+        y += M->rptr[2][4];
+        z = 0;
+        z += M->rptr[3][1] * c;
+        z += M->rptr[3][2] * r;
+        z += M->rptr[3][3] * s;
+        z += M->rptr[3][4];
+        for (f = 0; f < nsurfs; f++) {
+          vno = -1;
+          d = 0;
+          if (grids[f]) vno = cvgFindClosest(grids[f], x, y, z, &d);
+          vtxno[(size_t)row * nsurfs + f] = vno;
+          if (dist) dist[(size_t)row * nsurfs + f] = d;
+        }
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  for (n = 0; n < nsurfs; n++)
+    if (grids[n]) cvgFree(&grids[n]);
+  free(grids);
+  MatrixFree(&M);
+  return (0);
+}
+
 /*
   \fn MRI *MRIannot2CorticalSeg(MRI *seg, MRIS *lhw, MRIS *lhp, MRIS *rhw, MRIS *rhp, LTA *anat2seg, MRI *ctxseg)
   \brief Creates a segmentation of the cortical labels
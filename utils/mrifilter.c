@@ -2573,6 +2573,163 @@ MRI *MRIstdNonzero(MRI *mri_src, MRI *mri_dst, MRI *mri_mean, int wsize)
   return (mri_dst);
 }
 
+/*-----------------------------------------------------
+  Separable Gaussian engine for MRI_FLOAT volumes, used by
+  MRIconvolveGaussian(). Each pass is written as a sequence of
+  row updates out[x] += k[i] * in[x] over contiguous float rows,
+  so the inner loop vectorizes, and every output still sums its
+  taps in kernel order with clamped borders, which gives the same
+  result as the three MRIconvolve1d() passes.
+
+  The x and y passes run slice by slice (one slice of scratch per
+  thread), and the z pass walks all slices for a tile of
+  CONVOLVE_YTILE rows at a time, so the len input rows stay in
+  cache while the tile moves down the volume. Set
+  FS_LEGACY_CONVOLVE to go back to MRIconvolve1d().
+------------------------------------------------------*/
+#ifndef FS_CUDA
+#define CONVOLVE_YTILE 8
+
+static int mriConvolveGaussianLegacy(void)
+{
+  static int legacy = -1;
+
+  if (legacy < 0) {
+    legacy = getenv("FS_LEGACY_CONVOLVE") != NULL;
+  }
+  return (legacy);
+}
+
+static void mriConvolveRowAccumulate(float *out, const float *in, float k, int width)
+{
+  int x;
+
+  for (x = 0; x < width; x++) {
+    out[x] += k * in[x];
+  }
+}
+
+static int mriConvolveGaussianFloat(MRI *mri_src, MRI *mri_dst, float *kernel, int klen)
+{
+  int width, height, depth, frame, z, nytiles, ytile;
+  float *vol, one = 1.0f;
+  float *kx, *ky, *kz;
+  int lx, ly, lz;
+  size_t slice;
+
+  width = mri_src->width;
+  height = mri_src->height;
+  depth = mri_src->depth;
+  slice = (size_t)width * height;
+
+  /* MRIconvolve1d() copies instead of convolving along a dimension of 1 */
+  kx = ky = kz = kernel;
+  lx = ly = lz = klen;
+  if (width == 1) {
+    kx = &one;
+    lx = 1;
+  }
+  if (height == 1) {
+    ky = &one;
+    ly = 1;
+  }
+  if (depth == 1) {
+    kz = &one;
+    lz = 1;
+  }
+
+  vol = (float *)calloc(slice * depth, sizeof(float));
+  if (!vol) {
+    ErrorReturn(ERROR_NOMEMORY,
+                (ERROR_NOMEMORY, "mriConvolveGaussianFloat: could not allocate %dx%dx%d buffer", width, height, depth));
+  }
+
+  nytiles = (height + CONVOLVE_YTILE - 1) / CONVOLVE_YTILE;
+  for (frame = 0; frame < mri_src->nframes; frame++) {
+    /* x and y passes, one slice at a time, into vol */
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(assume_reproducible) schedule(static, 1)
+#endif
+    for (z = 0; z < depth; z++) {
+      ROMP_PFLB_begin
+      int x, y, i, yk, xhalf = lx / 2, yhalf = ly / 2;
+      float *pad, *xbuf, *in, *out;
+
+      pad = (float *)calloc(width + lx, sizeof(float));
+      xbuf = (float *)calloc(slice, sizeof(float));
+      if (!pad || !xbuf) {
+        ErrorExit(ERROR_NOMEMORY, "mriConvolveGaussianFloat: could not allocate slice buffers");
+      }
+
+      for (y = 0; y < height; y++) {
+        in = &MRIFseq_vox(mri_src, 0, y, z, frame);
+        for (x = 0; x < xhalf; x++) {
+          pad[x] = in[0];
+        }
+        memmove(pad + xhalf, in, width * sizeof(float));
+        for (x = xhalf + width; x < width + lx; x++) {
+          pad[x] = in[width - 1];
+        }
+        out = xbuf + (size_t)y * width;
+        for (i = 0; i < lx; i++) {
+          mriConvolveRowAccumulate(out, pad + i, kx[i], width);
+        }
+      }
+
+      for (y = 0; y < height; y++) {
+        out = vol + z * slice + (size_t)y * width;
+        for (i = 0; i < ly; i++) {
+          yk = MIN(height - 1, MAX(0, y + i - yhalf));
+          mriConvolveRowAccumulate(out, xbuf + (size_t)yk * width, ky[i], width);
+        }
+      }
+
+      free(xbuf);
+      free(pad);
+      exec_progress_callback(z, depth, frame, mri_src->nframes);
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
+    /* z pass, a tile of rows at a time, from vol into the destination */
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 1)
+#endif
+    for (ytile = 0; ytile < nytiles; ytile++) {
+      ROMP_PFLB_begin
+      int x, y, y0, y1, zz, i, zk, zhalf = lz / 2;
+      float *out;
+
+      y0 = ytile * CONVOLVE_YTILE;
+      y1 = MIN(height, y0 + CONVOLVE_YTILE);
+      for (zz = 0; zz < depth; zz++) {
+        for (y = y0; y < y1; y++) {
+          out = &MRIFseq_vox(mri_dst, 0, y, zz, frame);
+          for (x = 0; x < width; x++) {
+            out[x] = 0.0f;
+          }
+          for (i = 0; i < lz; i++) {
+            zk = MIN(depth - 1, MAX(0, zz + i - zhalf));
+            mriConvolveRowAccumulate(out, vol + zk * slice + (size_t)y * width, kz[i], width);
+          }
+        }
+      }
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
+    if (frame < mri_src->nframes - 1) {
+      memset(vol, 0, slice * depth * sizeof(float));
+    }
+  }
+
+  free(vol);
+  return (NO_ERROR);
+}
+#endif
+
 /*-----------------------------------------------------
 MRIconvolveGaussian() - see also MRIgaussianSmooth();
 ------------------------------------------------------*/
@@ -2625,26 +2782,31 @@ MRI *MRIconvolveGaussian(MRI *mri_src, MRI *mri_dst, MRI *mri_gaussian)
     mri_tmp = NULL;
   }
 
-  int nstart = global_progress_range[0];
-  int nend = global_progress_range[1];
-  int nstep = (nstart - nend) / mri_src->nframes;
-  mtmp1 = NULL;
-  for (frame = 0; frame < mri_src->nframes; frame++) {
-    global_progress_range[1] = global_progress_range[0] + nstep / 3;
-    mtmp1 = MRIcopyFrame(mri_src, mtmp1, frame, 0);
-    MRIconvolve1d(mri_src, mtmp1, kernel, klen, MRI_WIDTH, frame, 0);
-    global_progress_range[0] += nstep / 3;
-    global_progress_range[1] += nstep / 3;
-    MRIconvolve1d(mtmp1, mri_dst, kernel, klen, MRI_HEIGHT, 0, frame);
-    global_progress_range[0] += nstep / 3;
-    global_progress_range[1] += nstep / 3;
-    MRIconvolve1d(mri_dst, mtmp1, kernel, klen, MRI_DEPTH, frame, 0);
-
-    MRIcopyFrame(mtmp1, mri_dst, 0, frame); /* convert it back to UCHAR */
-    global_progress_range[0] = global_progress_range[1];
+  if (mri_src->type == MRI_FLOAT && !mriConvolveGaussianLegacy()) {
+    mriConvolveGaussianFloat(mri_src, mri_dst, kernel, klen);
   }
+  else {
+    int nstart = global_progress_range[0];
+    int nend = global_progress_range[1];
+    int nstep = (nstart - nend) / mri_src->nframes;
+    mtmp1 = NULL;
+    for (frame = 0; frame < mri_src->nframes; frame++) {
+      global_progress_range[1] = global_progress_range[0] + nstep / 3;
+      mtmp1 = MRIcopyFrame(mri_src, mtmp1, frame, 0);
+      MRIconvolve1d(mri_src, mtmp1, kernel, klen, MRI_WIDTH, frame, 0);
+      global_progress_range[0] += nstep / 3;
+      global_progress_range[1] += nstep / 3;
+      MRIconvolve1d(mtmp1, mri_dst, kernel, klen, MRI_HEIGHT, 0, frame);
+      global_progress_range[0] += nstep / 3;
+      global_progress_range[1] += nstep / 3;
+      MRIconvolve1d(mri_dst, mtmp1, kernel, klen, MRI_DEPTH, frame, 0);
+
+      MRIcopyFrame(mtmp1, mri_dst, 0, frame); /* convert it back to UCHAR */
+      global_progress_range[0] = global_progress_range[1];
+    }
 
-  MRIfree(&mtmp1);
+    MRIfree(&mtmp1);
+  }
 #endif
   MRIcopyHeader(mri_src, mri_dst);
 
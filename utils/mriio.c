@@ -39,6 +39,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
@@ -67,6 +68,7 @@
 #include "math.h"
 #include "matrix.h"
 #include "mghendian.h"
+#include "mgzblock.h"
 #include "mri2.h"
 #include "mri_circulars.h"
 #include "mri_identify.h"
@@ -180,7 +182,7 @@ static void float_local_buffer_to_image(float *buf, MRI *mri, int slice, int fra
 static void local_buffer_to_image(BUFTYPE *buf, MRI *mri, int slice, int frame);
 
 static MRI *sdtRead(const char *fname, int read_volume);
-static MRI *mghRead(const char *fname, int read_volume, int frame);
+static MRI *mghRead(const char *fname, int read_volume, int start_frame, int end_frame);
 static int mghWrite(MRI *mri, const char *fname, int frame);
 static int mghAppend(MRI *mri, const char *fname, int frame);
 
@@ -693,7 +695,14 @@ MRI *mri_read(const char *fname, int type, int volume_flag, int start_frame, int
     mri = sdtRead(fname_copy, volume_flag);
   }
   else if (type == MRI_MGH_FILE) {
-    mri = mghRead(fname_copy, volume_flag, -1);
+    if (volume_flag && start_frame >= 0) {
+      // mghRead() only reads the requested frames off disk
+      mri = mghRead(fname_copy, volume_flag, start_frame, end_frame);
+      if (mri && nan_inf_check(mri) != NO_ERROR) MRIfree(&mri);
+      start_frame = -1;
+    }
+    else
+      mri = mghRead(fname_copy, volume_flag, -1, -1);
   }
   else if (type == MGH_MORPH) {
     int which = start_frame ;
@@ -984,7 +993,7 @@ MRI *MRIread(const char *fname)
 } /* end MRIread() */
 
 // allow picking one frame out of many frame
-// currently implemented only for Siemens dicom file
+// for Siemens dicom and mgh/mgz only that frame is read off disk
 MRI *MRIreadEx(const char *fname, int nthframe)
 {
   char buf[STRLEN];
@@ -11203,16 +11212,197 @@ int znzTAGreadMRIframes(znzFile fp, MRI *mri, long len)
 // declare function pointer
 // static int (*myclose)(FILE *stream);
 
-static MRI *mghRead(const char *fname, int read_volume, int frame)
+#define MGH_HEADER_SIZE (7 * sizeof(int) + UNUSED_SPACE_SIZE)
+
+/*!
+  \fn static void mghSwapToHost(void *buf, size_t nvox, int bpv)
+  \brief Converts nvox big-endian (MGH file order) voxels in buf to host
+  byte order in place, or back again. Written as plain shifts on unsigned
+  ints so the compiler can vectorize it.
+*/
+static void mghSwapToHost(void *buf, size_t nvox, int bpv)
+{
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+  size_t n;
+
+  if (bpv == 2) {
+    unsigned short *p = (unsigned short *)buf;
+    for (n = 0; n < nvox; n++) p[n] = (unsigned short)((p[n] >> 8) | (p[n] << 8));
+  }
+  else if (bpv == 4) {
+    unsigned int *p = (unsigned int *)buf;
+    for (n = 0; n < nvox; n++) {
+      unsigned int v = p[n];
+      p[n] = (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+    }
+  }
+#endif
+}
+
+/*!
+  \fn static MGZB *mghOpenBlocks(const char *fname, int nframes, size_t bytes_per_vol)
+  \brief Returns the member index if fname is a block-compressed mgz with
+  one member per frame (see mgzblock.h), otherwise NULL, in which case the
+  file is read as an ordinary gzip stream.
+*/
+static MGZB *mghOpenBlocks(const char *fname, int nframes, size_t bytes_per_vol)
+{
+  MGZB *mgzb;
+  int frame;
+
+  mgzb = MGZBopen(fname);
+  if (mgzb == NULL) return (NULL);
+  if (mgzb->nmembers < nframes + 1 || mgzb->usize[0] != (long long)MGH_HEADER_SIZE) {
+    MGZBclose(&mgzb);
+    return (NULL);
+  }
+  for (frame = 0; frame < nframes; frame++)
+    if (mgzb->usize[frame + 1] != (long long)bytes_per_vol) {
+      MGZBclose(&mgzb);
+      return (NULL);
+    }
+  return (mgzb);
+}
+
+/*!
+  \fn static MRI *mghMapFrames(const char *fname, long offset, int width, int height, int depth, int type, int nframes)
+  \brief mmap()s nframes of voxel data starting at offset of an uncompressed
+  .mgh into a chunked MRI. The mapping is private, so swapping to host byte
+  order does not touch the file. Returns NULL if the file cannot be mapped
+  (setenv FS_MGH_MMAP 0 to never map), and the caller falls back to reading.
+*/
+static MRI *mghMapFrames(const char *fname, long offset, int width, int height, int depth, int type, int nframes)
+{
+  MRI *mri;
+  struct stat st;
+  size_t bytes, pad;
+  void *map;
+  char *env;
+  int fd;
+
+  env = getenv("FS_MGH_MMAP");
+  if (env && !strcmp(env, "0")) return (NULL);
+
+  bytes = (size_t)width * height * depth * nframes * MRIsizeof(type);
+  fd = open(fname, O_RDONLY);
+  if (fd < 0) return (NULL);
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)(offset + bytes)) {
+    close(fd);
+    return (NULL);
+  }
+  pad = offset % sysconf(_SC_PAGESIZE);
+  map = mmap(NULL, bytes + pad, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, (off_t)(offset - pad));
+  close(fd);
+  if (map == MAP_FAILED) return (NULL);
+
+  mghSwapToHost((char *)map + pad, bytes / MRIsizeof(type), MRIsizeof(type));
+  mri = MRIallocChunkMapped(width, height, depth, type, nframes, map, bytes + pad, pad);
+  if (mri == NULL) munmap(map, bytes + pad);
+  return (mri);
+}
+
+/*!
+  \fn static MRI *mghReadFrames(const char *fname, znzFile fp, MGZB *mgzb, long data_offset,
+                                int width, int height, int depth, int type, int nframes,
+                                int start_frame, int end_frame)
+  \brief Reads frames start_frame to end_frame from an open MGH file whose
+  voxel data begins at data_offset. Only the requested frames are read:
+  uncompressed files are mmap()ed or seeked, block-compressed mgz members
+  are inflated individually, and plain gzip streams are skipped with one
+  seek. A subset of frames (or FS_USE_MRI_CHUNK=1) yields a chunked MRI and
+  the voxels go straight into the chunk.
+*/
+static MRI *mghReadFrames(const char *fname,
+                          znzFile fp,
+                          MGZB *mgzb,
+                          long data_offset,
+                          int width,
+                          int height,
+                          int depth,
+                          int type,
+                          int nframes,
+                          int start_frame,
+                          int end_frame)
+{
+  MRI *mri = NULL;
+  int frame, z, y, nread, ranged, chunk_env;
+  size_t bpv, bytes_per_row, bytes_per_slice, bytes_per_vol;
+  BUFTYPE *buf = NULL, *vol = NULL, *src;
+  char *env;
+
+  nread = end_frame - start_frame + 1;
+  ranged = (nread != nframes);
+  env = getenv("FS_USE_MRI_CHUNK");
+  chunk_env = (env != NULL && strcmp(env, "1") == 0);
+
+  bpv = (type == MRI_TENSOR) ? sizeof(float) : MRIsizeof(type);
+  bytes_per_row = bpv * width;
+  bytes_per_slice = bytes_per_row * height;
+  bytes_per_vol = bytes_per_slice * depth;
+
+  if (fp->withz == 0 && type != MRI_TENSOR && (ranged || chunk_env))
+    mri = mghMapFrames(fname, data_offset + (long)(start_frame * bytes_per_vol), width, height, depth, type, nread);
+  if (mri) return (mri);
+
+  if (ranged && type != MRI_TENSOR)
+    mri = MRIallocChunk(width, height, depth, type, nread);
+  else
+    mri = MRIallocSequence(width, height, depth, type, nread);
+  if (mri == NULL) return (NULL);
+  if (!mri->ischunked) buf = (BUFTYPE *)malloc(mgzb ? bytes_per_vol : bytes_per_slice);
+
+  if (!mgzb && start_frame > 0) znzseek(fp, data_offset + (long)(start_frame * bytes_per_vol), SEEK_SET);
+
+  for (frame = start_frame; frame <= end_frame; frame++) {
+    if (mri->ischunked)
+      vol = (BUFTYPE *)mri->chunk + (frame - start_frame) * bytes_per_vol;
+    if (mgzb) {
+      if (!mri->ischunked) vol = buf;
+      if (MGZBreadMember(mgzb, frame + 1, vol, bytes_per_vol) != NO_ERROR) {
+        if (buf) free(buf);
+        MRIfree(&mri);
+        ErrorReturn(NULL, (ERROR_BADFILE, "mghRead(%s): could not read frame %d", fname, frame));
+      }
+      mghSwapToHost(vol, bytes_per_vol / bpv, bpv);
+    }
+    for (z = 0; z < depth; z++) {
+      if (mgzb)
+        src = vol + z * bytes_per_slice;
+      else {
+        src = mri->ischunked ? vol + z * bytes_per_slice : buf;
+        if (znzread(src, sizeof(char), bytes_per_slice, fp) != bytes_per_slice) {
+          if (buf) free(buf);
+          MRIfree(&mri);
+          ErrorReturn(NULL,
+                      (ERROR_BADFILE,
+                       "mghRead(%s): could not read %d bytes at slice %d",
+                       fname,
+                       (int)bytes_per_slice,
+                       z));
+        }
+        mghSwapToHost(src, bytes_per_slice / bpv, bpv);
+      }
+      if (!mri->ischunked)
+        for (y = 0; y < height; y++)
+          memmove(mri->slices[z + (frame - start_frame) * depth][y], src + y * bytes_per_row, bytes_per_row);
+      exec_progress_callback(z, depth, frame - start_frame, nread);
+    }
+  }
+  if (buf) free(buf);
+
+  return (mri);
+}
+
+static MRI *mghRead(const char *fname, int read_volume, int start_frame, int end_frame)
 {
   MRI *mri;
   znzFile fp;
-  int start_frame, end_frame, width, height, depth, nframes, type, x, y, z, bpv, dof, bytes, version, ival,
-      unused_space_size, good_ras_flag, i;
-  BUFTYPE *buf;
+  MGZB *mgzb = NULL;
+  int width, height, depth, nframes, type, bpv, dof, version, unused_space_size, good_ras_flag;
+  size_t bytes_per_vol;
+  long data_offset;
   char unused_buf[UNUSED_SPACE_SIZE + 1];
   float fval, xsize, ysize, zsize, x_r, x_a, x_s, y_r, y_a, y_s, z_r, z_a, z_s, c_r, c_a, c_s, xfov, yfov, zfov;
-  short sval;
   //  int tag_data_size;
   char *ext;
   int gzipped = 0;
@@ -11237,7 +11427,7 @@ static MRI *mghRead(const char *fname, int read_volume, int frame)
     fp = znzopen(fname, "rb", gzipped);
     if (znz_isnull(fp)) {
       errno = 0;
-      ErrorReturn(NULL, (ERROR_BADPARM, "mghRead(%s, %d): could not open file", fname, frame));
+      ErrorReturn(NULL, (ERROR_BADPARM, "mghRead(%s, %d): could not open file", fname, start_frame));
     }
   }
   else {
@@ -11246,7 +11436,7 @@ static MRI *mghRead(const char *fname, int read_volume, int frame)
                  "mghRead(%s, %d): could not open file.\n"
                  "Filename extension must be .mgh, .mgh.gz or .mgz",
                  fname,
-                 frame));
+                 start_frame));
   }
 
   /* keep the compiler quiet */
@@ -11257,7 +11447,7 @@ static MRI *mghRead(const char *fname, int read_volume, int frame)
   c_r = c_a = c_s = 0;
 
   nread = znzreadIntEx(&version, fp);
-  if (!nread) ErrorReturn(NULL, (ERROR_BADPARM, "mghRead(%s, %d): read error", fname, frame));
+  if (!nread) ErrorReturn(NULL, (ERROR_BADPARM, "mghRead(%s, %d): read error", fname, start_frame));
 
   width = znzreadInt(fp);
   height = znzreadInt(fp);
@@ -11311,93 +11501,68 @@ static MRI *mghRead(const char *fname, int read_volume, int frame)
       nframes = 9;
       break;
   }
-  bytes = width * height * bpv; /* bytes per slice */
+  bytes_per_vol = (size_t)width * height * depth * bpv;
+  data_offset = znztell(fp);
+  if (gzipped) mgzb = mghOpenBlocks(fname, nframes, bytes_per_vol);
+
   if (!read_volume) {
     mri = MRIallocHeader(width, height, depth, type, nframes);
     mri->dof = dof;
     mri->nframes = nframes;
-    if (gzipped) {  // pipe cannot seek
-      long count, total_bytes;
-      uchar buf[STRLEN];
-
-      total_bytes = (long)mri->nframes * width * height * depth * bpv;
-      for (count = 0; count < total_bytes - STRLEN; count += STRLEN) znzread(buf, STRLEN, 1, fp);
-      znzread(buf, total_bytes - count, 1, fp);
-    }
-    else
-      znzseek(fp, (long)mri->nframes * width * height * depth * bpv, SEEK_CUR);
   }
   else {
-    if (frame >= 0) {
-      start_frame = end_frame = frame;
-      if (gzipped) {  // pipe cannot seek
-        long count;
-        for (count = 0; count < (long)frame * width * height * depth * bpv; count++) znzgetc(fp);
-      }
-      else
-        znzseek(fp, (long)frame * width * height * depth * bpv, SEEK_CUR);
-      nframes = 1;
-    }
-    else { /* hack - # of frames < -1 means to only read in that
-              many frames. Otherwise I would have had to change the whole
-              MRIread interface and that was too much of a pain. Sorry.
-           */
-      if (frame < -1) nframes = frame * -1;
-
+    if (start_frame < 0) {
       start_frame = 0;
       end_frame = nframes - 1;
-      if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON) fprintf(stderr, "read %d frames\n", nframes);
     }
-    buf = (BUFTYPE *)calloc(bytes, sizeof(BUFTYPE));
-    mri = MRIallocSequence(width, height, depth, type, nframes);
+    else if (start_frame >= nframes || end_frame >= nframes || end_frame < start_frame) {
+      znzclose(fp);
+      MGZBclose(&mgzb);
+      errno = 0;
+      ErrorReturn(NULL,
+                  (ERROR_BADPARM,
+                   "mghRead(%s): frames %d to %d are out of range (%d frames in volume)",
+                   fname,
+                   start_frame,
+                   end_frame,
+                   nframes));
+    }
+    mri = mghReadFrames(fname, fp, mgzb, data_offset, width, height, depth, type, nframes, start_frame, end_frame);
+    if (mri == NULL) {
+      znzclose(fp);
+      MGZBclose(&mgzb);
+      return (NULL);
+    }
     mri->dof = dof;
-    for (frame = start_frame; frame <= end_frame; frame++) {
-      for (z = 0; z < depth; z++) {
-        if ((int)znzread(buf, sizeof(char), bytes, fp) != bytes) {
-          // fclose(fp) ;
-          znzclose(fp);
-          free(buf);
-          ErrorReturn(NULL, (ERROR_BADFILE, "mghRead(%s): could not read %d bytes at slice %d", fname, bytes, z));
-        }
-        switch (type) {
-          case MRI_INT:
-            for (i = y = 0; y < height; y++) {
-              for (x = 0; x < width; x++, i++) {
-                ival = orderIntBytes(((int *)buf)[i]);
-                MRIIseq_vox(mri, x, y, z, frame - start_frame) = ival;
-              }
-            }
-            break;
-          case MRI_SHORT:
-            for (i = y = 0; y < height; y++) {
-              for (x = 0; x < width; x++, i++) {
-                sval = orderShortBytes(((short *)buf)[i]);
-                MRISseq_vox(mri, x, y, z, frame - start_frame) = sval;
-              }
-            }
-            break;
-          case MRI_TENSOR:
-          case MRI_FLOAT:
-            for (i = y = 0; y < height; y++) {
-              for (x = 0; x < width; x++, i++) {
-                fval = orderFloatBytes(((float *)buf)[i]);
-                MRIFseq_vox(mri, x, y, z, frame - start_frame) = fval;
-              }
-            }
-            break;
-          case MRI_UCHAR:
-            local_buffer_to_image(buf, mri, z, frame - start_frame);
-            break;
-          default:
-            errno = 0;
-            ErrorReturn(NULL, (ERROR_UNSUPPORTED, "mghRead: unsupported type %d", mri->type));
-            break;
-        }
-        exec_progress_callback(z, depth, frame - start_frame, end_frame - start_frame + 1);
-      }
+  }
+
+  // position fp at the TR etc and tags that follow the voxel data
+  if (mgzb && mgzb->tail_offset >= 0) {
+    int fd;
+
+    znzclose(fp);
+    fd = open(fname, O_RDONLY);
+    if (fd >= 0 && lseek(fd, (off_t)mgzb->tail_offset, SEEK_SET) == (off_t)mgzb->tail_offset)
+      fp = znzdopen(fd, "rb", 1);
+    else if (fd >= 0)
+      close(fd);
+    if (znz_isnull(fp)) {
+      MGZBclose(&mgzb);
+      MRIfree(&mri);
+      ErrorReturn(NULL, (ERROR_BADFILE, "mghRead(%s): could not reopen file at tags", fname));
     }
-    if (buf) free(buf);
   }
+  else if (!read_volume && gzipped) {  // pipe cannot seek
+    long count, total_bytes;
+    uchar buf[STRLEN];
+
+    total_bytes = (long)nframes * bytes_per_vol;
+    for (count = 0; count < total_bytes - STRLEN; count += STRLEN) znzread(buf, STRLEN, 1, fp);
+    znzread(buf, total_bytes - count, 1, fp);
+  }
+  else if (znztell(fp) != data_offset + (long)(nframes * bytes_per_vol))
+    znzseek(fp, data_offset + (long)(nframes * bytes_per_vol), SEEK_SET);
+  MGZBclose(&mgzb);
 
   if (good_ras_flag > 0) {
     mri->xsize = xsize;
@@ -11457,7 +11622,22 @@ static MRI *mghRead(const char *fname, int read_volume, int frame)
 
       switch (tag) {
         case TAG_MRI_FRAME:
-          if (znzTAGreadMRIframes(fp, mri, len) != NO_ERROR)
+          if (mri->nframes != nframes) {
+            // only some frames were read, keep the info for those
+            MRI *mri_all = MRIallocHeader(width, height, depth, type, nframes);
+            if (znzTAGreadMRIframes(fp, mri_all, len) != NO_ERROR)
+              fprintf(stderr, "couldn't read frame structure from file\n");
+            else {
+              int f;
+              for (f = 0; f < mri->nframes; f++) {
+                MATRIX *m = mri->frames[f].m_ras2vox;
+                mri->frames[f] = mri_all->frames[f + start_frame];
+                mri_all->frames[f + start_frame].m_ras2vox = m;
+              }
+            }
+            MRIfree(&mri_all);
+          }
+          else if (znzTAGreadMRIframes(fp, mri, len) != NO_ERROR)
             fprintf(stderr, "couldn't read frame structure from file\n");
           break;
 
@@ -11551,15 +11731,120 @@ static MRI *mghRead(const char *fname, int read_volume, int frame)
   return (mri);
 }
 
+static void mghPutInt(unsigned char **pp, int i)
+{
+  i = orderIntBytes(i);
+  memmove(*pp, &i, sizeof(i));
+  *pp += sizeof(i);
+}
+
+static void mghPutShort(unsigned char **pp, short sval)
+{
+  sval = orderShortBytes(sval);
+  memmove(*pp, &sval, sizeof(sval));
+  *pp += sizeof(sval);
+}
+
+static void mghPutFloat(unsigned char **pp, float fval)
+{
+  fval = orderFloatBytes(fval);
+  memmove(*pp, &fval, sizeof(fval));
+  *pp += sizeof(fval);
+}
+
+/*!
+  \fn static void mghPackHeader(MRI *mri, unsigned char *hdr)
+  \brief Fills hdr with the MGH_HEADER_SIZE byte header of mri as it
+  appears on disk.
+
+  WARNING - adding or removing anything before nframes will
+  cause mghAppend to fail.
+*/
+static void mghPackHeader(MRI *mri, unsigned char *hdr)
+{
+  unsigned char *p = hdr;
+
+  memset(hdr, 0, MGH_HEADER_SIZE);
+  mghPutInt(&p, MGH_VERSION);
+  mghPutInt(&p, mri->width);
+  mghPutInt(&p, mri->height);
+  mghPutInt(&p, mri->depth);
+  mghPutInt(&p, mri->nframes);
+  mghPutInt(&p, mri->type);
+  mghPutInt(&p, mri->dof);
+
+  /* write RAS and voxel size info */
+  mghPutShort(&p, mri->ras_good_flag ? 1 : -1);
+  mghPutFloat(&p, mri->xsize);
+  mghPutFloat(&p, mri->ysize);
+  mghPutFloat(&p, mri->zsize);
+
+  mghPutFloat(&p, mri->x_r);
+  mghPutFloat(&p, mri->x_a);
+  mghPutFloat(&p, mri->x_s);
+
+  mghPutFloat(&p, mri->y_r);
+  mghPutFloat(&p, mri->y_a);
+  mghPutFloat(&p, mri->y_s);
+
+  mghPutFloat(&p, mri->z_r);
+  mghPutFloat(&p, mri->z_a);
+  mghPutFloat(&p, mri->z_s);
+
+  mghPutFloat(&p, mri->c_r);
+  mghPutFloat(&p, mri->c_a);
+  mghPutFloat(&p, mri->c_s);
+  /* the rest is left zero so stuff can be added to the header in the future */
+}
+
+/*!
+  \fn static int mghWriteBlocks(MRI *mri, const char *fname, unsigned char *hdr, int start_frame, int end_frame)
+  \brief Writes the header and voxels of a block-compressed mgz (see
+  mgzblock.h), one gzip member for the header and one per frame. The
+  caller appends the tags as a final, ordinary gzip member.
+*/
+static int mghWriteBlocks(MRI *mri, const char *fname, unsigned char *hdr, int start_frame, int end_frame)
+{
+  FILE *fp;
+  BUFTYPE *vol;
+  size_t bpv, bytes_per_row, bytes_per_vol;
+  int frame, y, z, ret;
+
+  fp = fopen(fname, "wb");
+  if (fp == NULL) ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "mghWrite(%s): could not open file", fname));
+
+  bpv = MRIsizeof(mri->type);
+  bytes_per_row = bpv * mri->width;
+  bytes_per_vol = bytes_per_row * mri->height * mri->depth;
+  vol = (BUFTYPE *)malloc(bytes_per_vol);
+
+  ret = MGZBwriteMember(fp, hdr, MGH_HEADER_SIZE, Z_DEFAULT_COMPRESSION);
+  for (frame = start_frame; frame <= end_frame && ret == NO_ERROR; frame++) {
+    for (z = 0; z < mri->depth; z++)
+      for (y = 0; y < mri->height; y++)
+        memmove(vol + (z * mri->height + y) * bytes_per_row,
+                mri->slices[z + frame * mri->depth][y],
+                bytes_per_row);
+    mghSwapToHost(vol, bytes_per_vol / bpv, bpv);
+    ret = MGZBwriteMember(fp, vol, bytes_per_vol, Z_DEFAULT_COMPRESSION);
+    exec_progress_callback(frame - start_frame, end_frame - start_frame + 1, 0, 1);
+  }
+  free(vol);
+  if (fclose(fp) != 0 && ret == NO_ERROR)
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "mghWrite(%s): could not close file", fname));
+
+  return (ret);
+}
+
 static int mghWrite(MRI *mri, const char *fname, int frame)
 {
   znzFile fp;
-  int ival, start_frame, end_frame, x, y, z, width, height, depth, unused_space_size, flen;
-  char buf[UNUSED_SPACE_SIZE + 1];
+  int ival, start_frame, end_frame, x, y, z, width, height, depth, flen;
+  unsigned char hdr[MGH_HEADER_SIZE];
   float fval;
   short sval;
   int gzipped = 0;
-  char *ext;
+  char *ext, *env;
 
   if (frame >= 0)
     start_frame = end_frame = frame;
@@ -11581,14 +11866,7 @@ static int mghWrite(MRI *mri, const char *fname, int frame)
       valid_ext = 1;
     }
   }
-  if (valid_ext) {
-    fp = znzopen(fname, "wb", gzipped);
-    if (znz_isnull(fp)) {
-      errno = 0;
-      ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "mghWrite(%s, %d): could not open file", fname, frame));
-    }
-  }
-  else {
+  if (!valid_ext) {
     errno = 0;
     ErrorReturn(ERROR_BADPARM,
                 (ERROR_BADPARM,
@@ -11597,90 +11875,72 @@ static int mghWrite(MRI *mri, const char *fname, int frame)
                  fname));
   }
 
-  /* WARNING - adding or removing anything before nframes will
-     cause mghAppend to fail.
-  */
+  mghPackHeader(mri, hdr);
   width = mri->width;
   height = mri->height;
   depth = mri->depth;
-  // printf("(w,h,d) = (%d,%d,%d)\n", width, height, depth);
-  znzwriteInt(MGH_VERSION, fp);
-  znzwriteInt(mri->width, fp);
-  znzwriteInt(mri->height, fp);
-  znzwriteInt(mri->depth, fp);
-  znzwriteInt(mri->nframes, fp);
-  znzwriteInt(mri->type, fp);
-  znzwriteInt(mri->dof, fp);
-
-  unused_space_size = UNUSED_SPACE_SIZE - USED_SPACE_SIZE - sizeof(short);
-
-  /* write RAS and voxel size info */
-  znzwriteShort(mri->ras_good_flag ? 1 : -1, fp);
-  znzwriteFloat(mri->xsize, fp);
-  znzwriteFloat(mri->ysize, fp);
-  znzwriteFloat(mri->zsize, fp);
-
-  znzwriteFloat(mri->x_r, fp);
-  znzwriteFloat(mri->x_a, fp);
-  znzwriteFloat(mri->x_s, fp);
-
-  znzwriteFloat(mri->y_r, fp);
-  znzwriteFloat(mri->y_a, fp);
-  znzwriteFloat(mri->y_s, fp);
-
-  znzwriteFloat(mri->z_r, fp);
-  znzwriteFloat(mri->z_a, fp);
-  znzwriteFloat(mri->z_s, fp);
-
-  znzwriteFloat(mri->c_r, fp);
-  znzwriteFloat(mri->c_a, fp);
-  znzwriteFloat(mri->c_s, fp);
 
-  /* so stuff can be added to the header in the future */
-  memset(buf, 0, UNUSED_SPACE_SIZE * sizeof(char));
-  znzwrite(buf, sizeof(char), unused_space_size, fp);
+  // setenv FS_MGZ_BLOCKED 1 to write an mgz that can be read a frame at a time
+  env = getenv("FS_MGZ_BLOCKED");
+  if (gzipped && env != NULL && strcmp(env, "1") == 0 &&
+      (mri->type == MRI_UCHAR || mri->type == MRI_SHORT || mri->type == MRI_INT || mri->type == MRI_FLOAT)) {
+    if (mghWriteBlocks(mri, fname, hdr, start_frame, end_frame) != NO_ERROR) return (Gerror);
+    fp = znzopen(fname, "ab", 1);
+    if (znz_isnull(fp)) {
+      errno = 0;
+      ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "mghWrite(%s, %d): could not open file", fname, frame));
+    }
+  }
+  else {
+    fp = znzopen(fname, "wb", gzipped);
+    if (znz_isnull(fp)) {
+      errno = 0;
+      ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "mghWrite(%s, %d): could not open file", fname, frame));
+    }
+    znzwrite(hdr, sizeof(char), MGH_HEADER_SIZE, fp);
 
-  for (frame = start_frame; frame <= end_frame; frame++) {
-    for (z = 0; z < depth; z++) {
-      for (y = 0; y < height; y++) {
-        switch (mri->type) {
-          case MRI_SHORT:
-            for (x = 0; x < width; x++) {
-              if (z == 74 && y == 16 && x == 53) DiagBreak();
-              sval = MRISseq_vox(mri, x, y, z, frame);
-              znzwriteShort(sval, fp);
-            }
-            break;
-          case MRI_INT:
-            for (x = 0; x < width; x++) {
-              if (z == 74 && y == 16 && x == 53) DiagBreak();
-              ival = MRIIseq_vox(mri, x, y, z, frame);
-              znzwriteInt(ival, fp);
-            }
-            break;
-          case MRI_FLOAT:
-            for (x = 0; x < width; x++) {
-              if (z == 74 && y == 16 && x == 53) DiagBreak();
-              // printf("mghWrite: MRI_FLOAT: curr (x, y, z, frame) = (%d, %d, %d, %d)\n", x, y, z, frame);
-              fval = MRIFseq_vox(mri, x, y, z, frame);
-              // if(x==10 && y == 0 && z == 0 && frame == 67)
-              // printf("MRIIO: %g\n",fval);
-              znzwriteFloat(fval, fp);
-            }
-            break;
-          case MRI_UCHAR:
-            if ((int)znzwrite(&MRIseq_vox(mri, 0, y, z, frame), sizeof(BUFTYPE), width, fp) != width) {
+    for (frame = start_frame; frame <= end_frame; frame++) {
+      for (z = 0; z < depth; z++) {
+        for (y = 0; y < height; y++) {
+          switch (mri->type) {
+            case MRI_SHORT:
+              for (x = 0; x < width; x++) {
+                if (z == 74 && y == 16 && x == 53) DiagBreak();
+                sval = MRISseq_vox(mri, x, y, z, frame);
+                znzwriteShort(sval, fp);
+              }
+              break;
+            case MRI_INT:
+              for (x = 0; x < width; x++) {
+                if (z == 74 && y == 16 && x == 53) DiagBreak();
+                ival = MRIIseq_vox(mri, x, y, z, frame);
+                znzwriteInt(ival, fp);
+              }
+              break;
+            case MRI_FLOAT:
+              for (x = 0; x < width; x++) {
+                if (z == 74 && y == 16 && x == 53) DiagBreak();
+                // printf("mghWrite: MRI_FLOAT: curr (x, y, z, frame) = (%d, %d, %d, %d)\n", x, y, z, frame);
+                fval = MRIFseq_vox(mri, x, y, z, frame);
+                // if(x==10 && y == 0 && z == 0 && frame == 67)
+                // printf("MRIIO: %g\n",fval);
+                znzwriteFloat(fval, fp);
+              }
+              break;
+            case MRI_UCHAR:
+              if ((int)znzwrite(&MRIseq_vox(mri, 0, y, z, frame), sizeof(BUFTYPE), width, fp) != width) {
+                errno = 0;
+                ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "mghWrite: could not write %d bytes to %s", width, fname));
+              }
+              break;
+            default:
               errno = 0;
-              ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "mghWrite: could not write %d bytes to %s", width, fname));
-            }
-            break;
-          default:
-            errno = 0;
-            ErrorReturn(ERROR_UNSUPPORTED, (ERROR_UNSUPPORTED, "mghWrite: unsupported type %d", mri->type));
-            break;
+              ErrorReturn(ERROR_UNSUPPORTED, (ERROR_UNSUPPORTED, "mghWrite: unsupported type %d", mri->type));
+              break;
+          }
         }
+        exec_progress_callback(z, depth, frame - start_frame, end_frame - start_frame + 1);
       }
-      exec_progress_callback(z, depth, frame - start_frame, end_frame - start_frame + 1);
     }
   }
 
@@ -212,6 +212,22 @@ int mhtBruteForceClosestVertex(
 //--------- test -----------
 static int checkFace(MRIS_HASH_TABLE *mht, MRI_SURFACE const *mris, int fno1);
 
+//--------- tree-backed tables -----------
+static void mhtTreeFree(MHT_TREE **ptree);
+static void mhtTreeRefitItem(MRIS_HASH_TABLE *mht, int item);
+static int  mhtTreeDoesTriangleIntersect(
+    MRIS_HASH_TABLE const * const mht, 
+    MHT_TRIANGLE    const * const triangle,
+    int                     const nFaceToIgnore,
+    int const             * const fnoToIgnore,
+    int                     const trace);
+static int  mhtTreeFindClosest(
+    MRIS_HASH_TABLE const *mht, 
+    double probex, double probey, double probez,
+    double max_distance_mm,
+    int project_into_face,
+    double *pdistance);
+
 
 // Primitives that have to be correct...
 //
@@ -257,6 +273,7 @@ void MHTfree(MRIS_HASH_TABLE **pmht)
   omp_destroy_lock(&mht->buckets_lock);
 #endif
   
+  if (mht->tree) mhtTreeFree(&mht->tree);
   free(mht);
 }
 
@@ -499,6 +516,14 @@ int MHTaddAllFaces(MRIS_HASH_TABLE *mht, MRI_SURFACE const *mris, VERTEX const *
     ErrorExit(ERROR_BADPARM, "%s: mht not initialized for faces\n", __MYFUNCTION__);
   }
 
+  if (mht->tree) {
+    for (fi = 0; fi < v->num; fi++) {
+      mht->tree->absent[v->f[fi]] = 0;
+      mhtTreeRefitItem(mht, v->f[fi]);
+    }
+    return (NO_ERROR);
+  }
+
   for (fi = 0; fi < v->num; fi++) mhtFaceToMHT(mht, mris, v->f[fi], 1);
   return (NO_ERROR);
 }
@@ -519,6 +544,11 @@ int MHTremoveAllFaces(MRIS_HASH_TABLE *mht, MRI_SURFACE const *mris, VERTEX cons
     ErrorExit(ERROR_BADPARM, "%s: mht not initialized for faces\n", __MYFUNCTION__);
   }
 
+  if (mht->tree) {
+    for (fno = 0; fno < v->num; fno++) mht->tree->absent[v->f[fno]] = 1;
+    return (NO_ERROR);
+  }
+
   for (fno = 0; fno < v->num; fno++) mhtFaceToMHT(mht, mris, v->f[fno], 0);
   return (NO_ERROR);
 }
@@ -1343,6 +1373,8 @@ static int MHTdoesTriangleIntersect(
 {
   int retval = 0;
 
+  if (mht->tree) return mhtTreeDoesTriangleIntersect(mht, triangle, nFaceToIgnore, fnoToIgnore, trace);
+
   // Find all the voxels that the triangle intersects
   //
   VOXEL_LISTgw voxlist;
@@ -1959,6 +1991,14 @@ int MHTfindClosestVertexGeneric(MRIS_HASH_TABLE *mht,
   // Safety limit
   if (max_mhts > max_mhts_MAX) max_mhts = max_mhts_MAX;
 
+  if (mht->tree) {
+    MinDistVtxNum = mhtTreeFindClosest(mht, probex, probey, probez, max_distance_mm, 0, &MinDistTemp);
+    if (pvtx) *pvtx = (MinDistVtxNum < 0) ? NULL : &mris->vertices[MinDistVtxNum];
+    if (vtxnum) *vtxnum = MinDistVtxNum;
+    if (vtx_distance) *vtx_distance = MinDistTemp;
+    return NO_ERROR;
+  }
+
   // printf("\nmax_distance_mm=%f\n",max_distance_mm);
 
   //--------------------------------------------------
@@ -2265,6 +2305,15 @@ int MHTfindClosestFaceGeneric(MRIS_HASH_TABLE *mht,
     max_mhts = max_mhts_MAX;
 #endif
 
+  if (mht->tree) {
+    MinDistFaceNum =
+        mhtTreeFindClosest(mht, probex, probey, probez, max_distance_mm, project_into_face, &MinDistTemp);
+    if (pface) *pface = (MinDistFaceNum < 0) ? NULL : &mris->faces[MinDistFaceNum];
+    if (pfno) *pfno = MinDistFaceNum;
+    if (pface_distance) *pface_distance = MinDistTemp;
+    return NO_ERROR;
+  }
+
   // printf("\nmax_distance_mm=%f\n",max_distance_mm);
 
   //--------------------------------------------------
@@ -3020,6 +3069,8 @@ MHBT *MHTacqBucket(MRIS_HASH_TABLE *mht, float x, float y, float z)
   //-------------------------------------------------------------------
   int xv, yv, zv;
 
+  if (mht->tree) ErrorExit(ERROR_UNSUPPORTED, "%s: tree-backed tables have no buckets\n", __MYFUNCTION__);
+
   xv = WORLD_TO_VOXEL(mht, x);
   yv = WORLD_TO_VOXEL(mht, y);
   zv = WORLD_TO_VOXEL(mht, z);
@@ -3030,6 +3081,7 @@ MHBT *MHTacqBucket(MRIS_HASH_TABLE *mht, float x, float y, float z)
 /*-----------------------------------------------------------------*/
 MHBT *MHTacqBucketAtVoxIx(MRIS_HASH_TABLE *mht, int xv, int yv, int zv)
 {
+  if (mht->tree) ErrorExit(ERROR_UNSUPPORTED, "%s: tree-backed tables have no buckets\n", __MYFUNCTION__);
   return acqBucket(mht, xv, yv, zv);
 }
 
@@ -3407,3 +3459,405 @@ static void mhtStoreFaceCentroids(MHT* mht, MRI_SURFACE const *mris, int which)
     face->cz = zt;
   }
 }
+
+
+//=============================================================================
+// Tree-backed tables
+//
+// MHTcreateFaceTree and MHTcreateVertexTree put the items in a flattened
+// bounding volume hierarchy instead of the buckets. Each node is split at the
+// median centroid along the widest axis of its centroids, so the tree has
+// depth log2(n/MHT_TREE_LEAF_SIZE) however the triangle sizes vary, and a
+// query costs the same in the crowded sulci as on the smooth crowns.
+//
+// Boxes are refit rather than rebuilt when vertices move. That keeps them
+// correct but lets them grow looser if the surface deforms a lot, so
+// callers that move the surface far should rebuild now and then.
+//=============================================================================
+
+#define MHT_TREE_LEAF_SIZE  4
+#define MHT_TREE_MAX_DEPTH  128
+
+static void mhtTreeFree(MHT_TREE **ptree)
+{
+  MHT_TREE *tree = *ptree;
+  *ptree = NULL;
+  if (!tree) return;
+  free(tree->nodes);
+  free(tree->items);
+  free(tree->leaf);
+  free(tree->absent);
+  free(tree);
+}
+
+static void mhtTreeItemCentroid(MRIS_HASH_TABLE const *mht, int item, float *c)
+{
+  if (mht->fno_usage == MHTFNO_FACE)
+    mhtFaceCentroid2xyz_float(mht, item, &c[0], &c[1], &c[2]);
+  else
+    mhtVertex2xyz_float(&mht->mris->vertices[item], mht->which_vertices, &c[0], &c[1], &c[2]);
+}
+
+static void mhtTreeItemBox(MRIS_HASH_TABLE const *mht, int item, float *lo, float *hi)
+{
+  float p[3];
+  int n, k;
+
+  if (mht->fno_usage != MHTFNO_FACE) {
+    mhtTreeItemCentroid(mht, item, p);
+    for (k = 0; k < 3; k++) lo[k] = hi[k] = p[k];
+    return;
+  }
+
+  FACE const *face = &mht->mris->faces[item];
+  for (n = 0; n < VERTICES_PER_FACE; n++) {
+    mhtVertex2xyz_float(&mht->mris->vertices[face->v[n]], mht->which_vertices, &p[0], &p[1], &p[2]);
+    for (k = 0; k < 3; k++) {
+      if (n == 0 || p[k] < lo[k]) lo[k] = p[k];
+      if (n == 0 || p[k] > hi[k]) hi[k] = p[k];
+    }
+  }
+}
+
+static void mhtTreeRefitNode(MRIS_HASH_TABLE const *mht, int nodeno)
+{
+  MHT_TREE *tree = mht->tree;
+  MHT_TREE_NODE *node = &tree->nodes[nodeno];
+  float lo[3], hi[3];
+  int i, k;
+
+  if (node->count == 0) {
+    MHT_TREE_NODE const *left  = &tree->nodes[node->first];
+    MHT_TREE_NODE const *right = &tree->nodes[node->first + 1];
+    for (k = 0; k < 3; k++) {
+      node->lo[k] = MIN(left->lo[k], right->lo[k]);
+      node->hi[k] = MAX(left->hi[k], right->hi[k]);
+    }
+    return;
+  }
+
+  for (i = 0; i < node->count; i++) {
+    mhtTreeItemBox(mht, tree->items[node->first + i], lo, hi);
+    for (k = 0; k < 3; k++) {
+      if (i == 0 || lo[k] < node->lo[k]) node->lo[k] = lo[k];
+      if (i == 0 || hi[k] > node->hi[k]) node->hi[k] = hi[k];
+    }
+  }
+}
+
+// Recompute the centroid of one face or vertex and the boxes above it
+static void mhtTreeRefitItem(MRIS_HASH_TABLE *mht, int item)
+{
+  MHT_TREE *tree = mht->tree;
+  int nodeno;
+
+  if (mht->fno_usage == MHTFNO_FACE) {
+    MHT_FACE *face = &mht->f[item];
+    mhtComputeFaceCentroid(mht->mris, mht->which_vertices, item, &face->cx, &face->cy, &face->cz);
+  }
+  for (nodeno = tree->leaf[item]; nodeno >= 0; nodeno = tree->nodes[nodeno].parent) {
+    mhtTreeRefitNode(mht, nodeno);
+  }
+}
+
+// Partially sort items[lo..hi] so that items[k] has the k'th smallest key
+static void mhtTreeSelect(int *items, float const *centroids, int axis, int lo, int hi, int k)
+{
+  while (hi > lo) {
+    float const pivot = centroids[3 * items[(lo + hi) / 2] + axis];
+    int i = lo, j = hi;
+    while (i <= j) {
+      while (centroids[3 * items[i] + axis] < pivot) i++;
+      while (centroids[3 * items[j] + axis] > pivot) j--;
+      if (i <= j) {
+        int const tmp = items[i];
+        items[i++] = items[j];
+        items[j--] = tmp;
+      }
+    }
+    if (k <= j)
+      hi = j;
+    else if (k >= i)
+      lo = i;
+    else
+      break;
+  }
+}
+
+static void mhtTreeBuildNode(MRIS_HASH_TABLE *mht, float const *centroids, int nodeno, int first, int count)
+{
+  MHT_TREE *tree = mht->tree;
+  MHT_TREE_NODE *node = &tree->nodes[nodeno];
+  float lo[3], hi[3];
+  int i, k, axis, mid, left;
+
+  if (count <= MHT_TREE_LEAF_SIZE) {
+    node->first = first;
+    node->count = count;
+    for (i = 0; i < count; i++) tree->leaf[tree->items[first + i]] = nodeno;
+    mhtTreeRefitNode(mht, nodeno);
+    return;
+  }
+
+  // split at the median centroid along the axis they spread furthest
+  for (i = 0; i < count; i++) {
+    float const *c = &centroids[3 * tree->items[first + i]];
+    for (k = 0; k < 3; k++) {
+      if (i == 0 || c[k] < lo[k]) lo[k] = c[k];
+      if (i == 0 || c[k] > hi[k]) hi[k] = c[k];
+    }
+  }
+  axis = 0;
+  for (k = 1; k < 3; k++)
+    if (hi[k] - lo[k] > hi[axis] - lo[axis]) axis = k;
+  mid = first + count / 2;
+  mhtTreeSelect(tree->items, centroids, axis, first, first + count - 1, mid);
+
+  left = tree->nnodes;
+  tree->nnodes += 2;
+  node->first = left;
+  node->count = 0;
+  tree->nodes[left].parent = tree->nodes[left + 1].parent = nodeno;
+  mhtTreeBuildNode(mht, centroids, left, first, mid - first);
+  mhtTreeBuildNode(mht, centroids, left + 1, mid, first + count - mid);
+  mhtTreeRefitNode(mht, nodeno);
+}
+
+static void mhtTreeBuild(MRIS_HASH_TABLE *mht)
+{
+  MRI_SURFACE const *mris = mht->mris;
+  int const nall = (mht->fno_usage == MHTFNO_FACE) ? mris->nfaces : mris->nvertices;
+  MHT_TREE *tree;
+  float *centroids;
+  int item;
+
+  tree = (MHT_TREE *)calloc(1, sizeof(MHT_TREE));
+  if (!tree) ErrorExit(ERROR_NO_MEMORY, "%s: could not allocate tree.\n", __MYFUNCTION__);
+  mht->tree = tree;
+
+  tree->items = (int *)calloc(MAX(nall, 1), sizeof(int));
+  tree->leaf = (int *)calloc(MAX(nall, 1), sizeof(int));
+  tree->absent = (char *)calloc(MAX(nall, 1), sizeof(char));
+  tree->nodes = (MHT_TREE_NODE *)calloc(2 * nall + 1, sizeof(MHT_TREE_NODE));
+  centroids = (float *)calloc(3 * MAX(nall, 1), sizeof(float));
+  if (!tree->items || !tree->leaf || !tree->absent || !tree->nodes || !centroids) {
+    ErrorExit(ERROR_NO_MEMORY, "%s: could not allocate tree for %d items.\n", __MYFUNCTION__, nall);
+  }
+
+  for (item = 0; item < nall; item++) {
+    tree->leaf[item] = -1;
+    if (mht->fno_usage == MHTFNO_FACE ? mris->faces[item].ripflag : mris->vertices[item].ripflag) continue;
+    mhtTreeItemCentroid(mht, item, &centroids[3 * item]);
+    tree->items[tree->nitems++] = item;
+  }
+
+  tree->nnodes = 1;
+  tree->nodes[0].parent = -1;
+  if (tree->nitems) mhtTreeBuildNode(mht, centroids, 0, 0, tree->nitems);
+  free(centroids);
+}
+
+/*-------------------------------------------------------------
+  MHTcreateFaceTree, MHTcreateVertexTree
+  Like MHTcreateFaceTable_Resolution and MHTcreateVertexTable, but
+  backed by a tree. The face and vertex queries work on it unchanged.
+  -------------------------------------------------------------*/
+MRIS_HASH_TABLE *MHTcreateFaceTree(MRI_SURFACE const *mris, int which)
+{
+  MRIS_HASH_TABLE *mht = newMHT(mris);
+
+  mhtStoreFaceCentroids(mht, mris, which);
+  mht->vres = VOXEL_RES;
+  mht->which_vertices = which;
+  mht->fno_usage = MHTFNO_FACE;
+  mhtTreeBuild(mht);
+  return mht;
+}
+
+MRIS_HASH_TABLE *MHTcreateVertexTree(MRI_SURFACE const *mris, int which)
+{
+  MRIS_HASH_TABLE *mht = newMHT(mris);
+
+  mhtStoreFaceCentroids(mht, mris, which);
+  mht->vres = VOXEL_RES;
+  mht->which_vertices = which;
+  mht->fno_usage = MHTFNO_VERTEX;
+  mhtTreeBuild(mht);
+  return mht;
+}
+
+/*-------------------------------------------------------------
+  MHTrefit
+  Update a tree-backed table in place after the vertices have
+  moved, bottom up so every box covers what is below it. The
+  set of faces or vertices is kept, so rebuild if ripflags change.
+  -------------------------------------------------------------*/
+int MHTrefit(MRIS_HASH_TABLE *mht, MRI_SURFACE const *mris)
+{
+  MHT_TREE *tree;
+  int fno, nodeno;
+
+  if (!mht || !mht->tree) ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "%s: not a tree-backed table\n", __MYFUNCTION__));
+  if (mht->mris != mris) ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "%s: mris is wrong\n", __MYFUNCTION__));
+
+  tree = mht->tree;
+  for (fno = 0; fno < mht->nfaces; fno++) {
+    MHT_FACE *face = &mht->f[fno];
+    mhtComputeFaceCentroid(mris, mht->which_vertices, fno, &face->cx, &face->cy, &face->cz);
+  }
+  // children always follow their parents
+  if (tree->nitems)
+    for (nodeno = tree->nnodes - 1; nodeno >= 0; nodeno--) mhtTreeRefitNode(mht, nodeno);
+  return (NO_ERROR);
+}
+
+static int mhtTreeBoxesOverlap(MHT_TREE_NODE const *node, float const *lo, float const *hi)
+{
+  return node->lo[0] <= hi[0] && lo[0] <= node->hi[0] &&
+         node->lo[1] <= hi[1] && lo[1] <= node->hi[1] &&
+         node->lo[2] <= hi[2] && lo[2] <= node->hi[2];
+}
+
+static int mhtTreeDoesTriangleIntersect(
+    MRIS_HASH_TABLE const * const mht, 
+    MHT_TRIANGLE    const * const triangle,
+    int                     const nFaceToIgnore,
+    int const             * const fnoToIgnore,
+    int                     const trace)
+{
+  MRI_SURFACE const *mris = mht->mris;
+  MHT_TREE const *tree = mht->tree;
+  int stack[MHT_TREE_MAX_DEPTH];
+  int nstack = 0, n, i, k;
+  float lo[3], hi[3];
+  double v0[3], v1[3], v2[3];
+
+  for (n = 0; n < 3; n++) {
+    Ptdbl_t const *corner = &triangle->corners[n];
+    double const c[3] = {corner->x, corner->y, corner->z};
+    for (k = 0; k < 3; k++) {
+      if (n == 0 || c[k] < lo[k]) lo[k] = c[k];
+      if (n == 0 || c[k] > hi[k]) hi[k] = c[k];
+    }
+  }
+  // the corners were rounded to float, so widen the box by one ulp
+  for (k = 0; k < 3; k++) {
+    lo[k] = nextafterf(lo[k], -HUGE_VALF);
+    hi[k] = nextafterf(hi[k], HUGE_VALF);
+  }
+
+  v0[0] = triangle->corners[0].x;  v0[1] = triangle->corners[0].y;  v0[2] = triangle->corners[0].z;
+  v1[0] = triangle->corners[1].x;  v1[1] = triangle->corners[1].y;  v1[2] = triangle->corners[1].z;
+  v2[0] = triangle->corners[2].x;  v2[1] = triangle->corners[2].y;  v2[2] = triangle->corners[2].z;
+
+  if (tree->nitems) stack[nstack++] = 0;
+  while (nstack) {
+    MHT_TREE_NODE const *node = &tree->nodes[stack[--nstack]];
+    if (!mhtTreeBoxesOverlap(node, lo, hi)) continue;
+    if (node->count == 0) {
+      stack[nstack++] = node->first;
+      stack[nstack++] = node->first + 1;
+      continue;
+    }
+
+    for (i = 0; i < node->count; i++) {
+      int const fno = tree->items[node->first + i];
+      if (tree->absent[fno]) continue;
+      for (k = 0; k < nFaceToIgnore; k++)
+        if (fnoToIgnore[k] == fno) break;
+      if (k < nFaceToIgnore) continue;
+
+      FACE const *face = &mris->faces[fno];
+      double u0[3], u1[3], u2[3];
+      mhtVertex2array3_double(&mris->vertices[face->v[0]], mht->which_vertices, u0);
+      mhtVertex2array3_double(&mris->vertices[face->v[1]], mht->which_vertices, u1);
+      mhtVertex2array3_double(&mris->vertices[face->v[2]], mht->which_vertices, u2);
+
+      if (tri_tri_intersect(v0, v1, v2, u0, u1, u2)) {
+        if (trace) {
+          fprintf(stderr, "mhtTreeDoesTriangleIntersect thinks face:%d intersects\n", fno);
+        }
+        return (1);
+      }
+    }
+  }
+
+  return (0);
+}
+
+static double mhtTreeBoxDistSq(MHT_TREE_NODE const *node, double const *p)
+{
+  double d, dsq = 0.0;
+  int k;
+
+  for (k = 0; k < 3; k++) {
+    if (p[k] < node->lo[k])
+      d = node->lo[k] - p[k];
+    else if (p[k] > node->hi[k])
+      d = p[k] - node->hi[k];
+    else
+      continue;
+    dsq += d * d;
+  }
+  return dsq;
+}
+
+// Exact nearest vertex, or nearest face centroid, within max_distance_mm.
+// Returns -1 and a distance of 1e3 if there is none, like the bucket search.
+static int mhtTreeFindClosest(
+    MRIS_HASH_TABLE const *mht, 
+    double probex, double probey, double probez,
+    double max_distance_mm,
+    int project_into_face,
+    double *pdistance)
+{
+  MHT_TREE const *tree = mht->tree;
+  double const probe[3] = {probex, probey, probez};
+  double bestsq = max_distance_mm * max_distance_mm;
+  int stack[MHT_TREE_MAX_DEPTH];
+  int nstack = 0, best = -1, i;
+
+  if (tree->nitems) stack[nstack++] = 0;
+  while (nstack) {
+    MHT_TREE_NODE const *node = &tree->nodes[stack[--nstack]];
+    if (mhtTreeBoxDistSq(node, probe) > bestsq) continue;
+    if (node->count == 0) {
+      // push the farther child first so the nearer one is searched first
+      int nearer = node->first, farther = node->first + 1;
+      if (mhtTreeBoxDistSq(&tree->nodes[farther], probe) < mhtTreeBoxDistSq(&tree->nodes[nearer], probe)) {
+        nearer = farther;
+        farther = node->first;
+      }
+      stack[nstack++] = farther;
+      stack[nstack++] = nearer;
+      continue;
+    }
+
+    for (i = 0; i < node->count; i++) {
+      int const item = tree->items[node->first + i];
+      float c[3];
+      double distsq, lambda[3];
+
+      if (tree->absent[item]) continue;
+      mhtTreeItemCentroid(mht, item, c);
+      distsq = SQR(c[0] - probex) + SQR(c[1] - probey) + SQR(c[2] - probez);
+      if (best >= 0 ? distsq >= bestsq : distsq > bestsq) continue;
+      if (project_into_face > 0 &&
+          face_barycentric_coords(
+              mht->mris, item, mht->which_vertices, probex, probey, probez, &lambda[0], &lambda[1], &lambda[2]) < 0)
+        continue;
+      bestsq = distsq;
+      best = item;
+    }
+  }
+
+  *pdistance = 1e3;
+  if (best >= 0) {
+    *pdistance = sqrt(bestsq);
+    if (*pdistance > max_distance_mm) {
+      best = -1;
+      *pdistance = 1e3;
+    }
+  }
+  return best;
+}
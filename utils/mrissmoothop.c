@@ -0,0 +1,231 @@
+/**
+ * @file  mrissmoothop.c
+ * @brief nearest-neighbor surface smoothing as a precomputed sparse operator
+ *
+ * MRISsmoothMRIFast() walks the neighbor lists of every vertex for every
+ * frame and every step. Here the averaging step is built once as a
+ * compressed sparse row operator and applied to a vertices x frames
+ * block, so each neighbor lookup is shared by a block of frames and the
+ * inner loop runs over contiguous frames. Each step gives the same
+ * values as MRISsmoothMRIFast().
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "diag.h"
+#include "error.h"
+#include "macros.h"
+#include "mri.h"
+#include "mri2.h"
+#include "mrisurf.h"
+#include "mrissmoothop.h"
+#include "romp_support.h"
+
+static float smoothOpMaskVal(MRI *mri, int vno)
+{
+  int c, r, s;
+
+  c = vno % mri->width;
+  r = (vno / mri->width) % mri->height;
+  s = vno / (mri->width * mri->height);
+  return (MRIgetVoxVal(mri, c, r, s, 0));
+}
+
+/*!
+  \fn MRIS_SMOOTH_OP *MRISsmoothOpAlloc(MRIS *surf, MRI *IncMask)
+  \brief Builds the single nearest-neighbor averaging step of
+  MRISsmoothMRIFast(). Each vertex in the inclusive mask is averaged
+  with itself and its unripped neighbors in the mask; vertices outside
+  the mask are set to 0. IncMask may be NULL and may have any shape with
+  nvertices voxels.
+*/
+MRIS_SMOOTH_OP *MRISsmoothOpAlloc(MRIS *surf, MRI *IncMask)
+{
+  MRIS_SMOOTH_OP *op;
+  char *inmask;
+  int vno, nthnbr, nbrvno, nnz, nedges;
+  VERTEX *v;
+
+  if (IncMask && IncMask->width * IncMask->height * IncMask->depth != surf->nvertices) {
+    printf("ERROR: MRISsmoothOpAlloc(): Surf/Mask dimension mismatch\n");
+    return (NULL);
+  }
+
+  inmask = (char *)calloc(surf->nvertices, sizeof(char));
+  for (vno = 0; vno < surf->nvertices; vno++) inmask[vno] = (!IncMask || smoothOpMaskVal(IncMask, vno) >= 0.5);
+
+  op = (MRIS_SMOOTH_OP *)calloc(1, sizeof(MRIS_SMOOTH_OP));
+  op->nvertices = surf->nvertices;
+  nedges = 0;
+  for (vno = 0; vno < surf->nvertices; vno++) nedges += surf->vertices[vno].vnum;
+  op->rowptr = (int *)calloc(surf->nvertices + 1, sizeof(int));
+  op->colidx = (int *)calloc(surf->nvertices + nedges, sizeof(int));
+
+  nnz = 0;
+  for (vno = 0; vno < surf->nvertices; vno++) {
+    op->rowptr[vno] = nnz;
+    if (!inmask[vno]) continue;
+    op->nrows++;
+    op->colidx[nnz++] = vno;
+    v = &surf->vertices[vno];
+    for (nthnbr = 0; nthnbr < v->vnum; nthnbr++) {
+      nbrvno = v->v[nthnbr];
+      if (surf->vertices[nbrvno].ripflag) continue;
+      if (!inmask[nbrvno]) continue;
+      op->colidx[nnz++] = nbrvno;
+    }
+  }
+  op->rowptr[surf->nvertices] = nnz;
+  op->nnz = nnz;
+
+  free(inmask);
+  return (op);
+}
+
+/*!
+  \fn int MRISsmoothOpFree(MRIS_SMOOTH_OP **pop)
+  \brief Frees the operator.
+*/
+int MRISsmoothOpFree(MRIS_SMOOTH_OP **pop)
+{
+  MRIS_SMOOTH_OP *op = *pop;
+
+  if (op == NULL) return (0);
+  free(op->rowptr);
+  free(op->colidx);
+  free(op);
+  *pop = NULL;
+  return (0);
+}
+
+/*---------------------------------------------------------------
+  smoothOpStep() - y = op * x for a block of nb frames stored
+  vertex-major (the nb values of vertex vno at x[vno*nb]). The sums
+  are formed in the same order as MRISsmoothMRIFast() for each frame.
+  ---------------------------------------------------------------*/
+static void smoothOpStep(const MRIS_SMOOTH_OP *op, const float *x, float *y, int nb)
+{
+  int vno;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(static)
+#endif
+  for (vno = 0; vno < op->nvertices; vno++) {
+    ROMP_PFLB_begin
+    int n, j, start = op->rowptr[vno], end = op->rowptr[vno + 1], num;
+    const float *xn;
+    float *yv = y + (size_t)vno * nb;
+
+    if (start == end) {
+      for (j = 0; j < nb; j++) yv[j] = 0;
+      ROMP_PFLB_continue;
+    }
+    xn = x + (size_t)op->colidx[start] * nb;
+    for (j = 0; j < nb; j++) yv[j] = xn[j];
+    for (n = start + 1; n < end; n++) {
+      xn = x + (size_t)op->colidx[n] * nb;
+      for (j = 0; j < nb; j++) yv[j] += xn[j];
+    }
+    num = end - start;
+    for (j = 0; j < nb; j++) yv[j] = yv[j] / num;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
+/*!
+  \fn MRI *MRISsmoothOpApply(MRIS_SMOOTH_OP *op, MRI *Src, int nSmoothSteps, MRI *Targ)
+  \brief Applies nSmoothSteps averaging steps to every frame of Src,
+  which may have any shape with nvertices voxels (columns fastest). Can
+  be done in-place. If Targ is NULL, a float volume is allocated.
+  Vertices outside the operator's mask are set to 0. The result is
+  identical to MRISsmoothMRIFast().
+*/
+MRI *MRISsmoothOpApply(MRIS_SMOOTH_OP *op, MRI *Src, int nSmoothSteps, MRI *Targ)
+{
+  int nvox, frame0, nb, j, c, r, s, vno, nthstep;
+  float *x, *y, *tmp;
+
+  nvox = Src->width * Src->height * Src->depth;
+  if (nvox != op->nvertices) {
+    printf("ERROR: MRISsmoothOpApply(): Surf/Src dimension mismatch\n");
+    return (NULL);
+  }
+  if (Targ == NULL) {
+    Targ = MRIallocSequence(Src->width, Src->height, Src->depth, MRI_FLOAT, Src->nframes);
+    if (Targ == NULL) {
+      printf("ERROR: MRISsmoothOpApply(): could not alloc\n");
+      return (NULL);
+    }
+    MRIcopyHeader(Src, Targ);
+  }
+  else if (MRIdimMismatch(Src, Targ, 1)) {
+    printf("ERROR: MRISsmoothOpApply(): output dimension mismatch\n");
+    return (NULL);
+  }
+
+  nb = MIN(Src->nframes, MRIS_SMOOTH_OP_FRAME_BLOCK);
+  x = (float *)calloc((size_t)nvox * nb, sizeof(float));
+  y = (float *)calloc((size_t)nvox * nb, sizeof(float));
+
+  for (frame0 = 0; frame0 < Src->nframes; frame0 += MRIS_SMOOTH_OP_FRAME_BLOCK) {
+    nb = MIN(Src->nframes - frame0, MRIS_SMOOTH_OP_FRAME_BLOCK);
+
+    // Gather the block vertex-major; vertices outside the mask start at 0
+    vno = 0;
+    for (s = 0; s < Src->depth; s++) {
+      for (r = 0; r < Src->height; r++) {
+        for (c = 0; c < Src->width; c++) {
+          if (op->rowptr[vno] == op->rowptr[vno + 1])
+            for (j = 0; j < nb; j++) x[(size_t)vno * nb + j] = 0;
+          else if (Src->type == MRI_FLOAT)
+            for (j = 0; j < nb; j++) x[(size_t)vno * nb + j] = MRIFseq_vox(Src, c, r, s, frame0 + j);
+          else
+            for (j = 0; j < nb; j++) x[(size_t)vno * nb + j] = MRIgetVoxVal(Src, c, r, s, frame0 + j);
+          vno++;
+        }
+      }
+    }
+
+    for (nthstep = 0; nthstep < nSmoothSteps; nthstep++) {
+      smoothOpStep(op, x, y, nb);
+      tmp = x;
+      x = y;
+      y = tmp;
+    }
+
+    // Scatter back
+    vno = 0;
+    for (s = 0; s < Targ->depth; s++) {
+      for (r = 0; r < Targ->height; r++) {
+        for (c = 0; c < Targ->width; c++) {
+          if (Targ->type == MRI_FLOAT)
+            for (j = 0; j < nb; j++) MRIFseq_vox(Targ, c, r, s, frame0 + j) = x[(size_t)vno * nb + j];
+          else
+            for (j = 0; j < nb; j++) MRIsetVoxVal(Targ, c, r, s, frame0 + j, x[(size_t)vno * nb + j]);
+          vno++;
+        }
+      }
+    }
+  }
+
+  free(x);
+  free(y);
+  return (Targ);
+}
@@ -67,6 +67,7 @@
 
 #include "mri.h"
 #include "mrisurf.h"
+#include "mrissmoothop.h"
 #include "mrishash_internals.h"
 
 #include "chklc.h"
@@ -1814,10 +1815,180 @@ int MRISfree(MRI_SURFACE **pmris)
     MatrixFree(&mris->m_sras2vox);
   }
 
+  MRISsoaFree(mris);
   free(mris);
   return (NO_ERROR);
 }
 
+/*!
+  \fn int MRISsoaAlloc(MRI_SURFACE *mris)
+  \brief Attaches a structure-of-arrays mirror of the vertex positions,
+  normals, values and rip flags to mris. While it is attached, the vertex
+  distance computation, the spring terms and MRISaverageVals() read their
+  neighbors from the contiguous arrays instead of the VERTEX records.
+  MRISintegrate() and MRISinflateBrain() attach one themselves when
+  FS_MRIS_SOA is set.
+*/
+int MRISsoaAlloc(MRI_SURFACE *mris)
+{
+  MRIS_SOA *soa;
+  int nvertices;
+
+  MRISsoaFree(mris);
+  nvertices = mris->nvertices;
+  soa = (MRIS_SOA *)calloc(1, sizeof(MRIS_SOA));
+  if (!soa) {
+    ErrorReturn(ERROR_NOMEMORY, (ERROR_NOMEMORY, "MRISsoaAlloc: could not allocate MRIS_SOA"));
+  }
+  mris->soa = soa;
+  soa->nvertices = nvertices;
+  soa->x = (float *)calloc(nvertices, sizeof(float));
+  soa->y = (float *)calloc(nvertices, sizeof(float));
+  soa->z = (float *)calloc(nvertices, sizeof(float));
+  soa->nx = (float *)calloc(nvertices, sizeof(float));
+  soa->ny = (float *)calloc(nvertices, sizeof(float));
+  soa->nz = (float *)calloc(nvertices, sizeof(float));
+  soa->val = (float *)calloc(nvertices, sizeof(float));
+  soa->ripflag = (char *)calloc(nvertices, sizeof(char));
+  if (!soa->x || !soa->y || !soa->z || !soa->nx || !soa->ny || !soa->nz || !soa->val || !soa->ripflag) {
+    MRISsoaFree(mris);
+    ErrorReturn(ERROR_NOMEMORY,
+                (ERROR_NOMEMORY, "MRISsoaAlloc: could not allocate arrays for %d vertices", nvertices));
+  }
+  return (NO_ERROR);
+}
+
+int MRISsoaFree(MRI_SURFACE *mris)
+{
+  MRIS_SOA *soa = mris->soa;
+
+  if (!soa) {
+    return (NO_ERROR);
+  }
+  free(soa->x);
+  free(soa->y);
+  free(soa->z);
+  free(soa->nx);
+  free(soa->ny);
+  free(soa->nz);
+  free(soa->val);
+  free(soa->ripflag);
+  free(soa);
+  mris->soa = NULL;
+  return (NO_ERROR);
+}
+
+/*!
+  \fn int MRISsoaGather(MRI_SURFACE *mris, int which)
+  \brief Copies the fields selected by which (MRIS_SOA_POSITIONS,
+  MRIS_SOA_NORMALS, MRIS_SOA_VALS) from the vertices into mris->soa.
+  The rip flags are always copied. The mirror is reallocated if the
+  number of vertices has changed since it was attached.
+*/
+int MRISsoaGather(MRI_SURFACE *mris, int which)
+{
+  MRIS_SOA *soa = mris->soa;
+  int vno;
+
+  if (!soa) {
+    ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "MRISsoaGather: no MRIS_SOA attached"));
+  }
+  if (soa->nvertices != mris->nvertices) {
+    if (MRISsoaAlloc(mris) != NO_ERROR) {
+      return (Gerror);
+    }
+    soa = mris->soa;
+  }
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) shared(mris, soa, which)
+#endif
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    ROMP_PFLB_begin
+    VERTEX const *const v = &mris->vertices[vno];
+
+    soa->ripflag[vno] = v->ripflag;
+    if (which & MRIS_SOA_POSITIONS) {
+      soa->x[vno] = v->x;
+      soa->y[vno] = v->y;
+      soa->z[vno] = v->z;
+    }
+    if (which & MRIS_SOA_NORMALS) {
+      soa->nx[vno] = v->nx;
+      soa->ny[vno] = v->ny;
+      soa->nz[vno] = v->nz;
+    }
+    if (which & MRIS_SOA_VALS) {
+      soa->val[vno] = v->val;
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  return (NO_ERROR);
+}
+
+/*!
+  \fn int MRISsoaScatter(MRI_SURFACE *mris, int which)
+  \brief Copies the fields selected by which from mris->soa back into the
+  vertices. The rip flags are never written back.
+*/
+int MRISsoaScatter(MRI_SURFACE *mris, int which)
+{
+  MRIS_SOA *soa = mris->soa;
+  int vno;
+
+  if (!soa || soa->nvertices != mris->nvertices) {
+    ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "MRISsoaScatter: no MRIS_SOA gathered for this surface"));
+  }
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) shared(mris, soa, which)
+#endif
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    ROMP_PFLB_begin
+    VERTEX *const v = &mris->vertices[vno];
+
+    if (which & MRIS_SOA_POSITIONS) {
+      v->x = soa->x[vno];
+      v->y = soa->y[vno];
+      v->z = soa->z[vno];
+    }
+    if (which & MRIS_SOA_NORMALS) {
+      v->nx = soa->nx[vno];
+      v->ny = soa->ny[vno];
+      v->nz = soa->nz[vno];
+    }
+    if (which & MRIS_SOA_VALS) {
+      v->val = soa->val[vno];
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  return (NO_ERROR);
+}
+
+/*
+  Attaches an MRIS_SOA to mris if FS_MRIS_SOA is set to a non-zero value
+  and none is attached yet.
+*/
+static void mrisSoaAttachIfRequested(MRI_SURFACE *mris)
+{
+  static int requested = -1;
+  char *cp;
+
+  if (requested < 0) {
+    cp = getenv("FS_MRIS_SOA");
+    requested = (cp && atoi(cp) != 0);
+  }
+  if (requested && !mris->soa) {
+    MRISsoaAlloc(mris);
+  }
+}
+
 /*-----------------------------------------------------
   Parameters:
 
@@ -1902,7 +2073,7 @@ int MRISresetNeighborhoodSize(MRI_SURFACE *mris, int nsize)
 #define MAX_NEIGHBORS (10000)
 int mrisFindNeighbors(MRI_SURFACE *mris)
 {
-  int n0, n1, i, k, m, n, vno, vtotal, ntotal, vtmp[MAX_NEIGHBORS];
+  int i, k, m, vno, vtotal, ntotal;
   FACE *f;
   VERTEX *v;
 
@@ -1910,7 +2081,18 @@ int mrisFindNeighbors(MRI_SURFACE *mris)
     fprintf(stdout, "finding surface neighbors...");
   }
 
+  // each vertex only writes its own lists, so the order of the
+  // neighbors is the same however the vertices are split up
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
   for (k = 0; k < mris->nvertices; k++) {
+    ROMP_PFLB_begin
+    int n0, n1, i, m, n, vtmp[MAX_NEIGHBORS];
+    FACE *f;
+    VERTEX *v;
+
     if (k == Gdiag_no) {
       DiagBreak();
     }
@@ -1972,8 +2154,16 @@ int mrisFindNeighbors(MRI_SURFACE *mris)
       if (v->num != v->vnum)
       printf("%d: num=%d vnum=%d\n",k,v->num,v->vnum);
     */
+    ROMP_PFLB_end
   }
+  ROMP_PF_end
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) private(f, v, i, m)
+#endif
   for (k = 0; k < mris->nfaces; k++) {
+    ROMP_PFLB_begin
     f = &mris->faces[k];
     for (m = 0; m < VERTICES_PER_FACE; m++) {
       v = &mris->vertices[f->v[m]];
@@ -1992,7 +2182,9 @@ int mrisFindNeighbors(MRI_SURFACE *mris)
                   k,
                   f->v[m]);
     }
+    ROMP_PFLB_end
   }
+  ROMP_PF_end
 
   for (vno = ntotal = vtotal = 0; vno < mris->nvertices; vno++) {
     v = &mris->vertices[vno];
@@ -3042,7 +3234,11 @@ MRISsampleDistances(MRI_SURFACE *mris, int *nbrs, int max_nbhd)
 
   Description
   Expand the list of neighbors of each vertex, reallocating
-  the v->v array to hold the expanded list.
+  the v->v array to hold the expanded list. The v->marked
+  fields are used as the serial marking code used them: a
+  vertex that is marked on entry is not added to any list
+  until the first vertex (in vertex order) that is it or has
+  it in its list has been expanded, and that clears its mark.
   ------------------------------------------------------*/
 int MRISsetNeighborhoodSize(MRI_SURFACE *mris, int nsize)
 {
@@ -3088,65 +3284,141 @@ int MRISsetNeighborhoodSize(MRI_SURFACE *mris, int nsize)
   
   // setting neighborhood size to a value larger than it has been in the past
   mris->max_nsize = nsize;
+
+  // Each ring is built in two passes. The first only reads the current
+  // lists and uses per-thread visit stamps instead of the shared marked
+  // field, so it can run in parallel; the second swaps the new lists in.
+  // The neighbor order is the same as the old serial marking code.
+  // Marks set on entry are honored through clearAt (see below).
+#ifdef HAVE_OPENMP
+  int const maxThreads = omp_get_max_threads();
+#else
+  int const maxThreads = 1;
+#endif
+  int *stampsByThread = (int *)calloc((size_t)maxThreads * mris->nvertices, sizeof(int));
+  int **vnew = (int **)calloc(mris->nvertices, sizeof(int *));
+  int *nnew = (int *)calloc(mris->nvertices, sizeof(int));
+  int *clearAt = NULL;
+  if (!stampsByThread || !vnew || !nnew)
+    ErrorExit(ERROR_NOMEMORY, "MRISsetNeighborhoodSize: could not allocate %d vertex work space", mris->nvertices);
+
   for (niter = 0; niter < nsize - mris->nsize; niter++) {
-    // this can't be parallelized due to the marking of neighbors
+    memset(stampsByThread, 0, (size_t)maxThreads * mris->nvertices * sizeof(int));
+
+    // The serial code marked each vertex and its list while expanding it
+    // and cleared the marks of the expanded list afterwards, so a vertex
+    // marked on entry was skipped by every vertex expanded before the
+    // first one that is it or has it in its list. clearAt[] holds that
+    // vertex (nvertices if there is none, and the mark stays).
+    int nmarked = 0;
+    for (vno = 0; vno < mris->nvertices; vno++)
+      if (mris->vertices[vno].marked) nmarked++;
+    if (nmarked && !clearAt) {
+      clearAt = (int *)calloc(mris->nvertices, sizeof(int));
+      if (!clearAt)
+        ErrorExit(ERROR_NOMEMORY, "MRISsetNeighborhoodSize: could not allocate %d vertex work space", mris->nvertices);
+    }
+    if (nmarked) {
+      for (vno = 0; vno < mris->nvertices; vno++) clearAt[vno] = mris->nvertices;
+      for (vno = 0; vno < mris->nvertices; vno++) {
+        int i, n;
+        VERTEX *v = &mris->vertices[vno];
+        if (v->ripflag || !v->vtotal) continue;
+        if (v->marked && clearAt[vno] == mris->nvertices) clearAt[vno] = vno;
+        for (i = 0; i < v->vtotal; i++) {
+          n = v->v[i];
+          if (mris->vertices[n].marked && clearAt[n] == mris->nvertices) clearAt[n] = vno;
+        }
+      }
+    }
+
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
     for (vno = 0; vno < mris->nvertices; vno++) {
-      int i, n, neighbors, j, vnum, nb_vnum;
-      VERTEX *v, *vnb, *vnb2;
+      ROMP_PFLB_begin
+      int i, n, neighbors, j, vnum, nb_vnum, stamp;
+      VERTEX *v, *vnb;
       int vtmp[MAX_NEIGHBORS];
 
+#ifdef HAVE_OPENMP
+      int const tid = omp_get_thread_num();
+#else
+      int const tid = 0;
+#endif
+      int *const visited = stampsByThread + (size_t)tid * mris->nvertices;
+
       v = &mris->vertices[vno];
       if (vno == Gdiag_no) DiagBreak();
 
+      vnew[vno] = NULL;
       vnum = v->vtotal;
-      if (v->ripflag || !vnum) continue;
+      if (v->ripflag || !vnum) ROMP_PFLB_continue;
 
       memmove(vtmp, v->v, vnum * sizeof(int));
 
-      /* mark 1-neighbors so we don't count them twice */
-      v->marked = 1;
-      for (i = 0; i < vnum; i++) mris->vertices[v->v[i]].marked = 1;
+      /* stamp 1-neighbors so we don't count them twice */
+      stamp = vno + 1;
+      visited[vno] = stamp;
+      for (i = 0; i < vnum; i++) visited[v->v[i]] = stamp;
 
       /* count 2-neighbors */
       for (neighbors = vnum, i = 0; neighbors < MAX_NEIGHBORS && i < vnum; i++) {
         n = v->v[i];
         vnb = &mris->vertices[n];
-        vnb->marked = 1;
         if (vnb->ripflag) continue;
 
         nb_vnum = vnb->vnum;
 
         for (j = 0; j < nb_vnum; j++) {
-          vnb2 = &mris->vertices[vnb->v[j]];
-          if (vnb2->ripflag || vnb2->marked) continue;
+          n = vnb->v[j];
+          if (mris->vertices[n].ripflag || visited[n] == stamp) continue;
+          if (nmarked && mris->vertices[n].marked && clearAt[n] > vno) continue;
 
-          vtmp[neighbors] = vnb->v[j];
-          vnb2->marked = 1;
+          vtmp[neighbors] = n;
+          visited[n] = stamp;
           if (++neighbors >= MAX_NEIGHBORS) {
             fprintf(stderr, "vertex %d has too many neighbors!\n", vno);
             break;
           }
         }
       }
-      /*
-        now reallocate the v->v structure and
-        place the 2-connected neighbors
-        suquentially after the 1-connected neighbors.
-      */
-      free(v->v);
-      v->v = (int *)calloc(neighbors, sizeof(int));
-      if (!v->v)
+      vnew[vno] = (int *)calloc(neighbors, sizeof(int));
+      if (!vnew[vno])
         ErrorExit(ERROR_NO_MEMORY,
                   "MRISsetNeighborhoodSize: could not allocate list of %d "
                   "nbrs at v=%d",
                   neighbors,
                   vno);
+      memmove(vnew[vno], vtmp, neighbors * sizeof(int));
+      nnew[vno] = neighbors;
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
+    /*
+      now replace the v->v structure with the new list, which has
+      the 2-connected neighbors suquentially after the 1-connected
+      neighbors.
+    */
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+    for (vno = 0; vno < mris->nvertices; vno++) {
+      ROMP_PFLB_begin
+      int i, n, neighbors;
+      VERTEX *v;
+
+      if (!vnew[vno]) ROMP_PFLB_continue;
+
+      v = &mris->vertices[vno];
+      neighbors = nnew[vno];
+      free(v->v);
+      v->v = vnew[vno];
+      vnew[vno] = NULL;
 
-      v->marked = 0;
-      for (n = 0; n < neighbors; n++) {
-        v->v[n] = vtmp[n];
-        mris->vertices[vtmp[n]].marked = 0;
-      }
       if (v->dist) free(v->dist);
 
       if (v->dist_orig) free(v->dist_orig);
@@ -3188,8 +3460,18 @@ int MRISsetNeighborhoodSize(MRI_SURFACE *mris, int nsize)
           fprintf(stdout, "v[%d] = %d\n", n, v->v[n]);
         }
       }
+      ROMP_PFLB_end
     }
+    ROMP_PF_end
+
+    if (nmarked)
+      for (vno = 0; vno < mris->nvertices; vno++)
+        if (clearAt[vno] < mris->nvertices) mris->vertices[vno].marked = 0;
   }
+  free(stampsByThread);
+  free(vnew);
+  free(nnew);
+  if (clearAt) free(clearAt);
 
   ntotal = vtotal = 0;
   ROMP_PF_begin		// mris_fix_topology
@@ -3222,7 +3504,7 @@ int MRISsetNeighborhoodSize(MRI_SURFACE *mris, int nsize)
                   vno);
     }
 
-    if (v->ripflag) continue;
+    if (v->ripflag) ROMP_PFLB_continue;
 
     vtotal += v->vtotal;
     ntotal++;
@@ -4213,10 +4495,77 @@ static int MRIScomputeNormals_new(MRI_SURFACE *mris)
   Calculate distances between each vertex and all of its neighbors.
   CVD.
   ----------------------------------------------------------------*/
+/*
+  mrisComputeVertexDistances() with the neighbor positions and rip flags
+  read from mris->soa, which is gathered here.
+*/
+static int mrisComputeVertexDistancesSoA(MRI_SURFACE *mris)
+{
+  MRIS_SOA *soa;
+  int vno, sphere;
+
+  if (MRISsoaGather(mris, MRIS_SOA_POSITIONS) != NO_ERROR) {
+    return (Gerror);
+  }
+  soa = mris->soa;
+  sphere = (mris->status == MRIS_PARAMETERIZED_SPHERE || mris->status == MRIS_SPHERE);
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) shared(mris, soa, sphere)
+#endif
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    ROMP_PFLB_begin
+
+    if (vno == Gdiag_no) DiagBreak();
+
+    VERTEX const * const v = &mris->vertices[vno];
+    if (v->ripflag || v->dist == NULL) continue;
+
+    int const *pv = v->v;
+    int const vtotal = v->vtotal;
+    int n, vn;
+
+    if (sphere) {
+      XYZ xyz1_normalized;
+      float xyz1_length;
+      XYZ_NORMALIZED_LOAD(&xyz1_normalized, &xyz1_length, soa->x[vno], soa->y[vno], soa->z[vno]);
+
+      float const radius = xyz1_length;
+      for (n = 0; n < vtotal; n++) {
+        vn = *pv++;
+        if (soa->ripflag[vn]) continue;
+        float angle = fabs(XYZApproxAngle(&xyz1_normalized, soa->x[vn], soa->y[vn], soa->z[vn]));
+        v->dist[n] = angle * radius;
+      }
+    }
+    else {
+      float const x = soa->x[vno], y = soa->y[vno], z = soa->z[vno];
+      for (n = 0; n < vtotal; n++) {
+        vn = *pv++;
+        float xd = x - soa->x[vn];
+        float yd = y - soa->y[vn];
+        float zd = z - soa->z[vn];
+        float d = xd * xd + yd * yd + zd * zd;
+        v->dist[n] = sqrt(d);
+      }
+    }
+
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  return (NO_ERROR);
+}
+
 static int mrisComputeVertexDistances(MRI_SURFACE *mris)
 {
   int vno;
 
+  if (mris->soa) {
+    return (mrisComputeVertexDistancesSoA(mris));
+  }
+
   switch (mris->status) {
     default: /* don't really know what to do in other cases */
 
@@ -8449,6 +8798,7 @@ int MRISintegrate(MRI_SURFACE *mris, INTEGRATION_PARMS *parms, int n_averages)
     fprintf(stdout, "integrating with navgs=%d and tol=%2.3e\n", n_averages, tol);
   }
 
+  mrisSoaAttachIfRequested(mris);
   mrisProjectSurface(mris);
   MRIScomputeMetricProperties(mris);
 
@@ -18628,6 +18978,7 @@ int MRISinflateBrain(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
   if (IS_QUADRANGULAR(mris)) {
     MRISremoveTriangleLinks(mris);
   }
+  mrisSoaAttachIfRequested(mris);
 
 #if 0
   {
@@ -20289,6 +20640,113 @@ static int mrisComputeConvexityTerm(MRI_SURFACE *mris, double l_convex)
   return (NO_ERROR);
 }
 
+/*
+  The loops of mrisComputeSpringTerm(), mrisComputeNormalSpringTerm() and
+  mrisComputeTangentialSpringTerm() with the positions, normals and rip
+  flags read from mris->soa, which is gathered here. Each vertex only
+  updates its own gradient, so the vertices are processed in parallel.
+*/
+#define MRIS_SPRING_PLAIN      0
+#define MRIS_SPRING_NORMAL     1
+#define MRIS_SPRING_TANGENTIAL 2
+
+static int mrisComputeSpringTermsSoA(MRI_SURFACE *mris, double l_spring, float dist_scale, int which)
+{
+  MRIS_SOA *soa;
+  int vno;
+
+  if (MRISsoaGather(mris, which == MRIS_SPRING_PLAIN ? MRIS_SOA_POSITIONS : MRIS_SOA_POSITIONS | MRIS_SOA_NORMALS) !=
+      NO_ERROR) {
+    return (Gerror);
+  }
+  soa = mris->soa;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) shared(mris, soa, l_spring, dist_scale, which)
+#endif
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    ROMP_PFLB_begin
+    VERTEX *const v = &mris->vertices[vno];
+    int n, m, vn;
+    float sx, sy, sz, x, y, z, nx, ny, nz, nc;
+
+    if (soa->ripflag[vno]) ROMP_PF_continue;
+    if (vno == Gdiag_no) {
+      DiagBreak();
+    }
+    if (which != MRIS_SPRING_NORMAL && v->border && !v->neg) ROMP_PF_continue;
+
+    x = soa->x[vno];
+    y = soa->y[vno];
+    z = soa->z[vno];
+
+    sx = sy = sz = 0.0;
+    n = 0;
+    for (m = 0; m < v->vnum; m++) {
+      vn = v->v[m];
+      if (!soa->ripflag[vn]) {
+        sx += soa->x[vn] - x;
+        sy += soa->y[vn] - y;
+        sz += soa->z[vn] - z;
+        n++;
+      }
+    }
+
+    switch (which) {
+      case MRIS_SPRING_PLAIN:
+        if (n > 0) {
+          sx = dist_scale * sx / n;
+          sy = dist_scale * sy / n;
+          sz = dist_scale * sz / n;
+        }
+        sx *= l_spring;
+        sy *= l_spring;
+        sz *= l_spring;
+        if (vno == Gdiag_no) fprintf(stdout, "v %d spring term:         (%2.3f, %2.3f, %2.3f)\n", vno, sx, sy, sz);
+        break;
+      case MRIS_SPRING_NORMAL:
+        if (n > 0) {
+          sx = sx / n;
+          sy = sy / n;
+          sz = sz / n;
+        }
+        nx = soa->nx[vno];
+        ny = soa->ny[vno];
+        nz = soa->nz[vno];
+        nc = sx * nx + sy * ny + sz * nz; /* projection onto normal */
+        sx = l_spring * nc * nx;          /* move in normal direction */
+        sy = l_spring * nc * ny;
+        sz = l_spring * nc * nz;
+        if (vno == Gdiag_no) fprintf(stdout, "v %d spring normal term:  (%2.3f, %2.3f, %2.3f)\n", vno, sx, sy, sz);
+        break;
+      default:
+        if (n > 0) {
+          sx = sx / n;
+          sy = sy / n;
+          sz = sz / n;
+        }
+        nx = soa->nx[vno];
+        ny = soa->ny[vno];
+        nz = soa->nz[vno];
+        nc = sx * nx + sy * ny + sz * nz; /* projection onto normal */
+        sx = l_spring * (sx - nc * nx);   /* remove normal component and then scale */
+        sy = l_spring * (sy - nc * ny);
+        sz = l_spring * (sz - nc * nz);
+        if (vno == Gdiag_no) printf("v %d spring tangent term: (%2.3f, %2.3f, %2.3f)\n", vno, sx, sy, sz);
+        break;
+    }
+
+    v->dx += sx;
+    v->dy += sy;
+    v->dz += sz;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  return (NO_ERROR);
+}
+
 /*-----------------------------------------------------
   Parameters:
 
@@ -20308,6 +20766,9 @@ static int mrisComputeNormalSpringTerm(MRI_SURFACE *mris, double l_spring)
   if (FZERO(l_spring)) {
     return (NO_ERROR);
   }
+  if (mris->soa) {
+    return (mrisComputeSpringTermsSoA(mris, l_spring, 1.0, MRIS_SPRING_NORMAL));
+  }
 
   for (vno = 0; vno < mris->nvertices; vno++) {
     vertex = &mris->vertices[vno];
@@ -20374,6 +20835,9 @@ static int mrisComputeTangentialSpringTerm(MRI_SURFACE *mris, double l_spring)
   if (FZERO(l_spring)) {
     return (NO_ERROR);
   }
+  if (mris->soa) {
+    return (mrisComputeSpringTermsSoA(mris, l_spring, 1.0, MRIS_SPRING_TANGENTIAL));
+  }
 
   for (vno = 0; vno < mris->nvertices; vno++) {
     v = &mris->vertices[vno];
@@ -21807,6 +22271,9 @@ static int mrisComputeSpringTerm(MRI_SURFACE *mris, double l_spring)
 #else
   dist_scale = 1.0;
 #endif
+  if (mris->soa) {
+    return (mrisComputeSpringTermsSoA(mris, l_spring, dist_scale, MRIS_SPRING_PLAIN));
+  }
   for (vno = 0; vno < mris->nvertices; vno++) {
     v = &mris->vertices[vno];
     if (v->ripflag) {
@@ -30430,10 +30897,81 @@ int MRISaverageMarkedVals(MRI_SURFACE *mris, int navgs)
 
   Description
   ------------------------------------------------------*/
+/*
+  MRISaverageVals() over mris->soa. The values are gathered once, averaged
+  navgs times between the mirror and a scratch array, and written back
+  together with the last average in tdx, as the vertex loop leaves them.
+*/
+static int mrisAverageValsSoA(MRI_SURFACE *mris, int navgs)
+{
+  MRIS_SOA *soa;
+  float *tval;
+  int i, vno;
+
+  if (MRISsoaGather(mris, MRIS_SOA_VALS) != NO_ERROR) {
+    return (Gerror);
+  }
+  soa = mris->soa;
+  tval = (float *)calloc(mris->nvertices, sizeof(float));
+  if (!tval) {
+    ErrorReturn(ERROR_NOMEMORY, (ERROR_NOMEMORY, "MRISaverageVals: could not allocate %d values", mris->nvertices));
+  }
+
+  for (i = 0; i < navgs; i++) {
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(experimental) shared(mris, soa, tval) schedule(static, 1)
+#endif
+    for (vno = 0; vno < mris->nvertices; vno++) {
+      ROMP_PFLB_begin
+      int vnb, vnum, vn;
+      int const *pnb;
+      float val, num;
+
+      if (soa->ripflag[vno]) ROMP_PF_continue;
+
+      val = soa->val[vno];
+      pnb = mris->vertices[vno].v;
+      vnum = mris->vertices[vno].vnum;
+      for (num = 0.0f, vnb = 0; vnb < vnum; vnb++) {
+        vn = *pnb++;
+        if (soa->ripflag[vn]) continue;
+
+        num++;
+        val += soa->val[vn];
+      }
+      num++; /*  account for central vertex */
+      tval[vno] = val / num;
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
+    for (vno = 0; vno < mris->nvertices; vno++) {
+      if (!soa->ripflag[vno]) {
+        soa->val[vno] = tval[vno];
+      }
+    }
+  }
+
+  if (navgs > 0) {
+    for (vno = 0; vno < mris->nvertices; vno++) {
+      if (!soa->ripflag[vno]) {
+        mris->vertices[vno].tdx = tval[vno];
+      }
+    }
+    MRISsoaScatter(mris, MRIS_SOA_VALS);
+  }
+  free(tval);
+  return (NO_ERROR);
+}
+
 int MRISaverageVals(MRI_SURFACE *mris, int navgs)
 {
   int i, vno;
 
+  if (mris->soa) {
+    return (mrisAverageValsSoA(mris, navgs));
+  }
   for (i = 0; i < navgs; i++) {
     ROMP_PF_begin
 #ifdef HAVE_OPENMP
@@ -32963,6 +33501,23 @@ int MRISpositionSurfaces(MRI_SURFACE *mris, MRI **mri_flash, int nvolumes, INTEG
   return (NO_ERROR);
 }
 
+/*
+  Returns non-zero if FS_MHT_TREE is set to a non-zero value, in which case
+  MRISpositionSurface keeps its self-intersection table as a tree built
+  once and refit each iteration instead of rehashing every face.
+*/
+static int mrisUseFaceTree(void)
+{
+  static int use_tree = -1;
+  char *cp;
+
+  if (use_tree < 0) {
+    cp = getenv("FS_MHT_TREE");
+    use_tree = (cp && atoi(cp) != 0);
+  }
+  return (use_tree);
+}
+
 int MRISpositionSurface(MRI_SURFACE *mris, MRI *mri_brain, MRI *mri_smooth, INTEGRATION_PARMS *parms)
 {
   /*  char   *cp ;*/
@@ -33094,7 +33649,16 @@ int MRISpositionSurface(MRI_SURFACE *mris, MRI *mri_brain, MRI *mri_smooth, INTE
       MHTfree(&mht_f_current); mht_f_current = MHTcreateFaceTable(mris);
     }
     if (!(parms->flags & IPFLAG_NO_SELF_INT_TEST)) {
-      MHTfree(&mht); mht = MHTcreateFaceTable(mris);
+      if (mrisUseFaceTree()) {
+        // the vertices only moved a little, so refit the tree instead of rehashing every face
+        if (mht)
+          MHTrefit(mht, mris);
+        else
+          mht = MHTcreateFaceTree(mris, CURRENT_VERTICES);
+      }
+      else {
+        MHTfree(&mht); mht = MHTcreateFaceTable(mris);
+      }
     }
     MRISclearGradient(mris);
     mrisComputeTargetLocationTerm(mris, parms->l_location, parms);
@@ -40029,6 +40593,8 @@ int MRISwriteTriangularSurface(MRI_SURFACE *mris, const char *fname)
   int k, n;
   FILE *fp;
   const char *user, *time_str;
+  float *xyz;
+  int *fv;
 
   user = getenv("USER");
   if (!user) {
@@ -40046,16 +40612,30 @@ int MRISwriteTriangularSurface(MRI_SURFACE *mris, const char *fname)
   fprintf(fp, "created by %s on %s\n", user, time_str);
   fwriteInt(mris->nvertices, fp);
   fwriteInt(mris->nfaces, fp); /* # of triangles */
+
+  // pack the vertex and face blocks and write each with one call
+  xyz = (float *)calloc(3 * (size_t)mris->nvertices, sizeof(float));
+  fv = (int *)calloc(VERTICES_PER_FACE * (size_t)mris->nfaces, sizeof(int));
+  if (!xyz || !fv) ErrorExit(ERROR_NOMEMORY, "MRISwrite(%s): could not allocate output buffers", fname);
   for (k = 0; k < mris->nvertices; k++) {
-    fwriteFloat(mris->vertices[k].x, fp);
-    fwriteFloat(mris->vertices[k].y, fp);
-    fwriteFloat(mris->vertices[k].z, fp);
+    xyz[3 * k] = mris->vertices[k].x;
+    xyz[3 * k + 1] = mris->vertices[k].y;
+    xyz[3 * k + 2] = mris->vertices[k].z;
   }
   for (k = 0; k < mris->nfaces; k++) {
     for (n = 0; n < VERTICES_PER_FACE; n++) {
-      fwriteInt(mris->faces[k].v[n], fp);
+      fv[VERTICES_PER_FACE * k + n] = mris->faces[k].v[n];
     }
   }
+  if (fwriteFloatArray(xyz, 3 * (size_t)mris->nvertices, fp) != 3 * (size_t)mris->nvertices ||
+      fwriteIntArray(fv, VERTICES_PER_FACE * (size_t)mris->nfaces, fp) != VERTICES_PER_FACE * (size_t)mris->nfaces) {
+    free(xyz);
+    free(fv);
+    fclose(fp);
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "MRISwrite(%s): write failed\n", fname));
+  }
+  free(xyz);
+  free(fv);
   /* write whether vertex data was using
      the real RAS rather than conformed RAS */
   fwriteInt(TAG_OLD_USEREALRAS, fp);
@@ -40151,6 +40731,7 @@ static int mrisReadTriangleFilePositions(MRI_SURFACE *mris, const char *fname)
   int nvertices, nfaces, magic, vno;
   char line[STRLEN];
   FILE *fp;
+  float *xyz;
 #if 0
   FACE        *f ;
   int         fno, n ;
@@ -40181,12 +40762,20 @@ static int mrisReadTriangleFilePositions(MRI_SURFACE *mris, const char *fname)
   if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON)
     fprintf(stdout, "surface %s: %d vertices and %d faces.\n", fname, nvertices, nfaces);
 
+  xyz = (float *)calloc(3 * (size_t)nvertices, sizeof(float));
+  if (!xyz) ErrorExit(ERROR_NOMEMORY, "mrisReadTriangleFilePositions(%s): could not allocate %d vertices", fname, nvertices);
+  if (freadFloatArray(xyz, 3 * (size_t)nvertices, fp) != 3 * (size_t)nvertices) {
+    free(xyz);
+    fclose(fp);
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "mrisReadTriangleFilePositions(%s): file is truncated", fname));
+  }
   for (vno = 0; vno < nvertices; vno++) {
     v = &mris->vertices[vno];
-    v->x = freadFloat(fp);
-    v->y = freadFloat(fp);
-    v->z = freadFloat(fp);
+    v->x = xyz[3 * vno];
+    v->y = xyz[3 * vno + 1];
+    v->z = xyz[3 * vno + 2];
   }
+  free(xyz);
 
 #if 0
   for (fno = 0 ; fno < mris->nfaces ; fno++)
@@ -40221,6 +40810,8 @@ static MRI_SURFACE *mrisReadTriangleFile(const char *fname, double pct_over)
   FILE *fp;
   MRI_SURFACE *mris;
   int tag;
+  float *xyz;
+  int *fv;
 
   fp = fopen(fname, "rb");
   if (!fp) ErrorReturn(NULL, (ERROR_NOFILE, "mrisReadTriangleFile(%s): could not open file", fname));
@@ -40238,15 +40829,29 @@ static MRI_SURFACE *mrisReadTriangleFile(const char *fname, double pct_over)
   mris = MRISoverAlloc(pct_over * nvertices, pct_over * nfaces, nvertices, nfaces);
   mris->type = MRIS_TRIANGULAR_SURFACE;
 
+  // read the vertex and face blocks with one read each
+  xyz = (float *)calloc(3 * (size_t)nvertices, sizeof(float));
+  fv = (int *)calloc(VERTICES_PER_FACE * (size_t)nfaces, sizeof(int));
+  if (!xyz || !fv)
+    ErrorExit(ERROR_NOMEMORY, "mrisReadTriangleFile(%s): could not allocate %d vertices and %d faces", fname, nvertices, nfaces);
+  if (freadFloatArray(xyz, 3 * (size_t)nvertices, fp) != 3 * (size_t)nvertices ||
+      freadIntArray(fv, VERTICES_PER_FACE * (size_t)nfaces, fp) != VERTICES_PER_FACE * (size_t)nfaces) {
+    free(xyz);
+    free(fv);
+    fclose(fp);
+    MRISfree(&mris);
+    ErrorReturn(NULL, (ERROR_BADFILE, "mrisReadTriangleFile(%s): file is truncated", fname));
+  }
+
   for (vno = 0; vno < nvertices; vno++) {
     if (vno % 100 == 0) exec_progress_callback(vno, nvertices, 0, 1);
     v = &mris->vertices[vno];
     if (vno == Gdiag_no) {
       DiagBreak();
     }
-    v->x = freadFloat(fp);
-    v->y = freadFloat(fp);
-    v->z = freadFloat(fp);
+    v->x = xyz[3 * vno];
+    v->y = xyz[3 * vno + 1];
+    v->z = xyz[3 * vno + 2];
 #if 0
     v->label = NO_LABEL ;
 #endif
@@ -40262,7 +40867,7 @@ static MRI_SURFACE *mrisReadTriangleFile(const char *fname, double pct_over)
   for (fno = 0; fno < mris->nfaces; fno++) {
     f = &mris->faces[fno];
     for (n = 0; n < VERTICES_PER_FACE; n++) {
-      f->v[n] = freadInt(fp);
+      f->v[n] = fv[VERTICES_PER_FACE * fno + n];
       if (f->v[n] >= mris->nvertices || f->v[n] < 0)
         ErrorExit(ERROR_BADFILE, "f[%d]->v[%d] = %d - out of range!\n", fno, n, f->v[n]);
     }
@@ -40271,6 +40876,8 @@ static MRI_SURFACE *mrisReadTriangleFile(const char *fname, double pct_over)
       mris->vertices[mris->faces[fno].v[n]].num++;
     }
   }
+  free(xyz);
+  free(fv);
   // new addition
   mris->useRealRAS = 0;
 
@@ -67222,13 +67829,10 @@ MRI *MRISsmoothMRI(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *BinMask, MRI *Ta
   -------------------------------------------------------------------*/
 MRI *MRISsmoothMRIFast(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask, MRI *Targ)
 {
-  int nnbrs, nthstep, frame, vno, nthnbr, num, nvox, nbrvno, reshape;
-  MRI *SrcTmp, *mritmp, *IncMaskTmp = NULL;
+  int nvox;
+  MRIS_SMOOTH_OP *op;
   struct timeb mytimer;
   int msecTime;
-  int *nNbrs, *nNbrs0, *rip, *rip0, nNbrsMax;
-  float **pF, **pF0, *tF, *tF0, sumF;
-  VERTEX *v, *vn;
 
   if (Gdiag_no > 0) printf("MRISsmoothMRIFast()\n");
 
@@ -67242,20 +67846,6 @@ MRI *MRISsmoothMRIFast(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask, MRI
       printf("ERROR: MRISsmoothMRIFast(): Surf/Mask dimension mismatch\n");
       return (NULL);
     }
-    if (IncMask->width != nvox)
-      IncMaskTmp = mri_reshape(IncMask, nvox, 1, 1, IncMask->nframes);
-    else
-      IncMaskTmp = MRIcopy(IncMask, NULL);
-  }
-  // Reshape the source if needed
-  if (Src->width != nvox) {
-    if (Gdiag_no > 0) printf("MRISsmoothMRIFast(): reshaping\n");
-    SrcTmp = mri_reshape(Src, nvox, 1, 1, Src->nframes);
-    reshape = 1;
-  }
-  else {
-    reshape = 0;
-    SrcTmp = MRIcopy(Src, NULL);
   }
   if (Targ != NULL) {
     if (MRIdimMismatch(Src, Targ, 1)) {
@@ -67267,97 +67857,16 @@ MRI *MRISsmoothMRIFast(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask, MRI
       return (NULL);
     }
   }
-
-  // Alloc arrays. If there are ripped vertices, then only rip
-  // needs nvertices elements
-  nNbrsMax = 12;  // Should measure this, but overalloc does not hurt
-  pF = (float **)calloc(Surf->nvertices * nNbrsMax, sizeof(float *));
-  tF = (float *)calloc(Surf->nvertices, sizeof(float));
-  nNbrs = (int *)calloc(Surf->nvertices, sizeof(int));
-  rip = (int *)calloc(Surf->nvertices, sizeof(int));
-
-  pF0 = pF;
-  tF0 = tF;
-  rip0 = rip;
-  nNbrs0 = nNbrs;
+  else
+    Targ = MRIcopy(Src, NULL);
 
   TimerStart(&mytimer);
 
-  // Loop through frames
-  for (frame = 0; frame < Src->nframes; frame++) {
-    // Set up pointers for this frame
-    pF = pF0;
-    rip = rip0;
-    nNbrs = nNbrs0;
-    for (vno = 0; vno < Surf->nvertices; vno++) {
-      v = &Surf->vertices[vno];
-      if (IncMaskTmp && MRIgetVoxVal(IncMaskTmp, vno, 0, 0, 0) < 0.5) {
-        // Mask is inclusive, so look for out of mask
-        // should exclude rips here too? Original does not.
-        rip[vno] = 1;
-        MRIFseq_vox(SrcTmp, vno, 0, 0, frame) = 0;
-        continue;
-      }
-      rip[vno] = 0;
-      *pF++ = (float *)(&(MRIFseq_vox(SrcTmp, vno, 0, 0, frame)));
-      nnbrs = Surf->vertices[vno].vnum;
-      num = 1;
-      for (nthnbr = 0; nthnbr < nnbrs; nthnbr++) {
-        nbrvno = Surf->vertices[vno].v[nthnbr];
-        vn = &Surf->vertices[nbrvno];
-        if (vn->ripflag) {
-          continue;
-        }
-        if (IncMaskTmp && MRIgetVoxVal(IncMaskTmp, nbrvno, 0, 0, 0) < 0.5) {
-          continue;
-        }
-        *pF++ = (float *)(&(MRIFseq_vox(SrcTmp, nbrvno, 0, 0, frame)));
-        num++;
-      }
-      *nNbrs++ = num;  // num takes into account all rips/masks
-    }
-
-    // Step through the iterations
-    for (nthstep = 0; nthstep < nSmoothSteps; nthstep++) {
-      // Init pointers for this iteration
-      pF = pF0;
-      rip = rip0;
-      tF = tF0;
-      nNbrs = nNbrs0;
-      // Loop through vertices, average nearest neighbors
-      for (vno = 0; vno < Surf->nvertices; vno++) {
-        if (*rip++) {
-          continue;
-        }
-        sumF = *(*pF++);
-        for (nthnbr = 0; nthnbr < (*nNbrs) - 1; nthnbr++) {
-          sumF += *(*pF++);
-        }
-        *tF++ = sumF / (*nNbrs);
-        nNbrs++;
-      }
-      // Load up for the next step
-      rip = rip0;
-      tF = tF0;
-      for (vno = 0; vno < Surf->nvertices; vno++) {
-        if (*rip++) {
-          continue;
-        }
-        MRIsetVoxVal(SrcTmp, vno, 0, 0, frame, *tF++);
-      }
-    }
-
-  } /* end loop over frame */
-
-  // Copy to the output
-  if (reshape) {
-    if (Gdiag_no > 0) printf("MRISsmoothFast() reshaping again\n");
-    mritmp = mri_reshape(SrcTmp, Src->width, Src->height, Src->depth, Src->nframes);
-    Targ = MRIcopy(mritmp, Targ);
-    MRIfree(&mritmp);
-  }
-  else
-    Targ = MRIcopy(SrcTmp, Targ);
+  // The neighbor lists are built once as a sparse operator and all frames
+  // are smoothed in blocks; see mrissmoothop.c
+  op = MRISsmoothOpAlloc(Surf, IncMask);
+  MRISsmoothOpApply(op, Src, nSmoothSteps, Targ);
+  MRISsmoothOpFree(&op);
 
   msecTime = TimerStop(&mytimer);
   if (Gdiag_no > 0) {
@@ -67365,13 +67874,6 @@ MRI *MRISsmoothMRIFast(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask, MRI
     fflush(stdout);
   }
 
-  MRIfree(&SrcTmp);
-  if (IncMaskTmp) MRIfree(&IncMaskTmp);
-  free(pF0);
-  free(tF0);
-  free(rip0);
-  free(nNbrs0);
-
   return (Targ);
 }
 
@@ -0,0 +1,288 @@
+/**
+ * @file  mriview.cpp
+ * @brief resampling loops instantiated per voxel type with MRIView
+ *
+ * Each kernel is a template over the source and destination voxel types,
+ * dispatched once per call with MRIdispatchTypes(), so the inner loops do
+ * no per-voxel type switches. Target coordinates are stepped along rows
+ * with a RowCursor and slices are processed in parallel. The arithmetic
+ * matches the generic code in mri.c and mri2.c, which is kept as the
+ * fallback for other types, so the output does not depend on the number
+ * of threads.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <vector>
+
+#include "diag.h"
+#include "error.h"
+#include "matrix.h"
+#include "mri.h"
+#include "mriBSpline.h"
+
+extern "C" {
+#include "romp_support.h"
+}
+
+#include "mriview.hpp"
+
+namespace
+{
+/*!
+  A 4x4 voxel transform applied the way MatrixMultiply() does for
+  MATRIX_REAL. The x term of every target column is tabulated up front;
+  RowCursor adds the terms that are constant along a row, in the same order
+  MatrixMultiply() sums them, so the coordinates are bit-identical to a
+  per-voxel matrix product.
+*/
+class VoxelXform
+{
+ public:
+  VoxelXform(const MATRIX *m, int width) : width_(width), col_(3 * width)
+  {
+    int r, c, y1;
+    float val;
+
+    for (r = 0; r < 3; r++)
+      for (c = 0; c < 4; c++) {
+        a_[r][c] = m->rptr[r + 1][c + 1];
+      }
+    for (r = 0; r < 3; r++)
+      for (y1 = 0; y1 < width; y1++) {
+        val = 0.0;
+        val += a_[r][0] * (float)y1;
+        col_[r * width + y1] = val;
+      }
+  }
+
+  static bool supported(const MATRIX *m) { return m->type == MATRIX_REAL && m->rows == 4 && m->cols == 4; }
+
+ private:
+  friend class RowCursor;
+  float a_[3][4];
+  int width_;
+  std::vector<float> col_;
+};
+
+//! Source coordinates along one target row (y2,y3) of a VoxelXform
+class RowCursor
+{
+ public:
+  RowCursor(const VoxelXform &xform, int y2, int y3) : xform_(xform)
+  {
+    int r;
+    for (r = 0; r < 3; r++) {
+      yterm_[r] = xform.a_[r][1] * (float)y2;
+      zterm_[r] = xform.a_[r][2] * (float)y3;
+      cterm_[r] = xform.a_[r][3] * 1.0f;
+    }
+  }
+
+  void at(int y1, float *x) const
+  {
+    int r;
+    float val;
+
+    for (r = 0; r < 3; r++) {
+      val = xform_.col_[r * xform_.width_ + y1];
+      val += yterm_[r];
+      val += zterm_[r];
+      val += cterm_[r];
+      x[r] = val;
+    }
+  }
+
+ private:
+  const VoxelXform &xform_;
+  float yterm_[3], zterm_[3], cterm_[3];
+};
+
+//! Inner loops of MRIlinearTransformInterp() for SAMPLE_NEAREST and SAMPLE_TRILINEAR
+struct LinearTransformKernel
+{
+  const VoxelXform &xform;
+  int interp;
+
+  LinearTransformKernel(const VoxelXform &x, int i) : xform(x), interp(i) {}
+
+  template <typename S, typename D>
+  void operator()(MRIView<S> src, MRIView<D> dst) const
+  {
+    int y3, depth = dst.depth(), height = dst.height(), width = dst.width(), nframes = src.nframes();
+
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 1)
+#endif
+    for (y3 = 0; y3 < depth; y3++) {
+      ROMP_PFLB_begin
+      int y1, y2, frame;
+      float x[3];
+
+      for (y2 = 0; y2 < height; y2++) {
+        RowCursor row(xform, y2, y3);
+        for (y1 = 0; y1 < width; y1++) {
+          row.at(y1, x);
+          for (frame = 0; frame < nframes; frame++) {
+            dst.set(y1, y2, y3, frame, src.sample(x[0], x[1], x[2], frame, interp));
+          }
+        }
+      }
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+  }
+};
+
+//! Inner loops of MRIlinearTransformInterp() for SAMPLE_CUBIC_BSPLINE
+struct BSplineTransformKernel
+{
+  const VoxelXform &xform;
+  const MRI_BSPLINE *bspline;
+
+  BSplineTransformKernel(const VoxelXform &x, const MRI_BSPLINE *b) : xform(x), bspline(b) {}
+
+  template <typename D>
+  void operator()(MRIView<D> dst) const
+  {
+    int y3, depth = dst.depth(), height = dst.height(), width = dst.width(), nframes = bspline->coeff->nframes;
+
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 1)
+#endif
+    for (y3 = 0; y3 < depth; y3++) {
+      ROMP_PFLB_begin
+      int y1, y2, frame;
+      float x[3];
+      double val;
+
+      for (y2 = 0; y2 < height; y2++) {
+        RowCursor row(xform, y2, y3);
+        for (y1 = 0; y1 < width; y1++) {
+          row.at(y1, x);
+          for (frame = 0; frame < nframes; frame++) {
+            MRIsampleBSpline(bspline, x[0], x[1], x[2], frame, &val);
+            dst.set(y1, y2, y3, frame, val);
+          }
+        }
+      }
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+  }
+};
+
+//! Inner loops of MRIvol2VolVSM() for SAMPLE_NEAREST without a shift map
+struct Vol2VolNearestKernel
+{
+  const VoxelXform &xform;
+
+  explicit Vol2VolNearestKernel(const VoxelXform &x) : xform(x) {}
+
+  template <typename S, typename D>
+  void operator()(MRIView<S> src, MRIView<D> dst) const
+  {
+    int st, depth = dst.depth(), height = dst.height(), width = dst.width(), nframes = src.nframes();
+
+    // every target voxel is independent, so walk the target in memory order
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 1)
+#endif
+    for (st = 0; st < depth; st++) {
+      ROMP_PFLB_begin
+      int ct, rt, ics, irs, iss, f;
+      float crs[3];
+
+      for (rt = 0; rt < height; rt++) {
+        RowCursor row(xform, rt, st);
+        for (ct = 0; ct < width; ct++) {
+          row.at(ct, crs);
+          ics = MRIvoxelRound(crs[0]);
+          irs = MRIvoxelRound(crs[1]);
+          iss = MRIvoxelRound(crs[2]);
+          if (ics < 0 || ics >= src.width()) continue;
+          if (irs < 0 || irs >= src.height()) continue;
+          if (iss < 0 || iss >= src.depth()) continue;
+          for (f = 0; f < nframes; f++) {
+            dst.set(ct, rt, st, f, (float)src.at(ics, irs, iss, f));
+          }
+        }
+      }
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+  }
+};
+}  // namespace
+
+/*!
+  \fn int MRIlinearTransformInterpTyped(MRI *mri_src, MRI *mri_dst, MATRIX *mAinv, int InterpMethod)
+  \brief Fills mri_dst by sampling mri_src at mAinv * (c,r,s) with
+  nearest or trilinear interpolation, like the loop in
+  MRIlinearTransformInterp(). Returns ERROR_UNSUPPORTED, without touching
+  mri_dst, if a volume type, the matrix or the method has no typed kernel.
+*/
+int MRIlinearTransformInterpTyped(MRI *mri_src, MRI *mri_dst, MATRIX *mAinv, int InterpMethod)
+{
+  if (InterpMethod != SAMPLE_NEAREST && InterpMethod != SAMPLE_TRILINEAR) {
+    return (ERROR_UNSUPPORTED);
+  }
+  if (!VoxelXform::supported(mAinv) || mri_dst->nframes < mri_src->nframes) {
+    return (ERROR_UNSUPPORTED);
+  }
+
+  VoxelXform xform(mAinv, mri_dst->width);
+  LinearTransformKernel kernel(xform, InterpMethod);
+  return (MRIdispatchTypes(mri_src, mri_dst, kernel));
+}
+
+/*!
+  \fn int MRIlinearTransformBSplineTyped(const MRI_BSPLINE *bspline, MRI *mri_dst, MATRIX *mAinv)
+  \brief Fills mri_dst by sampling the B-spline at mAinv * (c,r,s), like
+  the SAMPLE_CUBIC_BSPLINE loop in MRIlinearTransformInterp(). Returns
+  ERROR_UNSUPPORTED, without touching mri_dst, if the destination type or
+  the matrix has no typed kernel.
+*/
+int MRIlinearTransformBSplineTyped(const MRI_BSPLINE *bspline, MRI *mri_dst, MATRIX *mAinv)
+{
+  if (!VoxelXform::supported(mAinv) || mri_dst->nframes < bspline->coeff->nframes) {
+    return (ERROR_UNSUPPORTED);
+  }
+
+  VoxelXform xform(mAinv, mri_dst->width);
+  BSplineTransformKernel kernel(xform, bspline);
+  return (MRIdispatchType(mri_dst, kernel));
+}
+
+/*!
+  \fn int MRIvol2VolNearestTyped(MRI *src, MRI *targ, MATRIX *Vt2s)
+  \brief Nearest-neighbor resampling of src into targ through the
+  target-to-source voxel matrix Vt2s, like MRIvol2VolVSM() without a shift
+  map. Target voxels that map outside src are left alone. Returns
+  ERROR_UNSUPPORTED if a volume type or the matrix has no typed kernel.
+*/
+int MRIvol2VolNearestTyped(MRI *src, MRI *targ, MATRIX *Vt2s)
+{
+  if (!VoxelXform::supported(Vt2s) || targ->nframes < src->nframes) {
+    return (ERROR_UNSUPPORTED);
+  }
+
+  VoxelXform xform(Vt2s, targ->width);
+  Vol2VolNearestKernel kernel(xform);
+  return (MRIdispatchTypes(src, targ, kernel));
+}
@@ -122,6 +122,28 @@ int RFspecSetSeed(RFS *rfs, unsigned long int seed)
   return (0);
 }
 
+/*!
+  \fn unsigned long int RFstreamSeed(unsigned long int seed, int stream)
+  \brief Returns the seed of the stream'th of a family of random
+  streams derived from seed, eg, one stream per simulation
+  iteration. The result only depends on seed and stream, so results
+  do not depend on how the streams are divided among threads or
+  processes. seed is hashed so that families from nearby seeds are
+  unlikely to overlap, and the streams of one family get consecutive,
+  distinct seeds in the range sc_rng_set() distinguishes (1 to
+  2147483562).
+*/
+unsigned long int RFstreamSeed(unsigned long int seed, int stream)
+{
+  unsigned long long h;
+
+  h = (unsigned long long)seed + 0x9e3779b97f4a7c15ULL;
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+  h = h ^ (h >> 31);
+  return (1 + (h % 2147483562ULL + (unsigned long long)stream) % 2147483562ULL);
+}
+
 /*-------------------------------------------------------------------*/
 int RFprint(FILE *fp, RFS *rfs)
 {
@@ -115,14 +115,31 @@ RANDOM_FOREST *RFalloc(int ntrees, int nfeatures, int nclasses, int max_depth, c
   return (rf);
 }
 
+static double info_gain_from_counts(RF *rf, TREE *tree, NODE *parent, int *left_counts, int *right_counts)
+{
+  double entropy_before, entropy_after, wl, wr;
+  int c;
+
+  entropy_before = entropy(parent->class_counts, rf->nclasses, tree->root.class_counts);
+  for (wr = wl = 0.0, c = 0; c < rf->nclasses; c++) {
+    if (tree->root.class_counts[c] == 0) continue;
+    wl += (double)left_counts[c] / tree->root.class_counts[c];
+    wr += (double)right_counts[c] / tree->root.class_counts[c];
+  }
+  wl = wl / (wl + wr);
+  wr = 1 - wl;
+
+  entropy_after = wl * entropy(left_counts, rf->nclasses, tree->root.class_counts) +
+                  wr * entropy(right_counts, rf->nclasses, tree->root.class_counts);
+  return (entropy_before - entropy_after);
+}
+
 static double compute_info_gain(
     RF *rf, TREE *tree, NODE *parent, NODE *left, NODE *right, double **training_data, int fno, double thresh)
 {
-  double entropy_before, entropy_after, wl, wr;
-  int i, tno, c;
+  int i, tno;
   NODE *node;
 
-  entropy_before = entropy(parent->class_counts, rf->nclasses, tree->root.class_counts);
   memset(left->class_counts, 0, rf->nclasses * sizeof(left->class_counts[0]));
   memset(right->class_counts, 0, rf->nclasses * sizeof(right->class_counts[0]));
   left->total_counts = right->total_counts = 0;
@@ -137,31 +154,123 @@ static double compute_info_gain(
     node->training_set[node->total_counts] = i;
     node->total_counts++;
   }
-  for (wr = wl = 0.0, c = 0; c < rf->nclasses; c++) {
-    if (tree->root.class_counts[c] == 0) continue;
-    wl += (double)left->class_counts[c] / tree->root.class_counts[c];
-    wr += (double)right->class_counts[c] / tree->root.class_counts[c];
+  return (info_gain_from_counts(rf, tree, parent, left->class_counts, right->class_counts));
+}
+
+/*
+  The training samples of a node sorted by one feature. As the threshold
+  moves only the samples it passes change sides, so the info gain of each
+  candidate threshold costs the distance moved instead of a pass over
+  every sample. The class counts (and so the info gain) are the same as
+  compute_info_gain() gets by repartitioning.
+*/
+typedef struct
+{
+  double val;
+  int c;
+} SPLIT_SAMPLE;
+
+typedef struct
+{
+  SPLIT_SAMPLE *samples;  // in increasing order of the feature, NaNs last
+  int nsamples;
+  int nleft;  // samples[0..nleft-1] are < the current threshold
+  int *left_counts;
+  int *right_counts;
+} SPLIT_SWEEP;
+
+static int compare_split_samples(const void *v1, const void *v2)
+{
+  double val1 = ((const SPLIT_SAMPLE *)v1)->val, val2 = ((const SPLIT_SAMPLE *)v2)->val;
+
+  if (val1 < val2) return (-1);
+  if (val1 > val2) return (1);
+  if (isnan(val1)) return (isnan(val2) ? 0 : 1);
+  if (isnan(val2)) return (-1);
+  return (0);
+}
+
+static SPLIT_SWEEP *rfAllocSplitSweep(RF *rf, int nsamples)
+{
+  SPLIT_SWEEP *sweep;
+
+  sweep = (SPLIT_SWEEP *)calloc(1, sizeof(SPLIT_SWEEP));
+  if (sweep == NULL) ErrorExit(ERROR_NOMEMORY, "rfAllocSplitSweep: could not allocate sweep");
+  sweep->samples = (SPLIT_SAMPLE *)calloc(nsamples > 0 ? nsamples : 1, sizeof(SPLIT_SAMPLE));
+  sweep->left_counts = (int *)calloc(rf->nclasses, sizeof(int));
+  sweep->right_counts = (int *)calloc(rf->nclasses, sizeof(int));
+  if (!sweep->samples || !sweep->left_counts || !sweep->right_counts)
+    ErrorExit(ERROR_NOMEMORY, "rfAllocSplitSweep: could not allocate %d samples", nsamples);
+  return (sweep);
+}
+
+static void rfFreeSplitSweep(SPLIT_SWEEP **psweep)
+{
+  SPLIT_SWEEP *sweep = *psweep;
+
+  *psweep = NULL;
+  free(sweep->samples);
+  free(sweep->left_counts);
+  free(sweep->right_counts);
+  free(sweep);
+}
+
+// sort the training samples of parent by feature fno, all on the right
+static void rfInitSplitSweep(RF *rf, SPLIT_SWEEP *sweep, NODE *parent, double **training_data, int fno)
+{
+  int tno, i;
+
+  memset(sweep->left_counts, 0, rf->nclasses * sizeof(int));
+  memset(sweep->right_counts, 0, rf->nclasses * sizeof(int));
+  for (tno = 0; tno < parent->total_counts; tno++) {
+    i = parent->training_set[tno];
+    sweep->samples[tno].val = training_data[i][fno];
+    sweep->samples[tno].c = rf->training_classes[i];
+    sweep->right_counts[sweep->samples[tno].c]++;
   }
-  wl = wl / (wl + wr);
-  wr = 1 - wl;
+  sweep->nsamples = parent->total_counts;
+  sweep->nleft = 0;
+  qsort(sweep->samples, sweep->nsamples, sizeof(SPLIT_SAMPLE), compare_split_samples);
+}
 
-  entropy_after = wl * entropy(left->class_counts, rf->nclasses, tree->root.class_counts) +
-                  wr * entropy(right->class_counts, rf->nclasses, tree->root.class_counts);
-  return (entropy_before - entropy_after);
+// move the threshold of the sweep to thresh and return the info gain
+static double rfSplitSweepInfoGain(RF *rf, TREE *tree, NODE *parent, SPLIT_SWEEP *sweep, double thresh)
+{
+  int c;
+
+  while (sweep->nleft < sweep->nsamples && sweep->samples[sweep->nleft].val < thresh) {
+    c = sweep->samples[sweep->nleft++].c;
+    sweep->left_counts[c]++;
+    sweep->right_counts[c]--;
+  }
+  while (sweep->nleft > 0 && !(sweep->samples[sweep->nleft - 1].val < thresh)) {
+    c = sweep->samples[--sweep->nleft].c;
+    sweep->left_counts[c]--;
+    sweep->right_counts[c]++;
+  }
+  return (info_gain_from_counts(rf, tree, parent, sweep->left_counts, sweep->right_counts));
 }
-static int adjust_optimal_threshold(
-    RF *rf, TREE *tree, NODE *parent, NODE *left, NODE *right, double **training_data, int fno, double *pbest_thresh)
+
+static int adjust_optimal_threshold(RF *rf,
+                                    TREE *tree,
+                                    NODE *parent,
+                                    NODE *left,
+                                    NODE *right,
+                                    double **training_data,
+                                    SPLIT_SWEEP *sweep,
+                                    int fno,
+                                    double *pbest_thresh)
 {
   double previous_thresh, next_thresh, info_gain, best_info_gain, step, thresh, best_thresh;
 
   best_thresh = *pbest_thresh;
-  best_info_gain = compute_info_gain(rf, tree, parent, left, right, training_data, fno, best_thresh);
+  best_info_gain = rfSplitSweepInfoGain(rf, tree, parent, sweep, best_thresh);
   if (rf->min_step_size > 0)
     step = rf->min_step_size;
   else
     step = (rf->feature_max[fno] - rf->feature_min[fno]) / (10 * rf->nsteps - 1);
   for (thresh = best_thresh; thresh <= rf->feature_max[fno]; thresh += step) {
-    info_gain = compute_info_gain(rf, tree, parent, left, right, training_data, fno, thresh);
+    info_gain = rfSplitSweepInfoGain(rf, tree, parent, sweep, thresh);
     if (info_gain < 0) DiagBreak();
     if (info_gain > best_info_gain) {
       best_thresh = thresh;
@@ -172,7 +281,7 @@ static int adjust_optimal_threshold(
   }
   next_thresh = thresh - step;
   for (thresh = best_thresh; thresh >= rf->feature_min[fno]; thresh -= step) {
-    info_gain = compute_info_gain(rf, tree, parent, left, right, training_data, fno, thresh);
+    info_gain = rfSplitSweepInfoGain(rf, tree, parent, sweep, thresh);
     if (info_gain > best_info_gain) {
       best_thresh = thresh;
       best_info_gain = info_gain;
@@ -183,11 +292,10 @@ static int adjust_optimal_threshold(
   previous_thresh = thresh + step;
 
   thresh = (next_thresh + previous_thresh) / 2;  // maximize margin
-  info_gain = compute_info_gain(rf, tree, parent, left, right, training_data, fno, thresh);
-  if (info_gain < best_info_gain)  // don't use it
-    compute_info_gain(rf, tree, parent, left, right, training_data, fno, best_thresh);
-  else
+  info_gain = rfSplitSweepInfoGain(rf, tree, parent, sweep, thresh);
+  if (info_gain >= best_info_gain)  // use it
     best_thresh = thresh;
+  compute_info_gain(rf, tree, parent, left, right, training_data, fno, best_thresh);  // partition the samples
   *pbest_thresh = best_thresh;
 
   return (NO_ERROR);
@@ -196,11 +304,7 @@ static int adjust_optimal_threshold(
 static double find_optimal_threshold(RF *rf,
                                      TREE *tree,
                                      NODE *parent,
-                                     NODE *left,
-                                     NODE *right,
-                                     double **training_data,
-                                     int ntraining,
-                                     int fno,
+                                     SPLIT_SWEEP *sweep,
                                      double *pinfo_gain,
                                      int nsteps,
                                      double fmin,
@@ -214,9 +318,9 @@ static double find_optimal_threshold(RF *rf,
   best_info_gain = -1e10;
   best_thresh = 0;
   for (thresh = fmin; thresh < fmax; thresh += step) {
-    info_gain = compute_info_gain(rf, tree, parent, left, right, training_data, fno, thresh);
+    info_gain = rfSplitSweepInfoGain(rf, tree, parent, sweep, thresh);
     if (info_gain < 0) DiagBreak();
-    if (info_gain > best_info_gain && left->total_counts > 0 && right->total_counts > 0) {
+    if (info_gain > best_info_gain && sweep->nleft > 0 && sweep->nsamples - sweep->nleft > 0) {
       best_info_gain = info_gain;
       best_thresh = thresh;
     }
@@ -236,13 +340,16 @@ static int find_optimal_feature_and_threshold(RANDOM_FOREST *rf,
 {
   double info_gain, best_info_gain, thresh, best_thresh, fmin, fmax, tdata;
   int f, best_f, fno, nsteps, i, tno;
+  SPLIT_SWEEP *sweep;
 
   info_gain = best_info_gain = -1;
   best_f = -1;
   best_thresh = 0;
+  sweep = rfAllocSplitSweep(rf, parent->total_counts);
   for (f = 0; f < tree->nfeatures; f++) {
     fno = tree->feature_list[f];
     if (fno == Gdiag_no) DiagBreak();
+    rfInitSplitSweep(rf, sweep, parent, rf->training_data, fno);
     fmin = rf->feature_max[fno];
     fmax = rf->feature_min[fno];
     for (tno = 0; tno < parent->total_counts; tno++) {
@@ -253,8 +360,7 @@ static int find_optimal_feature_and_threshold(RANDOM_FOREST *rf,
     }
     nsteps = rf->nsteps;
     do {
-      thresh = find_optimal_threshold(
-          rf, tree, parent, left, right, rf->training_data, rf->ntraining, fno, &info_gain, nsteps, fmin, fmax);
+      thresh = find_optimal_threshold(rf, tree, parent, sweep, &info_gain, nsteps, fmin, fmax);
       if (info_gain < 0) DiagBreak();
       nsteps *= 5;
       if (nsteps > rf->max_steps) break;  // don't keep trying forever
@@ -266,9 +372,13 @@ static int find_optimal_feature_and_threshold(RANDOM_FOREST *rf,
       best_thresh = thresh;
     }
   }
-  if (best_f < 0) return (0);
-  info_gain = compute_info_gain(rf, tree, parent, left, right, training_data, best_f, best_thresh);
-  adjust_optimal_threshold(rf, tree, parent, left, right, training_data, best_f, &best_thresh);
+  if (best_f < 0) {
+    rfFreeSplitSweep(&sweep);
+    return (0);
+  }
+  rfInitSplitSweep(rf, sweep, parent, training_data, best_f);
+  adjust_optimal_threshold(rf, tree, parent, left, right, training_data, sweep, best_f, &best_thresh);
+  rfFreeSplitSweep(&sweep);
   parent->thresh = best_thresh;
   parent->feature = best_f;
   return (1);
@@ -406,6 +516,17 @@ int RFtrain(RANDOM_FOREST *rf,
              ntraining_per_tree = 0, total_to_remove = 0;
   TREE *tree = NULL;
 
+  // the trees below share training_classes, so fix bad classes once here
+  for (n = 0; n < ntraining; n++)
+    if (training_classes[n] < 0 || training_classes[n] >= rf->nclasses) {
+      ErrorPrintf(ERROR_BADPARM,
+                  "RFtrain: class at index %d = %d: out of bounds (%d)",
+                  n,
+                  training_classes[n],
+                  rf->nclasses);
+      training_classes[n] = 0;
+    }
+
   if (rf->max_class_ratio > 0) {
     int class_counts[MAX_CLASSES], max_class, max_class_count, min_class, min_class_count;
     double **new_training_data;
@@ -508,7 +629,9 @@ int RFtrain(RANDOM_FOREST *rf,
   index = 0;
   n = 0;
   ii = 0;
-  #pragma omp parallel for if_ROMP(experimental) firstprivate(tree, start_no, end_no, ii, index) \
+  // the permutations are drawn above, and each tree only writes into
+  // itself, so the trees come out the same however they are scheduled
+  #pragma omp parallel for if_ROMP(assume_reproducible) firstprivate(tree, start_no, end_no, ii, index) \
     shared(rf, nfeatures_per_tree, Gdiag, training_classes, training_data) schedule(static, 1)
 #endif
   for (n = 0; n < rf->ntrees; n++)  // train each tree
@@ -544,14 +667,6 @@ int RFtrain(RANDOM_FOREST *rf,
     end_no = MIN(rf->ntraining - 1, start_no + ntraining_per_tree - 1);
     for (ii = start_no; ii <= end_no; ii++) {
       index = training_permutation[ii];
-      if (training_classes[index] < 0 || training_classes[index] >= rf->nclasses) {
-        ErrorPrintf(ERROR_BADPARM,
-                    "RFtrain: class at index %d = %d: out of bounds (%d)",
-                    index,
-                    training_classes[index],
-                    rf->nclasses);
-        training_classes[index] = 0;
-      }
       tree->root.class_counts[training_classes[index]]++;
       tree->root.training_set[tree->root.total_counts] = index;
       tree->root.total_counts++;
@@ -30,6 +30,7 @@ static const int debug = 0;
 #endif
 
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
 
 
@@ -163,9 +164,9 @@ static const char* getMainFile()
 
 static void rompExitHandler(void)
 {
-#if defined(ROMP_SUPPORT_ENABLED)
     static int once;
     if (once++ > 0) return;
+#if defined(ROMP_SUPPORT_ENABLED)
     if (debug) fprintf(stderr, "ROMP staticExitHandler called\n");
      
     int tid;
@@ -175,6 +176,23 @@ static void rompExitHandler(void)
     }
     
     ROMP_show_stats(stderr);
+
+    // FS_ROMP_PROFILE=<file> writes the scope tree in machine-readable form,
+    // as folded stacks if the name ends in .folded, otherwise as JSON
+    const char* profileFileName = getenv("FS_ROMP_PROFILE");
+    if (profileFileName && *profileFileName) {
+        FILE* profileFile = fopen(profileFileName, "w");
+        if (!profileFile) {
+            fprintf(stderr, "Could not create %s\n", profileFileName);
+        } else {
+            size_t len = strlen(profileFileName);
+            if (len > 7 && !strcmp(profileFileName + len - 7, ".folded")) 
+                ROMP_write_profile_folded(profileFile);
+            else
+                ROMP_write_profile_json(profileFile);
+            fclose(profileFile);
+        }
+    }
   
     if (getMainFile()) {
         char ROMP_statsFileName[1024];
@@ -188,6 +206,11 @@ static void rompExitHandler(void)
             fclose(comFile);
         }
     }
+#else
+    // the scope tree is not collected, so there is no profile to write
+    const char* profileFileName = getenv("FS_ROMP_PROFILE");
+    if (profileFileName && *profileFileName)
+        fprintf(stderr, "FS_ROMP_PROFILE=%s ignored, this build does not have ROMP_SUPPORT_ENABLED\n", profileFileName);
 #endif
 }
 
@@ -453,6 +476,150 @@ void ROMP_show_stats(FILE* file)
 }
 
 
+// Per-loop numbers derived from the watched threads' cpu times
+//
+typedef struct NodeProfile {
+    Nanosecs cpu;               // summed over the watched threads
+    Nanosecs maxThreadCpu;
+    Nanosecs self;              // in_scope not covered by the children
+    int      threadsUsed;
+    double   imbalance;         // busiest thread / mean thread, 1 is balanced
+    double   serialFraction;    // Karp-Flatt estimate from the measured speedup
+} NodeProfile;
+
+static void node_profile(PerThreadScopeTreeData* node, NodeProfile* profile) {
+    profile->cpu.ns = 0;
+    profile->maxThreadCpu.ns = 0;
+    profile->threadsUsed = 0;
+    int tid;
+    for (tid = 0; tid < ROMP_maxWatchedThreadNum; tid++) {
+        long ns = node->in_child_threads[tid].ns;
+        if (ns <= 0) continue;
+        profile->cpu.ns += ns;
+        profile->threadsUsed++;
+        if (ns > profile->maxThreadCpu.ns) profile->maxThreadCpu.ns = ns;
+    }
+
+    profile->self = node->in_scope;
+    PerThreadScopeTreeData* child;
+    for (child = node->first_child; child; child = child->next_sibling) {
+        profile->self.ns -= child->in_scope.ns;
+    }
+    if (profile->self.ns < 0) profile->self.ns = 0;
+
+    int p = profile->threadsUsed;
+    profile->imbalance = 
+        (p > 0) ? (double)profile->maxThreadCpu.ns * p / (double)profile->cpu.ns : 1.0;
+    
+    profile->serialFraction = 1.0;
+    if (p > 1 && node->in_scope.ns > 0 && profile->cpu.ns > 0) {
+        double speedup = (double)profile->cpu.ns / (double)node->in_scope.ns;
+        double f = (p / speedup - 1.0) / (p - 1.0);
+        profile->serialFraction = (f < 0.0) ? 0.0 : (f > 1.0) ? 1.0 : f;
+    }
+}
+
+static void json_string(FILE* file, const char* s) {
+    fputc('"', file);
+    for (; s && *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', file);
+        if ((unsigned char)*s >= ' ') fputc(*s, file);
+    }
+    fputc('"', file);
+}
+
+static void node_write_json(FILE* file, PerThreadScopeTreeData* node, unsigned int depth) {
+    ROMP_pf_static_struct* pf = node->key;
+    StaticData* sd = pf ? (StaticData*)(pf->ptr) : (StaticData*)(NULL);
+    NodeProfile profile;
+    node_profile(node, &profile);
+
+    fprintf(file, "%*s{\"file\": ", 2*depth, "");
+    json_string(file, pf ? pf->file : "<file>");
+    fprintf(file, ", \"func\": ");
+    json_string(file, pf ? pf->func : "<func>");
+    fprintf(file, ", \"line\": %d, \"level\": %d,\n", pf ? pf->line : 0, sd ? sd->level : 0);
+    fprintf(file, "%*s \"wall_ns\": %ld, \"self_ns\": %ld, \"cpu_ns\": %ld, \"thread_cpu_ns\": [",
+        2*depth, "", node->in_scope.ns, profile.self.ns, profile.cpu.ns);
+    int tid;
+    for (tid = 0; tid < ROMP_maxWatchedThreadNum; tid++) {
+        fprintf(file, "%s%ld", tid ? ", " : "", node->in_child_threads[tid].ns);
+    }
+    fprintf(file, "],\n%*s \"threads_used\": %d, \"imbalance\": %.4g, \"serial_fraction\": %.4g,\n",
+        2*depth, "", profile.threadsUsed, profile.imbalance, profile.serialFraction);
+    fprintf(file, "%*s \"children\": [", 2*depth, "");
+
+    PerThreadScopeTreeData* child;
+    for (child = node->first_child; child; child = child->next_sibling) {
+        fprintf(file, "\n");
+        node_write_json(file, child, depth+1);
+        if (child->next_sibling) fprintf(file, ",");
+    }
+    fprintf(file, "]}");
+}
+
+// One JSON object with the main timing and, per watched thread, the tree of
+// annotated loops it entered.  Times are nanoseconds; a loop's cpu times are
+// those of the threads that ran its body.
+//
+void ROMP_write_profile_json(FILE* file)
+{
+    Nanosecs mainDuration = TimerElapsedNanosecs(&mainTimer);
+
+    fprintf(file, "{\"program\": ");
+    json_string(file, getMainFile() ? mainFile : "");
+    fprintf(file, ", \"main_line\": %d, \"elapsed_ns\": %ld, \"romp_level\": %d, \"watched_threads\": %d,\n",
+        mainLine, mainDuration.ns, romp_level, ROMP_maxWatchedThreadNum);
+    fprintf(file, " \"threads\": [");
+    
+    int tid;
+    for (tid = 0; tid < ROMP_maxWatchedThreadNum; tid++) {
+        PerThreadScopeTreeData* root = &scopeTreeRoots[tid];
+        fprintf(file, "%s\n  {\"tid\": %d, \"elapsed_ns\": %ld, \"loops\": [", tid ? "," : "", tid, root->in_scope.ns);
+        PerThreadScopeTreeData* child;
+        for (child = root->first_child; child; child = child->next_sibling) {
+            fprintf(file, "\n");
+            node_write_json(file, child, 2);
+            if (child->next_sibling) fprintf(file, ",");
+        }
+        fprintf(file, "]}");
+    }
+    fprintf(file, "]}\n");
+}
+
+static void node_write_folded(FILE* file, PerThreadScopeTreeData* node, char* stack, size_t stackSize) {
+    ROMP_pf_static_struct* pf = node->key;
+    size_t len = strlen(stack);
+    
+    if (pf) snprintf(stack + len, stackSize - len, ";%s@%s:%d", pf->func, pf->file, pf->line);
+
+    NodeProfile profile;
+    node_profile(node, &profile);
+    if (profile.self.ns > 0) fprintf(file, "%s %ld\n", stack, profile.self.ns);
+
+    PerThreadScopeTreeData* child;
+    for (child = node->first_child; child; child = child->next_sibling) {
+        node_write_folded(file, child, stack, stackSize);
+    }
+    stack[len] = 0;
+}
+
+// Folded stacks, one "frame;frame;... self_ns" line per loop, as consumed by
+// flamegraph.pl and speedscope.  The first frame is the program and thread.
+//
+void ROMP_write_profile_folded(FILE* file)
+{
+    char stack[4096];
+    int tid;
+    for (tid = 0; tid < ROMP_maxWatchedThreadNum; tid++) {
+        PerThreadScopeTreeData* root = &scopeTreeRoots[tid];
+        if (!root->first_child) continue;
+        snprintf(stack, sizeof(stack), "%s/tid%d", getMainFile() ? mainFile : "main", tid);
+        node_write_folded(file, root, stack, sizeof(stack));
+    }
+}
+
+
 void ROMP_Distributor_begin(ROMP_Distributor* distributor,
     int lo, int hi, 
     double* sumReducedDouble0, 
@@ -0,0 +1,214 @@
+/*--------------------------------------------
+  mrishash_test_300_tree.c
+
+  Checks the tree-backed tables (MHTcreateFaceTree, MHTcreateVertexTree)
+  against the bucket tables they stand in for:
+
+  1. MHTdoesFaceIntersect gives the same answer for every face.
+  2. MHTfindClosestVertexGeneric and MHTfindClosestFaceGeneric find
+     a vertex or face at the same distance, or none in both.
+  3. After the vertices move, a tree updated with MHTrefit gives the
+     same intersections as a fresh bucket table.
+
+  The surfaces are two perturbed icosahedra whose offset is random, so
+  some repetitions overlap and some do not.
+  ----------------------------------------------*/
+
+#define TestRepetitions    10
+#define ProbeRepetitions  500
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "macros.h"
+#include "error.h"
+#include "diag.h"
+#include "proto.h"
+#include "mrisurf.h"
+#include "mrishash.h"
+#include "mri.h"
+#include "version.h"
+
+#include "gw_utils.h"
+#include "icosahedron.h"
+
+char * Progname;
+char progver[] = "V1.00";
+char logfilepath[1000];
+
+//------------------------------
+void init_various(char * AProgname) {
+//------------------------------
+  int rslt;
+  sprintf( logfilepath, "%s_log.txt", Progname);
+
+  rslt = gw_log_init(Progname, progver, logfilepath, 1); // empty file
+  if (rslt) {
+    printf("Couldn't open log file %s", logfilepath);
+    exit(-1);
+  }
+}
+
+static double urand(void) {
+  return (double) rand() / RAND_MAX;
+}
+
+static void perturb(MRI_SURFACE * mris, double amount) {
+  int vno;
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    mris->vertices[vno].x += amount * (urand() - 0.5);
+    mris->vertices[vno].y += amount * (urand() - 0.5);
+    mris->vertices[vno].z += amount * (urand() - 0.5);
+  }
+}
+
+// number of faces on which the two face tables disagree
+static int compareIntersections(MRI_SURFACE * mris,
+                                MRIS_HASH_TABLE * mht_bucket,
+                                MRIS_HASH_TABLE * mht_tree,
+                                int * nintersecting) {
+  int fno, in_bucket, in_tree, ndiffs = 0;
+
+  *nintersecting = 0;
+  for (fno = 0; fno < mris->nfaces; fno++) {
+    in_bucket = MHTdoesFaceIntersect(mht_bucket, mris, fno);
+    in_tree   = MHTdoesFaceIntersect(mht_tree,   mris, fno);
+    if (in_bucket != in_tree) ndiffs++;
+    if (in_tree) (*nintersecting)++;
+  }
+  return ndiffs;
+}
+
+// found both or neither, and at the same distance
+static int sameAnswer(int no1, double dist1, int no2, double dist2) {
+  if ((no1 < 0) != (no2 < 0)) return 0;
+  if (no1 < 0) return 1;
+  return no1 == no2 || fabs(dist1 - dist2) < 1e-4;
+}
+
+//---------------------------------------
+int TestTreeAgainstBuckets(int surfacenum) {
+//---------------------------------------
+  int rslt = 0; // default OK
+  int probeix, vno, nisect_diffs, nrefit_diffs, nvtx_diffs = 0, nface_diffs = 0;
+  int nvtx_found = 0, nface_found = 0;
+  int nintersecting, nintersecting_moved;
+  int bucket_no, tree_no;
+  char msg[1000];
+  double radius1, radius2, offset, searchrange;
+  double vecx, vecy, vecz, veclen, probex, probey, probez;
+  double bucket_dist, tree_dist;
+  MRI_SURFACE * mris;
+  MRIS_HASH_TABLE *mht_fbucket, *mht_ftree, *mht_vbucket, *mht_vtree;
+
+  radius1 = 20 + 40 * urand();
+  radius2 = 20 + 40 * urand();
+  // from well apart to deeply overlapping
+  offset  = (radius1 + radius2) * (0.6 + 0.6 * urand());
+  searchrange = 1.0 + 3.0 * urand();
+
+  vecx = urand(); vecy = urand(); vecz = urand();
+  veclen = sqrt(vecx*vecx + vecy*vecy + vecz*vecz);
+  vecx /= veclen; vecy /= veclen; vecz /= veclen;
+
+  mris = ic2562_make_two_icos(0,0,0,radius1,
+                              vecx*offset, vecy*offset, vecz*offset, radius2);
+  perturb(mris, 1.0);
+
+  mht_fbucket = MHTcreateFaceTable(mris);
+  mht_ftree   = MHTcreateFaceTree(mris, CURRENT_VERTICES);
+  mht_vbucket = MHTcreateVertexTable_Resolution(mris, CURRENT_VERTICES, searchrange);
+  mht_vtree   = MHTcreateVertexTree(mris, CURRENT_VERTICES);
+
+  nisect_diffs = compareIntersections(mris, mht_fbucket, mht_ftree, &nintersecting);
+
+  for (probeix = 0; probeix < ProbeRepetitions; probeix++) {
+    // near a random vertex, so that some probes are in range and some not
+    vno = (int) (urand() * (mris->nvertices - 1));
+    probex = mris->vertices[vno].x + 3 * searchrange * (urand() - 0.5);
+    probey = mris->vertices[vno].y + 3 * searchrange * (urand() - 0.5);
+    probez = mris->vertices[vno].z + 3 * searchrange * (urand() - 0.5);
+
+    MHTfindClosestVertexGeneric(mht_vbucket, mris, probex, probey, probez,
+                                searchrange, -1, NULL, &bucket_no, &bucket_dist);
+    MHTfindClosestVertexGeneric(mht_vtree, mris, probex, probey, probez,
+                                searchrange, -1, NULL, &tree_no, &tree_dist);
+    if (!sameAnswer(bucket_no, bucket_dist, tree_no, tree_dist)) nvtx_diffs++;
+    if (tree_no >= 0) nvtx_found++;
+
+    MHTfindClosestFaceGeneric(mht_fbucket, mris, probex, probey, probez,
+                              searchrange, -1, -1, NULL, &bucket_no, &bucket_dist);
+    MHTfindClosestFaceGeneric(mht_ftree, mris, probex, probey, probez,
+                              searchrange, -1, -1, NULL, &tree_no, &tree_dist);
+    if (!sameAnswer(bucket_no, bucket_dist, tree_no, tree_dist)) nface_diffs++;
+    if (tree_no >= 0) nface_found++;
+  }
+
+  // move the vertices a little, rehash the buckets and refit the tree
+  perturb(mris, 0.5);
+  MHTfree(&mht_fbucket);
+  mht_fbucket = MHTcreateFaceTable(mris);
+  MHTrefit(mht_ftree, mris);
+  nrefit_diffs = compareIntersections(mris, mht_fbucket, mht_ftree, &nintersecting_moved);
+
+  if (nisect_diffs || nvtx_diffs || nface_diffs || nrefit_diffs) rslt = 1;
+
+  sprintf(msg, "%5d %8.4f %8.4f %8.4f %8.4f %6d %6d %6d %6d %6d %6d %6d %6d %d",
+          surfacenum, radius1, radius2, offset, searchrange,
+          nintersecting, nisect_diffs, nvtx_found, nvtx_diffs,
+          nface_found, nface_diffs,
+          nintersecting_moved, nrefit_diffs, rslt);
+  printf("%s\n", msg);
+  gw_log_message(msg);
+
+  MHTfree(&mht_fbucket);
+  MHTfree(&mht_ftree);
+  MHTfree(&mht_vbucket);
+  MHTfree(&mht_vtree);
+  MRISfree(&mris);
+
+  return rslt;
+}
+
+//-----------------------------------
+int main(int argc, char *argv[]) {
+//-----------------------------------
+  int n;
+  int rslt = 0; // default to OK
+
+  if (getenv("SKIP_MRISHASH_TEST")) exit(77); // bypass
+
+  Progname = argv[0];
+  init_various(Progname);  // and gw_log_init
+
+  gw_log_begin();
+
+  printf("------------------------------\n");
+  printf("Program: %s\n", Progname);
+
+  //------------------------------------------
+  // Log column heads
+  //------------------------------------------
+  gw_log_message("surfacenum radius1 radius2 offset searchrange "
+                 "nintersecting isect_diffs vtx_found vtx_diffs face_found face_diffs "
+                 "nintersecting_moved refit_diffs rslt");
+  printf("surfacenum radius1 radius2 offset searchrange "
+         "nintersecting isect_diffs vtx_found vtx_diffs face_found face_diffs "
+         "nintersecting_moved refit_diffs rslt\n");
+
+  srand((unsigned int) time((time_t *) NULL) );
+
+  for (n = 0; n < TestRepetitions; n++) {
+    rslt = TestTreeAgainstBuckets(n);
+    if (rslt) goto done;
+  }
+
+ done:
+
+  gw_log_end();
+
+  return rslt;
+}
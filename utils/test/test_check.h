@@ -0,0 +1,57 @@
+/**
+ * @file  test_check.h
+ * @brief check and report helpers shared by the utils/test programs
+ *
+ * check() counts a failed condition and prints what failed (printf style);
+ * checkSummary() prints the result line of the program and returns the
+ * exit status for main(). The including file defines Progname.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#ifndef TEST_CHECK_H
+#define TEST_CHECK_H
+
+#include <stdarg.h>
+#include <stdio.h>
+
+extern const char *Progname;
+
+static int nfailed = 0;
+
+static void check(int ok, const char *fmt, ...)
+{
+  va_list args;
+
+  if (ok) return;
+  printf("FAILED: ");
+  va_start(args, fmt);
+  vprintf(fmt, args);
+  va_end(args);
+  printf("\n");
+  nfailed++;
+}
+
+static int checkSummary(void)
+{
+  if (nfailed) {
+    printf("%s: %d checks FAILED\n", Progname, nfailed);
+    return (1);
+  }
+  printf("%s: all checks passed\n", Progname);
+  return (0);
+}
+
+#endif
@@ -0,0 +1,147 @@
+/**
+ * @file  test_closest_vertex.c
+ * @brief check MRISclosestVertexField() against MRISfindClosestVertex()
+ *
+ * Builds icosahedra of a few sizes and places, some with their vertices
+ * rounded to whole mm so that several are equally close to a voxel, and
+ * some vertices ripped. MRISclosestVertexField() is run over a masked
+ * volume that reaches well outside the surfaces. For every voxel in the
+ * mask the vertex number and distance must be those of the exhaustive
+ * MRISfindClosestVertex(), and every voxel outside the mask must have
+ * row -1.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "error.h"
+#include "icosahedron.h"
+#include "matrix.h"
+#include "mri.h"
+#include "mri2.h"
+#include "mrisurf.h"
+#include "test_check.h"
+
+const char *Progname = "test_closest_vertex";
+
+#define NREPS 4
+#define NSURFS 3
+#define DIM 40
+
+/* an icosahedron of the given radius and center, rounded to whole mm if
+   round is set, with about 1 in 20 vertices ripped */
+static MRI_SURFACE *makeSurface(double radius, double x0, double y0, double z0, int round)
+{
+  MRI_SURFACE *mris;
+  VERTEX *v;
+  int vno;
+
+  mris = ic2562_make_surface(2562, 5120);
+  if (mris == NULL) ErrorExit(ERROR_NOMEMORY, "%s: could not make icosahedron", Progname);
+  MRISscaleBrain(mris, mris, radius / MRISaverageRadius(mris));
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    v = &mris->vertices[vno];
+    v->x += x0;
+    v->y += y0;
+    v->z += z0;
+    if (round) {
+      v->x = nint(v->x);
+      v->y = nint(v->y);
+      v->z = nint(v->z);
+    }
+    v->ripflag = (rand() % 20 == 0);
+  }
+  return (mris);
+}
+
+int main(int argc, char *argv[])
+{
+  MRI_SURFACE *surfs[NSURFS];
+  MRI *vol, *mask, *index;
+  MATRIX *vox2surf, *CRS, *RAS;
+  int *vtxno, rep, n, c, r, s, row, nrows, nbad_vtx, nbad_row, vno;
+  float *dist, d;
+
+  srand(7);
+  vol = MRIalloc(DIM, DIM, DIM, MRI_UCHAR);
+  mask = MRIalloc(DIM, DIM, DIM, MRI_UCHAR);
+  if (vol == NULL || mask == NULL) ErrorExit(ERROR_NOMEMORY, "%s: could not allocate volumes", Progname);
+  vox2surf = MRIxfmCRS2XYZtkreg(vol);
+  CRS = MatrixAlloc(4, 1, MATRIX_REAL);
+  CRS->rptr[4][1] = 1;
+  RAS = MatrixAlloc(4, 1, MATRIX_REAL);
+
+  for (rep = 0; rep < NREPS; rep++) {
+    surfs[0] = makeSurface(8 + rep * 4, -5, 3, 0, rep % 2 == 0);
+    surfs[1] = makeSurface(14, 6 + rep, -4, 2, rep % 2 == 1);
+    surfs[2] = (rep == 3) ? NULL : makeSurface(5, 0, 0, -10, 1);
+
+    for (s = 0; s < DIM; s++)
+      for (r = 0; r < DIM; r++)
+        for (c = 0; c < DIM; c++) MRIsetVoxVal(mask, c, r, s, 0, rand() % 3 != 0);
+
+    index = NULL;
+    vtxno = NULL;
+    dist = NULL;
+    if (MRISclosestVertexField(vol, mask, rep % 2 ? vox2surf : NULL, surfs, NSURFS, &index, &vtxno, &dist))
+      ErrorExit(ERROR_BADPARM, "%s: MRISclosestVertexField failed", Progname);
+
+    nrows = nbad_vtx = nbad_row = 0;
+    for (s = 0; s < DIM; s++)
+      for (r = 0; r < DIM; r++)
+        for (c = 0; c < DIM; c++) {
+          row = MRIIvox(index, c, r, s);
+          if (MRIgetVoxVal(mask, c, r, s, 0) < 0.5) {
+            if (row != -1) nbad_row++;
+            continue;
+          }
+          if (row < 0 || row >= DIM * DIM * DIM) {
+            nbad_row++;
+            continue;
+          }
+          nrows++;
+          CRS->rptr[1][1] = c;
+          CRS->rptr[2][1] = r;
+          CRS->rptr[3][1] = s;
+          RAS = MatrixMultiply(vox2surf, CRS, RAS);
+          for (n = 0; n < NSURFS; n++) {
+            vno = -1;
+            d = 0;
+            if (surfs[n]) vno = MRISfindClosestVertex(surfs[n], RAS->rptr[1][1], RAS->rptr[2][1], RAS->rptr[3][1], &d);
+            if (vtxno[row * NSURFS + n] != vno || dist[row * NSURFS + n] != d) nbad_vtx++;
+          }
+        }
+    check(nbad_row == 0, "rows of the voxels in and outside the mask (repetition %d)", rep);
+    check(nbad_vtx == 0, "closest vertices and distances (repetition %d)", rep);
+    printf("repetition %d: %d voxels in the mask, %d rows bad, %d vertices bad\n", rep, nrows, nbad_row, nbad_vtx);
+
+    MRIfree(&index);
+    free(vtxno);
+    free(dist);
+    for (n = 0; n < NSURFS; n++)
+      if (surfs[n]) MRISfree(&surfs[n]);
+  }
+
+  MatrixFree(&vox2surf);
+  MatrixFree(&CRS);
+  MatrixFree(&RAS);
+  MRIfree(&vol);
+  MRIfree(&mask);
+
+  exit(checkSummary());
+}
@@ -0,0 +1,172 @@
+/**
+ * @file  test_dcm_header_cache.c
+ * @brief check the DICOM header cache behind GetElementFromFile()
+ *
+ * Writes a small DICOM file and gets a few elements of it with
+ * GetElementFromFile(), which parses the header once and keeps it in a
+ * cache, and by parsing the file for every element. The values must be the
+ * same. The file is then rewritten with other values, once with a
+ * different size and once with the same size and a later modification
+ * time; GetElementFromFile() must reparse it and return the new values.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include "mri.h"
+#include "DICOMRead.h"
+#include "error.h"
+#include "test_check.h"
+
+const char *Progname = "test_dcm_header_cache";
+
+#define DCM_FILE "./test_dcm_header_cache.dcm"
+#define NELEMENTS 4
+
+static long tags[NELEMENTS][2] = {{0x8, 0x70}, {0x10, 0x10}, {0x20, 0x11}, {0x28, 0x10}};
+
+static void addString(DCM_OBJECT **object, long grpid, long elid, DCM_VALUEREPRESENTATION vr, const char *value)
+{
+  DCM_ELEMENT e;
+
+  memset(&e, 0, sizeof(e));
+  e.tag = DCM_MAKETAG(grpid, elid);
+  e.representation = vr;
+  e.multiplicity = 1;
+  e.length = strlen(value);
+  e.d.string = (char *)value;
+  if (DCM_AddElement(object, &e) != DCM_NORMAL) ErrorExit(ERROR_BADPARM, "%s: could not add element", Progname);
+}
+
+/* writes DCM_FILE with the given patient name and number of rows */
+static void writeFile(const char *name, unsigned short rows)
+{
+  DCM_OBJECT *object = NULL;
+  DCM_ELEMENT e;
+
+  if (DCM_CreateObject(&object, 0) != DCM_NORMAL) ErrorExit(ERROR_NOMEMORY, "%s: could not create object", Progname);
+  addString(&object, 0x8, 0x70, DCM_LO, "SIEMENS");
+  addString(&object, 0x10, 0x10, DCM_PN, name);
+  addString(&object, 0x20, 0x11, DCM_IS, "7 ");
+  memset(&e, 0, sizeof(e));
+  e.tag = DCM_MAKETAG(0x28, 0x10);
+  e.representation = DCM_US;
+  e.multiplicity = 1;
+  e.length = sizeof(rows);
+  e.d.us = &rows;
+  if (DCM_AddElement(&object, &e) != DCM_NORMAL) ErrorExit(ERROR_BADPARM, "%s: could not add element", Progname);
+  if (DCM_WriteFile(&object, DCM_ORDERLITTLEENDIAN, DCM_FILE) != DCM_NORMAL)
+    ErrorExit(ERROR_NOFILE, "%s: could not write %s", Progname, DCM_FILE);
+  DCM_CloseObject(&object);
+  COND_PopCondition(1);
+}
+
+/* GetElementFromFile() without the cache: parses the file every time */
+static DCM_ELEMENT *uncachedElement(const char *fname, long grpid, long elid)
+{
+  DCM_OBJECT *object;
+  DCM_ELEMENT *e;
+  unsigned int length;
+  void *ctx = NULL;
+
+  object = GetObjectFromFile(fname, 0);
+  if (object == NULL) return (NULL);
+  e = (DCM_ELEMENT *)calloc(1, sizeof(DCM_ELEMENT));
+  if (DCM_GetElement(&object, DCM_MAKETAG(grpid, elid), e) != DCM_NORMAL) {
+    free(e);
+    e = NULL;
+  }
+  else {
+    AllocElementData(e);
+    if (DCM_GetElementValue(&object, e, &length, &ctx) != DCM_NORMAL) {
+      FreeElementData(e);
+      free(e);
+      e = NULL;
+    }
+  }
+  DCM_CloseObject(&object);
+  COND_PopCondition(1);
+  return (e);
+}
+
+static int sameElement(DCM_ELEMENT *e1, DCM_ELEMENT *e2)
+{
+  if (e1 == NULL || e2 == NULL) return (0);
+  if (e1->tag != e2->tag || e1->representation != e2->representation || e1->length != e2->length) return (0);
+  if (e1->representation == DCM_US) return (*e1->d.us == *e2->d.us);
+  return (memcmp(e1->d.string, e2->d.string, e1->length) == 0);
+}
+
+static void freeElement(DCM_ELEMENT *e)
+{
+  if (e == NULL) return;
+  FreeElementData(e);
+  free(e);
+}
+
+/* every element twice from the cache and once parsed, all the same */
+static void checkElements(const char *what)
+{
+  DCM_ELEMENT *cached, *again, *parsed;
+  int n;
+
+  for (n = 0; n < NELEMENTS; n++) {
+    cached = GetElementFromFile(DCM_FILE, tags[n][0], tags[n][1]);
+    again = GetElementFromFile(DCM_FILE, tags[n][0], tags[n][1]);
+    parsed = uncachedElement(DCM_FILE, tags[n][0], tags[n][1]);
+    check(sameElement(cached, parsed) && sameElement(again, parsed), "%s: element (%04lx,%04lx)", what, tags[n][0],
+          tags[n][1]);
+    freeElement(cached);
+    freeElement(again);
+    freeElement(parsed);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  DCM_ELEMENT *e;
+  struct utimbuf times;
+
+  writeFile("Cache^Test", 64);
+  checkElements("first file");
+
+  // different size: the patient name is longer
+  writeFile("Cache^Test^Again", 64);
+  e = GetElementFromFile(DCM_FILE, 0x10, 0x10);
+  check(e && e->length == strlen("Cache^Test^Again") && !strncmp(e->d.string, "Cache^Test^Again", e->length),
+        "new patient name after a size change");
+  freeElement(e);
+  checkElements("file of another size");
+
+  // same size, later modification time
+  writeFile("Cache^Test^Again", 65);
+  times.actime = times.modtime = time(NULL) + 10;
+  check(utime(DCM_FILE, &times) == 0, "setting the modification time");
+  e = GetElementFromFile(DCM_FILE, 0x28, 0x10);
+  check(e && *e->d.us == 65, "new number of rows after a modification time change");
+  freeElement(e);
+  checkElements("file with a later modification time");
+
+  dcmHeaderCacheClear();
+  unlink(DCM_FILE);
+
+  exit(checkSummary());
+}
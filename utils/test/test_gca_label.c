@@ -0,0 +1,143 @@
+/**
+ * @file  test_gca_label.c
+ * @brief check GCAlabel() and GCAlabelProbabilities() with and without the table
+ *
+ * Builds small atlases with one and with two inputs and random means and
+ * covariances; with two inputs some priors have labels the node has no
+ * classifier for. Each is applied to a random volume by GCAlabel() and
+ * GCAlabelProbabilities() once with the per-node table of Gaussian
+ * constants and once with FS_GCA_NO_DENSITY_TABLE set, which computes
+ * every density untabulated. The outputs must be identical.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "error.h"
+#include "gca.h"
+#include "mri.h"
+#include "transform.h"
+#include "test_check.h"
+
+const char *Progname = "test_gca_label";
+
+#define DIM 24
+#define NLABELS 3
+
+static int labels[] = {0, 2, 3, 4, 17, 41};
+#define NALL ((int)(sizeof(labels) / sizeof(labels[0])))
+
+/* an atlas with ninputs inputs and NLABELS classifiers and priors at
+   every node and prior */
+static GCA *makeAtlas(int ninputs)
+{
+  GCA *gca;
+  GCA_NODE *gcan;
+  GCA_PRIOR *gcap;
+  GC1D *gc;
+  int x, y, z, n, i;
+  float a, c;
+
+  gca = GCAalloc(ninputs, 2, 4, DIM, DIM, DIM, 0);
+  if (gca == NULL) ErrorExit(ERROR_NOMEMORY, "%s: could not allocate atlas", Progname);
+  for (x = 0; x < gca->node_width; x++)
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++) {
+        gcan = &gca->nodes[x][y][z];
+        gcan->nlabels = NLABELS;
+        for (n = 0; n < NLABELS; n++) {
+          gcan->labels[n] = labels[(x + y + z + n) % NALL];
+          gc = &gcan->gcs[n];
+          for (i = 0; i < ninputs; i++) gc->means[i] = rand() % 200;
+          a = 20 + rand() % 400;
+          c = 20 + rand() % 400;
+          if (ninputs == 1)
+            gc->covars[0] = a;
+          else {
+            gc->covars[0] = a;
+            gc->covars[1] = (rand() % 20) - 10;
+            gc->covars[2] = c;
+          }
+          gc->ntraining = 10;
+        }
+      }
+  for (x = 0; x < gca->prior_width; x++)
+    for (y = 0; y < gca->prior_height; y++)
+      for (z = 0; z < gca->prior_depth; z++) {
+        gcap = &gca->priors[x][y][z];
+        gcap->nlabels = NLABELS;
+        for (n = 0; n < NLABELS; n++) {
+          // the labels of the node, with 2 inputs sometimes one it has no
+          // classifier for (GCAfindClosestValidGC() keeps an inverse
+          // covariance of the size of the first atlas it was called for)
+          gcap->labels[n] = labels[(x / 2 + y / 2 + z / 2 + n + (ninputs > 1 && rand() % 8 == 0)) % NALL];
+          gcap->priors[n] = (1 + rand() % 100) / 300.0;
+        }
+      }
+  return (gca);
+}
+
+static int sameVolumes(MRI *mri1, MRI *mri2)
+{
+  int c, r, s;
+
+  for (s = 0; s < mri1->depth; s++)
+    for (r = 0; r < mri1->height; r++)
+      for (c = 0; c < mri1->width; c++)
+        if (MRIgetVoxVal(mri1, c, r, s, 0) != MRIgetVoxVal(mri2, c, r, s, 0)) return (0);
+  return (1);
+}
+
+int main(int argc, char *argv[])
+{
+  GCA *gca;
+  MRI *mri, *labeled, *labeled_untab, *probs, *probs_untab;
+  TRANSFORM *transform;
+  int ninputs, c, r, s, f;
+
+  srand(3);
+  for (ninputs = 1; ninputs <= 2; ninputs++) {
+    gca = makeAtlas(ninputs);
+    mri = MRIallocSequence(DIM, DIM, DIM, MRI_FLOAT, ninputs);
+    if (mri == NULL) ErrorExit(ERROR_NOMEMORY, "%s: could not allocate volume", Progname);
+    for (f = 0; f < ninputs; f++)
+      for (s = 0; s < DIM; s++)
+        for (r = 0; r < DIM; r++)
+          for (c = 0; c < DIM; c++) MRIsetVoxVal(mri, c, r, s, f, rand() % 220);
+    transform = TransformAlloc(LINEAR_VOX_TO_VOX, NULL);
+
+    labeled = GCAlabel(mri, gca, NULL, transform);
+    probs = GCAlabelProbabilities(mri, gca, NULL, transform);
+    setenv("FS_GCA_NO_DENSITY_TABLE", "1", 1);
+    labeled_untab = GCAlabel(mri, gca, NULL, transform);
+    probs_untab = GCAlabelProbabilities(mri, gca, NULL, transform);
+    unsetenv("FS_GCA_NO_DENSITY_TABLE");
+
+    check(sameVolumes(labeled, labeled_untab), "GCAlabel with and without the table (%d inputs)", ninputs);
+    check(sameVolumes(probs, probs_untab), "GCAlabelProbabilities with and without the table (%d inputs)", ninputs);
+
+    MRIfree(&labeled);
+    MRIfree(&labeled_untab);
+    MRIfree(&probs);
+    MRIfree(&probs_untab);
+    MRIfree(&mri);
+    TransformFree(&transform);
+    GCAfree(&gca);
+  }
+
+  exit(checkSummary());
+}
@@ -0,0 +1,164 @@
+/**
+ * @file  test_glm_batch.c
+ * @brief check the batched MRIglmFitAndTest() against the voxel-by-voxel loop
+ *
+ * Sets up a masked multi-frame volume with more voxels than one batch, a
+ * design shared by all voxels and t and F contrasts, one of them with a
+ * nonzero gamma0. MRIglmFitAndTest() is run once as is, which fits the
+ * voxels in batches, and once with FS_GLM_NOBATCH set, which fits them
+ * one at a time. Every output volume (beta, residuals, variance, yhat,
+ * condition, gamma, gamma variance, F, p and z) must be the same.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "error.h"
+#include "fmriutils.h"
+#include "fsglm.h"
+#include "matrix.h"
+#include "mri.h"
+#include "test_check.h"
+
+const char *Progname = "test_glm_batch";
+
+#define NFRAMES 20
+#define NREG 4
+#define NCONTRASTS 3
+
+/* a glm of y over mask with the design X and the test contrasts */
+static MRIGLM *makeGlm(MRI *y, MRI *mask, MATRIX *X)
+{
+  MRIGLM *mriglm;
+  GLMMAT *glm;
+
+  mriglm = (MRIGLM *)calloc(1, sizeof(MRIGLM));
+  if (mriglm == NULL) ErrorExit(ERROR_NOMEMORY, "%s: could not allocate glm", Progname);
+  mriglm->y = y;
+  mriglm->mask = mask;
+  mriglm->Xg = X;
+  mriglm->yhatsave = 1;
+  mriglm->condsave = 1;
+  mriglm->glm = glm = GLMalloc();
+  glm->ncontrasts = NCONTRASTS;
+  glm->C[0] = MatrixAlloc(1, NREG, MATRIX_REAL);
+  glm->C[0]->rptr[1][2] = 1;
+  glm->C[1] = MatrixAlloc(2, NREG, MATRIX_REAL);
+  glm->C[1]->rptr[1][2] = 1;
+  glm->C[1]->rptr[2][3] = 1;
+  glm->C[2] = MatrixAlloc(1, NREG, MATRIX_REAL);
+  glm->C[2]->rptr[1][3] = 1;
+  glm->C[2]->rptr[1][4] = -1;
+  glm->UseGamma0[2] = 1;
+  glm->gamma0[2] = MatrixAlloc(1, 1, MATRIX_REAL);
+  glm->gamma0[2]->rptr[1][1] = 0.3;
+  return (mriglm);
+}
+
+static int sameVolumes(MRI *mri1, MRI *mri2)
+{
+  int c, r, s, f;
+
+  if (mri1 == NULL || mri2 == NULL || mri1->nframes != mri2->nframes) return (0);
+  for (f = 0; f < mri1->nframes; f++)
+    for (s = 0; s < mri1->depth; s++)
+      for (r = 0; r < mri1->height; r++)
+        for (c = 0; c < mri1->width; c++)
+          if (MRIgetVoxVal(mri1, c, r, s, f) != MRIgetVoxVal(mri2, c, r, s, f)) return (0);
+  return (1);
+}
+
+static void freeGlm(MRIGLM **pmriglm)
+{
+  MRIGLM *mriglm = *pmriglm;
+  int n;
+
+  MRIfree(&mriglm->beta);
+  MRIfree(&mriglm->eres);
+  MRIfree(&mriglm->rvar);
+  MRIfree(&mriglm->yhat);
+  MRIfree(&mriglm->cond);
+  for (n = 0; n < NCONTRASTS; n++) {
+    MRIfree(&mriglm->gamma[n]);
+    if (mriglm->gammaVar[n]) MRIfree(&mriglm->gammaVar[n]);
+    MRIfree(&mriglm->F[n]);
+    MRIfree(&mriglm->p[n]);
+    MRIfree(&mriglm->z[n]);
+  }
+  GLMfree(&mriglm->glm);
+  free(mriglm);
+  *pmriglm = NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  MRIGLM *batched, *single;
+  MRI *y, *mask;
+  MATRIX *X;
+  int c, r, s, f, n;
+
+  srand(9);
+  X = MatrixAlloc(NFRAMES, NREG, MATRIX_REAL);
+  for (f = 1; f <= NFRAMES; f++) {
+    X->rptr[f][1] = 1;
+    X->rptr[f][2] = f % 2;
+    X->rptr[f][3] = rand() / (float)RAND_MAX;
+    X->rptr[f][4] = f / 10.0;
+  }
+
+  // more voxels in the mask than one batch, some of them constant
+  y = MRIallocSequence(23, 17, 3, MRI_FLOAT, NFRAMES);
+  mask = MRIalloc(23, 17, 3, MRI_UCHAR);
+  if (y == NULL || mask == NULL) ErrorExit(ERROR_NOMEMORY, "%s: could not allocate volumes", Progname);
+  for (s = 0; s < y->depth; s++)
+    for (r = 0; r < y->height; r++)
+      for (c = 0; c < y->width; c++) {
+        MRIsetVoxVal(mask, c, r, s, 0, rand() % 10 < 7);
+        for (f = 0; f < NFRAMES; f++)
+          MRIsetVoxVal(y, c, r, s, f,
+                       (c % 7 == 0) ? 2.0 : rand() / (float)RAND_MAX * 3 + X->rptr[f + 1][2] * (r % 5) * 0.2);
+      }
+
+  batched = makeGlm(y, mask, X);
+  single = makeGlm(y, mask, X);
+  MRIglmFitAndTest(batched);
+  setenv("FS_GLM_NOBATCH", "1", 1);
+  MRIglmFitAndTest(single);
+  unsetenv("FS_GLM_NOBATCH");
+
+  check(sameVolumes(batched->beta, single->beta), "beta");
+  check(sameVolumes(batched->eres, single->eres), "residuals");
+  check(sameVolumes(batched->rvar, single->rvar), "residual variance");
+  check(sameVolumes(batched->yhat, single->yhat), "yhat");
+  check(sameVolumes(batched->cond, single->cond), "condition");
+  for (n = 0; n < NCONTRASTS; n++) {
+    check(sameVolumes(batched->gamma[n], single->gamma[n]), "gamma of contrast %d", n);
+    if (single->glm->C[n]->rows == 1)
+      check(sameVolumes(batched->gammaVar[n], single->gammaVar[n]), "gamma variance of contrast %d", n);
+    check(sameVolumes(batched->F[n], single->F[n]), "F of contrast %d", n);
+    check(sameVolumes(batched->p[n], single->p[n]), "p of contrast %d", n);
+    check(sameVolumes(batched->z[n], single->z[n]), "z of contrast %d", n);
+  }
+
+  freeGlm(&batched);
+  freeGlm(&single);
+  MatrixFree(&X);
+  MRIfree(&y);
+  MRIfree(&mask);
+
+  exit(checkSummary());
+}
@@ -0,0 +1,278 @@
+/**
+ * @file  test_label_ops.c
+ * @brief check the table-based label set operations against the pairwise ones
+ *
+ * Builds random surface labels on an icosahedron, with repeated vertex
+ * numbers and unassigned (vno < 0) points at repeated coordinates, and runs
+ * LabelRemoveDuplicates(), LabelRemoveAlmostDuplicates(), LabelIntersect(),
+ * LabelRemoveOverlap() and LabelDilate() on one copy and the pairwise
+ * versions they replaced on another. The points and their deleted flags
+ * must be identical. For labels indexed with LabelIndexVertices(), the
+ * lookups LabelHasVertex() and VertexIsInLabel() must also agree with the
+ * search of an unindexed copy after every operation, which finds the first
+ * point of a vertex whether it is deleted or not, and LabelDeleteVertex()
+ * must delete every undeleted point of a vertex, one per call.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "error.h"
+#include "icosahedron.h"
+#include "label.h"
+#include "macros.h"
+#include "mrisurf.h"
+#include "test_check.h"
+
+const char *Progname = "test_label_ops";
+
+#define NREPS 20
+
+/* a label with npoints points: vertex numbers drawn from nvertices (so
+   some repeat) and every unassigned-th point unassigned, at one of a few
+   coordinates */
+static LABEL *makeLabel(int npoints, int nvertices, int unassigned, unsigned int seed)
+{
+  LABEL *area;
+  int n;
+
+  srand(seed);
+  area = LabelAlloc(npoints, NULL, "test");
+  for (n = 0; n < npoints; n++) {
+    LV *lv = &area->lv[n];
+    if (unassigned > 0 && n % unassigned == 0) {
+      lv->vno = -1;
+      lv->x = rand() % 7;
+      lv->y = rand() % 3;
+      lv->z = 0.1f * (rand() % 2);
+    }
+    else {
+      lv->vno = rand() % nvertices;
+      lv->x = lv->vno;
+      lv->y = 2 * lv->vno;
+      lv->z = 3 * lv->vno;
+    }
+    lv->stat = n;
+  }
+  area->n_points = npoints;
+  return (area);
+}
+
+/* the pairwise LabelRemoveDuplicates() (dist < 0) and
+   LabelRemoveAlmostDuplicates() before compaction */
+static void pairwiseRemoveDuplicates(LABEL *area, double dist)
+{
+  int n1, n2;
+  LV *lv1, *lv2;
+
+  for (n1 = 0; n1 < area->n_points; n1++) {
+    lv1 = &area->lv[n1];
+    if (lv1->deleted) continue;
+    for (n2 = n1 + 1; n2 < area->n_points; n2++) {
+      lv2 = &area->lv[n2];
+      if (lv1->vno >= 0 && lv2->vno >= 0 && lv1->vno == lv2->vno)
+        lv2->deleted = 1;
+      else if (lv1->vno < 0 && lv2->vno < 0) {
+        if (dist < 0) {
+          if (FEQUAL(lv1->x, lv2->x) && FEQUAL(lv1->y, lv2->y) && FEQUAL(lv1->z, lv2->z)) lv2->deleted = 1;
+        }
+        else if (fabs(lv1->x - lv2->x) < dist && fabs(lv1->y - lv2->y) < dist && fabs(lv1->z - lv2->z) < dist)
+          lv2->deleted = 1;
+      }
+    }
+  }
+}
+
+static void pairwiseRemoveOverlap(LABEL *area1, LABEL *area2)
+{
+  int n1, n2;
+
+  for (n1 = 0; n1 < area1->n_points; n1++)
+    for (n2 = 0; n2 < area2->n_points; n2++)
+      if (area1->lv[n1].vno == area2->lv[n2].vno) {
+        area1->lv[n1].deleted = 1;
+        break;
+      }
+}
+
+/* keeps the last point of area1 of each vertex number that is in area2 */
+static void pairwiseIntersect(LABEL *area1, LABEL *area2)
+{
+  int n1, n2, nlast;
+
+  for (n1 = 0; n1 < area1->n_points; n1++) area1->lv[n1].deleted = 1;
+  for (n2 = 0; n2 < area2->n_points; n2++) {
+    nlast = -1;
+    for (n1 = 0; n1 < area1->n_points; n1++)
+      if (area1->lv[n1].vno == area2->lv[n2].vno) nlast = n1;
+    if (nlast >= 0) area1->lv[nlast].deleted = 0;
+  }
+}
+
+/* the sweep over all vertices that LabelDilate() used to do */
+static void sweepDilate(LABEL *area, MRI_SURFACE *mris, int num_times)
+{
+  int n, vno, nbr, found;
+  VERTEX *v;
+
+  MRISclearMarks(mris);
+  for (n = 0; n < num_times; n++) {
+    LabelMark(area, mris);
+    for (vno = 0; vno < mris->nvertices; vno++) {
+      v = &mris->vertices[vno];
+      if (v->marked == 1) continue;
+      found = 0;
+      for (nbr = 0; nbr < v->vnum; nbr++)
+        if (mris->vertices[v->v[nbr]].marked > 0) {
+          found = 1;
+          break;
+        }
+      if (found) {
+        LV *lv;
+        if (area->n_points >= area->max_points) LabelRealloc(area, nint(area->max_points * 1.5));
+        lv = &area->lv[area->n_points++];
+        lv->vno = vno;
+        lv->x = v->x;
+        lv->y = v->y;
+        lv->z = v->z;
+      }
+    }
+    LabelUnmark(area, mris);
+  }
+  MRISclearMarks(mris);
+}
+
+static int samePoints(LABEL *a, LABEL *b)
+{
+  int n;
+
+  if (a->n_points != b->n_points) return (0);
+  for (n = 0; n < a->n_points; n++)
+    if (a->lv[n].vno != b->lv[n].vno || a->lv[n].deleted != b->lv[n].deleted || a->lv[n].x != b->lv[n].x ||
+        a->lv[n].y != b->lv[n].y || a->lv[n].z != b->lv[n].z)
+      return (0);
+  return (1);
+}
+
+/* the indexed label and an unindexed copy with the same points answer
+   every lookup the same way */
+static int sameLookups(LABEL *indexed, LABEL *plain, int nvertices)
+{
+  int vno, *ind;
+
+  if (indexed->vertex_label_ind == NULL) return (0);
+  ind = plain->vertex_label_ind;
+  plain->vertex_label_ind = NULL;
+  for (vno = 0; vno < nvertices; vno++)
+    if (LabelHasVertex(vno, indexed) != LabelHasVertex(vno, plain) ||
+        VertexIsInLabel(vno, indexed) != VertexIsInLabel(vno, plain))
+      break;
+  plain->vertex_label_ind = ind;
+  return (vno == nvertices);
+}
+
+int main(int argc, char *argv[])
+{
+  MRI_SURFACE *mris;
+  LABEL *a, *b, *a2, *b2, *c, *d;
+  int rep, nv, n;
+
+  mris = ic2562_make_surface(2562, 5120);
+  if (mris == NULL) ErrorExit(ERROR_NOMEMORY, "%s: could not make icosahedron", Progname);
+  nv = mris->nvertices;
+
+  for (rep = 0; rep < NREPS; rep++) {
+    n = 50 + rep * 100;
+
+    // duplicates, exact and within a distance
+    a = makeLabel(n, nv / 4, 5, rep);
+    b = makeLabel(n, nv / 4, 5, rep);
+    LabelRemoveDuplicates(a);
+    pairwiseRemoveDuplicates(b, -1);
+    check(samePoints(a, b), "LabelRemoveDuplicates (repetition %d)", rep);
+    LabelFree(&a);
+    LabelFree(&b);
+
+    a = makeLabel(n, nv / 4, 5, rep);
+    b = makeLabel(n, nv / 4, 5, rep);
+    c = LabelRemoveAlmostDuplicates(a, 1.5, NULL);
+    pairwiseRemoveDuplicates(b, 1.5);
+    d = LabelCompact(b, NULL);
+    check(samePoints(c, d), "LabelRemoveAlmostDuplicates (repetition %d)", rep);
+    LabelFree(&a);
+    LabelFree(&b);
+    LabelFree(&c);
+    LabelFree(&d);
+
+    // overlap and intersection of two surface labels
+    a = makeLabel(n, nv / 2, 0, rep);
+    b = makeLabel(n, nv / 2, 0, rep);
+    a2 = makeLabel(n / 2 + 1, nv / 2, 0, 1000 + rep);
+    LabelIndexVertices(a, nv);
+    LabelRemoveOverlap(a, a2);
+    pairwiseRemoveOverlap(b, a2);
+    check(samePoints(a, b), "LabelRemoveOverlap (repetition %d)", rep);
+    check(sameLookups(a, b, nv), "lookups after LabelRemoveOverlap (repetition %d)", rep);
+    LabelFree(&a);
+    LabelFree(&b);
+
+    a = makeLabel(n, nv / 2, 0, rep);
+    b = makeLabel(n, nv / 2, 0, rep);
+    LabelIndexVertices(a, nv);
+    LabelIntersect(a, a2);
+    pairwiseIntersect(b, a2);
+    check(samePoints(a, b), "LabelIntersect (repetition %d)", rep);
+    check(sameLookups(a, b, nv), "lookups after LabelIntersect (repetition %d)", rep);
+    LabelFree(&a);
+    LabelFree(&b);
+    LabelFree(&a2);
+
+    // dilation of a label with repeated vertices
+    a = makeLabel(5 + rep, nv / 20, 0, rep);
+    b = makeLabel(5 + rep, nv / 20, 0, rep);
+    b2 = makeLabel(5 + rep, nv / 20, 0, rep);
+    LabelIndexVertices(a, nv);
+    LabelDilate(a, mris, 1 + rep % 4, CURRENT_VERTICES);
+    sweepDilate(b, mris, 1 + rep % 4);
+    check(samePoints(a, b), "LabelDilate (repetition %d)", rep);
+    check(sameLookups(a, b, nv), "lookups after LabelDilate (repetition %d)", rep);
+
+    // lookups with deleted points
+    for (n = 0; n < b2->n_points; n += 3) b2->lv[n].deleted = 1;
+    LabelIndexVertices(b2, nv);
+    a2 = makeLabel(5 + rep, nv / 20, 0, rep);
+    for (n = 0; n < a2->n_points; n += 3) a2->lv[n].deleted = 1;
+    check(sameLookups(b2, a2, nv), "lookups with deleted points (repetition %d)", rep);
+    for (n = 0; n < b2->n_points; n++)
+      while (LabelDeleteVertex(b2, b2->lv[n].vno, CURRENT_VERTICES) == NO_ERROR)
+        ;
+    for (n = 0; n < b2->n_points && b2->lv[n].deleted; n++)
+      ;
+    check(n == b2->n_points, "LabelDeleteVertex deletes every point (repetition %d)", rep);
+    for (n = 0; n < a2->n_points; n++) a2->lv[n].deleted = 1;
+    check(sameLookups(b2, a2, nv), "lookups after LabelDeleteVertex (repetition %d)", rep);
+    LabelFree(&a);
+    LabelFree(&b);
+    LabelFree(&a2);
+    LabelFree(&b2);
+  }
+
+  MRISfree(&mris);
+
+  exit(checkSummary());
+}
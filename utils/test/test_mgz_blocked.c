@@ -0,0 +1,127 @@
+/**
+ * @file  test_mgz_blocked.c
+ * @brief read block-compressed mgz volumes, whole and by frame range
+ *
+ * Writes 4D volumes of each type that FS_MGZ_BLOCKED supports as a
+ * block-compressed .mgz, as a plain .mgz and as an .mgh. Every file is read
+ * back whole and as a few fname#start:end frame ranges, the .mgh both
+ * mapped and with FS_MGH_MMAP 0. Each read must return the written frames,
+ * so the blocked reader gives the same volumes as the unblocked paths.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "mgzblock.h"
+#include "mri.h"
+#include "test_check.h"
+
+const char *Progname = "test_mgz_blocked";
+
+#define BLOCKED_FILE "./test_mgz_blocked.mgz"
+#define PLAIN_FILE "./test_mgz_plain.mgz"
+#define MGH_FILE "./test_mgz_blocked.mgh"
+#define NFRAMES 5
+#define NRANGES 4
+
+static int ranges[NRANGES][2] = {{0, NFRAMES - 1}, {1, 3}, {4, 4}, {0, 0}};
+
+static MRI *makeVolume(int type)
+{
+  MRI *mri;
+  int c, r, s, f;
+
+  mri = MRIallocSequence(13, 9, 7, type, NFRAMES);
+  if (mri == NULL) ErrorExit(ERROR_NOMEMORY, "%s: could not allocate volume", Progname);
+  mri->tr = 2000;
+  for (f = 0; f < NFRAMES; f++)
+    for (s = 0; s < mri->depth; s++)
+      for (r = 0; r < mri->height; r++)
+        for (c = 0; c < mri->width; c++)
+          MRIsetVoxVal(mri, c, r, s, f, (c + 3 * r + 7 * s + 11 * f) % 97 + (type == MRI_FLOAT ? 0.25 : 0));
+  return (mri);
+}
+
+/* mri holds frames start..end of the written volume */
+static int sameFrames(MRI *mri, MRI *written, int start, int end)
+{
+  int c, r, s, f;
+
+  if (mri == NULL) return (0);
+  if (mri->type != written->type || mri->nframes != end - start + 1 || mri->width != written->width ||
+      mri->height != written->height || mri->depth != written->depth || mri->tr != written->tr)
+    return (0);
+  for (f = start; f <= end; f++)
+    for (s = 0; s < mri->depth; s++)
+      for (r = 0; r < mri->height; r++)
+        for (c = 0; c < mri->width; c++)
+          if (MRIgetVoxVal(mri, c, r, s, f - start) != MRIgetVoxVal(written, c, r, s, f)) return (0);
+  return (1);
+}
+
+static void checkReads(MRI *written, const char *fname, const char *what)
+{
+  char spec[STRLEN];
+  MRI *mri;
+  int i;
+
+  for (i = 0; i < NRANGES; i++) {
+    if (i == 0)
+      strcpy(spec, fname);
+    else
+      sprintf(spec, "%s#%d:%d", fname, ranges[i][0], ranges[i][1]);
+    mri = MRIread(spec);
+    check(sameFrames(mri, written, ranges[i][0], ranges[i][1]), "%s frames %d to %d of type %d", what,
+          ranges[i][0], ranges[i][1], written->type);
+    if (mri) MRIfree(&mri);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  int types[] = {MRI_UCHAR, MRI_SHORT, MRI_INT, MRI_FLOAT}, t;
+  MRI *mri;
+
+  for (t = 0; t < (int)(sizeof(types) / sizeof(types[0])); t++) {
+    mri = makeVolume(types[t]);
+
+    setenv("FS_MGZ_BLOCKED", "1", 1);
+    check(MRIwrite(mri, BLOCKED_FILE) == NO_ERROR, "writing blocked mgz of type %d", types[t]);
+    unsetenv("FS_MGZ_BLOCKED");
+    check(MRIwrite(mri, PLAIN_FILE) == NO_ERROR, "writing plain mgz of type %d", types[t]);
+    check(MRIwrite(mri, MGH_FILE) == NO_ERROR, "writing mgh of type %d", types[t]);
+    check(MGZBisBlocked(BLOCKED_FILE), "%s is blocked", BLOCKED_FILE);
+    check(!MGZBisBlocked(PLAIN_FILE), "%s is not blocked", PLAIN_FILE);
+
+    checkReads(mri, BLOCKED_FILE, "blocked mgz");
+    checkReads(mri, PLAIN_FILE, "plain mgz");
+    checkReads(mri, MGH_FILE, "mapped mgh");
+    setenv("FS_MGH_MMAP", "0", 1);
+    checkReads(mri, MGH_FILE, "mgh");
+    unsetenv("FS_MGH_MMAP");
+
+    MRIfree(&mri);
+  }
+  unlink(BLOCKED_FILE);
+  unlink(PLAIN_FILE);
+  unlink(MGH_FILE);
+
+  exit(checkSummary());
+}
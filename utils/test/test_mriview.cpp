@@ -0,0 +1,271 @@
+/**
+ * @file  test_mriview.cpp
+ * @brief check MRIView against MRIgetVoxVal/MRIsetVoxVal and time both
+ *
+ * For each voxel type, scales a two-frame volume once through
+ * MRIgetVoxVal()/MRIsetVoxVal() and once through a kernel dispatched with
+ * MRIdispatchType(), and resamples it with MRIlinearTransformInterp()
+ * (typed, multithreaded kernels) and with the generic per-voxel loop they
+ * replaced, for nearest, trilinear and cubic B-spline interpolation. It also
+ * resamples into a same-type and a float target with MRIvol2VolNearestTyped()
+ * and with the generic nearest-neighbor loop of MRIvol2VolVSM(). The
+ * results must be identical; the per-voxel cost of each is printed.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "error.h"
+#include "matrix.h"
+#include "mri.h"
+#include "mriBSpline.h"
+#include "timer.h"
+
+#include "mriview.hpp"
+
+const char *Progname = "test_mriview";
+
+static const int DIM = 96;
+static const int NFRAMES = 2;
+
+struct ScaleKernel
+{
+  float scale;
+  MRI *dst;
+  template <typename T>
+  void operator()(MRIView<T> src) const
+  {
+    MRIView<T> out(dst);
+    for (int f = 0; f < src.nframes(); f++)
+      for (int z = 0; z < src.depth(); z++)
+        for (int y = 0; y < src.height(); y++) {
+          const T *in = src.row(y, z, f);
+          T *o = out.row(y, z, f);
+          for (int x = 0; x < src.width(); x++) {
+            o[x] = MRIvoxelCast<T>(scale * (float)in[x]);
+          }
+        }
+  }
+};
+
+static double nsPerVoxel(NanosecsTimer *timer, MRI *mri)
+{
+  Nanosecs ns = TimerElapsedNanosecs(timer);
+  return (double)ns.ns / ((double)mri->width * mri->height * mri->depth * mri->nframes);
+}
+
+static int compareVolumes(MRI *mri1, MRI *mri2, const char *what)
+{
+  int x, y, z, f, ndiffs = 0;
+
+  for (f = 0; f < mri1->nframes; f++)
+    for (z = 0; z < mri1->depth; z++)
+      for (y = 0; y < mri1->height; y++)
+        for (x = 0; x < mri1->width; x++)
+          if (MRIgetVoxVal(mri1, x, y, z, f) != MRIgetVoxVal(mri2, x, y, z, f)) {
+            ndiffs++;
+          }
+  if (ndiffs) {
+    printf("  %s: %d voxels differ\n", what, ndiffs);
+  }
+  return ndiffs;
+}
+
+// the loop MRIlinearTransformInterp() ran before the typed kernel
+static MRI *linearTransformGeneric(MRI *mri_src, MATRIX *mA, int interp)
+{
+  MRI *mri_dst = MRIclone(mri_src, NULL);
+  MATRIX *mAinv = MatrixInverse(mA, NULL);
+  VECTOR *v_X = VectorAlloc(4, MATRIX_REAL), *v_Y = VectorAlloc(4, MATRIX_REAL);
+  MRI_BSPLINE *bspline = NULL;
+  double val;
+
+  if (interp == SAMPLE_CUBIC_BSPLINE) bspline = MRItoBSpline(mri_src, NULL, 3);
+  v_Y->rptr[4][1] = 1.0f;
+  for (int y3 = 0; y3 < mri_dst->depth; y3++) {
+    V3_Z(v_Y) = y3;
+    for (int y2 = 0; y2 < mri_dst->height; y2++) {
+      V3_Y(v_Y) = y2;
+      for (int y1 = 0; y1 < mri_dst->width; y1++) {
+        V3_X(v_Y) = y1;
+        MatrixMultiply(mAinv, v_Y, v_X);
+        for (int frame = 0; frame < mri_src->nframes; frame++) {
+          if (bspline)
+            MRIsampleBSpline(bspline, V3_X(v_X), V3_Y(v_X), V3_Z(v_X), frame, &val);
+          else
+            MRIsampleVolumeFrameType(mri_src, V3_X(v_X), V3_Y(v_X), V3_Z(v_X), frame, interp, &val);
+          MRIsetVoxVal(mri_dst, y1, y2, y3, frame, val);
+        }
+      }
+    }
+  }
+  if (bspline) MRIfreeBSpline(&bspline);
+  MatrixFree(&v_X);
+  MatrixFree(&v_Y);
+  MatrixFree(&mAinv);
+  return mri_dst;
+}
+
+// the nearest-neighbor loop MRIvol2VolVSM() runs without a shift map when no typed kernel applies
+static void vol2volNearestGeneric(MRI *src, MRI *targ, MATRIX *Vt2s)
+{
+  MATRIX *crsT = MatrixAlloc(4, 1, MATRIX_REAL), *crsS = MatrixAlloc(4, 1, MATRIX_REAL);
+
+  crsT->rptr[4][1] = 1;
+  for (int ct = 0; ct < targ->width; ct++) {
+    for (int rt = 0; rt < targ->height; rt++) {
+      for (int st = 0; st < targ->depth; st++) {
+        crsT->rptr[1][1] = ct;
+        crsT->rptr[2][1] = rt;
+        crsT->rptr[3][1] = st;
+        crsS = MatrixMultiply(Vt2s, crsT, crsS);
+        int ics = nint(crsS->rptr[1][1]);
+        int irs = nint(crsS->rptr[2][1]);
+        int iss = nint(crsS->rptr[3][1]);
+        if (ics < 0 || ics >= src->width) continue;
+        if (irs < 0 || irs >= src->height) continue;
+        if (iss < 0 || iss >= src->depth) continue;
+        for (int f = 0; f < src->nframes; f++) {
+          MRIsetVoxVal(targ, ct, rt, st, f, MRIgetVoxVal(src, ics, irs, iss, f));
+        }
+      }
+    }
+  }
+  MatrixFree(&crsS);
+  MatrixFree(&crsT);
+}
+
+static int testVol2VolNearest(MRI *mri, MATRIX *Vt2s, int targ_type, const char *name)
+{
+  MRI *mri_generic, *mri_typed;
+  NanosecsTimer timer;
+  double generic_ns, typed_ns;
+  int ndiffs;
+
+  mri_generic = MRIallocSequence(DIM, DIM, DIM, targ_type, mri->nframes);
+  mri_typed = MRIallocSequence(DIM, DIM, DIM, targ_type, mri->nframes);
+  TimerStartNanosecs(&timer);
+  vol2volNearestGeneric(mri, mri_generic, Vt2s);
+  generic_ns = nsPerVoxel(&timer, mri);
+  TimerStartNanosecs(&timer);
+  if (MRIvol2VolNearestTyped(mri, mri_typed, Vt2s) != NO_ERROR) {
+    printf("  MRIvol2VolNearestTyped: no typed kernel for %s\n", name);
+    MRIfree(&mri_generic);
+    MRIfree(&mri_typed);
+    return 1;
+  }
+  typed_ns = nsPerVoxel(&timer, mri);
+  printf("%-13s: %6.2f ns/voxel generic, %6.2f ns/voxel MRIView\n", name, generic_ns, typed_ns);
+  ndiffs = compareVolumes(mri_generic, mri_typed, "MRIvol2VolNearestTyped");
+  MRIfree(&mri_generic);
+  MRIfree(&mri_typed);
+  return ndiffs;
+}
+
+static int testType(int type, const char *name)
+{
+  MRI *mri, *mri_generic, *mri_typed;
+  MATRIX *mA;
+  NanosecsTimer timer;
+  int x, y, z, f, ndiffs = 0, i, interp;
+  static const int interps[] = {SAMPLE_NEAREST, SAMPLE_TRILINEAR, SAMPLE_CUBIC_BSPLINE};
+  static const char *interp_names[] = {"nearest", "trilinear", "cubic"};
+  double generic_ns, typed_ns;
+
+  mri = MRIallocSequence(DIM, DIM, DIM, type, NFRAMES);
+  for (f = 0; f < NFRAMES; f++)
+    for (z = 0; z < DIM; z++)
+      for (y = 0; y < DIM; y++)
+        for (x = 0; x < DIM; x++) {
+          MRIsetVoxVal(mri, x, y, z, f, (x * 7 + y * 3 + z + f * 11) % 200 + 0.25f);
+        }
+
+  // voxel access: scale by 1.3
+  mri_generic = MRIclone(mri, NULL);
+  TimerStartNanosecs(&timer);
+  for (f = 0; f < NFRAMES; f++)
+    for (z = 0; z < DIM; z++)
+      for (y = 0; y < DIM; y++)
+        for (x = 0; x < DIM; x++) {
+          MRIsetVoxVal(mri_generic, x, y, z, f, 1.3f * MRIgetVoxVal(mri, x, y, z, f));
+        }
+  generic_ns = nsPerVoxel(&timer, mri);
+
+  mri_typed = MRIclone(mri, NULL);
+  ScaleKernel kernel = {1.3f, mri_typed};
+  TimerStartNanosecs(&timer);
+  MRIdispatchType(mri, kernel);
+  typed_ns = nsPerVoxel(&timer, mri);
+  printf("%-6s get/set      : %6.2f ns/voxel generic, %6.2f ns/voxel MRIView\n", name, generic_ns, typed_ns);
+  ndiffs += compareVolumes(mri_generic, mri_typed, "get/set");
+  MRIfree(&mri_generic);
+  MRIfree(&mri_typed);
+
+  // resampling: small rotation plus a non-integer shift
+  mA = MatrixIdentity(4, NULL);
+  *MATRIX_RELT(mA, 1, 1) = 0.996f;
+  *MATRIX_RELT(mA, 1, 2) = -0.087f;
+  *MATRIX_RELT(mA, 2, 1) = 0.087f;
+  *MATRIX_RELT(mA, 2, 2) = 0.996f;
+  *MATRIX_RELT(mA, 1, 4) = 2.3f;
+  *MATRIX_RELT(mA, 2, 4) = -1.7f;
+  *MATRIX_RELT(mA, 3, 4) = 0.6f;
+  for (i = 0; i < 3; i++) {
+    interp = interps[i];
+    TimerStartNanosecs(&timer);
+    mri_generic = linearTransformGeneric(mri, mA, interp);
+    generic_ns = nsPerVoxel(&timer, mri);
+    TimerStartNanosecs(&timer);
+    mri_typed = MRIlinearTransformInterp(mri, NULL, mA, interp);
+    typed_ns = nsPerVoxel(&timer, mri);
+    printf("%-6s %-13s: %6.2f ns/voxel generic, %6.2f ns/voxel MRIView\n",
+           name,
+           interp_names[i],
+           generic_ns,
+           typed_ns);
+    ndiffs += compareVolumes(mri_generic, mri_typed, "MRIlinearTransformInterp");
+    MRIfree(&mri_generic);
+    MRIfree(&mri_typed);
+  }
+
+  // vol2vol nearest: mA as the target-to-source voxel matrix, into the same type and into float
+  char vname[32];
+  snprintf(vname, sizeof(vname), "%s vol2vol", name);
+  ndiffs += testVol2VolNearest(mri, mA, type, vname);
+  snprintf(vname, sizeof(vname), "%s->float", name);
+  ndiffs += testVol2VolNearest(mri, mA, MRI_FLOAT, vname);
+  MatrixFree(&mA);
+  MRIfree(&mri);
+  return ndiffs;
+}
+
+int main(int argc, char *argv[])
+{
+  int ndiffs = 0;
+
+  ndiffs += testType(MRI_UCHAR, "uchar");
+  ndiffs += testType(MRI_SHORT, "short");
+  ndiffs += testType(MRI_INT, "int");
+  ndiffs += testType(MRI_FLOAT, "float");
+
+  if (ndiffs) {
+    printf("FAILED: %d voxels differ\n", ndiffs);
+    exit(1);
+  }
+  printf("passed\n");
+  exit(0);
+}
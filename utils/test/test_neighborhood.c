@@ -0,0 +1,172 @@
+/**
+ * @file  test_neighborhood.c
+ * @brief check the parallel MRISsetNeighborhoodSize() against the serial one
+ *
+ * Expands the neighborhoods of an icosahedron with some vertices ripped,
+ * once with MRISsetNeighborhoodSize() and once with the serial marking
+ * code it replaced. The neighbor lists, their order and the v2num, v3num,
+ * vtotal and nsize counts must be identical. The same vertices are marked
+ * on both surfaces before each expansion (none in some repetitions); the
+ * marks skip vertices and are cleared as in the serial code, so the lists
+ * and the marks left afterwards must be identical too.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "icosahedron.h"
+#include "mrisurf.h"
+#include "test_check.h"
+
+const char *Progname = "test_neighborhood";
+
+#define NREPS 5
+#define MAX_NEIGHBORS (10000) /* as in mrisurf.c */
+
+/* the serial expansion that MRISsetNeighborhoodSize() used to do, which
+   marks the neighbors found so far and clears the marks of each list */
+static void serialSetNeighborhoodSize(MRI_SURFACE *mris, int nsize)
+{
+  int niter, vno, i, j, n, neighbors, vnum;
+  int vtmp[MAX_NEIGHBORS];
+  VERTEX *v, *vnb, *vnb2;
+
+  for (niter = 0; niter < nsize - mris->nsize; niter++) {
+    for (vno = 0; vno < mris->nvertices; vno++) {
+      v = &mris->vertices[vno];
+      vnum = v->vtotal;
+      if (v->ripflag || !vnum) continue;
+
+      memmove(vtmp, v->v, vnum * sizeof(int));
+      v->marked = 1;
+      for (i = 0; i < vnum; i++) mris->vertices[v->v[i]].marked = 1;
+
+      for (neighbors = vnum, i = 0; neighbors < MAX_NEIGHBORS && i < vnum; i++) {
+        vnb = &mris->vertices[v->v[i]];
+        vnb->marked = 1;
+        if (vnb->ripflag) continue;
+        for (j = 0; j < vnb->vnum; j++) {
+          vnb2 = &mris->vertices[vnb->v[j]];
+          if (vnb2->ripflag || vnb2->marked) continue;
+          vtmp[neighbors] = vnb->v[j];
+          vnb2->marked = 1;
+          if (++neighbors >= MAX_NEIGHBORS) break;
+        }
+      }
+
+      free(v->v);
+      v->v = (int *)calloc(neighbors, sizeof(int));
+      if (!v->v) ErrorExit(ERROR_NOMEMORY, "%s: could not allocate %d neighbors", Progname, neighbors);
+      v->marked = 0;
+      for (n = 0; n < neighbors; n++) {
+        v->v[n] = vtmp[n];
+        mris->vertices[vtmp[n]].marked = 0;
+      }
+      v->nsize++;
+      switch (v->nsize) {
+        case 2:
+          v->v2num = neighbors;
+          break;
+        case 3:
+          v->v3num = neighbors;
+          break;
+        default:
+          v->v3num = v->vtotal;
+          break;
+      }
+      v->vtotal = neighbors;
+    }
+  }
+  mris->max_nsize = mris->nsize = nsize;
+}
+
+static int sameNeighborhoods(MRI_SURFACE *a, MRI_SURFACE *b)
+{
+  int vno;
+  VERTEX *va, *vb;
+
+  for (vno = 0; vno < a->nvertices; vno++) {
+    va = &a->vertices[vno];
+    vb = &b->vertices[vno];
+    if (va->vtotal != vb->vtotal || va->v2num != vb->v2num || va->v3num != vb->v3num || va->nsize != vb->nsize ||
+        memcmp(va->v, vb->v, va->vtotal * sizeof(int)))
+      return (0);
+  }
+  return (1);
+}
+
+static int sameMarks(MRI_SURFACE *a, MRI_SURFACE *b)
+{
+  int vno;
+
+  for (vno = 0; vno < a->nvertices; vno++)
+    if (a->vertices[vno].marked != b->vertices[vno].marked) return (0);
+  return (1);
+}
+
+/* marks every step-th vertex from first on both surfaces */
+static void markVertices(MRI_SURFACE *a, MRI_SURFACE *b, int first, int step)
+{
+  int vno;
+
+  for (vno = first; vno < a->nvertices; vno += step) a->vertices[vno].marked = b->vertices[vno].marked = 1;
+}
+
+static MRI_SURFACE *makeSurface(unsigned int seed)
+{
+  MRI_SURFACE *mris;
+  int vno;
+
+  mris = ic2562_make_surface(2562, 5120);
+  if (mris == NULL) ErrorExit(ERROR_NOMEMORY, "%s: could not make icosahedron", Progname);
+  srand(seed);
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    mris->vertices[vno].nsize = 1;  // as mrisFindNeighbors() leaves it
+    mris->vertices[vno].ripflag = (rand() % 40 == 0);
+  }
+  return (mris);
+}
+
+int main(int argc, char *argv[])
+{
+  MRI_SURFACE *mris, *ref;
+  int rep;
+
+  for (rep = 0; rep < NREPS; rep++) {
+    mris = makeSurface(rep);
+    ref = makeSurface(rep);
+
+    // two rings in one call, then a third; some vertices marked before each
+    if (rep > 0) markVertices(mris, ref, rep, 7 * rep);
+    MRISsetNeighborhoodSize(mris, 3);
+    serialSetNeighborhoodSize(ref, 3);
+    check(sameNeighborhoods(mris, ref), "neighborhood size 3 (repetition %d)", rep);
+    check(sameMarks(mris, ref), "marks after neighborhood size 3 (repetition %d)", rep);
+    if (rep > 0) markVertices(mris, ref, 2 * rep, 11 * rep);
+    MRISsetNeighborhoodSize(mris, 4);
+    serialSetNeighborhoodSize(ref, 4);
+    check(sameNeighborhoods(mris, ref), "neighborhood size 4 (repetition %d)", rep);
+    check(sameMarks(mris, ref), "marks after neighborhood size 4 (repetition %d)", rep);
+
+    MRISfree(&mris);
+    MRISfree(&ref);
+  }
+
+  exit(checkSummary());
+}
@@ -0,0 +1,113 @@
+/**
+ * @file  test_rforest.c
+ * @brief check that RFtrain() builds the same forest on 1 and on N threads
+ *
+ * Trains a random forest on synthetic data, some of it with out of range
+ * classes, once on a single thread and once on several, from the same
+ * random seed. The forests written by RFwriteInto() must be byte for byte
+ * identical and must classify every training sample the same way.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "rforest.h"
+#include "romp_support.h"
+#include "utils.h"
+#include "test_check.h"
+
+const char *Progname = "test_rforest";
+
+#define NTRAINING 5000
+#define NFEATURES 6
+#define NCLASSES 4
+#define NTREES 8
+#define NTHREADS 4
+
+/* trains a forest on nthreads threads and returns it; *pbuf and *plen
+   receive what RFwriteInto() wrote */
+static RANDOM_FOREST *train(int nthreads, int *classes, double **data, char **pbuf, long *plen)
+{
+  RANDOM_FOREST *rf;
+  int *training_classes;
+  FILE *fp;
+
+#ifdef HAVE_OPENMP
+  omp_set_num_threads(nthreads);
+#endif
+  // RFtrain() resets out of range classes, so give it its own copy
+  training_classes = (int *)calloc(NTRAINING, sizeof(int));
+  if (training_classes == NULL) ErrorExit(ERROR_NOMEMORY, "%s: could not allocate classes", Progname);
+  memcpy(training_classes, classes, NTRAINING * sizeof(int));
+
+  setRandomSeed(17L);
+  rf = RFalloc(NTREES, NFEATURES, NCLASSES, 8, NULL, 10);
+  RFtrain(rf, 0.6, 0.7, training_classes, data, NTRAINING);
+
+  fp = tmpfile();
+  if (fp == NULL) ErrorExit(ERROR_NOFILE, "%s: could not open a temporary file", Progname);
+  RFwriteInto(rf, fp);
+  *plen = ftell(fp);
+  *pbuf = (char *)calloc(*plen + 1, sizeof(char));
+  if (*pbuf == NULL) ErrorExit(ERROR_NOMEMORY, "%s: could not allocate %ld bytes", Progname, *plen);
+  rewind(fp);
+  if (fread(*pbuf, 1, *plen, fp) != (size_t)*plen) ErrorExit(ERROR_BADFILE, "%s: could not read back forest", Progname);
+  fclose(fp);
+  free(training_classes);
+  return (rf);
+}
+
+int main(int argc, char *argv[])
+{
+  RANDOM_FOREST *rf1, *rfn;
+  double **data;
+  int *classes, n, f, nsame;
+  char *buf1, *bufn;
+  long len1, lenn;
+
+  data = (double **)calloc(NTRAINING, sizeof(double *));
+  classes = (int *)calloc(NTRAINING, sizeof(int));
+  if (data == NULL || classes == NULL) ErrorExit(ERROR_NOMEMORY, "%s: could not allocate training set", Progname);
+  srand(5);
+  for (n = 0; n < NTRAINING; n++) {
+    data[n] = (double *)calloc(NFEATURES, sizeof(double));
+    if (data[n] == NULL) ErrorExit(ERROR_NOMEMORY, "%s: could not allocate training set", Progname);
+    classes[n] = rand() % NCLASSES;
+    for (f = 0; f < NFEATURES; f++) data[n][f] = (f == 0 ? 1.3 * classes[n] : 0) + (rand() % 1000) / 100.0;
+    if (n % 500 == 7) classes[n] = (n % 1000 == 7) ? -1 : NCLASSES;
+  }
+
+  rf1 = train(1, classes, data, &buf1, &len1);
+  rfn = train(NTHREADS, classes, data, &bufn, &lenn);
+  check(len1 == lenn && memcmp(buf1, bufn, len1) == 0, "forests written on 1 and on N threads are identical");
+
+  for (nsame = n = 0; n < NTRAINING; n++)
+    if (RFclassify(rf1, data[n], NULL, -1) == RFclassify(rfn, data[n], NULL, -1)) nsame++;
+  check(nsame == NTRAINING, "forests trained on 1 and on N threads classify the same");
+
+  free(buf1);
+  free(bufn);
+  RFfree(&rf1);
+  RFfree(&rfn);
+  for (n = 0; n < NTRAINING; n++) free(data[n]);
+  free(data);
+  free(classes);
+
+  exit(checkSummary());
+}
@@ -0,0 +1,120 @@
+/**
+ * @file  test_sample_frames.c
+ * @brief check MRIsampleVolumeFrames() against per-frame sampling
+ *
+ * Fills multi-frame volumes of every supported type, both with a slice
+ * table and chunked, and samples them at random points, at whole voxel
+ * coordinates, on the borders and outside. Each frame sampled by
+ * MRIsampleVolumeFrames() (nearest and trilinear) and by
+ * MRIsampleSeqVolume() must be the value MRIsampleVolumeFrameType()
+ * returns for that frame, and frames past the end must get outside_val.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "error.h"
+#include "mri.h"
+#include "test_check.h"
+
+const char *Progname = "test_sample_frames";
+
+#define NFRAMES 6
+#define NPOINTS 2000
+#define NEXTRA 2
+
+static MRI *makeVolume(int type, int chunked)
+{
+  MRI *mri;
+  int c, r, s, f;
+
+  if (chunked)
+    mri = MRIallocChunk(11, 8, 9, type, NFRAMES);
+  else
+    mri = MRIallocSequence(11, 8, 9, type, NFRAMES);
+  if (mri == NULL) ErrorExit(ERROR_NOMEMORY, "%s: could not allocate volume", Progname);
+  mri->outside_val = -3;
+  for (f = 0; f < NFRAMES; f++)
+    for (s = 0; s < mri->depth; s++)
+      for (r = 0; r < mri->height; r++)
+        for (c = 0; c < mri->width; c++)
+          MRIsetVoxVal(mri, c, r, s, f, rand() % 250 + (type == MRI_FLOAT ? (rand() % 1000) / 999.0 : 0));
+  return (mri);
+}
+
+/* the i-th sample point: random inside, whole voxels, borders and outside */
+static void samplePoint(MRI *mri, int i, double *px, double *py, double *pz)
+{
+  double lo = (i % 5 == 4) ? -2 : 0, ext = (i % 5 == 4) ? 4 : 0;
+
+  *px = lo + (rand() % 1000) / 1000.0 * (mri->width - 1 + ext);
+  *py = lo + (rand() % 1000) / 1000.0 * (mri->height - 1 + ext);
+  *pz = lo + (rand() % 1000) / 1000.0 * (mri->depth - 1 + ext);
+  if (i % 5 == 1) {
+    *px = nint(*px);
+    *py = nint(*py);
+    *pz = nint(*pz);
+  }
+  if (i % 5 == 2) *px = mri->width - 1 + (rand() % 100) / 200.0;
+  if (i % 5 == 3) *pz = -(rand() % 100) / 200.0;
+}
+
+int main(int argc, char *argv[])
+{
+  int types[] = {MRI_UCHAR, MRI_SHORT, MRI_INT, MRI_FLOAT}, t, chunked, i, f, first, last, nbad, nbad_seq, nbad_past;
+  float vals[NFRAMES + NEXTRA], seqvals[NFRAMES + NEXTRA];
+  double x, y, z, val;
+  MRI *mri;
+
+  srand(13);
+  for (chunked = 0; chunked <= 1; chunked++)
+    for (t = 0; t < (int)(sizeof(types) / sizeof(types[0])); t++) {
+      mri = makeVolume(types[t], chunked);
+      nbad = nbad_seq = nbad_past = 0;
+      for (i = 0; i < NPOINTS; i++) {
+        samplePoint(mri, i, &x, &y, &z);
+        first = rand() % NFRAMES;
+        last = first + rand() % (NFRAMES + NEXTRA - first);
+
+        MRIsampleVolumeFrames(mri, x, y, z, first, last, SAMPLE_TRILINEAR, vals);
+        MRIsampleSeqVolume(mri, x, y, z, seqvals, first, last);
+        for (f = first; f <= last && f < NFRAMES; f++) {
+          MRIsampleVolumeFrameType(mri, x, y, z, f, SAMPLE_TRILINEAR, &val);
+          if (vals[f] != (float)val) nbad++;
+          if (seqvals[f] != (float)val) nbad_seq++;
+        }
+        for (f = NFRAMES; f <= last; f++)
+          if (vals[f] != mri->outside_val || seqvals[f] != mri->outside_val) nbad_past++;
+
+        MRIsampleVolumeFrames(mri, x, y, z, first, last, SAMPLE_NEAREST, vals);
+        for (f = first; f <= last && f < NFRAMES; f++) {
+          MRIsampleVolumeFrameType(mri, x, y, z, f, SAMPLE_NEAREST, &val);
+          if (vals[f] != (float)val) nbad++;
+        }
+        for (f = NFRAMES; f <= last; f++)
+          if (vals[f] != mri->outside_val) nbad_past++;
+      }
+      check(nbad == 0, "MRIsampleVolumeFrames of type %d (chunked %d): %d values differ", types[t], chunked, nbad);
+      check(nbad_seq == 0, "MRIsampleSeqVolume of type %d (chunked %d): %d values differ", types[t], chunked,
+            nbad_seq);
+      check(nbad_past == 0, "frames past the end of type %d (chunked %d): %d not outside_val", types[t], chunked,
+            nbad_past);
+      MRIfree(&mri);
+    }
+
+  exit(checkSummary());
+}
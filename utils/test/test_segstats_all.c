@@ -0,0 +1,106 @@
+/**
+ * @file  test_segstats_all.c
+ * @brief check MRIsegStatsAll() against the per-segmentation functions
+ *
+ * Builds a segmentation with a few dozen ids, deep enough to be split in
+ * several slabs, and a multi-frame float volume. MRIsegStatsAll() is run on
+ * a list of ids that has duplicates and ids that are not in the
+ * segmentation, plain and robust. Counts, minima and maxima must be those
+ * of MRIsegStats(), MRIsegStatsRobust() and MRIsegFrameAvg(); means,
+ * standard deviations and frame averages must agree within a small
+ * tolerance, since the sums are accumulated in another order.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "error.h"
+#include "mri.h"
+#include "mri2.h"
+#include "test_check.h"
+
+const char *Progname = "test_segstats_all";
+
+#define NFRAMES 3
+#define NSEGS 40
+#define PCT 10.0
+
+/* a and b equal up to rounding of sums accumulated in another order */
+static int nearlyEqual(double a, double b)
+{
+  return (fabs(a - b) <= 1e-5 * (1 + fabs(a) + fabs(b)));
+}
+
+int main(int argc, char *argv[])
+{
+  MRI *seg, *mri;
+  int segids[NSEGS], nvoxels[NSEGS], c, r, s, f, n, robust, nv, nvref;
+  float min[NSEGS], max[NSEGS], range[NSEGS], mean[NSEGS], std[NSEGS];
+  float rmin, rmax, rrange, rmean, rstd;
+  double *favg[NSEGS], favgref[NFRAMES];
+
+  srand(11);
+  seg = MRIalloc(23, 19, 41, MRI_INT);
+  mri = MRIallocSequence(23, 19, 41, MRI_FLOAT, NFRAMES);
+  if (seg == NULL || mri == NULL) ErrorExit(ERROR_NOMEMORY, "%s: could not allocate volumes", Progname);
+  for (s = 0; s < seg->depth; s++)
+    for (r = 0; r < seg->height; r++)
+      for (c = 0; c < seg->width; c++) {
+        // runs of the same id along the columns, as in a real segmentation
+        MRIsetVoxVal(seg, c, r, s, 0, (c / 4 + 3 * (r / 5) + 7 * (s / 6)) % 30);
+        for (f = 0; f < NFRAMES; f++) MRIsetVoxVal(mri, c, r, s, f, 100 * f + (rand() % 100000) / 37.0);
+      }
+
+  // ids 0..29 are in seg; some twice, some not at all
+  for (n = 0; n < NSEGS; n++) {
+    segids[n] = (n * 7) % 36 - 2;
+    favg[n] = (double *)calloc(NFRAMES, sizeof(double));
+  }
+
+  for (robust = 0; robust <= 1; robust++) {
+    if (MRIsegStatsAll(seg, NSEGS, segids, mri, 1, robust, PCT, nvoxels, min, max, range, mean, std, favg))
+      ErrorExit(ERROR_BADPARM, "%s: MRIsegStatsAll failed", Progname);
+    for (n = 0; n < NSEGS; n++) {
+      nvref = MRIsegFrameAvg(seg, segids[n], mri, favgref);
+      check(nvoxels[n] == nvref, "count of id %d (robust %d)", segids[n], robust);
+      for (f = 0; f < NFRAMES; f++)
+        check(nearlyEqual(favg[n][f], favgref[f]), "frame %d average of id %d (robust %d)", f, segids[n], robust);
+      if (robust)
+        nv = MRIsegStatsRobust(seg, segids[n], mri, 1, &rmin, &rmax, &rrange, &rmean, &rstd, PCT);
+      else
+        nv = MRIsegStats(seg, segids[n], mri, 1, &rmin, &rmax, &rrange, &rmean, &rstd);
+      if (nv == 0) continue;
+      check(min[n] == rmin && max[n] == rmax && range[n] == rrange, "min, max and range of id %d (robust %d)",
+            segids[n], robust);
+      check(nearlyEqual(mean[n], rmean) && nearlyEqual(std[n], rstd), "mean and std of id %d (robust %d)", segids[n],
+            robust);
+    }
+  }
+
+  // counts only, without an input volume
+  if (MRIsegStatsAll(seg, NSEGS, segids, NULL, 0, 0, 0, nvoxels, NULL, NULL, NULL, NULL, NULL, NULL))
+    ErrorExit(ERROR_BADPARM, "%s: MRIsegStatsAll failed", Progname);
+  for (n = 0; n < NSEGS; n++)
+    check(nvoxels[n] == MRIsegFrameAvg(seg, segids[n], mri, favgref), "count only of id %d", segids[n]);
+
+  for (n = 0; n < NSEGS; n++) free(favg[n]);
+  MRIfree(&seg);
+  MRIfree(&mri);
+
+  exit(checkSummary());
+}
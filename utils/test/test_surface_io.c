@@ -0,0 +1,189 @@
+/**
+ * @file  test_surface_io.c
+ * @brief round trip and truncation of triangle surface files, bulk reads
+ *
+ * Writes a 163842-vertex icosahedron with MRISwriteTriangularSurface() and
+ * reads it back with MRISread() and MRISreadVertexPositions(); the vertices
+ * and faces must be identical. The file is then truncated inside the face
+ * block and inside the vertex block, and both readers must fail instead of
+ * returning a surface. Finally the vertex and face blocks of that size are
+ * read once value by value (freadFloat()/freadInt()) and once in bulk
+ * (freadFloatArray()/freadIntArray()); the values must be identical. With
+ * --timing both reads are repeated and the best of 5 times is printed.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "error.h"
+#include "fio.h"
+#include "icosahedron.h"
+#include "mrisurf.h"
+#include "timer.h"
+#include "test_check.h"
+
+const char *Progname = "test_surface_io";
+
+#define SURF_FILE "./test_surface_io.srf"
+#define BLOCK_FILE "./test_surface_io.bin"
+#define NREPS 5
+
+static int sameSurface(MRI_SURFACE *a, MRI_SURFACE *b)
+{
+  int vno, fno, n;
+
+  if (a->nvertices != b->nvertices || a->nfaces != b->nfaces) return (0);
+  for (vno = 0; vno < a->nvertices; vno++)
+    if (a->vertices[vno].x != b->vertices[vno].x || a->vertices[vno].y != b->vertices[vno].y ||
+        a->vertices[vno].z != b->vertices[vno].z)
+      return (0);
+  for (fno = 0; fno < a->nfaces; fno++)
+    for (n = 0; n < VERTICES_PER_FACE; n++)
+      if (a->faces[fno].v[n] != b->faces[fno].v[n]) return (0);
+  return (1);
+}
+
+static long fileSize(const char *fname)
+{
+  struct stat st;
+
+  if (stat(fname, &st) != 0) return (-1);
+  return ((long)st.st_size);
+}
+
+/* reads the nxyz floats and nfv ints of BLOCK_FILE one value at a time
+   or in bulk and returns the time in ms */
+static double readBlocks(float *xyz, size_t nxyz, int *fv, size_t nfv, int bulk)
+{
+  NanosecsTimer timer;
+  FILE *fp;
+  size_t i;
+
+  TimerStartNanosecs(&timer);
+  fp = fopen(BLOCK_FILE, "rb");
+  if (fp == NULL) ErrorExit(ERROR_NOFILE, "%s: could not open %s", Progname, BLOCK_FILE);
+  if (bulk) {
+    freadFloatArray(xyz, nxyz, fp);
+    freadIntArray(fv, nfv, fp);
+  }
+  else {
+    for (i = 0; i < nxyz; i++) xyz[i] = freadFloat(fp);
+    for (i = 0; i < nfv; i++) fv[i] = freadInt(fp);
+  }
+  fclose(fp);
+  return (TimerElapsedNanosecs(&timer).ns / 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+  MRI_SURFACE *mris, *mris2;
+  float *xyz, *xyz1, *xyz2;
+  int *fv, *fv1, *fv2, vno, fno, n, rep, timing;
+  size_t nxyz, nfv;
+  long size;
+  double ms, best_value = 1e30, best_bulk = 1e30;
+  FILE *fp;
+
+  timing = (argc > 1 && !strcmp(argv[1], "--timing"));
+
+  mris = ic163842_make_surface(163842, 327680);
+  if (mris == NULL) ErrorExit(ERROR_NOMEMORY, "%s: could not make icosahedron", Progname);
+  mris->type = MRIS_TRIANGULAR_SURFACE;
+  // coordinates that do not all have short float representations
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    mris->vertices[vno].x *= 1.0f + vno / 3e6f;
+    mris->vertices[vno].y -= vno / 7e4f;
+  }
+
+  // round trip
+  check(MRISwriteTriangularSurface(mris, SURF_FILE) == NO_ERROR, "MRISwriteTriangularSurface");
+  mris2 = MRISread(SURF_FILE);
+  check(mris2 != NULL, "MRISread");
+  if (mris2) {
+    check(sameSurface(mris, mris2), "MRISread returns the written surface");
+    for (vno = 0; vno < mris2->nvertices; vno++) mris2->vertices[vno].x = mris2->vertices[vno].y = 0;
+    check(MRISreadVertexPositions(mris2, SURF_FILE) == NO_ERROR, "MRISreadVertexPositions");
+    check(sameSurface(mris, mris2), "MRISreadVertexPositions returns the written positions");
+  }
+
+  // truncated in the face block, then in the vertex block (the header
+  // is far shorter than half of the face block)
+  size = fileSize(SURF_FILE);
+  check(size > 12L * mris->nvertices + 12L * mris->nfaces, "size of the surface file");
+  if (truncate(SURF_FILE, 12L * mris->nvertices + 6L * mris->nfaces) == 0) {
+    check(MRISread(SURF_FILE) == NULL, "MRISread fails on a file truncated in the face block");
+  }
+  if (truncate(SURF_FILE, 1000) == 0) {
+    check(MRISread(SURF_FILE) == NULL, "MRISread fails on a file truncated in the vertex block");
+    if (mris2)
+      check(MRISreadVertexPositions(mris2, SURF_FILE) != NO_ERROR,
+            "MRISreadVertexPositions fails on a file truncated in the vertex block");
+  }
+  unlink(SURF_FILE);
+
+  // per-value versus bulk reads of the vertex and face blocks
+  nxyz = 3 * (size_t)mris->nvertices;
+  nfv = VERTICES_PER_FACE * (size_t)mris->nfaces;
+  xyz = (float *)calloc(nxyz, sizeof(float));
+  xyz1 = (float *)calloc(nxyz, sizeof(float));
+  xyz2 = (float *)calloc(nxyz, sizeof(float));
+  fv = (int *)calloc(nfv, sizeof(int));
+  fv1 = (int *)calloc(nfv, sizeof(int));
+  fv2 = (int *)calloc(nfv, sizeof(int));
+  if (!xyz || !xyz1 || !xyz2 || !fv || !fv1 || !fv2) ErrorExit(ERROR_NOMEMORY, "%s: could not allocate blocks", Progname);
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    xyz[3 * vno] = mris->vertices[vno].x;
+    xyz[3 * vno + 1] = mris->vertices[vno].y;
+    xyz[3 * vno + 2] = mris->vertices[vno].z;
+  }
+  for (fno = 0; fno < mris->nfaces; fno++)
+    for (n = 0; n < VERTICES_PER_FACE; n++) fv[VERTICES_PER_FACE * fno + n] = mris->faces[fno].v[n];
+
+  fp = fopen(BLOCK_FILE, "wb");
+  if (fp == NULL) ErrorExit(ERROR_NOFILE, "%s: could not create %s", Progname, BLOCK_FILE);
+  check(fwriteFloatArray(xyz, nxyz, fp) == nxyz && fwriteIntArray(fv, nfv, fp) == nfv, "bulk write");
+  fclose(fp);
+
+  for (rep = 0; rep < (timing ? NREPS : 1); rep++) {
+    ms = readBlocks(xyz1, nxyz, fv1, nfv, 0);
+    if (ms < best_value) best_value = ms;
+    ms = readBlocks(xyz2, nxyz, fv2, nfv, 1);
+    if (ms < best_bulk) best_bulk = ms;
+  }
+  unlink(BLOCK_FILE);
+  check(memcmp(xyz, xyz1, nxyz * sizeof(float)) == 0 && memcmp(fv, fv1, nfv * sizeof(int)) == 0,
+        "per-value read returns the written blocks");
+  check(memcmp(xyz, xyz2, nxyz * sizeof(float)) == 0 && memcmp(fv, fv2, nfv * sizeof(int)) == 0,
+        "bulk read returns the written blocks");
+  if (timing)
+    printf("%d vertices, %d faces: per-value read %.1f ms, bulk read %.1f ms (best of %d)\n",
+           mris->nvertices, mris->nfaces, best_value, best_bulk, NREPS);
+
+  free(xyz);
+  free(xyz1);
+  free(xyz2);
+  free(fv);
+  free(fv1);
+  free(fv2);
+  if (mris2) MRISfree(&mris2);
+  MRISfree(&mris);
+
+  exit(checkSummary());
+}